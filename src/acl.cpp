@@ -0,0 +1,190 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "acl.h"
+#include "casemap.h"
+
+void AccessList::Trie::Clear()
+{
+    rules.assign(1, std::vector<uint32_t>());
+    edges.clear();
+}
+
+void AccessList::Trie::Insert(const std::string& key, uint32_t rule)
+{
+    uint32_t node = 0;
+    for (unsigned char c : key)
+    {
+        auto itr = edges.emplace(uint64_t(node) << 8 | c, uint32_t(rules.size()));
+        if (itr.second)
+            rules.emplace_back();
+        node = itr.first->second;
+    }
+    rules[node].push_back(rule);
+}
+
+void AccessList::Trie::Collect(const std::string& key, std::vector<uint32_t>& out) const
+{
+    uint32_t node = 0;
+    for (unsigned char c : key)
+    {
+        auto itr = edges.find(uint64_t(node) << 8 | c);
+        if (itr == edges.end())
+            return;
+        node = itr->second;
+        out.insert(out.end(), rules[node].begin(), rules[node].end());
+    }
+}
+
+void AccessList::Clear()
+{
+    _rules.clear();
+    _suffix.Clear();
+    _prefix.Clear();
+    _nicks.clear();
+    _generic.clear();
+}
+
+bool AccessList::Add(const std::string& mask, unsigned levels)
+{
+    if (mask.empty())
+        return false;
+
+    std::string folded = foldNick(mask);
+    size_t bang = folded.find('!');
+    size_t at = folded.find('@', bang == std::string::npos ? 0 : bang);
+
+    Rule rule;
+    rule.levels = levels;
+    if (bang == std::string::npos && at == std::string::npos)
+    {
+        rule.nick = folded;
+        rule.user = rule.host = "*";
+    }
+    else
+    {
+        size_t userStart = bang == std::string::npos ? 0 : bang + 1;
+        rule.nick = bang == std::string::npos ? "*" : folded.substr(0, bang);
+        rule.user = folded.substr(userStart, at == std::string::npos ? std::string::npos : at - userStart);
+        rule.host = at == std::string::npos ? "*" : folded.substr(at + 1);
+    }
+    for (std::string* part : { &rule.nick, &rule.user, &rule.host })
+    {
+        if (part->empty())
+            *part = "*";
+    }
+
+    uint32_t id = _rules.size();
+    _rules.push_back(rule);
+
+    // Якорь - самая длинная буквальная часть хоста с края
+    size_t last = rule.host.find_last_of("*?");
+    size_t first = rule.host.find_first_of("*?");
+    std::string suffix = last == std::string::npos ? rule.host : rule.host.substr(last + 1);
+    std::string prefix = first == std::string::npos ? rule.host : rule.host.substr(0, first);
+
+    if (!suffix.empty() && suffix.size() >= prefix.size())
+        _suffix.Insert(std::string(suffix.rbegin(), suffix.rend()), id);
+    else if (!prefix.empty())
+        _prefix.Insert(prefix, id);
+    else if (rule.nick.find_first_of("*?") == std::string::npos)
+        _nicks[rule.nick].push_back(id);
+    else
+        _generic.push_back(id);
+    return true;
+}
+
+bool AccessList::Load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "ACL: cannot open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t number = 0;
+    while (std::getline(file, line))
+    {
+        ++number;
+        std::istringstream stream(line);
+        std::string level, mask;
+        if (!(stream >> level) || level[0] == '#')
+            continue;
+        stream >> mask;
+
+        unsigned levels = level == "admin" ? AclAdmin : level == "ignore" ? AclIgnore : 0;
+        if (levels == 0 || !Add(mask, levels))
+            std::cerr << "ACL: " << path << ":" << number << ": expected \"admin|ignore <mask>\"" << std::endl;
+    }
+    return true;
+}
+
+size_t AccessList::Count(unsigned level) const
+{
+    size_t count = 0;
+    for (const Rule& rule : _rules)
+        count += (rule.levels & level) != 0;
+    return count;
+}
+
+bool AccessList::Glob(const std::string& pattern, const std::string& text)
+{
+    // Жадное сопоставление с возвратом к последней звёздочке
+    size_t p = 0, t = 0;
+    size_t star = std::string::npos, resume = 0;
+    while (t < text.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t]))
+        {
+            ++p;
+            ++t;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            resume = t;
+        }
+        else if (star != std::string::npos)
+        {
+            p = star + 1;
+            t = ++resume;
+        }
+        else
+            return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
+
+unsigned AccessList::Match(std::string_view nick, std::string_view user, std::string_view host) const
+{
+    if (_rules.empty())
+        return 0;
+
+    foldNick(nick, &_nick);
+    foldNick(user, &_user);
+    foldNick(host, &_host);
+    _reversed.assign(_host.rbegin(), _host.rend());
+
+    _candidates.assign(_generic.begin(), _generic.end());
+    _suffix.Collect(_reversed, _candidates);
+    _prefix.Collect(_host, _candidates);
+    auto itr = _nicks.find(_nick);
+    if (itr != _nicks.end())
+        _candidates.insert(_candidates.end(), itr->second.begin(), itr->second.end());
+
+    unsigned levels = 0;
+    for (uint32_t id : _candidates)
+    {
+        const Rule& rule = _rules[id];
+        if ((rule.levels & ~levels) == 0)
+            continue;
+        if (Glob(rule.host, _host) && Glob(rule.user, _user) && Glob(rule.nick, _nick))
+            levels |= rule.levels;
+    }
+    return levels;
+}
@@ -0,0 +1,78 @@
+#ifndef ACL_H_
+#define ACL_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Уровни доступа; маска может давать несколько сразу
+enum AclLevel : unsigned
+{
+    AclIgnore = 1,      // бот не отвечает на команды и CTCP
+    AclAdmin = 2        // служебные команды (quit); сильнее ignore
+};
+
+inline bool aclIgnored(unsigned levels)
+{
+    return (levels & AclIgnore) && !(levels & AclAdmin);
+}
+
+// Список доступа по маскам nick!user@host с * и ?, в регистре RFC 1459.
+// Маски раскладываются по самому длинному буквальному "якорю": концу хоста
+// (*!*@*.example.com - в дерево перевёрнутых хостов), началу хоста
+// (*!*@10.1.* - в дерево прямых) или точному нику (nick!*@*). Проверка
+// проходит хост по обоим деревьям и сверяет полной маской только
+// найденных кандидатов, поэтому от тысяч масок почти не зависит.
+class AccessList
+{
+public:
+    AccessList() { Clear(); };
+
+    void Clear();
+    // Маска без '!' и '@' - ник, user@host - *!user@host; false - пустая маска
+    bool Add(const std::string& mask, unsigned levels);
+    // Файл строк "admin <маска>" / "ignore <маска>", # - комментарий
+    bool Load(const std::string& path);
+
+    // Объединение уровней всех подходящих масок
+    unsigned Match(std::string_view nick, std::string_view user, std::string_view host) const;
+
+    size_t Size() const { return _rules.size(); };
+    size_t Count(unsigned level) const;
+
+private:
+    struct Rule
+    {
+        std::string nick, user, host;   // уже в нижнем регистре
+        unsigned levels;
+    };
+
+    // Префиксное дерево с рёбрами в одной хеш-таблице (узел << 8 | байт)
+    struct Trie
+    {
+        std::vector<std::vector<uint32_t>> rules;   // маски, чей якорь кончается в узле
+        std::unordered_map<uint64_t, uint32_t> edges;
+
+        void Clear();
+        void Insert(const std::string& key, uint32_t rule);
+        // Маски всех узлов на пути key
+        void Collect(const std::string& key, std::vector<uint32_t>& out) const;
+    };
+
+    static bool Glob(const std::string& pattern, const std::string& text);
+
+    std::vector<Rule> _rules;
+    Trie _suffix;           // ключ - перевёрнутый хвост хоста
+    Trie _prefix;           // ключ - начало хоста
+    std::unordered_map<std::string, std::vector<uint32_t>> _nicks;
+    std::vector<uint32_t> _generic;     // без якоря, проверяются всегда
+
+    // Рабочие буферы Match(): вызывается на каждое сообщение, а так обходится
+    // без выделений памяти
+    mutable std::string _nick, _user, _host, _reversed;
+    mutable std::vector<uint32_t> _candidates;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <memory_resource>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+
+// Арена для всего, что живёт не дольше одной пачки принятых строк: копия
+// строк, разобранные сообщения, временные буферы обработчиков. Выделение -
+// сдвиг указателя, освобождение - ничего; Reset() после разбора пачки
+// возвращает всё разом. Блоки не отдаются обратно, поэтому в установившемся
+// режиме арена не обращается к malloc совсем.
+class BatchArena : public std::pmr::memory_resource
+{
+public:
+    explicit BatchArena(size_t blockSize = 64 << 10) : _blockSize(blockSize), _current(0), _offset(0), _used(0) {};
+    ~BatchArena()
+    {
+        for (const Block& block : _blocks)
+            free(block.data);
+    }
+
+    BatchArena(const BatchArena&) = delete;
+    BatchArena& operator=(const BatchArena&) = delete;
+
+    void Reset()
+    {
+        if (_used == 0)
+            return;
+        ++_stats.batches;
+        _stats.bytes += _used;
+        if (_used > _stats.peak)
+            _stats.peak = _used;
+        _current = _offset = _used = 0;
+        for (Block& block : _blocks)
+            block.fresh = false;
+    }
+
+    struct Stats
+    {
+        uint64_t batches = 0;   // пачек с хотя бы одним выделением
+        uint64_t bytes = 0;     // выдано за все пачки
+        uint64_t reused = 0;    // из них из блоков, оставшихся от прежних пачек
+        uint64_t blocks = 0;    // обращений к malloc за блоками
+        size_t peak = 0;        // больше всего за одну пачку
+    };
+    const Stats& GetStats() const { return _stats; };
+    size_t Capacity() const
+    {
+        size_t total = 0;
+        for (const Block& block : _blocks)
+            total += block.size;
+        return total;
+    }
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+        bool fresh;     // выделен в текущей пачке
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        while (_current < _blocks.size())
+        {
+            Block& block = _blocks[_current];
+            size_t start = (_offset + alignment - 1) & ~(alignment - 1);
+            if (start + bytes <= block.size)
+            {
+                _offset = start + bytes;
+                _used += bytes;
+                if (!block.fresh)
+                    _stats.reused += bytes;
+                return block.data + start;
+            }
+            ++_current;
+            _offset = 0;
+        }
+
+        // Блок под крупный запрос тоже остаётся и пригодится следующим пачкам
+        size_t size = bytes + alignment > _blockSize ? bytes + alignment : _blockSize;
+        char* data = (char*)malloc(size);
+        if (!data)
+            throw std::bad_alloc();
+        _blocks.push_back({ data, size, true });
+        ++_stats.blocks;
+        _offset = 0;
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* /*p*/, size_t /*bytes*/, size_t /*alignment*/) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    size_t _blockSize;
+    std::vector<Block> _blocks;
+    size_t _current;    // блок, из которого сейчас выделяем
+    size_t _offset;     // занято в нём
+    size_t _used;       // выдано в текущей пачке
+    Stats _stats;
+};
+
+#endif
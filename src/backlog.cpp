@@ -0,0 +1,220 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <zlib.h>
+
+#include "backlog.h"
+#include "memtrack.h"
+
+// Запись в блоке: время (8 байт), флаги (2), длина ника (1), длина текста (2),
+// затем ник и текст без выравнивания - блок читается только после распаковки
+static const size_t RecordHeader = 8 + 2 + 1 + 2;
+
+Backlog::Backlog() : _budget(4 << 20), _block(16 << 10), _lines(1000), _memory(0),
+    _raw(0), _compressed(0), _evicted(0), _inflated(0)
+{
+}
+
+void Backlog::Configure(size_t budget, size_t block, size_t lines)
+{
+    _budget = budget;
+    _block = std::max<size_t>(block, 1024);
+    _lines = std::max<size_t>(lines, 1);
+    if (!_lru.empty())
+        Evict(&_lru.front());
+}
+
+size_t Backlog::Footprint(const Channel& channel)
+{
+    return sizeof(Channel) + channel.name.capacity() + channel.open.capacity()
+        + channel.packed + channel.blocks.size() * sizeof(Block);
+}
+
+void Backlog::Append(std::string_view channel, std::string_view nick, std::string_view text,
+                     uint16_t flags, int64_t timestamp)
+{
+    MemScope scope(MemBacklog);
+    std::string key(channel);
+    std::unordered_map<std::string, ChannelRef>::iterator itr = _channels.find(key);
+    if (itr == _channels.end())
+    {
+        _lru.emplace_front();
+        _lru.front().name = key;
+        itr = _channels.emplace(key, _lru.begin()).first;
+        _memory += Footprint(_lru.front());
+    }
+    else
+        _lru.splice(_lru.begin(), _lru, itr->second);
+
+    Channel& chan = *itr->second;
+    size_t before = Footprint(chan);
+
+    nick = nick.substr(0, 255);
+    text = text.substr(0, 65535);
+    size_t size = RecordHeader + nick.size() + text.size();
+    if (chan.openLines > 0 && chan.open.size() + size > _block)
+        Seal(chan);
+
+    char header[RecordHeader];
+    uint16_t textLength = text.size();
+    memcpy(header, &timestamp, 8);
+    memcpy(header + 8, &flags, 2);
+    header[10] = char(nick.size());
+    memcpy(header + 11, &textLength, 2);
+    chan.open.append(header, RecordHeader);
+    chan.open.append(nick);
+    chan.open.append(text);
+    ++chan.openLines;
+    ++chan.lines;
+
+    // Кольцо канала: старый блок уходит, когда без него строк всё равно хватает
+    while (!chan.blocks.empty() && chan.lines - chan.blocks.front().lines >= _lines)
+        DropOldest(chan);
+
+    _memory += Footprint(chan) - before;
+    Evict(&chan);
+}
+
+void Backlog::Seal(Channel& channel)
+{
+    uLongf length = compressBound(channel.open.size());
+    Block block;
+    block.data.resize(length);
+    if (compress2((Bytef*)&block.data[0], &length, (const Bytef*)channel.open.data(), channel.open.size(),
+                  Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        // Не сжалось - строки открытого блока теряются, но кольцо остаётся целым
+        std::cout << "[!] Backlog: compress failed for " << channel.name << std::endl;
+        channel.lines -= channel.openLines;
+    }
+    else
+    {
+        block.data.resize(length);
+        block.data.shrink_to_fit();
+        block.lines = channel.openLines;
+        block.raw = channel.open.size();
+        _raw += block.raw;
+        _compressed += length;
+        channel.packed += block.data.size();
+        channel.blocks.push_back(std::move(block));
+    }
+
+    // Ёмкость открытого блока остаётся: канал, скорее всего, продолжит писать
+    channel.open.clear();
+    channel.openLines = 0;
+}
+
+void Backlog::DropOldest(Channel& channel)
+{
+    const Block& oldest = channel.blocks.front();
+    channel.lines -= oldest.lines;
+    channel.packed -= oldest.data.size();
+    channel.blocks.pop_front();
+}
+
+void Backlog::Evict(const Channel* keep)
+{
+    while (_memory > _budget && !_lru.empty())
+    {
+        Channel& victim = _lru.back();
+        size_t before = Footprint(victim);
+
+        if (&victim != keep && victim.openLines > 0)
+        {
+            // Сначала молчащий канал просто сжимает открытый блок и отдаёт
+            // его буфер - история при этом не теряется
+            Seal(victim);
+            std::string().swap(victim.open);
+            _memory -= before - Footprint(victim);
+            continue;
+        }
+
+        if (!victim.blocks.empty())
+        {
+            DropOldest(victim);
+            _memory -= before - Footprint(victim);
+        }
+        else if (&victim == keep)
+            break;      // остался только открытый блок того, кто пишет
+        else
+        {
+            _memory -= before;
+            _channels.erase(victim.name);
+            _lru.pop_back();
+        }
+        ++_evicted;
+    }
+}
+
+void Backlog::Decode(std::string_view data, std::vector<Entry>* entries)
+{
+    size_t offset = 0;
+    while (offset + RecordHeader <= data.size())
+    {
+        Entry entry;
+        uint16_t textLength;
+        memcpy(&entry.timestamp, data.data() + offset, 8);
+        memcpy(&entry.flags, data.data() + offset + 8, 2);
+        size_t nickLength = (unsigned char)data[offset + 10];
+        memcpy(&textLength, data.data() + offset + 11, 2);
+        offset += RecordHeader;
+        if (offset + nickLength + textLength > data.size())
+            break;
+        entry.nick.assign(data.data() + offset, nickLength);
+        entry.text.assign(data.data() + offset + nickLength, textLength);
+        offset += nickLength + textLength;
+        entries->push_back(std::move(entry));
+    }
+}
+
+std::vector<Backlog::Entry> Backlog::Last(std::string_view channel, size_t count)
+{
+    MemScope scope(MemBacklog);
+    std::vector<Entry> result;
+    std::unordered_map<std::string, ChannelRef>::iterator itr = _channels.find(std::string(channel));
+    if (itr == _channels.end() || count == 0)
+        return result;
+    _lru.splice(_lru.begin(), _lru, itr->second);
+    const Channel& chan = *itr->second;
+
+    // От нового к старому; каждый источник отдаёт свой хвост в начало результата
+    std::vector<Entry> entries;
+    Decode(chan.open, &entries);
+    std::string raw;
+    for (size_t block = chan.blocks.size() + 1; block-- > 0 && result.size() < count; )
+    {
+        if (block < chan.blocks.size())
+        {
+            const Block& source = chan.blocks[block];
+            uLongf length = source.raw;
+            raw.resize(length);
+            entries.clear();
+            if (uncompress((Bytef*)&raw[0], &length, (const Bytef*)source.data.data(), source.data.size()) != Z_OK)
+                break;
+            ++_inflated;
+            Decode(std::string_view(raw.data(), length), &entries);
+        }
+
+        size_t take = std::min(count - result.size(), entries.size());
+        result.insert(result.begin(), std::make_move_iterator(entries.end() - take),
+                      std::make_move_iterator(entries.end()));
+    }
+    return result;
+}
+
+Backlog::Stats Backlog::GetStats() const
+{
+    Stats stats;
+    stats.channels = _lru.size();
+    for (const Channel& channel : _lru)
+    {
+        stats.blocks += channel.blocks.size();
+        stats.lines += channel.lines;
+    }
+    stats.memory = _memory;
+    stats.raw = _raw;
+    stats.compressed = _compressed;
+    stats.evicted = _evicted;
+    stats.inflated = _inflated;
+    return stats;
+}
@@ -0,0 +1,98 @@
+#ifndef BACKLOG_H_
+#define BACKLOG_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Недавние сообщения каналов в памяти для команды last ("что я пропустил").
+// У каждого канала открытый блок, куда строки дописываются как есть, и
+// очередь закрытых блоков, сжатых zlib. Заполненный открытый блок сжимается
+// целиком; чтение распаковывает блоки от новых к старым и останавливается,
+// как только набрало нужное число строк.
+//
+// Память ограничена общим бюджетом на все каналы: при превышении
+// вытесняются самые старые блоки канала, к которому дольше всех не
+// обращались (ни записью, ни чтением). Отдельно у канала ограничено число
+// строк. Работает в потоке цикла событий бота, без блокировок.
+class Backlog
+{
+public:
+    Backlog();
+
+    // budget - байт на все каналы, block - размер открытого блока до сжатия,
+    // lines - строк на канал. Уменьшение бюджета вытесняет лишнее сразу.
+    void Configure(size_t budget, size_t block, size_t lines);
+
+    // channel - свёрнутое имя канала; flags - LogAction и т. п. из chanlog.h
+    void Append(std::string_view channel, std::string_view nick, std::string_view text,
+                uint16_t flags, int64_t timestamp /*мс*/);
+
+    struct Entry
+    {
+        int64_t timestamp;
+        uint16_t flags;
+        std::string nick;
+        std::string text;
+    };
+    // Последние count строк канала, от старых к новым
+    std::vector<Entry> Last(std::string_view channel, size_t count);
+
+    struct Stats
+    {
+        size_t channels = 0;
+        size_t blocks = 0;          // закрытых блоков
+        size_t lines = 0;
+        size_t memory = 0;          // учитываемая бюджетом память
+        uint64_t raw = 0;           // байт строк, сжатых за всё время
+        uint64_t compressed = 0;    // они же после сжатия
+        uint64_t evicted = 0;       // блоков вытеснено бюджетом
+        uint64_t inflated = 0;      // блоков распаковано для last
+    };
+    Stats GetStats() const;
+
+private:
+    struct Block
+    {
+        std::string data;           // сжатые строки
+        uint32_t lines;
+        uint32_t raw;               // размер до сжатия
+    };
+
+    struct Channel
+    {
+        std::string name;
+        std::string open;           // несжатые записи открытого блока
+        uint32_t openLines = 0;
+        std::deque<Block> blocks;   // от старых к новым
+        size_t packed = 0;          // сумма размеров сжатых блоков
+        size_t lines = 0;           // всего, вместе с открытым блоком
+    };
+    typedef std::list<Channel>::iterator ChannelRef;
+
+    static size_t Footprint(const Channel& channel);
+    void Seal(Channel& channel);
+    void DropOldest(Channel& channel);
+    void Evict(const Channel* keep);
+    static void Decode(std::string_view data, std::vector<Entry>* entries);
+
+    size_t _budget;
+    size_t _block;
+    size_t _lines;
+
+    std::list<Channel> _lru;    // голова - канал, к которому обращались последним
+    std::unordered_map<std::string, ChannelRef> _channels;
+    size_t _memory;
+
+    uint64_t _raw;
+    uint64_t _compressed;
+    uint64_t _evicted;
+    uint64_t _inflated;
+};
+
+#endif
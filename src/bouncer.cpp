@@ -0,0 +1,507 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "bouncer.h"
+#include "ircbot.h"
+#include "casemap.h"
+#include "memtrack.h"
+
+Bouncer::Bouncer() : _bot(nullptr), _listen(-1), _retry(0), _retryLogged(false), _sender(-1)
+{
+}
+
+Bouncer::~Bouncer()
+{
+    Close();
+}
+
+bool Bouncer::Open(IRCBot* bot, const IRCConfig::Bouncer& conf)
+{
+    Close();
+    _bot = bot;
+    _conf = conf;
+    Listen();
+    return true;
+}
+
+void Bouncer::Listen()
+{
+    _retry = 0;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo* result = nullptr;
+    int error = getaddrinfo(_conf.host.empty() ? nullptr : _conf.host.c_str(), std::to_string(_conf.port).c_str(), &hints, &result);
+    if (error != 0)
+    {
+        std::cout << "[!] Bouncer: cannot resolve " << _conf.host << ": " << gai_strerror(error) << std::endl;
+        return;
+    }
+
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (fd != -1)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (fd == -1 || bind(fd, result->ai_addr, result->ai_addrlen) != 0 || listen(fd, 64) != 0)
+    {
+        int saved = errno;
+        if (fd != -1)
+            close(fd);
+        freeaddrinfo(result);
+
+        // Порт ещё держит прежний процесс (горячее обновление) - он скоро выйдет
+        if (saved == EADDRINUSE)
+        {
+            if (!_retryLogged)
+                std::cout << "[!] Bouncer: " << _conf.host << ":" << _conf.port << " is busy, retrying" << std::endl;
+            _retryLogged = true;
+            _retry = _bot->Timers().Schedule(1000, [this] { Listen(); });
+        }
+        else
+            std::cout << "[!] Bouncer: cannot listen on " << _conf.host << ":" << _conf.port << ": " << strerror(saved) << std::endl;
+        return;
+    }
+    freeaddrinfo(result);
+
+    _listen = fd;
+    _retryLogged = false;
+    _bot->WatchFd(_listen, POLLIN, [this](short) { Accept(); });
+    std::cout << "[*] Bouncer: listening on " << _conf.host << ":" << _conf.port << std::endl;
+}
+
+void Bouncer::Close()
+{
+    if (!_bot)
+        return;
+
+    while (!_clients.empty())
+        Drop(_clients.begin()->first, "Bouncer is shutting down");
+    if (_listen != -1)
+    {
+        _bot->UnwatchFd(_listen);
+        close(_listen);
+        _listen = -1;
+    }
+    if (_retry)
+        _bot->Timers().Cancel(_retry);
+    _retry = 0;
+    _backlog.clear();
+
+    std::cout << "[*] Bouncer: " << _stats.lines << " lines fanned out (" << _stats.queued << " bytes queued), "
+              << _stats.written << " bytes in " << _stats.writes << " writes, " << _stats.dropped
+              << " slow clients dropped" << std::endl;
+    _bot = nullptr;
+}
+
+void Bouncer::Accept()
+{
+    MemScope scope(MemBouncer);
+    while (true)
+    {
+        int fd = accept4(_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                std::cout << "[!] Bouncer: accept failed: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        if (_clients.size() >= _conf.clients)
+        {
+            static const char full[] = "ERROR :Closing link: too many bouncer clients\r\n";
+            send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL);
+            close(fd);
+            continue;
+        }
+
+        std::unique_ptr<Client>& client = _clients[fd];
+        client.reset(new Client);
+        client->fd = fd;
+        _bot->WatchFd(fd, POLLIN, [this, fd](short revents) { OnClient(fd, revents); });
+    }
+}
+
+void Bouncer::OnClient(int fd, short revents)
+{
+    MemScope scope(MemBouncer);
+    std::map<int, std::unique_ptr<Client>>::iterator itr = _clients.find(fd);
+    if (itr == _clients.end())
+        return;
+    Client& client = *itr->second;
+
+    if (revents & POLLOUT)
+    {
+        if (!Write(client))
+        {
+            Drop(fd, nullptr);
+            return;
+        }
+        if (client.closing && client.outq.empty())
+        {
+            Drop(fd, nullptr);
+            return;
+        }
+    }
+
+    if (!(revents & (POLLIN | POLLERR | POLLHUP)) || client.closing)
+        return;
+
+    char buffer[4096];
+    ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (bytes <= 0)
+    {
+        Drop(fd, nullptr);
+        return;
+    }
+
+    client.inbuf.append(buffer, bytes);
+    size_t start = 0, end;
+    while ((end = client.inbuf.find('\n', start)) != std::string::npos)
+    {
+        std::string_view line(client.inbuf.data() + start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (!line.empty())
+            HandleLine(client, line);
+        // Клиент мог уйти (QUIT, неверный пароль) - его буфер уже удалён
+        if (_clients.find(fd) == _clients.end() || client.closing)
+            return;
+    }
+    client.inbuf.erase(0, start);
+
+    if (client.inbuf.size() > MaxInput)
+        Drop(fd, "Input line too long");
+}
+
+void Bouncer::HandleLine(Client& client, std::string_view line)
+{
+    std::string command(line.substr(0, line.find(' ')));
+    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+    std::string_view args = line.size() > command.size() ? line.substr(command.size() + 1) : std::string_view();
+    std::string_view last = args.substr(0, 1) == ":" ? args.substr(1)
+                          : args.find(" :") != std::string_view::npos ? args.substr(args.find(" :") + 2)
+                          : args.substr(0, args.find(' '));
+
+    // Клиент считает бота сервером: эти команды на настоящий сервер не идут
+    if (command == "CAP")
+    {
+        // Возможностей не предлагаем - клиенты переходят к обычной регистрации
+        std::string sub(args.substr(0, args.find(' ')));
+        std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+        if (sub == "LS" || sub == "LIST")
+            Send(client, ":bouncer CAP * " + sub + " :");
+        else if (sub == "REQ")
+            Send(client, ":bouncer CAP * NAK :" + std::string(last));
+        return;
+    }
+    if (command == "PING")
+    {
+        Send(client, ":bouncer PONG bouncer :" + std::string(last));
+        return;
+    }
+    if (command == "PONG")
+        return;
+    if (command == "QUIT")
+    {
+        // Клиент уходит, бот остаётся на сервере
+        Drop(client.fd, "Detached");
+        return;
+    }
+
+    if (!client.attached)
+    {
+        if (command == "PASS")
+            client.pass = last;
+        else if (command == "NICK")
+            client.nick = last;
+        else if (command == "USER")
+            client.user = true;
+
+        if (!client.nick.empty() && client.user)
+        {
+            std::shared_ptr<const IRCConfig> conf = _bot->Config();
+            if (!conf->bncconf.password.empty() && client.pass != conf->bncconf.password)
+            {
+                std::cout << "[!] Bouncer: client with a wrong password, fd " << client.fd << std::endl;
+                Send(client, ":bouncer 464 " + client.nick + " :Password incorrect");
+                Send(client, "ERROR :Closing link: password incorrect");
+                client.closing = true;
+                return;
+            }
+            Attach(client);
+        }
+        return;
+    }
+
+    if (command == "PASS" || command == "USER")
+        return;
+
+    if (!_bot->Registered())
+    {
+        Send(client, ":bouncer NOTICE " + _bot->Nick() + " :Not connected to the server, line dropped");
+        return;
+    }
+
+    // На сервер - через очередь с темпом отправки, как ответы бота: вставка или
+    // скрипт в клиенте не выбьют бота с сервера за флуд. PING/PONG сюда не
+    // доходят, на них баунсер отвечает сам. Эхо остальным клиентам и история -
+    // сразу, а не когда строка дойдёт до сервера
+    bool echo = command == "PRIVMSG" || command == "NOTICE";
+    if (echo)
+    {
+        _sender = client.fd;
+        Echo(std::string(line));
+        _sender = -1;
+    }
+    _bot->QueueIRC(std::string(line), echo);
+}
+
+void Bouncer::Attach(Client& client)
+{
+    client.attached = true;
+    std::shared_ptr<const IRCConfig> conf = _bot->Config();
+    const std::string& nick = _bot->Nick();
+    const std::string server = conf->serverconf.bothostname;
+    std::string self = _bot->SelfHost().empty() ? nick : nick + "!" + _bot->SelfHost();
+
+    std::cout << "[+] Bouncer: client attached as " << client.nick << ", fd " << client.fd
+              << " (" << _clients.size() << " clients)" << std::endl;
+
+    // Регистрация у клиента завершается от имени сервера бота, под ником бота
+    Send(client, ":" + server + " 001 " + client.nick + " :Welcome, attached to " + nick + " on " + server);
+    Send(client, ":" + server + " 002 " + client.nick + " :Your host is " + server + " via the bot's bouncer");
+    const std::vector<std::string>& isupport = _bot->ISupport();
+    for (size_t i = 0; i < isupport.size(); i += 12)
+    {
+        std::string tokens;
+        for (size_t j = i; j < isupport.size() && j < i + 12; ++j)
+            tokens += isupport[j] + " ";
+        Send(client, ":" + server + " 005 " + client.nick + " " + tokens + ":are supported by this server");
+    }
+    Send(client, ":" + server + " 422 " + client.nick + " :MOTD File is missing");
+    if (client.nick != nick)
+        Send(client, ":" + client.nick + " NICK :" + nick);
+    if (!_bot->Registered())
+        Send(client, ":bouncer NOTICE " + nick + " :Not connected to the server right now");
+
+    // Каналы бота и их последние строки
+    for (const std::string& channel : _bot->ChannelNames())
+    {
+        Send(client, ":" + self + " JOIN :" + channel);
+        std::map<std::string, std::deque<Line>>::const_iterator backlog = _backlog.find(foldNick(channel));
+        if (backlog == _backlog.end())
+            continue;
+        for (const Line& line : backlog->second)
+            Send(client, line);
+    }
+}
+
+void Bouncer::Send(Client& client, const Line& line)
+{
+    if (client.closing)
+        return;
+    client.outq.push_back(line);
+    client.outBytes += line->size();
+    client.dirty = true;
+    ++_stats.lines;
+    _stats.queued += line->size();
+}
+
+void Bouncer::Send(Client& client, const std::string& line)
+{
+    Send(client, std::make_shared<const std::string>(line + "\r\n"));
+}
+
+void Bouncer::Broadcast(const Line& line, int except)
+{
+    for (std::pair<const int, std::unique_ptr<Client>>& client : _clients)
+    {
+        if (client.second->attached && client.first != except)
+            Send(*client.second, line);
+    }
+}
+
+void Bouncer::Remember(std::string_view target, const Line& line)
+{
+    if (_conf.backlog == 0 || target.empty() || target[0] != '#')
+        return;
+
+    std::string folded;
+    foldNick(target, &folded);
+    std::deque<Line>& backlog = _backlog[folded];
+    backlog.push_back(line);
+    if (backlog.size() > _conf.backlog)
+        backlog.pop_front();
+}
+
+void Bouncer::Relay(std::string_view line, const IRCMessage& message)
+{
+    MemScope scope(MemBouncer);
+    // Свой PING/PONG бот ведёт сам, ERROR означает разрыв только его соединения
+    if (message.command == "PING" || message.command == "PONG" || message.command == "ERROR")
+        return;
+
+    bool chat = (message.command == "PRIVMSG" || message.command == "NOTICE") && !message.parts.empty();
+    if (_clients.empty() && (!chat || _conf.backlog == 0))
+        return;
+
+    std::string encoded;
+    encoded.reserve(line.size() + 2);
+    encoded.append(line).append("\r\n");
+    Line shared = std::make_shared<const std::string>(std::move(encoded));
+
+    Broadcast(shared, -1);
+    if (chat)
+        Remember(message.parts[0], shared);
+}
+
+void Bouncer::Echo(const std::string& line)
+{
+    MemScope scope(MemBouncer);
+    // Сервер не присылает отправителю его же сообщения - клиентам их показывает баунсер
+    size_t space = line.find(' ');
+    if (space == std::string::npos)
+        return;
+
+    std::string self = _bot->SelfHost().empty() ? _bot->Nick() : _bot->Nick() + "!" + _bot->SelfHost();
+    Line shared = std::make_shared<const std::string>(":" + self + " " + line + "\r\n");
+    Broadcast(shared, _sender);
+    Remember(std::string_view(line).substr(space + 1, line.find(' ', space + 1) - space - 1), shared);
+}
+
+void Bouncer::Notice(const std::string& text)
+{
+    for (std::pair<const int, std::unique_ptr<Client>>& client : _clients)
+    {
+        if (client.second->attached)
+            Send(*client.second, ":bouncer NOTICE " + _bot->Nick() + " :" + text);
+    }
+}
+
+size_t Bouncer::Queued() const
+{
+    size_t queued = 0;
+    for (const std::pair<const int, std::unique_ptr<Client>>& client : _clients)
+        queued += client.second->outq.size();
+    return queued;
+}
+
+void Bouncer::Flush()
+{
+    MemScope scope(MemBouncer);
+    std::vector<int> failed;
+    for (std::pair<const int, std::unique_ptr<Client>>& item : _clients)
+    {
+        Client& client = *item.second;
+        if (!client.dirty)
+            continue;
+        client.dirty = false;
+
+        if (client.outBytes > MaxOutput)
+        {
+            ++_stats.dropped;
+            std::cout << "[!] Bouncer: client fd " << client.fd << " is not reading (" << client.outBytes
+                      << " bytes queued), dropping it" << std::endl;
+            failed.push_back(item.first);
+            continue;
+        }
+        // Уже ждём POLLOUT - запишем по нему
+        if (!client.pollout && !Write(client))
+            failed.push_back(item.first);
+        else if (client.closing && client.outq.empty())
+            failed.push_back(item.first);
+    }
+
+    for (int fd : failed)
+        Drop(fd, nullptr);
+}
+
+bool Bouncer::Write(Client& client)
+{
+    struct iovec iov[IOV_MAX];
+    while (!client.outq.empty())
+    {
+        int count = 0;
+        for (std::deque<Line>::const_iterator itr = client.outq.begin(); itr != client.outq.end() && count < IOV_MAX; ++itr, ++count)
+        {
+            size_t skip = count == 0 ? client.outOffset : 0;
+            iov[count].iov_base = (void*)((*itr)->data() + skip);
+            iov[count].iov_len = (*itr)->size() - skip;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(client.fd, &msg, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            ++_stats.writes;
+            _stats.written += sent;
+            client.outBytes -= sent;
+
+            size_t left = sent;
+            while (left > 0 && left >= client.outq.front()->size() - client.outOffset)
+            {
+                left -= client.outq.front()->size() - client.outOffset;
+                client.outOffset = 0;
+                client.outq.pop_front();
+            }
+            client.outOffset += left;
+            continue;
+        }
+
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return false;
+    }
+
+    // POLLOUT нужен, только пока есть остаток
+    bool pollout = !client.outq.empty();
+    if (pollout != client.pollout)
+    {
+        int fd = client.fd;
+        client.pollout = pollout;
+        _bot->WatchFd(fd, pollout ? POLLIN | POLLOUT : POLLIN, [this, fd](short revents) { OnClient(fd, revents); });
+    }
+    return true;
+}
+
+void Bouncer::Drop(int fd, const char* reason)
+{
+    std::map<int, std::unique_ptr<Client>>::iterator itr = _clients.find(fd);
+    if (itr == _clients.end())
+        return;
+
+    if (reason)
+    {
+        std::string error = "ERROR :Closing link: " + std::string(reason) + "\r\n";
+        send(fd, error.data(), error.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    if (itr->second->attached)
+        std::cout << "[-] Bouncer: client " << itr->second->nick << " detached, fd " << fd << std::endl;
+
+    _bot->UnwatchFd(fd);
+    close(fd);
+    _clients.erase(itr);
+}
@@ -0,0 +1,110 @@
+#ifndef BOUNCER_H_
+#define BOUNCER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <cstdint>
+
+#include "config.h"
+
+class IRCBot;
+struct IRCMessage;
+
+// Встроенный баунсер: IRC-клиенты подключаются к боту, как к серверу, и
+// работают через его единственное соединение. Всё, что приходит от сервера,
+// расходится всем подключённым клиентам; строки клиентов уходят на сервер
+// от имени бота. При подключении клиент получает приветствие, каналы бота
+// и последние строки каждого канала.
+//
+// Строка для рассылки кодируется один раз: очереди клиентов и история
+// каналов держат указатели на один и тот же буфер, а запись в сокеты идёт
+// раз за итерацию цикла, по writev на клиента. Всё работает в потоке цикла
+// событий бота (IRCBot::WatchFd).
+class Bouncer
+{
+public:
+    Bouncer();
+    ~Bouncer();
+
+    // Слушать conf.host:conf.port; занятый порт (например, прежним процессом
+    // при /upgrade) пробуется снова раз в секунду
+    bool Open(IRCBot* bot, const IRCConfig::Bouncer& conf);
+    void Close();
+    bool IsOpen() const { return _bot != nullptr; };
+
+    // Строка от сервера без CRLF и её разбор: всем клиентам, сообщения
+    // каналов ещё и в историю
+    void Relay(std::string_view line, const IRCMessage& message);
+    // PRIVMSG/NOTICE, которые бот отправил сам (ответы, консоль, клиенты)
+    void Echo(const std::string& line);
+    // Служебное уведомление всем клиентам
+    void Notice(const std::string& text);
+    // Записать накопленное клиентам; вызывается в конце итерации цикла
+    void Flush();
+
+    size_t Clients() const { return _clients.size(); };
+    // Строк в очередях всех клиентов
+    size_t Queued() const;
+
+    struct Stats
+    {
+        uint64_t lines = 0;     // строк поставлено в очереди (одна строка - один буфер)
+        uint64_t queued = 0;    // из них байт по всем клиентам
+        uint64_t written = 0;   // записано в сокеты клиентов
+        uint64_t writes = 0;    // вызовов writev
+        uint64_t dropped = 0;   // клиентов, отключённых за переполнение очереди
+    };
+    const Stats& GetStats() const { return _stats; };
+
+private:
+    static const size_t MaxInput = 8 << 10;     // строка клиента длиннее - разрыв
+    static const size_t MaxOutput = 4 << 20;    // клиент не читает - разрыв
+
+    typedef std::shared_ptr<const std::string> Line;
+
+    struct Client
+    {
+        int fd;
+        std::string inbuf;
+        std::deque<Line> outq;
+        size_t outOffset = 0;   // сколько байт первой строки уже отправлено
+        size_t outBytes = 0;
+        bool pollout = false;   // в WatchFd запрошен POLLOUT
+        bool dirty = false;     // есть что записать в этой итерации
+        bool closing = false;   // отключить, когда очередь уйдёт
+        std::string nick;       // ник, с которым клиент регистрировался
+        std::string pass;
+        bool user = false;      // USER получен
+        bool attached = false;  // регистрация пройдена, получает рассылку
+    };
+
+    void Listen();
+    void Accept();
+    void OnClient(int fd, short revents);
+    void HandleLine(Client& client, std::string_view line);
+    void Attach(Client& client);
+    void Send(Client& client, const Line& line);
+    void Send(Client& client, const std::string& line);
+    void Broadcast(const Line& line, int except);
+    void Remember(std::string_view target, const Line& line);
+    bool Write(Client& client);
+    void Drop(int fd, const char* reason);
+
+    IRCBot* _bot;
+    IRCConfig::Bouncer _conf;
+    int _listen;
+    uint64_t _retry;            // таймер повторной попытки bind
+    bool _retryLogged;
+
+    std::map<int, std::unique_ptr<Client>> _clients;
+    int _sender;                // клиент, чья строка сейчас уходит на сервер: эхо не ему
+    std::map<std::string, std::deque<Line>> _backlog;  // свёрнутое имя канала -> строки
+
+    Stats _stats;
+};
+
+#endif
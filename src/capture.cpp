@@ -0,0 +1,250 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "ircbot.h"
+
+static const char CaptureMagic[8] = { 'I', 'R', 'C', 'C', 'A', 'P', '\0', '\0' };
+static const uint32_t CaptureVersion = 1;
+static const size_t CaptureHeaderSize = 24;     // сигнатура, версия, резерв, время начала
+
+static int64_t monotonicUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void putVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static bool getVarint(const char* data, size_t size, size_t* offset, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; *offset < size && shift < 64; shift += 7)
+    {
+        uint8_t byte = data[(*offset)++];
+        result |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+CaptureWriter::CaptureWriter() : _fd(-1), _lastChunk(0), _lastFlush(0), _chunks(0), _bytes(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+bool CaptureWriter::Open(const std::string& path)
+{
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd == -1)
+    {
+        std::cerr << "Capture: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    int64_t started = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    char header[CaptureHeaderSize] = { 0 };
+    memcpy(header, CaptureMagic, sizeof(CaptureMagic));
+    memcpy(header + 8, &CaptureVersion, sizeof(CaptureVersion));
+    memcpy(header + 16, &started, sizeof(started));
+    _buffer.assign(header, sizeof(header));
+
+    _lastChunk = _lastFlush = monotonicUs();
+    _chunks = _bytes = 0;
+    return Flush();
+}
+
+void CaptureWriter::Close()
+{
+    if (_fd == -1)
+        return;
+
+    Flush();
+    close(_fd);
+    _fd = -1;
+}
+
+void CaptureWriter::Write(const char* data, size_t length)
+{
+    if (_fd == -1)
+        return;
+
+    int64_t now = monotonicUs();
+    putVarint(_buffer, now - _lastChunk);
+    putVarint(_buffer, length);
+    _buffer.append(data, length);
+    _lastChunk = now;
+    ++_chunks;
+    _bytes += length;
+
+    if (_buffer.size() >= FlushBytes || now - _lastFlush >= FlushUs)
+        Flush();
+}
+
+bool CaptureWriter::Flush()
+{
+    _lastFlush = monotonicUs();
+
+    const char* data = _buffer.data();
+    size_t length = _buffer.size();
+    while (length > 0)
+    {
+        ssize_t written = write(_fd, data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Capture: write failed: " << strerror(errno) << std::endl;
+            _buffer.clear();
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    _buffer.clear();
+    return true;
+}
+
+CaptureReader::CaptureReader() : _data(nullptr), _size(0), _offset(0), _startTime(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    if (_data)
+        munmap((void*)_data, _size);
+}
+
+bool CaptureReader::Open(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        std::cerr << "Capture: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= CaptureHeaderSize)
+    {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            _data = (const char*)data;
+            _size = st.st_size;
+        }
+    }
+    close(fd);
+
+    uint32_t version = 0;
+    if (_data)
+        memcpy(&version, _data + 8, sizeof(version));
+    if (!_data || memcmp(_data, CaptureMagic, sizeof(CaptureMagic)) != 0 || version != CaptureVersion)
+    {
+        std::cerr << "Capture: " << path << " is not a capture file" << std::endl;
+        return false;
+    }
+
+    memcpy(&_startTime, _data + 16, sizeof(_startTime));
+    Rewind();
+    return true;
+}
+
+void CaptureReader::Rewind()
+{
+    _offset = CaptureHeaderSize;
+}
+
+bool CaptureReader::Next(int64_t* delayUs, const char** data, size_t* length)
+{
+    uint64_t delay, size;
+    size_t offset = _offset;
+    if (!getVarint(_data, _size, &offset, &delay) || !getVarint(_data, _size, &offset, &size)
+        || size > _size - offset)
+        return false;   // конец записи или оборванный последний кусок
+
+    *delayUs = delay;
+    *data = _data + offset;
+    *length = size;
+    _offset = offset + size;
+    return true;
+}
+
+bool replayCapture(const std::string& path, double speed, int loops, IRCBot* client)
+{
+    CaptureReader reader;
+    if (!reader.Open(path))
+        return false;
+
+    uint64_t chunks = 0, bytes = 0, lines = 0;
+    int64_t recorded = 0;
+    int64_t started = monotonicUs();
+
+    for (int loop = 0; loop < std::max(loops, 1); ++loop)
+    {
+        reader.Rewind();
+
+        // Пауза отсчитывается от начала прохода, чтобы ошибки сна не копились
+        int64_t origin = monotonicUs();
+        int64_t due = 0;
+
+        int64_t delay;
+        const char* data;
+        size_t length;
+        while (reader.Next(&delay, &data, &length))
+        {
+            due += delay;
+            recorded += delay;
+            if (speed > 0)
+            {
+                int64_t wait = origin + int64_t(due / speed) - monotonicUs();
+                if (wait > 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(wait));
+                client->Timers().Advance(TimerWheel::Now());
+            }
+
+            client->Feed(data, length);
+            ++chunks;
+            bytes += length;
+            lines += std::count(data, data + length, '\n');
+        }
+    }
+
+    double seconds = (monotonicUs() - started) / 1e6;
+    const BatchArena::Stats& arena = client->Arena().GetStats();
+    std::cerr << "Replayed " << path << ": " << chunks << " chunks, " << lines << " lines, "
+              << bytes << " bytes in " << seconds << " s (recorded " << recorded / 1e6 << " s)\n"
+              << "Throughput: " << lines / seconds << " lines/s, " << bytes / seconds / 1048576 << " MB/s\n"
+              << "Arena: " << arena.batches << " batches, " << arena.bytes / 1024 << " KB, "
+              << arena.reused * 100 / std::max<uint64_t>(arena.bytes, 1) << "% reused, peak "
+              << arena.peak << " bytes, " << arena.blocks << " blocks of " << client->Arena().Capacity() / 1024 << " KB"
+              << std::endl;
+    return true;
+}
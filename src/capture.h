@@ -0,0 +1,70 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+class IRCBot;
+
+// Запись принятого от сервера трафика для воспроизведения.
+// Файл: заголовок (сигнатура, версия, время начала UTC в мс) и куски в том
+// виде, как их вернуло чтение из сокета: varint паузы от предыдущего куска
+// по монотонным часам (мкс), varint длины и сами байты.
+class CaptureWriter
+{
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    bool Open(const std::string& path);
+    void Close();
+    bool IsOpen() const { return _fd != -1; };
+
+    void Write(const char* data, size_t length);
+
+    uint64_t Chunks() const { return _chunks; };
+    uint64_t Bytes() const { return _bytes; };
+
+private:
+    static const size_t FlushBytes = 64 << 10;
+    static const int64_t FlushUs = 1000000;     // не держать данные в буфере дольше
+
+    bool Flush();
+
+    int _fd;
+    std::string _buffer;
+    int64_t _lastChunk;     // монотонное время предыдущего куска, мкс
+    int64_t _lastFlush;
+    uint64_t _chunks;
+    uint64_t _bytes;
+};
+
+// Чтение записи через mmap
+class CaptureReader
+{
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    bool Open(const std::string& path);
+    void Rewind();
+
+    // Следующий кусок; delayUs - пауза перед ним при записи
+    bool Next(int64_t* delayUs, const char** data, size_t* length);
+
+    int64_t StartTime() const { return _startTime; };
+
+private:
+    const char* _data;
+    size_t _size;
+    size_t _offset;
+    int64_t _startTime;
+};
+
+// Прогоняет запись через IRCBot::Feed. speed: 1 - в исходном темпе,
+// N - в N раз быстрее, 0 - без пауз. Сводка пишется в stderr, чтобы вывод
+// обработчиков можно было отправить в /dev/null.
+bool replayCapture(const std::string& path, double speed, int loops, IRCBot* client);
+
+#endif
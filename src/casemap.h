@@ -0,0 +1,32 @@
+#ifndef CASEMAP_H_
+#define CASEMAP_H_
+
+#include <string>
+#include <string_view>
+
+// Регистр ников и каналов по RFC 1459: кроме латиницы, парами считаются
+// [ и {, ] и }, \ и |, ~ и ^ (скандинавские буквы в исходной кодировке IRC)
+inline char ircToLower(char c)
+{
+    if (c >= 'A' && c <= '^')
+        return c + ('a' - 'A');
+    return c;
+}
+
+inline std::string foldNick(const std::string& nick)
+{
+    std::string folded(nick);
+    for (char& c : folded)
+        c = ircToLower(c);
+    return folded;
+}
+
+// То же в готовую строку: её буфер переиспользуется от вызова к вызову
+inline void foldNick(std::string_view nick, std::string* folded)
+{
+    folded->assign(nick);
+    for (char& c : *folded)
+        c = ircToLower(c);
+}
+
+#endif
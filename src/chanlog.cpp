@@ -0,0 +1,556 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "chanlog.h"
+#include "memtrack.h"
+
+// Заголовок сегмента: сигнатура и версия формата
+static const char SegmentMagic[8] = { 'C', 'H', 'A', 'N', 'L', 'O', 'G', '\0' };
+static const uint32_t SegmentVersion = 1;
+static const size_t SegmentHeaderSize = 16;
+
+static const char NameKinds[LogKinds] = { 'n', 'c', 'u' };
+
+static std::string segmentName(uint32_t sequence)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "%08u.seg", sequence);
+    return name;
+}
+
+// Словарь: строки "<вид> <ID> <имя>", вид - n (сеть), c (канал), u (ник).
+// Дописывается потоком записи раньше записей, которые на него ссылаются.
+static bool loadNames(const std::string& path, std::vector<std::string>* names)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        char kind;
+        uint32_t id;
+        std::string name;
+        if (!(fields >> kind >> id >> name) || id == 0)
+            continue;
+
+        const char* found = std::find(NameKinds, NameKinds + LogKinds, kind);
+        if (found == NameKinds + LogKinds)
+            continue;
+
+        std::vector<std::string>& list = names[found - NameKinds];
+        if (list.size() < id)
+            list.resize(id);
+        list[id - 1] = name;
+    }
+    return true;
+}
+
+static std::vector<std::string> listSegments(const std::string& dir)
+{
+    std::vector<std::string> segments;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, error))
+    {
+        if (entry.path().extension() == ".seg")
+            segments.push_back(entry.path().string());
+    }
+    // Номера дополнены нулями, поэтому порядок имён совпадает с порядком записи
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+// Отображение сегмента в память только для чтения
+class MappedSegment
+{
+public:
+    MappedSegment() : _data(nullptr), _size(0) {};
+    ~MappedSegment()
+    {
+        if (_data)
+            munmap(_data, _size);
+    };
+
+    bool Map(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                madvise(data, st.st_size, MADV_SEQUENTIAL);
+                _data = (char*)data;
+                _size = st.st_size;
+            }
+        }
+        close(fd);
+        return _data != nullptr;
+    };
+
+    const char* Data() const { return _data; };
+    size_t Size() const { return _size; };
+
+private:
+    char* _data;
+    size_t _size;
+};
+
+size_t scanSegment(const char* data, size_t size, uint32_t sequence, size_t from,
+                   const ChannelLogReader::Visitor& visitor)
+{
+    if (size < SegmentHeaderSize || memcmp(data, SegmentMagic, sizeof(SegmentMagic)) != 0)
+        return 0;
+
+    uint32_t version;
+    memcpy(&version, data + sizeof(SegmentMagic), sizeof(version));
+    if (version != SegmentVersion)
+        return 0;
+
+    size_t offset = std::max(from, SegmentHeaderSize);
+    while (offset < size && size - offset >= sizeof(LogRecord))
+    {
+        const LogRecord* record = (const LogRecord*)(data + offset);
+        size_t length = logRecordSize(record->length);
+        if (length > size - offset)
+            break;      // запись не дописана
+
+        if (visitor && !visitor(*record, data + offset + sizeof(LogRecord), (LogAddress(sequence) << 32) | offset))
+            return offset + length;
+        offset += length;
+    }
+    return offset;
+}
+
+ChannelLog::ChannelLog() : _segmentBytes(0), _open(false), _stop(false),
+    _segmentFd(-1), _namesFd(-1), _sequence(0), _segmentSize(0), _written(0), _dropped(0)
+{
+}
+
+ChannelLog::~ChannelLog()
+{
+    Close();
+}
+
+bool ChannelLog::Open(const std::string& dir, size_t segmentBytes)
+{
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error)
+    {
+        std::cerr << "Channel log: cannot create " << dir << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    _dir = dir;
+    _segmentBytes = std::max(segmentBytes, size_t(64 << 10));
+
+    // Продолжаем нумерацию ID с того места, где остановился прошлый запуск
+    std::string namesPath = dir + "/names.dic";
+    std::vector<std::string> names[LogKinds];
+    loadNames(namesPath, names);
+    for (int kind = 0; kind < LogKinds; ++kind)
+    {
+        for (size_t i = 0; i < names[kind].size(); ++i)
+            _ids[kind][names[kind][i]] = i + 1;
+        _names[kind] = std::move(names[kind]);
+    }
+
+    _namesFd = open(namesPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_namesFd == -1)
+    {
+        std::cerr << "Channel log: cannot open " << namesPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> segments = listSegments(dir);
+    bool resumed = false;
+    if (!segments.empty())
+    {
+        const std::string& last = segments.back();
+        _sequence = strtoul(std::filesystem::path(last).stem().c_str(), nullptr, 10);
+
+        // После аварийного завершения в конце может остаться обрывок записи -
+        // отрезаем его, чтобы дописывать с границы записи
+        size_t end = 0;
+        {
+            MappedSegment segment;
+            if (segment.Map(last))
+                end = scanSegment(segment.Data(), segment.Size(), _sequence, 0, nullptr);
+        }
+
+        if (end >= SegmentHeaderSize && truncate(last.c_str(), end) == 0)
+        {
+            _segmentFd = open(last.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            _segmentSize = end;
+            resumed = _segmentFd != -1;
+        }
+        else
+            ++_sequence;    // повреждённый заголовок не трогаем, начинаем новый сегмент
+    }
+
+    if (!resumed && !OpenSegment(_sequence ? _sequence : 1))
+    {
+        close(_namesFd);
+        _namesFd = -1;
+        return false;
+    }
+
+    _stop = false;
+    _open = true;
+    if (!_thread.Start(&writerThread, this))
+    {
+        _open = false;
+        return false;
+    }
+
+    std::cout << "Channel log: " << dir << "/" << segmentName(_sequence)
+              << " (" << _segmentSize << " bytes)" << std::endl;
+    return true;
+}
+
+void ChannelLog::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_open)
+            return;
+        _open = false;
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.Join();
+
+    if (_segmentFd != -1)
+    {
+        fdatasync(_segmentFd);
+        close(_segmentFd);
+        _segmentFd = -1;
+    }
+    if (_namesFd != -1)
+    {
+        close(_namesFd);
+        _namesFd = -1;
+    }
+}
+
+void ChannelLog::Append(std::string_view network, std::string_view channel, std::string_view nick,
+                        std::string_view text, uint16_t flags)
+{
+    MemScope scope(MemLog);
+    LogRecord record;
+    record.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.flags = flags;
+    record.length = text.size();
+
+    size_t size = logRecordSize(record.length);
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_open)
+            return;
+
+        if (_pending.size() + size > MaxPending)
+        {
+            ++_dropped;
+            return;
+        }
+
+        record.network = Intern(LogNetwork, network);
+        record.channel = Intern(LogChannel, channel);
+        record.nick = Intern(LogNick, nick);
+
+        _pending.append((const char*)&record, sizeof(record));
+        _pending.append(text);
+        _pending.append(size - sizeof(record) - text.size(), '\0');
+        wake = _pending.size() >= FlushBytes;
+    }
+
+    if (wake)
+        _wake.notify_one();
+}
+
+uint32_t ChannelLog::Intern(LogNameKind kind, std::string_view name)
+{
+    auto found = _ids[kind].find(name);
+    if (found != _ids[kind].end())
+        return found->second;
+
+    uint32_t id = _names[kind].size() + 1;
+    _ids[kind].emplace(name, id);
+    _names[kind].emplace_back(name);
+
+    _pendingNames += NameKinds[kind];
+    _pendingNames += ' ' + std::to_string(id) + ' ';
+    _pendingNames += name;
+    _pendingNames += '\n';
+    return id;
+}
+
+uint32_t ChannelLog::Find(LogNameKind kind, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _ids[kind].find(name);
+    return found != _ids[kind].end() ? found->second : 0;
+}
+
+std::string ChannelLog::Name(LogNameKind kind, uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (id == 0 || id > _names[kind].size())
+        return "?";
+    return _names[kind][id - 1];
+}
+
+bool ChannelLog::OpenSegment(uint32_t sequence)
+{
+    if (_segmentFd != -1)
+    {
+        fdatasync(_segmentFd);
+        close(_segmentFd);
+    }
+
+    std::string path = _dir + "/" + segmentName(sequence);
+    _segmentFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (_segmentFd == -1)
+    {
+        std::cerr << "Channel log: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    char header[SegmentHeaderSize] = { 0 };
+    memcpy(header, SegmentMagic, sizeof(SegmentMagic));
+    memcpy(header + sizeof(SegmentMagic), &SegmentVersion, sizeof(SegmentVersion));
+
+    _sequence = sequence;
+    _segmentSize = 0;
+    if (!WriteAll(_segmentFd, header, sizeof(header)))
+        return false;
+    _segmentSize = sizeof(header);
+    return true;
+}
+
+bool ChannelLog::WriteAll(int fd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Channel log: write failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+void ChannelLog::WriteBatch(const std::string& batch)
+{
+    size_t offset = 0;
+    size_t chunk = 0;
+    uint64_t records = 0;
+
+    while (offset < batch.size())
+    {
+        const LogRecord* record = (const LogRecord*)(batch.data() + offset);
+        size_t size = logRecordSize(record->length);
+
+        // Сегмент переполнится - дописываем накопленное и начинаем следующий.
+        // Запись целиком остаётся в одном сегменте.
+        size_t fill = _segmentSize + (offset - chunk);
+        if (fill + size > _segmentBytes && fill > SegmentHeaderSize)
+        {
+            if (_segmentFd != -1 && WriteAll(_segmentFd, batch.data() + chunk, offset - chunk))
+                _written += records;
+            else
+                _dropped += records;
+            records = 0;
+            chunk = offset;
+            OpenSegment(_sequence + 1);
+        }
+
+        offset += size;
+        ++records;
+    }
+
+    if (_segmentFd != -1 && WriteAll(_segmentFd, batch.data() + chunk, offset - chunk))
+    {
+        _segmentSize += offset - chunk;
+        _written += records;
+    }
+    else
+        _dropped += records;
+}
+
+ThreadReturn ChannelLog::writerThread(void* param)
+{
+    ChannelLog* log = (ChannelLog*)param;
+    MemScope scope(MemLog);
+    std::string batch;
+    std::string names;
+
+    std::unique_lock<std::mutex> lock(log->_mutex);
+    while (true)
+    {
+        log->_wake.wait_for(lock, std::chrono::milliseconds(200),
+            [log] { return log->_stop || log->_pending.size() >= FlushBytes; });
+
+        if (log->_pending.empty() && log->_pendingNames.empty())
+        {
+            if (log->_stop)
+                break;
+            continue;
+        }
+
+        // Буферы меняются местами, запись на диск идёт без блокировки
+        batch.swap(log->_pending);
+        names.swap(log->_pendingNames);
+        lock.unlock();
+
+        // Словарь раньше записей: читатель не должен встретить неизвестный ID
+        if (!names.empty() && log->_namesFd != -1)
+            log->WriteAll(log->_namesFd, names.data(), names.size());
+        log->WriteBatch(batch);
+
+        batch.clear();
+        names.clear();
+        lock.lock();
+    }
+
+    return NULL;
+}
+
+bool ChannelLogReader::Open(const std::string& dir, bool names)
+{
+    for (int kind = 0; kind < LogKinds; ++kind)
+    {
+        _names[kind].clear();
+        _ids[kind].clear();
+    }
+
+    _dir = dir;
+    if (names && !loadNames(dir + "/names.dic", _names))
+        return false;
+
+    for (int kind = 0; kind < LogKinds; ++kind)
+    {
+        for (size_t i = 0; i < _names[kind].size(); ++i)
+            _ids[kind][_names[kind][i]] = i + 1;
+    }
+
+    _segments = listSegments(dir);
+    return true;
+}
+
+uint32_t ChannelLogReader::SegmentSequence(size_t index) const
+{
+    return strtoul(std::filesystem::path(_segments[index]).stem().c_str(), nullptr, 10);
+}
+
+const std::string& ChannelLogReader::Name(LogNameKind kind, uint32_t id) const
+{
+    static const std::string unknown = "?";
+    if (id == 0 || id > _names[kind].size())
+        return unknown;
+    return _names[kind][id - 1];
+}
+
+uint32_t ChannelLogReader::Find(LogNameKind kind, const std::string& name) const
+{
+    auto found = _ids[kind].find(name);
+    return found != _ids[kind].end() ? found->second : 0;
+}
+
+bool ChannelLogReader::Scan(size_t segment, const Visitor& visitor, uint32_t from) const
+{
+    MappedSegment mapped;
+    if (segment >= _segments.size() || !mapped.Map(_segments[segment]))
+        return false;
+
+    bool stopped = false;
+    scanSegment(mapped.Data(), mapped.Size(), SegmentSequence(segment), from,
+        [&](const LogRecord& record, const char* text, LogAddress address) {
+            stopped = !visitor(record, text, address);
+            return !stopped;
+        });
+    return !stopped;
+}
+
+bool ChannelLogReader::ScanAll(const Visitor& visitor) const
+{
+    bool stopped = false;
+    for (size_t i = 0; i < _segments.size() && !stopped; ++i)
+    {
+        Scan(i, [&](const LogRecord& record, const char* text, LogAddress address) {
+            stopped = !visitor(record, text, address);
+            return !stopped;
+        });
+    }
+    return !stopped;
+}
+
+bool ChannelLogReader::Fetch(LogAddress address, LogRecord* record, std::string* text) const
+{
+    MappedSegment mapped;
+    if (!mapped.Map(_dir + "/" + segmentName(address >> 32)))
+        return false;
+
+    size_t offset = address & 0xFFFFFFFF;
+    if (offset < SegmentHeaderSize || offset % 8 != 0 || offset + sizeof(LogRecord) > mapped.Size())
+        return false;
+
+    const LogRecord* found = (const LogRecord*)(mapped.Data() + offset);
+    if (logRecordSize(found->length) > mapped.Size() - offset)
+        return false;
+
+    *record = *found;
+    text->assign(mapped.Data() + offset + sizeof(LogRecord), found->length);
+    return true;
+}
+
+std::vector<ChannelLogReader::Entry> ChannelLogReader::Tail(const std::string& channel, size_t count) const
+{
+    std::vector<Entry> result;
+    uint32_t id = Find(LogChannel, channel);
+    if (id == 0 || count == 0)
+        return result;
+
+    // Сегменты идут от новых к старым, внутри сегмента держим только последние count
+    for (size_t i = _segments.size(); i > 0 && result.size() < count; --i)
+    {
+        std::deque<Entry> found;
+        Scan(i - 1, [&](const LogRecord& record, const char* text, LogAddress) {
+            if (record.channel != id)
+                return true;
+            found.push_back({ record.timestamp, record.flags, Name(LogNick, record.nick),
+                              std::string(text, record.length) });
+            if (found.size() > count - result.size())
+                found.pop_front();
+            return true;
+        });
+        result.insert(result.begin(), found.begin(), found.end());
+    }
+    return result;
+}
@@ -0,0 +1,180 @@
+#ifndef CHANLOG_H_
+#define CHANLOG_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "thread.h"
+
+// Журнал каналов и приватных сообщений: каталог с сегментами 00000001.seg,
+// 00000002.seg ... в которые записи только дописываются, и словарь имён
+// names.dic. Сетям, каналам и никам присваиваются числовые ID, в записи
+// хранятся только они. Новый сегмент начинается, когда текущий дорастает
+// до заданного размера.
+
+// Заголовок записи; за ним идёт текст длиной length, вся запись выровнена
+// на 8 байт, поэтому заголовок читается прямо из отображённого файла
+struct LogRecord
+{
+    uint64_t timestamp;     // время UTC, мс
+    uint16_t network;       // ID сети
+    uint16_t flags;         // LogPrivate, LogAction
+    uint32_t channel;       // ID канала (для привата - ID собеседника)
+    uint32_t nick;          // ID автора
+    uint32_t length;        // длина текста, байт
+};
+static_assert(sizeof(LogRecord) == 24, "LogRecord layout is part of the file format");
+
+// Адрес записи в журнале: (номер сегмента << 32) | смещение в сегменте.
+// Адреса растут в порядке записи.
+typedef uint64_t LogAddress;
+
+inline size_t logRecordSize(uint32_t length)
+{
+    return (sizeof(LogRecord) + length + 7) & ~size_t(7);
+}
+
+enum LogFlags : uint16_t
+{
+    LogPrivate  = 1,        // личное сообщение боту
+    LogAction   = 2         // CTCP ACTION (/me)
+};
+
+// Пространства имён словаря
+enum LogNameKind
+{
+    LogNetwork = 0,
+    LogChannel = 1,
+    LogNick    = 2,
+    LogKinds   = 3
+};
+
+// Запись в журнал. Append() только копирует запись в буфер под коротким
+// мьютексом; файлы пишет фоновый поток, так что цикл приёма на диске не
+// ждёт. Если диск не успевает и буфер переполнен, записи отбрасываются
+// и учитываются в Dropped().
+class ChannelLog
+{
+public:
+    ChannelLog();
+    ~ChannelLog();
+
+    bool Open(const std::string& dir, size_t segmentBytes);
+    // Дописывает буфер и останавливает поток записи
+    void Close();
+    bool IsOpen() const { return _open; };
+
+    void Append(std::string_view network, std::string_view channel, std::string_view nick,
+                std::string_view text, uint16_t flags);
+
+    uint64_t Written() const { return _written; };
+    uint64_t Dropped() const { return _dropped; };
+    const std::string& Dir() const { return _dir; };
+
+    // Словарь журнала в памяти, без чтения names.dic; 0 / "?" - нет такого
+    uint32_t Find(LogNameKind kind, const std::string& name);
+    std::string Name(LogNameKind kind, uint32_t id);
+
+private:
+    static const size_t MaxPending = 16 << 20;  // предел буфера до отбрасывания
+    static const size_t FlushBytes = 64 << 10;  // будить поток записи раньше таймаута
+
+    static ThreadReturn writerThread(void* param);
+
+    // Поиск в словаре по string_view, без временной std::string
+    struct NameHash
+    {
+        typedef void is_transparent;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); };
+    };
+
+    uint32_t Intern(LogNameKind kind, std::string_view name);
+    bool OpenSegment(uint32_t sequence);
+    void WriteBatch(const std::string& batch);
+    bool WriteAll(int fd, const char* data, size_t length);
+
+    std::string _dir;
+    size_t _segmentBytes;
+    bool _open;
+
+    // Под _mutex: буферы, которые забирает поток записи, и словарь
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::string _pending;           // готовые записи
+    std::string _pendingNames;      // новые строки словаря
+    std::unordered_map<std::string, uint32_t, NameHash, std::equal_to<>> _ids[LogKinds];
+    std::vector<std::string> _names[LogKinds];
+    bool _stop;
+
+    // Только в потоке записи
+    Thread _thread;
+    int _segmentFd;
+    int _namesFd;
+    uint32_t _sequence;
+    size_t _segmentSize;
+
+    std::atomic<uint64_t> _written;
+    std::atomic<uint64_t> _dropped;
+};
+
+// Чтение журнала через mmap: записи отдаются указателями в отображение
+// сегмента, без копирования. Сегмент, в который ещё идёт запись, читается
+// по размеру на момент отображения; недописанная запись в конце пропускается.
+class ChannelLogReader
+{
+public:
+    // Запись, как она лежит в сегменте; text не оканчивается нулём
+    typedef std::function<bool(const LogRecord& /*record*/, const char* /*text*/, LogAddress /*address*/)> Visitor;
+
+    // names = false - не загружать словарь (он бывает большим), Name() и Find()
+    // тогда ничего не знают
+    bool Open(const std::string& dir, bool names = true);
+
+    size_t Segments() const { return _segments.size(); };
+    const std::string& SegmentPath(size_t index) const { return _segments[index]; };
+    uint32_t SegmentSequence(size_t index) const;
+
+    const std::string& Name(LogNameKind kind, uint32_t id) const;
+    // 0, если такого имени в журнале нет
+    uint32_t Find(LogNameKind kind, const std::string& name) const;
+
+    // Обходит записи сегмента по порядку начиная со смещения from, пока
+    // visitor возвращает true; false, если сегмент не удалось прочитать или
+    // обход прерван
+    bool Scan(size_t segment, const Visitor& visitor, uint32_t from = 0) const;
+    bool ScanAll(const Visitor& visitor) const;
+    // Одна запись по адресу; false, если её нет
+    bool Fetch(LogAddress address, LogRecord* record, std::string* text) const;
+
+    struct Entry
+    {
+        uint64_t timestamp;
+        uint16_t flags;
+        std::string nick;
+        std::string text;
+    };
+    // Последние count записей канала, от старых к новым
+    std::vector<Entry> Tail(const std::string& channel, size_t count) const;
+
+private:
+    std::string _dir;
+    std::vector<std::string> _segments;
+    std::vector<std::string> _names[LogKinds];
+    std::unordered_map<std::string, uint32_t> _ids[LogKinds];
+};
+
+// Разбор отображённого сегмента с номером sequence, начиная со смещения from
+// (0 - с первой записи); общий для читателя и восстановления после сбоя.
+// Возвращает смещение за последней пройденной целой записью.
+size_t scanSegment(const char* data, size_t size, uint32_t sequence, size_t from,
+                   const ChannelLogReader::Visitor& visitor);
+
+#endif
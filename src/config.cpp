@@ -0,0 +1,461 @@
+#include <iostream>
+#include <filesystem>
+#include <exception>
+#include <algorithm>
+#include <signal.h>
+
+#include "cpptoml.h" // Подключение библиотеки cpptoml
+#include "config.h"
+#include "ircbot.h"
+#include "memtrack.h"
+
+// Функция для парсинга TOML-файла
+IRCConfig parseTomlFile(const std::string& filename) {
+    MemScope scope(MemConfig);
+    IRCConfig config;
+
+    try {
+        // Загрузка TOML-файла
+        auto table = cpptoml::parse_file(filename);
+
+        // Секция [ircServer]
+        const auto& ircServer = table->get_table("ircServer");
+        config.serverconf.bothostname = *ircServer->get_as<std::string>("ircServerHost");
+        config.serverconf.bothostport = *ircServer->get_as<int>("ircServerPort");
+        config.serverconf.bothostpass = *ircServer->get_as<std::string>("ircServerPass");
+        config.serverconf.usetls = ircServer->get_as<bool>("ircServerTls").value_or(false);
+        config.serverconf.tlsverify = ircServer->get_as<bool>("ircTlsVerify").value_or(true);
+        config.serverconf.tlscert = ircServer->get_as<std::string>("ircTlsCert").value_or("");
+        config.serverconf.tlskey = ircServer->get_as<std::string>("ircTlsKey").value_or("");
+
+        // Секция [ircClient]
+        const auto& ircClient = table->get_table("ircClient");
+        config.clientconf.username = *ircClient->get_as<std::string>("ircBotUser");
+        config.clientconf.nickname = *ircClient->get_as<std::string>("ircBotNick");
+        config.clientconf.realname = *ircClient->get_as<std::string>("ircBotRnam");
+        config.clientconf.nspasswd = *ircClient->get_as<std::string>("ircBotNspw");
+        config.clientconf.botschan = *ircClient->get_as<std::string>("ircBotChan");
+        config.clientconf.adminick = *ircClient->get_as<std::string>("ircBotAdmi");
+        config.clientconf.runatcon = *ircClient->get_as<std::string>("ircBotRcon");
+        config.clientconf.xdccvers = *ircClient->get_as<std::string>("ircBotDccv");
+        config.clientconf.connect_runbot = *ircClient->get_as<bool>("ircBotAcon");
+        config.clientconf.saslmech = ircClient->get_as<std::string>("ircBotSasl").value_or("");
+        std::transform(config.clientconf.saslmech.begin(), config.clientconf.saslmech.end(),
+                       config.clientconf.saslmech.begin(), ::toupper);
+        if (!config.clientconf.saslmech.empty() && config.clientconf.saslmech != "EXTERNAL" && config.clientconf.saslmech != "PLAIN") {
+            throw std::runtime_error("ircBotSasl must be empty, PLAIN or EXTERNAL.");
+        }
+        if (config.clientconf.saslmech == "PLAIN" && config.clientconf.nspasswd.empty()) {
+            throw std::runtime_error("SASL PLAIN requires ircBotNspw.");
+        }
+        config.clientconf.saslacct = ircClient->get_as<std::string>("ircBotAcct").value_or("");
+        auto altnicks = ircClient->get_array_of<std::string>("ircBotAnik");
+        if (altnicks) {
+            config.clientconf.altnicks = *altnicks;
+        }
+        if (config.clientconf.saslmech == "EXTERNAL" && config.serverconf.tlscert.empty()) {
+            throw std::runtime_error("SASL EXTERNAL requires ircServerTls and ircTlsCert.");
+        }
+
+        // Командный символ читается как строка длиной в один символ
+        std::string commandSymbolStr = *ircClient->get_as<std::string>("ircBotCsym");
+        if (commandSymbolStr.length() == 1) {
+            config.clientconf.command_symbol = commandSymbolStr[0];
+        } else {
+            throw std::runtime_error("ircBotCsym must be a single character.");
+        }
+
+        // Секция [botComset] - параметры дополнительных команд бота
+        auto botComset = table->get_table("botComset");
+
+        if (botComset)
+        {
+            auto ipinftkn = botComset->get_as<std::string>("ipInfToken");
+            if (ipinftkn)
+            {
+                config.featureconf.ipinftkn = *ipinftkn;
+            }
+            else
+            {
+                std::cerr << "[botComset] exists, but 'ipInfToken' is missing or not a string." << std::endl;
+                // Обработка ошибки или установка значения по умолчанию
+            }
+        }
+        else
+        {
+            std::cerr << "[botComset] section is missing in the TOML file." << std::endl;
+            // Здесь можно использовать значения по умолчанию или завершить программу
+        }
+
+        // Секция [botLimits] - ограничение частоты команд (необязательная)
+        auto botLimits = table->get_table("botLimits");
+
+        if (botLimits)
+        {
+            config.limitconf.userrate = botLimits->get_as<unsigned>("userCmdRate").value_or(config.limitconf.userrate);
+            config.limitconf.userper = botLimits->get_as<unsigned>("userCmdPer").value_or(config.limitconf.userper);
+            config.limitconf.chanrate = botLimits->get_as<unsigned>("chanCmdRate").value_or(config.limitconf.chanrate);
+            config.limitconf.chanper = botLimits->get_as<unsigned>("chanCmdPer").value_or(config.limitconf.chanper);
+            config.limitconf.maxkeys = botLimits->get_as<unsigned>("limitKeys").value_or(config.limitconf.maxkeys);
+            config.limitconf.notify = botLimits->get_as<bool>("limitNote").value_or(config.limitconf.notify);
+        }
+
+        // Секция [botTimers] - таймеры соединения (необязательная)
+        auto botTimers = table->get_table("botTimers");
+
+        if (botTimers)
+        {
+            config.timerconf.pingevery = botTimers->get_as<unsigned>("pingEvery").value_or(config.timerconf.pingevery);
+            config.timerconf.pinglimit = botTimers->get_as<unsigned>("pingLimit").value_or(config.timerconf.pinglimit);
+            config.timerconf.connlimit = botTimers->get_as<unsigned>("connLimit").value_or(config.timerconf.connlimit);
+            config.timerconf.backoffmin = botTimers->get_as<unsigned>("backoffMin").value_or(config.timerconf.backoffmin);
+            config.timerconf.backoffmax = botTimers->get_as<unsigned>("backoffMax").value_or(config.timerconf.backoffmax);
+            config.timerconf.laglimit = botTimers->get_as<unsigned>("lagLimit").value_or(config.timerconf.laglimit);
+            config.timerconf.sendpace = botTimers->get_as<unsigned>("sendPace").value_or(config.timerconf.sendpace);
+            config.timerconf.sendpacemax = botTimers->get_as<unsigned>("sendPaceMax").value_or(config.timerconf.sendpacemax);
+        }
+
+        // Секция [botLog] - журнал каналов (необязательная)
+        auto botLog = table->get_table("botLog");
+
+        if (botLog)
+        {
+            config.logconf.enabled = botLog->get_as<bool>("logEnable").value_or(config.logconf.enabled);
+            config.logconf.dir = botLog->get_as<std::string>("logDir").value_or(config.logconf.dir);
+            config.logconf.segmentmb = botLog->get_as<unsigned>("logSegMb").value_or(config.logconf.segmentmb);
+            config.logconf.search = botLog->get_as<bool>("logSearch").value_or(config.logconf.search);
+        }
+
+        // Секция [botSeen] - база команды seen (необязательная)
+        auto botSeen = table->get_table("botSeen");
+
+        if (botSeen)
+        {
+            config.seenconf.enabled = botSeen->get_as<bool>("seenEnable").value_or(config.seenconf.enabled);
+            config.seenconf.file = botSeen->get_as<std::string>("seenFile").value_or(config.seenconf.file);
+            config.seenconf.maxnicks = botSeen->get_as<unsigned>("seenMax").value_or(config.seenconf.maxnicks);
+        }
+
+        // Секция [botLast] - история каналов для команды last (необязательная)
+        auto botLast = table->get_table("botLast");
+
+        if (botLast)
+        {
+            config.lastconf.enabled = botLast->get_as<bool>("lastEnable").value_or(config.lastconf.enabled);
+            config.lastconf.budgetkb = botLast->get_as<unsigned>("lastBudgetKb").value_or(config.lastconf.budgetkb);
+            config.lastconf.blockkb = botLast->get_as<unsigned>("lastBlockKb").value_or(config.lastconf.blockkb);
+            config.lastconf.lines = botLast->get_as<unsigned>("lastLines").value_or(config.lastconf.lines);
+            config.lastconf.maxreply = botLast->get_as<unsigned>("lastMax").value_or(config.lastconf.maxreply);
+        }
+
+        // Секция [botState] - снимок состояния для перезапуска (необязательная)
+        auto botState = table->get_table("botState");
+
+        if (botState)
+        {
+            config.stateconf.enabled = botState->get_as<bool>("stateEnable").value_or(config.stateconf.enabled);
+            config.stateconf.file = botState->get_as<std::string>("stateFile").value_or(config.stateconf.file);
+            config.stateconf.every = botState->get_as<unsigned>("stateEvery").value_or(config.stateconf.every);
+        }
+
+        // Секция [botDrift] - контроль медленного роста ресурсов (необязательная)
+        auto botDrift = table->get_table("botDrift");
+
+        if (botDrift)
+        {
+            config.driftconf.enabled = botDrift->get_as<bool>("driftEnable").value_or(config.driftconf.enabled);
+            config.driftconf.every = botDrift->get_as<unsigned>("driftEvery").value_or(config.driftconf.every);
+            config.driftconf.window = botDrift->get_as<unsigned>("driftWindow").value_or(config.driftconf.window);
+            config.driftconf.warmup = botDrift->get_as<unsigned>("driftWarmup").value_or(config.driftconf.warmup);
+            config.driftconf.rss = botDrift->get_as<unsigned>("driftRssKb").value_or(config.driftconf.rss);
+            config.driftconf.fds = botDrift->get_as<unsigned>("driftFds").value_or(config.driftconf.fds);
+            config.driftconf.queue = botDrift->get_as<unsigned>("driftQueue").value_or(config.driftconf.queue);
+            config.driftconf.latency = botDrift->get_as<unsigned>("driftLatencyUs").value_or(config.driftconf.latency);
+            config.driftconf.exit = botDrift->get_as<bool>("driftExit").value_or(config.driftconf.exit);
+            if (config.driftconf.every == 0 || config.driftconf.window < 3) {
+                throw std::runtime_error("driftEvery must be positive and driftWindow at least 3.");
+            }
+        }
+
+        // Секция [botBouncer] - подключения IRC-клиентов через бота (необязательная)
+        auto botBouncer = table->get_table("botBouncer");
+
+        if (botBouncer)
+        {
+            config.bncconf.enabled = botBouncer->get_as<bool>("bncEnable").value_or(config.bncconf.enabled);
+            config.bncconf.host = botBouncer->get_as<std::string>("bncHost").value_or(config.bncconf.host);
+            config.bncconf.port = botBouncer->get_as<int>("bncPort").value_or(config.bncconf.port);
+            config.bncconf.password = botBouncer->get_as<std::string>("bncPass").value_or(config.bncconf.password);
+            config.bncconf.backlog = botBouncer->get_as<unsigned>("bncBacklog").value_or(config.bncconf.backlog);
+            config.bncconf.clients = botBouncer->get_as<unsigned>("bncClients").value_or(config.bncconf.clients);
+        }
+
+        // Секция [botDcc] - передача файлов и чат по DCC (необязательная)
+        auto botDcc = table->get_table("botDcc");
+
+        if (botDcc)
+        {
+            config.dccconf.enabled = botDcc->get_as<bool>("dccEnable").value_or(config.dccconf.enabled);
+            config.dccconf.dir = botDcc->get_as<std::string>("dccDir").value_or(config.dccconf.dir);
+            config.dccconf.address = botDcc->get_as<std::string>("dccAddress").value_or(config.dccconf.address);
+            config.dccconf.portmin = botDcc->get_as<int>("dccPortMin").value_or(config.dccconf.portmin);
+            config.dccconf.portmax = botDcc->get_as<int>("dccPortMax").value_or(config.dccconf.portmax);
+            config.dccconf.slots = botDcc->get_as<unsigned>("dccSlots").value_or(config.dccconf.slots);
+            config.dccconf.ratekb = botDcc->get_as<unsigned>("dccRateKb").value_or(config.dccconf.ratekb);
+            config.dccconf.chats = botDcc->get_as<unsigned>("dccChats").value_or(config.dccconf.chats);
+            config.dccconf.timeout = botDcc->get_as<unsigned>("dccTimeout").value_or(config.dccconf.timeout);
+
+            if (config.dccconf.portmin < 0 || config.dccconf.portmax > 65535
+                || (config.dccconf.portmin > 0 && config.dccconf.portmax < config.dccconf.portmin)) {
+                throw std::runtime_error("dccPortMin..dccPortMax is not a valid port range.");
+            }
+            if (config.dccconf.timeout == 0) {
+                throw std::runtime_error("dccTimeout must be positive.");
+            }
+        }
+
+        // Секция [botRelay] - мост каналов между сетями (необязательная)
+        auto botRelay = table->get_table("botRelay");
+
+        if (botRelay)
+        {
+            config.relayconf.name = botRelay->get_as<std::string>("relayName").value_or(config.relayconf.name);
+            config.relayconf.rate = botRelay->get_as<unsigned>("relayRate").value_or(config.relayconf.rate);
+            config.relayconf.per = botRelay->get_as<unsigned>("relayPer").value_or(config.relayconf.per);
+            config.relayconf.joins = botRelay->get_as<bool>("relayJoins").value_or(config.relayconf.joins);
+
+            // "#канал > сеть/#канал"
+            for (const std::string& spec : botRelay->get_array_of<std::string>("relayLinks").value_or(std::vector<std::string>()))
+            {
+                size_t arrow = spec.find('>');
+                size_t slash = spec.find('/', arrow);
+                if (arrow == std::string::npos || slash == std::string::npos) {
+                    throw std::runtime_error("relayLinks entry \"" + spec + "\" must look like \"#chan > network/#chan\".");
+                }
+                auto trim = [](std::string value) {
+                    value.erase(0, value.find_first_not_of(' '));
+                    value.erase(value.find_last_not_of(' ') + 1);
+                    return value;
+                };
+                IRCConfig::Relay::Link link;
+                link.channel = trim(spec.substr(0, arrow));
+                link.network = trim(spec.substr(arrow + 1, slash - arrow - 1));
+                link.target = trim(spec.substr(slash + 1));
+                if (link.channel.empty() || link.network.empty() || link.target.empty()) {
+                    throw std::runtime_error("relayLinks entry \"" + spec + "\" has an empty part.");
+                }
+                config.relayconf.links.push_back(link);
+            }
+        }
+
+        // Секция [botAcl] - маски доступа (необязательная)
+        auto botAcl = table->get_table("botAcl");
+
+        if (botAcl)
+        {
+            config.aclconf.admins = botAcl->get_array_of<std::string>("aclAdmin").value_or(config.aclconf.admins);
+            config.aclconf.ignores = botAcl->get_array_of<std::string>("aclIgnore").value_or(config.aclconf.ignores);
+            config.aclconf.file = botAcl->get_as<std::string>("aclFile").value_or(config.aclconf.file);
+        }
+
+        // Массив таблиц [[botTrigger]] - реакции на слова в канале (необязательный)
+        auto botTriggers = table->get_table_array("botTrigger");
+
+        if (botTriggers)
+        {
+            for (const auto& botTrigger : *botTriggers)
+            {
+                IRCConfig::Trigger trigger;
+                trigger.match = botTrigger->get_as<std::string>("match").value_or("");
+                trigger.reply = botTrigger->get_as<std::string>("reply").value_or("");
+                trigger.action = botTrigger->get_as<std::string>("action").value_or(trigger.action);
+                trigger.word = botTrigger->get_as<bool>("word").value_or(trigger.word);
+                if (trigger.match.empty()) {
+                    throw std::runtime_error("botTrigger requires a non-empty match.");
+                }
+                if (trigger.action != "reply" && trigger.action != "notice" && trigger.action != "log") {
+                    throw std::runtime_error("botTrigger action must be reply, notice or log.");
+                }
+                config.triggers.push_back(trigger);
+            }
+        }
+
+    } catch (const cpptoml::parse_exception& e) {
+        std::cerr << "TOML parsing error: " << e.what() << "\n";
+        throw;
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing TOML file: " << e.what() << "\n";
+        throw;
+    }
+
+    config.filename = filename;
+    if (config.relayconf.name.empty())
+        config.relayconf.name = std::filesystem::path(filename).stem().string();
+
+    return config;
+}
+
+// Функция для вывода конфигурации
+void printConfig(const IRCConfig& config) {
+    std::cout << "IRC Server Configuration:\n";
+    std::cout << "Host: " << config.serverconf.bothostname << "\n";
+    std::cout << "Port: " << config.serverconf.bothostport << "\n";
+    std::cout << "Password: " << config.serverconf.bothostpass << "\n";
+    std::cout << "TLS: " << (config.serverconf.usetls ? "true" : "false")
+              << (config.serverconf.usetls && !config.serverconf.tlsverify ? " (no verify)" : "") << "\n";
+    if (!config.serverconf.tlscert.empty())
+        std::cout << "Client certificate: " << config.serverconf.tlscert << "\n";
+    std::cout << "\n";
+
+    std::cout << "IRC Client Configuration:\n";
+    std::cout << "Username: " << config.clientconf.username << "\n";
+    std::cout << "Nickname: " << config.clientconf.nickname << "\n";
+    std::cout << "Realname: " << config.clientconf.realname << "\n";
+    std::cout << "NickServ Password: " << config.clientconf.nspasswd << "\n";
+    std::cout << "On IRC connect run: " << config.clientconf.runatcon << "\n";
+    std::cout << "Channel: " << config.clientconf.botschan << "\n";
+    std::cout << "Admin Nick: " << config.clientconf.adminick << "\n";
+    std::cout << "CTCP version: " << config.clientconf.xdccvers << "\n";
+    std::cout << "Auto Connect: " << (config.clientconf.connect_runbot ? "true" : "false") << "\n";
+    std::cout << "Command Symbol: '" << config.clientconf.command_symbol << "'\n";
+    std::cout << "SASL: " << (config.clientconf.saslmech.empty() ? "none" : config.clientconf.saslmech) << "\n";
+    std::cout << "Alternate nicks:";
+    for (const std::string& nick : config.clientconf.altnicks)
+        std::cout << " " << nick;
+    std::cout << "\n";
+
+    std::cout << "Bot features:\n";
+    std::cout << "IP info token: " << config.featureconf.ipinftkn << "\n";
+    std::cout << "User command limit: " << config.limitconf.userrate << "/" << config.limitconf.userper << "s\n";
+    std::cout << "Channel command limit: " << config.limitconf.chanrate << "/" << config.limitconf.chanper << "s\n";
+    std::cout << "Ping every/timeout: " << config.timerconf.pingevery << "s/" << config.timerconf.pinglimit << "s\n";
+    std::cout << "Connect timeout: " << config.timerconf.connlimit << "s\n";
+    std::cout << "Reconnect backoff: " << config.timerconf.backoffmin << "-" << config.timerconf.backoffmax << "s\n";
+    std::cout << "Lag limit: " << config.timerconf.laglimit << "s\n";
+    std::cout << "Send pace: " << config.timerconf.sendpace << "-" << config.timerconf.sendpacemax << "ms\n";
+    std::cout << "Channel log: " << (config.logconf.enabled ? config.logconf.dir : "off");
+    if (config.logconf.enabled)
+        std::cout << " (" << config.logconf.segmentmb << " MB segments" << (config.logconf.search ? ", indexed" : "") << ")";
+    std::cout << "\n";
+    std::cout << "Seen database: " << (config.seenconf.enabled ? config.seenconf.file : "off");
+    if (config.seenconf.enabled)
+        std::cout << " (up to " << config.seenconf.maxnicks << " nicks)";
+    std::cout << "\n";
+    std::cout << "Channel backlog: ";
+    if (config.lastconf.enabled)
+        std::cout << config.lastconf.lines << " lines per channel, " << config.lastconf.budgetkb << " KB total";
+    else
+        std::cout << "off";
+    std::cout << "\n";
+    std::cout << "State snapshot: " << (config.stateconf.enabled ? config.stateconf.file : "off");
+    if (config.stateconf.enabled)
+        std::cout << " (every " << config.stateconf.every << "s)";
+    std::cout << "\n";
+    std::cout << "Drift monitor: ";
+    if (config.driftconf.enabled)
+        std::cout << config.driftconf.window << " samples every " << config.driftconf.every << "s after "
+                  << config.driftconf.warmup << "s warmup, limits/h: RSS "
+                  << config.driftconf.rss << " KB, fds " << config.driftconf.fds << ", queue " << config.driftconf.queue
+                  << ", p99 " << config.driftconf.latency << " us" << (config.driftconf.exit ? ", exit on drift" : "");
+    else
+        std::cout << "off";
+    std::cout << "\n";
+    std::cout << "Bouncer: ";
+    if (config.bncconf.enabled)
+        std::cout << config.bncconf.host << ":" << config.bncconf.port << " (" << config.bncconf.backlog
+                  << " lines per channel, up to " << config.bncconf.clients << " clients"
+                  << (config.bncconf.password.empty() ? ", no password" : "") << ")";
+    else
+        std::cout << "off";
+    std::cout << "\n";
+    std::cout << "DCC: ";
+    if (config.dccconf.enabled)
+    {
+        std::cout << "files from " << config.dccconf.dir << ", " << config.dccconf.slots << " slots, "
+                  << config.dccconf.chats << " chats, ports ";
+        if (config.dccconf.portmin > 0)
+            std::cout << config.dccconf.portmin << "-" << std::max(config.dccconf.portmax, config.dccconf.portmin);
+        else
+            std::cout << "any";
+        std::cout << ", " << (config.dccconf.ratekb ? std::to_string(config.dccconf.ratekb) + " KB/s per transfer" : "no rate limit")
+                  << ", address " << (config.dccconf.address.empty() ? "of the server connection" : config.dccconf.address);
+    }
+    else
+        std::cout << "off";
+    std::cout << "\n";
+    std::cout << "Relay links:";
+    for (const IRCConfig::Relay::Link& link : config.relayconf.links)
+        std::cout << " " << link.channel << ">" << link.network << "/" << link.target;
+    if (!config.relayconf.links.empty())
+        std::cout << " (" << config.relayconf.rate << " lines per " << config.relayconf.per << "s each)";
+    std::cout << "\n";
+    std::cout << "Admin masks:";
+    for (const std::string& mask : config.aclconf.admins)
+        std::cout << " " << mask;
+    std::cout << "\n";
+    std::cout << "Ignore masks: " << config.aclconf.ignores.size();
+    if (!config.aclconf.file.empty())
+        std::cout << " (+ " << config.aclconf.file << ")";
+    std::cout << "\n";
+    std::cout << "Triggers: " << config.triggers.size() << "\n";
+}
+
+bool needsReconnect(const IRCConfig& oldconf, const IRCConfig& newconf)
+{
+    return oldconf.serverconf.bothostname != newconf.serverconf.bothostname
+        || oldconf.serverconf.bothostport != newconf.serverconf.bothostport
+        || oldconf.serverconf.bothostpass != newconf.serverconf.bothostpass
+        || oldconf.serverconf.usetls != newconf.serverconf.usetls
+        || oldconf.serverconf.tlsverify != newconf.serverconf.tlsverify
+        || oldconf.serverconf.tlscert != newconf.serverconf.tlscert
+        || oldconf.serverconf.tlskey != newconf.serverconf.tlskey
+        || oldconf.clientconf.saslmech != newconf.clientconf.saslmech
+        || oldconf.clientconf.saslacct != newconf.clientconf.saslacct;
+}
+
+bool ConfigWatcher::Start(IRCBot* client)
+{
+    _client = client;
+
+    // SIGHUP принимается только через sigwait() в потоке наблюдателя
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+        return false;
+
+    return _thread.Start(&watchThread, this);
+}
+
+ThreadReturn ConfigWatcher::watchThread(void* param)
+{
+    ConfigWatcher* watcher = (ConfigWatcher*)param;
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+
+    while (true)
+    {
+        int sig;
+        if (sigwait(&set, &sig) != 0)
+            continue;
+
+        std::shared_ptr<const IRCConfig> current = watcher->_client->Config();
+        std::cout << "[*] SIGHUP received, reloading " << current->filename << std::endl;
+
+        try {
+            // Разбор идёт целиком в этом потоке, цикл приёма не блокируется;
+            // при ошибке остаётся действующая конфигурация
+            auto fresh = std::make_shared<const IRCConfig>(parseTomlFile(current->filename));
+            IRCBot* client = watcher->_client;
+            // Применение (NICK, JOIN, переподключение) - в потоке цикла
+            client->Post([client, fresh] { client->SetConfig(fresh); });
+            std::cout << "[+] Configuration reloaded." << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Config reload failed, keeping previous configuration: " << e.what() << "\n";
+        }
+    }
+
+    return NULL;
+}
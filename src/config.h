@@ -0,0 +1,190 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "thread.h"
+
+class IRCBot;
+
+struct IRCConfig {
+    struct Server {
+        std::string bothostname;    // Bot host name
+        int bothostport;            // Bot host port
+        std::string bothostpass;    // Bot host pass
+        bool usetls = false;        // TLS connection
+        bool tlsverify = true;      // Verify server certificate
+        std::string tlscert;        // Client certificate (CertFP, SASL EXTERNAL)
+        std::string tlskey;         // Client certificate key
+    } serverconf;
+
+    struct Client {
+        std::string username;   // Bot usernane
+        std::string nickname;   // Bot nickname
+        std::string realname;   // Bot realname
+        std::string nspasswd;   // NickServ password
+        std::string botschan;   // Bot channel
+        std::string adminick;   // Bot admin nick
+        std::string runatcon;   // Any command sent upon connection
+        std::string xdccvers;
+        bool connect_runbot;    // Connect at launch
+        char command_symbol;    // Bot command symbol
+        std::string saslmech;   // SASL mechanism ("" - no SASL)
+        std::string saslacct;   // SASL PLAIN account ("" - nickname)
+        std::vector<std::string> altnicks;  // Nicks to try on 433
+    } clientconf;
+
+    struct Feature
+    {
+        std::string ipinftkn;
+    } featureconf;
+
+    struct Limits
+    {
+        unsigned userrate = 5;      // Команд от одного nick!user@host...
+        unsigned userper = 10;      // ...за столько секунд
+        unsigned chanrate = 10;     // Команд в одном канале...
+        unsigned chanper = 10;      // ...за столько секунд
+        unsigned maxkeys = 4096;    // Максимум отслеживаемых ключей
+        bool notify = true;         // Сообщать пользователю о превышении
+    } limitconf;
+
+    struct Timers
+    {
+        unsigned pingevery = 60;    // Интервал собственных PING серверу, с (0 - не слать)
+        unsigned pinglimit = 180;   // Разрыв, если сервер молчит дольше, с
+        unsigned connlimit = 15;    // Таймаут разрешения имени и подключения, с
+        unsigned backoffmin = 5;    // Первая пауза перед переподключением, с
+        unsigned backoffmax = 300;  // Максимальная пауза между попытками, с
+        unsigned laglimit = 30;     // Переподключение при устойчивой задержке выше, с (0 - нет)
+        unsigned sendpace = 500;    // Базовая пауза между ответами бота, мс
+        unsigned sendpacemax = 3000;// Предел паузы при большой задержке, мс
+    } timerconf;
+
+    struct Log
+    {
+        bool enabled = false;       // Писать журнал каналов и привата
+        std::string dir = "logs";   // Каталог сегментов журнала
+        unsigned segmentmb = 64;    // Размер сегмента, МБ
+        bool search = true;         // Поисковый индекс по журналу (команда grep)
+    } logconf;
+
+    struct Seen
+    {
+        bool enabled = true;        // Запоминать, кого и когда видел бот
+        std::string file = "seen.db";   // Файл базы
+        unsigned maxnicks = 1000000;    // Предел ников; дальше вытесняются самые старые
+    } seenconf;
+
+    struct Last
+    {
+        bool enabled = true;        // Держать в памяти недавние сообщения каналов
+        unsigned budgetkb = 4096;   // Общий бюджет на все каналы, КБ
+        unsigned blockkb = 16;      // Размер блока до сжатия, КБ
+        unsigned lines = 1000;      // Строк на канал
+        unsigned maxreply = 30;     // Больше строк команда last не отдаёт
+    } lastconf;
+
+    struct State
+    {
+        bool enabled = true;        // Сохранять состояние для быстрого перезапуска
+        std::string file = "state.db";  // Файл снимка
+        unsigned every = 300;       // Период сохранения, с (и всегда при выходе)
+    } stateconf;
+
+    struct Drift
+    {
+        bool enabled = false;       // Следить за ростом RSS, дескрипторов, очередей и задержки команд
+        unsigned every = 60;        // Период замера, с
+        unsigned window = 60;       // Замеров в окне, по которому считается наклон
+        unsigned warmup = 600;      // Сколько секунд после запуска не замерять (кэши, история, база seen)
+        unsigned rss = 1024;        // Порог роста анонимного RSS, КБ в час
+        unsigned fds = 2;           // Порог роста числа дескрипторов, в час
+        unsigned queue = 20;        // Порог роста очередей отправки, строк в час
+        unsigned latency = 1000;    // Порог роста p99 задержки команд, мкс в час
+        bool exit = false;          // Завершиться с кодом 3 при превышении
+    } driftconf;
+
+    struct Bouncer
+    {
+        bool enabled = false;       // Принимать подключения IRC-клиентов
+        std::string host = "127.0.0.1"; // Адрес для клиентов
+        int port = 6690;            // Порт для клиентов
+        std::string password;       // PASS клиентов ("" - без пароля)
+        unsigned backlog = 100;     // Строк истории на канал, отдаются при подключении
+        unsigned clients = 256;     // Предел одновременно подключённых клиентов
+    } bncconf;
+
+    struct Dcc
+    {
+        bool enabled = false;       // Отдавать файлы по DCC SEND и принимать DCC CHAT
+        std::string dir = "files";  // Каталог с файлами (только верхний уровень)
+        std::string address;        // Адрес в предложениях ("" - локальный адрес соединения с сервером)
+        int portmin = 0;            // Порты для входящих подключений (0 - любой свободный)
+        int portmax = 0;
+        unsigned slots = 4;         // Одновременных передач, включая ещё не принятые
+        unsigned ratekb = 0;        // Предел скорости одной передачи, КБ/с (0 - без предела)
+        unsigned chats = 4;         // Одновременных DCC CHAT
+        unsigned timeout = 60;      // Секунд ждать подключения и терпеть простой передачи
+    } dccconf;
+
+    struct Relay
+    {
+        struct Link
+        {
+            std::string channel;    // Канал этой сети
+            std::string network;    // Сеть получателя (её relayName)
+            std::string target;     // Канал получателя
+        };
+        std::string name;           // Имя этой сети в ссылках ("" - имя файла конфигурации)
+        std::vector<Link> links;    // Откуда и куда пересылать
+        unsigned rate = 20;         // Строк в одну ссылку...
+        unsigned per = 30;          // ...за столько секунд, сверх - отбрасываются
+        bool joins = true;          // Пересылать JOIN и PART, не только сообщения
+    } relayconf;
+
+    struct Acl
+    {
+        std::vector<std::string> admins;    // Маски nick!user@host администраторов
+        std::vector<std::string> ignores;   // Маски, которым бот не отвечает
+        std::string file;           // Дополнительный файл масок ("" - нет)
+    } aclconf;
+
+    struct Trigger
+    {
+        std::string match;          // Слово или фраза, без учёта регистра
+        std::string reply;          // Текст ответа: $nick, $chan, $match, $word
+        std::string action = "reply";   // reply - в канал, notice - автору, log - только в консоль
+        bool word = false;          // Только целым словом
+
+        bool operator==(const Trigger&) const = default;
+    };
+    std::vector<Trigger> triggers;  // Таблицы [[botTrigger]]
+
+    std::string filename;       // Файл, из которого прочитана конфигурация
+};
+
+IRCConfig parseTomlFile(const std::string& filename);
+void printConfig(const IRCConfig& config);
+
+// true, если смена конфигурации требует переподключения к серверу
+bool needsReconnect(const IRCConfig& oldconf, const IRCConfig& newconf);
+
+// Фоновый поток, перечитывающий конфигурацию по SIGHUP.
+// Start() блокирует SIGHUP в вызывающем потоке, поэтому его нужно вызывать
+// до запуска остальных потоков, чтобы они унаследовали маску сигналов.
+class ConfigWatcher
+{
+public:
+    bool Start(IRCBot* client);
+
+private:
+    static ThreadReturn watchThread(void* param);
+
+    Thread _thread;
+    IRCBot* _client;
+};
+
+#endif
@@ -0,0 +1,967 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "dcc.h"
+#include "ircbot.h"
+#include "casemap.h"
+#include "memtrack.h"
+
+// Аргументы CTCP DCC; имя файла с пробелами приходит в кавычках
+static std::vector<std::string> splitDcc(std::string_view text)
+{
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while (i < text.size())
+    {
+        if (text[i] == ' ')
+        {
+            ++i;
+            continue;
+        }
+        size_t end;
+        if (text[i] == '"')
+        {
+            end = std::min(text.find('"', i + 1), text.size());
+            tokens.emplace_back(text.substr(i + 1, end - i - 1));
+            ++end;
+        }
+        else
+        {
+            end = std::min(text.find(' ', i), text.size());
+            tokens.emplace_back(text.substr(i, end - i));
+        }
+        i = end;
+    }
+    return tokens;
+}
+
+static std::string quoteDcc(const std::string& name)
+{
+    return name.find(' ') == std::string::npos ? name : "\"" + name + "\"";
+}
+
+// Только файлы верхнего уровня каталога: без путей, скрытых файлов и кавычек
+static bool validName(const std::string& name)
+{
+    if (name.empty() || name[0] == '.')
+        return false;
+    for (char c : name)
+    {
+        if (c == '/' || c == '"' || (unsigned char)c < 0x20)
+            return false;
+    }
+    return true;
+}
+
+static std::string formatSize(uint64_t bytes)
+{
+    if (bytes >= (10ull << 20))
+        return std::to_string(bytes >> 20) + " MB";
+    if (bytes >= (10ull << 10))
+        return std::to_string(bytes >> 10) + " KB";
+    return std::to_string(bytes) + " bytes";
+}
+
+// Запас корзины: 100 мс на пределе скорости, но не меньше 4 КБ
+static double burstOf(double rate)
+{
+    return std::max(rate / 10, 4096.0);
+}
+
+DccServer::DccServer() : _bot(nullptr), _nextId(0), _nextPort(0)
+{
+}
+
+DccServer::~DccServer()
+{
+    Close();
+}
+
+void DccServer::Open(IRCBot* bot)
+{
+    Close();
+    _bot = bot;
+}
+
+void DccServer::Close()
+{
+    if (!_bot)
+        return;
+
+    while (!_transfers.empty())
+        Finish(_transfers.begin()->first, "bot is shutting down");
+    while (!_chats.empty())
+        DropChat(_chats.begin()->first, "Bot is shutting down");
+
+    std::cout << "[*] DCC: " << _stats.files << " of " << _stats.offers << " files sent (" << _stats.resumed
+              << " resumed, " << _stats.failed << " failed), " << _stats.bytes << " bytes in " << _stats.calls
+              << " sendfile calls, " << _stats.chats << " chats" << std::endl;
+    _bot = nullptr;
+}
+
+bool DccServer::Resolve(sockaddr_storage* address, std::string* text)
+{
+    memset(address, 0, sizeof(*address));
+    const std::string configured = _bot->Config()->dccconf.address;
+    if (!configured.empty())
+    {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* result = nullptr;
+        int error = getaddrinfo(configured.c_str(), nullptr, &hints, &result);
+        if (error != 0)
+        {
+            std::cout << "[!] DCC: cannot resolve " << configured << ": " << gai_strerror(error) << std::endl;
+            return false;
+        }
+        memcpy(address, result->ai_addr, result->ai_addrlen);
+        freeaddrinfo(result);
+    }
+    else
+    {
+        // Без dccAddress - адрес, с которого бот подключён к серверу (за NAT не годится)
+        socklen_t length = sizeof(*address);
+        if (!_bot->Connected() || getsockname(_bot->SocketFd(), (struct sockaddr*)address, &length) != 0)
+            return false;
+    }
+
+    if (address->ss_family == AF_INET6)
+    {
+        // IPv4 через сокет IPv6 предлагается как обычный IPv4
+        struct sockaddr_in6* v6 = (struct sockaddr_in6*)address;
+        if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr))
+        {
+            struct sockaddr_in v4;
+            memset(&v4, 0, sizeof(v4));
+            v4.sin_family = AF_INET;
+            memcpy(&v4.sin_addr, &v6->sin6_addr.s6_addr[12], 4);
+            memset(address, 0, sizeof(*address));
+            memcpy(address, &v4, sizeof(v4));
+        }
+    }
+
+    // В DCC адрес IPv4 - десятичное 32-битное число, IPv6 - обычная запись
+    if (address->ss_family == AF_INET)
+        *text = std::to_string(ntohl(((struct sockaddr_in*)address)->sin_addr.s_addr));
+    else if (address->ss_family == AF_INET6)
+    {
+        char buffer[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &((struct sockaddr_in6*)address)->sin6_addr, buffer, sizeof(buffer));
+        *text = buffer;
+    }
+    else
+        return false;
+    return true;
+}
+
+int DccServer::Listen(const sockaddr_storage& address, uint16_t* port)
+{
+    std::shared_ptr<const IRCConfig> conf = _bot->Config();
+    int first = conf->dccconf.portmin, last = conf->dccconf.portmax;
+    if (first <= 0)
+        first = last = 0;       // любой свободный порт
+    last = std::max(last, first);
+    if (_nextPort < first || _nextPort > last)
+        _nextPort = first;
+
+    for (int attempt = 0; attempt <= last - first; ++attempt)
+    {
+        int candidate = _nextPort;
+        _nextPort = _nextPort >= last ? first : _nextPort + 1;
+
+        int fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            break;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        // Слушаем на всех адресах: предлагаемый может быть внешним адресом NAT
+        sockaddr_storage local;
+        memset(&local, 0, sizeof(local));
+        socklen_t length;
+        if (address.ss_family == AF_INET)
+        {
+            struct sockaddr_in* in = (struct sockaddr_in*)&local;
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(INADDR_ANY);
+            in->sin_port = htons(candidate);
+            length = sizeof(*in);
+        }
+        else
+        {
+            struct sockaddr_in6* in = (struct sockaddr_in6*)&local;
+            in->sin6_family = AF_INET6;
+            in->sin6_addr = in6addr_any;
+            in->sin6_port = htons(candidate);
+            length = sizeof(*in);
+        }
+
+        if (bind(fd, (struct sockaddr*)&local, length) == 0 && listen(fd, 1) == 0
+            && getsockname(fd, (struct sockaddr*)&local, &length) == 0)
+        {
+            *port = ntohs(address.ss_family == AF_INET ? ((struct sockaddr_in*)&local)->sin_port
+                                                       : ((struct sockaddr_in6*)&local)->sin6_port);
+            return fd;
+        }
+        close(fd);
+    }
+
+    std::cout << "[!] DCC: no free port in " << first << "-" << last << std::endl;
+    return -1;
+}
+
+size_t DccServer::Busy(const std::string& nick, size_t* nickBusy) const
+{
+    std::string folded = foldNick(nick);
+    *nickBusy = 0;
+    for (const std::pair<const uint32_t, std::unique_ptr<Transfer>>& transfer : _transfers)
+    {
+        if (foldNick(transfer.second->nick) == folded)
+            ++*nickBusy;
+    }
+    return _transfers.size();
+}
+
+std::string DccServer::List() const
+{
+    std::string dir = _bot->Config()->dccconf.dir;
+    std::vector<std::pair<std::string, uint64_t>> files;
+    if (DIR* handle = opendir(dir.c_str()))
+    {
+        while (struct dirent* entry = readdir(handle))
+        {
+            struct stat info;
+            std::string name = entry->d_name;
+            if (validName(name) && stat((dir + "/" + name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+                files.emplace_back(name, info.st_size);
+        }
+        closedir(handle);
+    }
+    if (files.empty())
+        return "No files to share";
+
+    std::sort(files.begin(), files.end());
+    static const size_t MaxListed = 20;
+    std::string reply = "Files:";
+    for (size_t i = 0; i < files.size() && i < MaxListed; ++i)
+        reply += " " + files[i].first + " (" + formatSize(files[i].second) + "),";
+    reply.pop_back();
+    if (files.size() > MaxListed)
+        reply += " and " + std::to_string(files.size() - MaxListed) + " more";
+    return reply;
+}
+
+std::string DccServer::Offer(const IRCMessage& message, const std::string& name)
+{
+    MemScope scope(MemDcc);
+    std::shared_ptr<const IRCConfig> conf = _bot->Config();
+    std::string nick(message.prefix.nick);
+
+    size_t nickBusy;
+    if (Busy(nick, &nickBusy) >= conf->dccconf.slots)
+        return "All " + std::to_string(conf->dccconf.slots) + " DCC slots are busy, try again later";
+    if (nickBusy > 0)
+        return nick + ", you already have a DCC transfer";
+    if (!validName(name))
+        return "No such file: " + name;
+
+    int file = open((conf->dccconf.dir + "/" + name).c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    struct stat info;
+    if (file == -1 || fstat(file, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        if (file != -1)
+            close(file);
+        return "No such file: " + name;
+    }
+
+    sockaddr_storage address;
+    std::string host;
+    uint16_t port = 0;
+    int listen = -1;
+    if (!Resolve(&address, &host) || (listen = Listen(address, &port)) == -1)
+    {
+        close(file);
+        return "Cannot open a DCC port, try again later";
+    }
+
+    uint32_t id = ++_nextId;
+    std::unique_ptr<Transfer>& transfer = _transfers[id];
+    transfer.reset(new Transfer);
+    transfer->listen = listen;
+    transfer->file = file;
+    transfer->port = port;
+    transfer->nick = nick;
+    transfer->name = name;
+    transfer->size = info.st_size;
+    transfer->rate = conf->dccconf.ratekb * 1024.0;
+    _bot->WatchFd(listen, POLLIN, [this, id](short) { AcceptTransfer(id); });
+    transfer->expire = _bot->Timers().Schedule(int64_t(conf->dccconf.timeout) * 1000, [this, id] { Expire(id); });
+    ++_stats.offers;
+
+    _bot->SendIRC("PRIVMSG " + nick + " :\001DCC SEND " + quoteDcc(name) + " " + host + " " + std::to_string(port)
+                  + " " + std::to_string(transfer->size) + "\001");
+    std::cout << "[*] DCC: offered " << name << " (" << transfer->size << " bytes) to " << nick << " on port " << port << std::endl;
+    return "Sending " + name + " (" + formatSize(transfer->size) + ") to " + nick + " over DCC";
+}
+
+void DccServer::AcceptTransfer(uint32_t id)
+{
+    std::map<uint32_t, std::unique_ptr<Transfer>>::iterator itr = _transfers.find(id);
+    if (itr == _transfers.end())
+        return;
+    Transfer& transfer = *itr->second;
+
+    int fd = accept4(transfer.listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            Finish(id, "accept failed");
+        return;
+    }
+
+    // Порт предложения больше не нужен: одно подключение на предложение
+    _bot->UnwatchFd(transfer.listen);
+    close(transfer.listen);
+    transfer.listen = -1;
+    transfer.fd = fd;
+
+    // Чтение вперёд побольше: файл читается подряд, и не раз - разным получателям
+    posix_fadvise(transfer.file, transfer.position, 0, POSIX_FADV_SEQUENTIAL);
+
+    int64_t now = TimerWheel::Now();
+    transfer.accepted = transfer.progress = transfer.refilled = now;
+    transfer.tokens = burstOf(transfer.rate);
+    transfer.pollout = true;
+    _bot->WatchFd(fd, POLLIN | POLLOUT, [this, id](short revents) { OnTransfer(id, revents); });
+    std::cout << "[+] DCC: " << transfer.nick << " is receiving " << transfer.name
+              << (transfer.start ? " from " + std::to_string(transfer.start) : std::string()) << std::endl;
+}
+
+void DccServer::OnTransfer(uint32_t id, short revents)
+{
+    std::map<uint32_t, std::unique_ptr<Transfer>>::iterator itr = _transfers.find(id);
+    if (itr == _transfers.end())
+        return;
+    Transfer& transfer = *itr->second;
+
+    if (revents & (POLLIN | POLLERR | POLLHUP))
+    {
+        // Получатель подтверждает принятое 32-битными числами в сетевом порядке
+        unsigned char buffer[512];
+        ssize_t bytes = recv(transfer.fd, buffer, sizeof(buffer), 0);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            ;
+        else if (bytes <= 0)
+        {
+            Finish(id, transfer.position == transfer.size ? nullptr : "closed by the receiver");
+            return;
+        }
+        else
+        {
+            for (ssize_t i = 0; i < bytes; ++i)
+            {
+                transfer.ack[transfer.ackBytes++] = buffer[i];
+                if (transfer.ackBytes == 4)
+                {
+                    transfer.acked = (uint32_t(transfer.ack[0]) << 24) | (uint32_t(transfer.ack[1]) << 16)
+                                   | (uint32_t(transfer.ack[2]) << 8) | transfer.ack[3];
+                    transfer.ackBytes = 0;
+                }
+            }
+            transfer.progress = TimerWheel::Now();
+
+            // Клиенты подтверждают либо позицию в файле, либо принятое с начала докачки
+            if (transfer.position == transfer.size && (transfer.acked == uint32_t(transfer.size)
+                || transfer.acked == uint32_t(transfer.size - transfer.start)))
+            {
+                Finish(id, nullptr);
+                return;
+            }
+        }
+    }
+
+    if (revents & POLLOUT)
+        Pump(id);
+}
+
+void DccServer::Pump(uint32_t id)
+{
+    std::map<uint32_t, std::unique_ptr<Transfer>>::iterator itr = _transfers.find(id);
+    if (itr == _transfers.end())
+        return;
+    Transfer& transfer = *itr->second;
+
+    int64_t now = TimerWheel::Now();
+    size_t budget = MaxBurst;
+    if (transfer.rate > 0)
+    {
+        transfer.tokens = std::min(burstOf(transfer.rate), transfer.tokens + (now - transfer.refilled) * transfer.rate / 1000);
+        transfer.refilled = now;
+        budget = std::min<size_t>(budget, transfer.tokens);
+    }
+
+    // Из кэша страниц в сокет, пока сокет берёт и позволяет предел
+    uint64_t sent = 0;
+    bool blocked = false;
+    while (transfer.position < transfer.size && sent < budget)
+    {
+        off_t offset = transfer.position;
+        size_t chunk = std::min<uint64_t>(budget - sent, transfer.size - transfer.position);
+        ssize_t bytes = sendfile(transfer.fd, transfer.file, &offset, chunk);
+        if (bytes > 0)
+        {
+            ++_stats.calls;
+            transfer.position += bytes;
+            sent += bytes;
+            continue;
+        }
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            blocked = true;
+            break;
+        }
+        Finish(id, bytes == 0 ? "file was truncated" : "send failed");
+        return;
+    }
+
+    if (sent > 0)
+    {
+        transfer.progress = now;
+        _stats.bytes += sent;
+        if (transfer.rate > 0)
+            transfer.tokens -= sent;
+    }
+
+    bool more = transfer.position < transfer.size;
+    bool pollout = more;
+    if (more && !blocked && transfer.rate > 0)
+    {
+        // Корзина пуста: POLLOUT снимается до накопления половины запаса
+        double need = std::min<double>(burstOf(transfer.rate) / 2, transfer.size - transfer.position);
+        int64_t wait = std::max(int64_t(TimerWheel::TickMs), int64_t((need - transfer.tokens) * 1000 / transfer.rate) + 1);
+        pollout = false;
+        ++_stats.pauses;
+        transfer.resume = _bot->Timers().Schedule(wait, [this, id] {
+            std::map<uint32_t, std::unique_ptr<Transfer>>::iterator itr = _transfers.find(id);
+            if (itr == _transfers.end())
+                return;
+            itr->second->resume = 0;
+            Pump(id);
+        });
+    }
+
+    // Всё отправлено - ждём последнего подтверждения или закрытия получателем
+    if (pollout != transfer.pollout)
+    {
+        transfer.pollout = pollout;
+        _bot->WatchFd(transfer.fd, pollout ? POLLIN | POLLOUT : POLLIN,
+                      [this, id](short revents) { OnTransfer(id, revents); });
+    }
+}
+
+void DccServer::Expire(uint32_t id)
+{
+    std::map<uint32_t, std::unique_ptr<Transfer>>::iterator itr = _transfers.find(id);
+    if (itr == _transfers.end())
+        return;
+    Transfer& transfer = *itr->second;
+    transfer.expire = 0;
+
+    if (transfer.fd == -1)
+    {
+        Finish(id, "not accepted in time");
+        return;
+    }
+
+    // Простой проверяется по таймеру, а не переустановкой на каждую запись
+    int64_t timeout = int64_t(_bot->Config()->dccconf.timeout) * 1000;
+    int64_t idle = TimerWheel::Now() - transfer.progress;
+    if (idle < timeout)
+        transfer.expire = _bot->Timers().Schedule(timeout - idle, [this, id] { Expire(id); });
+    else if (transfer.position == transfer.size)
+        Finish(id, nullptr);    // всё отправлено, получатель просто не подтвердил
+    else
+        Finish(id, "stalled");
+}
+
+void DccServer::Finish(uint32_t id, const char* failure)
+{
+    std::map<uint32_t, std::unique_ptr<Transfer>>::iterator itr = _transfers.find(id);
+    if (itr == _transfers.end())
+        return;
+    Transfer& transfer = *itr->second;
+
+    if (transfer.listen != -1)
+    {
+        _bot->UnwatchFd(transfer.listen);
+        close(transfer.listen);
+    }
+    if (transfer.fd != -1)
+    {
+        _bot->UnwatchFd(transfer.fd);
+        close(transfer.fd);
+    }
+    close(transfer.file);
+    _bot->Timers().Cancel(transfer.expire);
+    _bot->Timers().Cancel(transfer.resume);
+
+    if (failure)
+    {
+        ++_stats.failed;
+        std::cout << "[!] DCC: " << transfer.name << " to " << transfer.nick << " failed (" << failure << ") at "
+                  << transfer.position << " of " << transfer.size << " bytes" << std::endl;
+    }
+    else
+    {
+        ++_stats.files;
+        double seconds = std::max<int64_t>(TimerWheel::Now() - transfer.accepted, 1) / 1000.0;
+        std::cout << "[-] DCC: sent " << transfer.name << " to " << transfer.nick << ", "
+                  << transfer.position - transfer.start << " bytes in " << seconds << " s ("
+                  << int64_t((transfer.position - transfer.start) / seconds / 1024) << " KB/s)" << std::endl;
+    }
+    _transfers.erase(itr);
+}
+
+void DccServer::Resume(const IRCMessage& message, std::string_view request)
+{
+    // RESUME <файл> <порт> <позиция>: клиент просит начать не с нуля
+    std::vector<std::string> tokens = splitDcc(request);
+    if (tokens.size() < 4)
+        return;
+    unsigned long port = strtoul(tokens[2].c_str(), nullptr, 10);
+    uint64_t position = strtoull(tokens[3].c_str(), nullptr, 10);
+    std::string nick(message.prefix.nick);
+    std::string folded = foldNick(nick);
+
+    for (std::pair<const uint32_t, std::unique_ptr<Transfer>>& item : _transfers)
+    {
+        Transfer& transfer = *item.second;
+        if (transfer.listen == -1 || transfer.port != port || foldNick(transfer.nick) != folded)
+            continue;
+        if (position > transfer.size)
+            break;
+
+        transfer.start = transfer.position = position;
+        ++_stats.resumed;
+        _bot->SendIRC("PRIVMSG " + nick + " :\001DCC ACCEPT " + quoteDcc(tokens[1]) + " " + tokens[2] + " "
+                      + std::to_string(position) + "\001");
+        std::cout << "[*] DCC: " << nick << " resumes " << transfer.name << " from " << position << std::endl;
+        return;
+    }
+    std::cout << "[!] DCC: " << nick << " asked to resume an unknown offer on port " << port << std::endl;
+}
+
+void DccServer::Ctcp(const IRCMessage& message, std::string_view request)
+{
+    MemScope scope(MemDcc);
+    std::string type(request.substr(0, request.find(' ')));
+    std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+
+    if (type == "RESUME")
+        Resume(message, request);
+    else if (type == "CHAT")
+        ConnectChat(message, request);
+    else
+        _bot->SendIRC("NOTICE " + std::string(message.prefix.nick) + " :\001ERRMSG DCC " + type + " :Not supported\001");
+}
+
+DccServer::Chat* DccServer::NewChat(const IRCMessage& message, uint32_t* id)
+{
+    if (_chats.size() >= _bot->Config()->dccconf.chats)
+        return nullptr;
+
+    *id = ++_nextId;
+    std::unique_ptr<Chat>& chat = _chats[*id];
+    chat.reset(new Chat);
+    chat->nick = message.prefix.nick;
+    chat->user = message.prefix.user;
+    chat->host = message.prefix.host;
+    chat->prefix = message.prefix.prefix;
+    chat->access = message.access;
+    return chat.get();
+}
+
+std::string DccServer::OfferChat(const IRCMessage& message)
+{
+    MemScope scope(MemDcc);
+    std::shared_ptr<const IRCConfig> conf = _bot->Config();
+    uint32_t id;
+    Chat* chat = NewChat(message, &id);
+    if (!chat)
+        return "All " + std::to_string(conf->dccconf.chats) + " DCC chats are busy, try again later";
+
+    sockaddr_storage address;
+    std::string host;
+    uint16_t port = 0;
+    if (!Resolve(&address, &host) || (chat->listen = Listen(address, &port)) == -1)
+    {
+        _chats.erase(id);
+        return "Cannot open a DCC port, try again later";
+    }
+
+    _bot->WatchFd(chat->listen, POLLIN, [this, id](short) { AcceptChat(id); });
+    chat->expire = _bot->Timers().Schedule(int64_t(conf->dccconf.timeout) * 1000, [this, id] {
+        std::map<uint32_t, std::unique_ptr<Chat>>::iterator itr = _chats.find(id);
+        if (itr == _chats.end())
+            return;
+        itr->second->expire = 0;
+        DropChat(id, nullptr);
+    });
+
+    _bot->SendIRC("PRIVMSG " + chat->nick + " :\001DCC CHAT chat " + host + " " + std::to_string(port) + "\001");
+    return "Offered " + chat->nick + " a DCC chat";
+}
+
+bool DccServer::SameHost(const sockaddr_storage& address, std::string_view host)
+{
+    // Хост в префиксе сравнивается как адрес; имя или маскировка сети не
+    // совпадут никогда - тогда остаётся команда chat, где подключается пользователь
+    std::string text(host);
+    if (address.ss_family == AF_INET)
+    {
+        struct in_addr v4;
+        return inet_pton(AF_INET, text.c_str(), &v4) == 1
+            && ((const struct sockaddr_in*)&address)->sin_addr.s_addr == v4.s_addr;
+    }
+    struct in6_addr v6;
+    return inet_pton(AF_INET6, text.c_str(), &v6) == 1
+        && memcmp(&((const struct sockaddr_in6*)&address)->sin6_addr, &v6, sizeof(v6)) == 0;
+}
+
+void DccServer::ConnectChat(const IRCMessage& message, std::string_view request)
+{
+    // CHAT chat <адрес> <порт>: пользователь слушает, бот подключается
+    std::vector<std::string> tokens = splitDcc(request);
+    std::string nick(message.prefix.nick);
+    if (tokens.size() < 4)
+        return;
+
+    sockaddr_storage address;
+    memset(&address, 0, sizeof(address));
+    socklen_t length;
+    struct in6_addr v6;
+    if (tokens[2].find_first_not_of("0123456789") == std::string::npos)
+    {
+        struct sockaddr_in* in = (struct sockaddr_in*)&address;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(uint32_t(strtoul(tokens[2].c_str(), nullptr, 10)));
+        in->sin_port = htons(strtoul(tokens[3].c_str(), nullptr, 10));
+        length = sizeof(*in);
+    }
+    else if (inet_pton(AF_INET6, tokens[2].c_str(), &v6) == 1)
+    {
+        struct sockaddr_in6* in = (struct sockaddr_in6*)&address;
+        in->sin6_family = AF_INET6;
+        in->sin6_addr = v6;
+        in->sin6_port = htons(strtoul(tokens[3].c_str(), nullptr, 10));
+        length = sizeof(*in);
+    }
+    else
+        return;
+
+    // Порт 0 - пассивный DCC (слушать должен бот); служебные порты не трогаем
+    unsigned long port = strtoul(tokens[3].c_str(), nullptr, 10);
+    if (port < 1024 || port > 65535)
+    {
+        _bot->SendIRC("NOTICE " + nick + " :\001ERRMSG DCC CHAT :Passive or privileged port is not supported, use "
+                      + std::string(1, _bot->Config()->clientconf.command_symbol) + "chat\001");
+        return;
+    }
+
+    // Адрес из CTCP задаёт сам пользователь: иначе бот подключался бы по его
+    // указке к себе (127.0.0.1) или во внутреннюю сеть. Подключаемся только к
+    // хосту отправителя, а к любому адресу - по просьбе админа
+    if (!(message.access & AclAdmin) && !SameHost(address, message.prefix.host))
+    {
+        std::cout << "[!] DCC: " << nick << " asked for a chat at a foreign address " << tokens[2] << std::endl;
+        _bot->SendIRC("NOTICE " + nick + " :\001ERRMSG DCC CHAT :Address does not match your host, use "
+                      + std::string(1, _bot->Config()->clientconf.command_symbol) + "chat\001");
+        return;
+    }
+
+    uint32_t id;
+    Chat* chat = NewChat(message, &id);
+    if (!chat)
+    {
+        _bot->SendIRC("NOTICE " + nick + " :All DCC chats are busy, try again later");
+        return;
+    }
+
+    chat->fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (chat->fd == -1 || (connect(chat->fd, (struct sockaddr*)&address, length) != 0 && errno != EINPROGRESS))
+    {
+        std::cout << "[!] DCC: cannot connect to " << nick << "'s chat: " << strerror(errno) << std::endl;
+        DropChat(id, nullptr);
+        return;
+    }
+    chat->connecting = true;
+    _bot->WatchFd(chat->fd, POLLOUT, [this, id](short revents) { OnChat(id, revents); });
+    chat->expire = _bot->Timers().Schedule(int64_t(_bot->Config()->dccconf.timeout) * 1000, [this, id] {
+        std::map<uint32_t, std::unique_ptr<Chat>>::iterator itr = _chats.find(id);
+        if (itr == _chats.end())
+            return;
+        itr->second->expire = 0;
+        DropChat(id, nullptr);
+    });
+}
+
+void DccServer::AcceptChat(uint32_t id)
+{
+    std::map<uint32_t, std::unique_ptr<Chat>>::iterator itr = _chats.find(id);
+    if (itr == _chats.end())
+        return;
+    Chat& chat = *itr->second;
+
+    int fd = accept4(chat.listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            DropChat(id, nullptr);
+        return;
+    }
+
+    _bot->UnwatchFd(chat.listen);
+    close(chat.listen);
+    chat.listen = -1;
+    chat.fd = fd;
+    _bot->WatchFd(fd, POLLIN, [this, id](short revents) { OnChat(id, revents); });
+    Greet(id);
+}
+
+void DccServer::Greet(uint32_t id)
+{
+    Chat& chat = *_chats[id];
+    _bot->Timers().Cancel(chat.expire);
+    chat.expire = 0;
+    ++_stats.chats;
+    std::cout << "[+] DCC: chat with " << chat.nick << " (" << _chats.size() << " open)" << std::endl;
+    SendChat(chat, "Connected to " + _bot->Nick() + ". Commands work with or without "
+             + std::string(1, _bot->Config()->clientconf.command_symbol) + ", exit closes the chat.");
+    WriteChat(id);
+}
+
+void DccServer::OnChat(uint32_t id, short revents)
+{
+    MemScope scope(MemDcc);
+    std::map<uint32_t, std::unique_ptr<Chat>>::iterator itr = _chats.find(id);
+    if (itr == _chats.end())
+        return;
+    Chat& chat = *itr->second;
+
+    if (chat.connecting)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(chat.fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+        {
+            std::cout << "[!] DCC: cannot connect to " << chat.nick << "'s chat: " << strerror(error) << std::endl;
+            DropChat(id, nullptr);
+            return;
+        }
+        chat.connecting = false;
+        _bot->WatchFd(chat.fd, POLLIN, [this, id](short revents) { OnChat(id, revents); });
+        Greet(id);
+        return;
+    }
+
+    if ((revents & POLLOUT) && !WriteChat(id))
+        return;
+    if (!(revents & (POLLIN | POLLERR | POLLHUP)))
+        return;
+
+    char buffer[4096];
+    ssize_t bytes = recv(chat.fd, buffer, sizeof(buffer), 0);
+    if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (bytes <= 0)
+    {
+        DropChat(id, nullptr);
+        return;
+    }
+
+    chat.inbuf.append(buffer, bytes);
+    size_t start = 0, end;
+    while ((end = chat.inbuf.find('\n', start)) != std::string::npos)
+    {
+        std::string line = chat.inbuf.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            ChatLine(id, line);
+        // Сессию могли закрыть (exit, переполнение вывода)
+        if (_chats.find(id) == _chats.end())
+            return;
+    }
+    chat.inbuf.erase(0, start);
+
+    if (chat.inbuf.size() > MaxInput)
+        DropChat(id, "Input line too long");
+}
+
+void DccServer::ChatLine(uint32_t id, const std::string& line)
+{
+    Chat& chat = *_chats[id];
+    char symbol = _bot->Config()->clientconf.command_symbol;
+    std::string text = line[0] == symbol ? line.substr(1) : line;
+    if (text.find_first_not_of(' ') == std::string::npos)
+        return;
+    if (text == "exit")
+    {
+        DropChat(id, "Bye");
+        return;
+    }
+
+    // Строка чата - команда бота от того, кто открыл сессию; ответы идут в чат,
+    // а не через очередь отправки на сервер
+    std::string body = std::string(1, symbol) + text;
+    IRCMessage message(std::pmr::get_default_resource());
+    message.command = "PRIVMSG";
+    message.prefix.prefix = chat.prefix;
+    message.prefix.nick = chat.nick;
+    message.prefix.user = chat.user;
+    message.prefix.host = chat.host;
+    message.parts.push_back(_bot->Nick());
+    message.parts.push_back(body);
+    message.access = chat.access;
+
+    if (_bot->CommandLimited(message))
+    {
+        SendChat(chat, "Too many commands, slow down");
+        WriteChat(id);
+        return;
+    }
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    // Отложенный ответ (ip) застаёт чат, только если тот ещё открыт
+    IRCBot::ReplySink later = [this, id](const std::vector<std::string>& lines) {
+        std::map<uint32_t, std::unique_ptr<Chat>>::iterator itr = _chats.find(id);
+        if (itr == _chats.end() || itr->second->fd == -1)
+            return;
+        for (const std::string& reply : lines)
+            SendChat(*itr->second, reply);
+        WriteChat(id);
+    };
+    for (const std::string& reply : botReply(text, message, _bot, later))
+        SendChat(chat, reply);
+    _bot->CommandDone(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count());
+    WriteChat(id);
+}
+
+void DccServer::SendChat(Chat& chat, const std::string& text)
+{
+    chat.outbuf.append(text).append("\n");
+}
+
+bool DccServer::WriteChat(uint32_t id)
+{
+    Chat& chat = *_chats[id];
+    size_t written = 0;
+    while (written < chat.outbuf.size())
+    {
+        ssize_t sent = send(chat.fd, chat.outbuf.data() + written, chat.outbuf.size() - written, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            written += sent;
+            continue;
+        }
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        DropChat(id, nullptr);
+        return false;
+    }
+    chat.outbuf.erase(0, written);
+
+    if (chat.outbuf.size() > MaxOutput)
+    {
+        std::cout << "[!] DCC: chat with " << chat.nick << " is not reading, closing it" << std::endl;
+        DropChat(id, nullptr);
+        return false;
+    }
+
+    bool pollout = !chat.outbuf.empty();
+    if (pollout != chat.pollout)
+    {
+        chat.pollout = pollout;
+        _bot->WatchFd(chat.fd, pollout ? POLLIN | POLLOUT : POLLIN, [this, id](short revents) { OnChat(id, revents); });
+    }
+    return true;
+}
+
+void DccServer::DropChat(uint32_t id, const char* reason)
+{
+    std::map<uint32_t, std::unique_ptr<Chat>>::iterator itr = _chats.find(id);
+    if (itr == _chats.end())
+        return;
+    Chat& chat = *itr->second;
+
+    if (reason && chat.fd != -1 && !chat.connecting)
+    {
+        std::string line = std::string(reason) + "\n";
+        send(chat.fd, line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    if (chat.listen != -1)
+    {
+        _bot->UnwatchFd(chat.listen);
+        close(chat.listen);
+    }
+    if (chat.fd != -1)
+    {
+        _bot->UnwatchFd(chat.fd);
+        close(chat.fd);
+        if (!chat.connecting)
+            std::cout << "[-] DCC: chat with " << chat.nick << " closed" << std::endl;
+    }
+    _bot->Timers().Cancel(chat.expire);
+    _chats.erase(itr);
+}
+
+std::vector<std::string> DccServer::Report() const
+{
+    std::vector<std::string> lines;
+    lines.push_back("DCC: " + std::to_string(_stats.files) + " of " + std::to_string(_stats.offers) + " files sent ("
+                    + std::to_string(_stats.resumed) + " resumed, " + std::to_string(_stats.failed) + " failed), "
+                    + formatSize(_stats.bytes) + " in " + std::to_string(_stats.calls) + " sendfile calls, "
+                    + std::to_string(_stats.pauses) + " rate pauses, " + std::to_string(_stats.chats) + " chats");
+
+    int64_t now = TimerWheel::Now();
+    for (const std::pair<const uint32_t, std::unique_ptr<Transfer>>& item : _transfers)
+    {
+        const Transfer& transfer = *item.second;
+        std::string line = "  " + transfer.name + " -> " + transfer.nick + ": ";
+        if (transfer.fd == -1)
+            line += "waiting on port " + std::to_string(transfer.port);
+        else
+        {
+            double seconds = std::max<int64_t>(now - transfer.accepted, 1) / 1000.0;
+            line += std::to_string(transfer.position) + " of " + std::to_string(transfer.size) + " bytes, "
+                  + std::to_string(int64_t((transfer.position - transfer.start) / seconds / 1024)) + " KB/s";
+        }
+        lines.push_back(line);
+    }
+    for (const std::pair<const uint32_t, std::unique_ptr<Chat>>& item : _chats)
+    {
+        const Chat& chat = *item.second;
+        lines.push_back("  chat with " + chat.nick + (chat.listen != -1 ? ": waiting" : chat.connecting ? ": connecting" : ""));
+    }
+    return lines;
+}
@@ -0,0 +1,138 @@
+#ifndef DCC_H_
+#define DCC_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "timer.h"
+
+class IRCBot;
+struct IRCMessage;
+
+// DCC: отдача файлов (SEND с докачкой RESUME/ACCEPT) и командные сессии
+// через DCC CHAT. Файлы берутся только с верхнего уровня dccconf.dir и
+// уходят в сокет через sendfile прямо из кэша страниц, без копии в
+// пространство процесса. Каждое предложение - свой порт, который ждёт
+// одного подключения dccconf.timeout секунд.
+//
+// Всё работает в потоке цикла событий бота (IRCBot::WatchFd), без потока
+// на передачу: сокет получателя пишется по POLLOUT, а предел скорости -
+// корзина токенов, которая при нехватке снимает POLLOUT и ставит таймер
+// до накопления следующей порции. Настройки читаются из текущего снимка
+// конфигурации при каждом предложении.
+class DccServer
+{
+public:
+    DccServer();
+    ~DccServer();
+
+    void Open(IRCBot* bot);
+    void Close();
+    bool IsOpen() const { return _bot != nullptr; };
+
+    // Команда file <имя>: предложить DCC SEND; возвращает ответ пользователю
+    std::string Offer(const IRCMessage& message, const std::string& name);
+    // Команда file без имени: файлы каталога
+    std::string List() const;
+    // Команда chat: бот ждёт подключения и предлагает DCC CHAT
+    std::string OfferChat(const IRCMessage& message);
+    // CTCP DCC от пользователя без "DCC ": CHAT (бот подключается сам) и RESUME
+    void Ctcp(const IRCMessage& message, std::string_view request);
+
+    struct Stats
+    {
+        uint64_t offers = 0;        // предложено файлов
+        uint64_t files = 0;         // отдано целиком
+        uint64_t failed = 0;        // не принято, оборвано или зависло
+        uint64_t resumed = 0;       // докачек
+        uint64_t bytes = 0;         // отправлено байт по всем передачам
+        uint64_t calls = 0;         // вызовов sendfile
+        uint64_t pauses = 0;        // остановок по пределу скорости
+        uint64_t chats = 0;         // сессий DCC CHAT
+    };
+    const Stats& GetStats() const { return _stats; };
+    // Передач и чатов, включая ещё не принятые
+    size_t Active() const { return _transfers.size() + _chats.size(); };
+
+    // Сводка и строка на каждую передачу и сессию
+    std::vector<std::string> Report() const;
+
+private:
+    static const size_t MaxInput = 4 << 10;     // строка чата длиннее - разрыв
+    static const size_t MaxOutput = 1 << 20;    // чат не читает - разрыв
+    static const size_t MaxBurst = 4 << 20;     // за одно пробуждение на передачу, без предела скорости
+
+    struct Transfer
+    {
+        int listen = -1;            // ждёт подключения получателя
+        int fd = -1;                // сокет получателя
+        int file = -1;
+        uint16_t port = 0;
+        std::string nick;
+        std::string name;
+        uint64_t size = 0;
+        uint64_t start = 0;         // позиция, с которой идёт отправка (докачка)
+        uint64_t position = 0;      // следующий байт файла
+        uint32_t acked = 0;         // последнее подтверждение получателя (младшие 32 бита)
+        unsigned char ack[4];
+        size_t ackBytes = 0;
+        int64_t accepted = 0;       // время подключения, мс
+        int64_t progress = 0;       // время последнего движения, мс
+        double rate = 0;            // байт в секунду, 0 - без предела
+        double tokens = 0;
+        int64_t refilled = 0;
+        bool pollout = false;
+        TimerWheel::TimerId expire = 0;     // ожидание подключения и простой
+        TimerWheel::TimerId resume = 0;     // пауза по пределу скорости
+    };
+
+    struct Chat
+    {
+        int listen = -1;            // бот предложил CHAT и ждёт подключения
+        int fd = -1;
+        bool connecting = false;    // исходящее подключение по CTCP DCC CHAT
+        std::string nick, user, host, prefix;
+        unsigned access = 0;
+        std::string inbuf;
+        std::string outbuf;
+        bool pollout = false;
+        TimerWheel::TimerId expire = 0;
+    };
+
+    bool Resolve(sockaddr_storage* address, std::string* text);
+    int Listen(const sockaddr_storage& address, uint16_t* port);
+    size_t Busy(const std::string& nick, size_t* nickBusy) const;
+
+    void AcceptTransfer(uint32_t id);
+    void OnTransfer(uint32_t id, short revents);
+    void Pump(uint32_t id);
+    void Expire(uint32_t id);
+    void Finish(uint32_t id, const char* failure);
+    void Resume(const IRCMessage& message, std::string_view request);
+
+    static bool SameHost(const sockaddr_storage& address, std::string_view host);
+    void ConnectChat(const IRCMessage& message, std::string_view request);
+    void AcceptChat(uint32_t id);
+    void Greet(uint32_t id);
+    void OnChat(uint32_t id, short revents);
+    void ChatLine(uint32_t id, const std::string& line);
+    void SendChat(Chat& chat, const std::string& text);
+    bool WriteChat(uint32_t id);
+    void DropChat(uint32_t id, const char* reason);
+    Chat* NewChat(const IRCMessage& message, uint32_t* id);
+
+    IRCBot* _bot;
+    uint32_t _nextId;
+    int _nextPort;              // следующий порт диапазона для поиска свободного
+    std::map<uint32_t, std::unique_ptr<Transfer>> _transfers;
+    std::map<uint32_t, std::unique_ptr<Chat>> _chats;
+    Stats _stats;
+};
+
+#endif
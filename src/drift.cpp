@@ -0,0 +1,153 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+
+#include "drift.h"
+#include "memtrack.h"
+
+static const char* const metricNames[DriftMetrics] = { "anon RSS", "fds", "queue", "p99" };
+static const char* const metricUnits[DriftMetrics] = { " KB", "", " lines", " us" };
+
+DriftMonitor::DriftMonitor() : _started(-1), _tripped(false)
+{
+    std::fill(_alarm, _alarm + DriftMetrics, false);
+}
+
+void DriftMonitor::Configure(const IRCConfig::Drift& conf)
+{
+    _conf = conf;
+    while (_points.size() > _conf.window)
+        _points.pop_front();
+}
+
+void DriftMonitor::Command(int64_t micros)
+{
+    if (_latencies.size() < MaxLatencies)
+        _latencies.push_back(micros);
+}
+
+size_t DriftMonitor::CountFds()
+{
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir)
+        return 0;
+    size_t count = 0;
+    while (struct dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+            ++count;
+    }
+    closedir(dir);
+    return count > 0 ? count - 1 : 0;   // без дескриптора самого opendir
+}
+
+double DriftMonitor::Limit(size_t metric) const
+{
+    switch (metric)
+    {
+        case DriftRss: return _conf.rss;
+        case DriftFds: return _conf.fds;
+        case DriftQueue: return _conf.queue;
+        default: return _conf.latency;
+    }
+}
+
+double DriftMonitor::Slope(size_t metric) const
+{
+    // Наклон прямой по методу наименьших квадратов, время - в часах от первого замера
+    size_t n = _points.size();
+    if (n < 2)
+        return 0;
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for (const Point& point : _points)
+    {
+        double x = (point.time - _points.front().time) / 3600000.0;
+        double y = point.values[metric];
+        sumX += x;
+        sumY += y;
+        sumXX += x * x;
+        sumXY += x * y;
+    }
+    double denominator = n * sumXX - sumX * sumX;
+    return denominator > 0 ? (n * sumXY - sumX * sumY) / denominator : 0;
+}
+
+std::vector<std::string> DriftMonitor::Sample(int64_t now, size_t queued)
+{
+    std::vector<std::string> alarms;
+    if (_started < 0)
+        _started = now;
+    if (now - _started < int64_t(_conf.warmup) * 1000)
+    {
+        _latencies.clear();
+        return alarms;
+    }
+
+    Point point;
+    point.time = now;
+    // Страницы отображённых файлов растут вместе с журналом и индексом и
+    // вытесняются ядром - утечку видно по анонимной памяти
+    point.values[DriftRss] = MemTrack::ResidentKb(true);
+    point.values[DriftFds] = CountFds();
+    point.values[DriftQueue] = queued;
+
+    // p99 за период; без команд - как в прошлом замере, чтобы тишина не выглядела спадом
+    if (!_latencies.empty())
+    {
+        size_t rank = (_latencies.size() * 99) / 100;
+        std::nth_element(_latencies.begin(), _latencies.begin() + rank, _latencies.end());
+        point.values[DriftLatency] = _latencies[rank];
+        _latencies.clear();
+    }
+    else
+        point.values[DriftLatency] = _points.empty() ? 0 : _points.back().values[DriftLatency];
+
+    _points.push_back(point);
+    while (_points.size() > _conf.window)
+        _points.pop_front();
+
+    if (_points.size() < _conf.window)
+        return alarms;
+
+    double hours = (_points.back().time - _points.front().time) / 3600000.0;
+    for (size_t metric = 0; metric < DriftMetrics; metric++)
+    {
+        double slope = Slope(metric);
+        bool alarm = slope > Limit(metric);
+        if (alarm && !_alarm[metric])
+        {
+            char text[160];
+            snprintf(text, sizeof(text), "%s rising %.1f%s/h over %.2f h (limit %.0f), now %.0f%s",
+                     metricNames[metric], slope, metricUnits[metric], hours, Limit(metric),
+                     point.values[metric], metricUnits[metric]);
+            alarms.push_back(text);
+            _tripped = true;
+        }
+        else if (!alarm && _alarm[metric])
+            std::cout << "[*] Drift: " << metricNames[metric] << " is flat again" << std::endl;
+        _alarm[metric] = alarm;
+    }
+    return alarms;
+}
+
+std::vector<std::string> DriftMonitor::Report() const
+{
+    std::vector<std::string> lines;
+    if (_points.empty())
+    {
+        lines.push_back("No drift samples yet (warmup " + std::to_string(_conf.warmup) + " s)");
+        return lines;
+    }
+
+    for (size_t metric = 0; metric < DriftMetrics; metric++)
+    {
+        char text[160];
+        snprintf(text, sizeof(text), "%s: now %.0f%s, slope %.1f%s/h (limit %.0f)%s",
+                 metricNames[metric], _points.back().values[metric], metricUnits[metric],
+                 Slope(metric), metricUnits[metric], Limit(metric), _alarm[metric] ? ", DRIFTING" : "");
+        lines.push_back(text);
+    }
+    lines.push_back(std::to_string(_points.size()) + " of " + std::to_string(_conf.window) + " samples in window");
+    return lines;
+}
@@ -0,0 +1,66 @@
+#ifndef DRIFT_H_
+#define DRIFT_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+#include "config.h"
+
+enum DriftMetric
+{
+    DriftRss = 0,       // анонимный RSS, КБ
+    DriftFds,           // открытых дескрипторов
+    DriftQueue,         // строк в очередях отправки (сервер и клиенты баунсера)
+    DriftLatency,       // p99 задержки команд за период замера, мкс
+    DriftMetrics
+};
+
+// Контроль медленного роста: раз в период бот снимает замер, монитор держит
+// последние window замеров и по ним считает наклон (МНК) в единицах за час.
+// Первые warmup секунд замеры не берутся - кэши и история ещё заполняются.
+// Наклон выше порога при полном окне - тревога; она снимается, когда наклон
+// опускается обратно. Работает в потоке цикла событий бота.
+class DriftMonitor
+{
+public:
+    DriftMonitor();
+
+    void Configure(const IRCConfig::Drift& conf);
+
+    // Время обработки одной команды бота
+    void Command(int64_t micros);
+
+    // Замер: RSS и дескрипторы читаются здесь, очереди передаёт бот.
+    // Возвращает описания тревог, поднятых этим замером.
+    std::vector<std::string> Sample(int64_t now /*мс*/, size_t queued);
+
+    // Хоть одна тревога поднималась за время работы
+    bool Tripped() const { return _tripped; };
+
+    // Последний замер и наклон каждой величины
+    std::vector<std::string> Report() const;
+
+private:
+    static const size_t MaxLatencies = 16384;   // замеров команд за период, дальше не копятся
+
+    struct Point
+    {
+        int64_t time;
+        double values[DriftMetrics];
+    };
+
+    double Slope(size_t metric) const;
+    double Limit(size_t metric) const;
+    static size_t CountFds();
+
+    IRCConfig::Drift _conf;
+    int64_t _started;           // время первого вызова Sample, мс
+    std::deque<Point> _points;
+    std::vector<int64_t> _latencies;
+    bool _alarm[DriftMetrics];
+    bool _tripped;
+};
+
+#endif
@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
 #include "handler.h"
+#include "casemap.h"
 
 IRCCommandHandler ircCommandTable[NUM_IRC_CMDS] =
 {
@@ -6,15 +12,24 @@ IRCCommandHandler ircCommandTable[NUM_IRC_CMDS] =
     { "NOTICE",             &IRCBot::HandleNotice                    },
     { "JOIN",               &IRCBot::HandleChannelJoinPart           },
     { "PART",               &IRCBot::HandleChannelJoinPart           },
+    { "KICK",               &IRCBot::HandleKick                      },
     { "NICK",               &IRCBot::HandleUserNickChange            },
     { "QUIT",               &IRCBot::HandleUserQuit                  },
     { "353",                &IRCBot::HandleChannelNamesList          },
     { "433",                &IRCBot::HandleNicknameInUse             },
-    { "001",                &IRCBot::HandleServerMessage             },
+    { "PONG",               &IRCBot::HandlePong                      },
+    { "CAP",                &IRCBot::HandleCap                       },
+    { "AUTHENTICATE",       &IRCBot::HandleAuthenticate              },
+    { "900",                &IRCBot::HandleLoggedIn                  },
+    { "903",                &IRCBot::HandleSaslResult                },
+    { "904",                &IRCBot::HandleSaslResult                },
+    { "905",                &IRCBot::HandleSaslResult                },
+    { "906",                &IRCBot::HandleSaslResult                },
+    { "001",                &IRCBot::HandleWelcome                   },
     { "002",                &IRCBot::HandleServerMessage             },
     { "003",                &IRCBot::HandleServerMessage             },
     { "004",                &IRCBot::HandleServerMessage             },
-    { "005",                &IRCBot::HandleServerMessage             },
+    { "005",                &IRCBot::HandleISupport                  },
     { "250",                &IRCBot::HandleServerMessage             },
     { "251",                &IRCBot::HandleServerMessage             },
     { "252",                &IRCBot::HandleServerMessage             },
@@ -31,52 +46,201 @@ IRCCommandHandler ircCommandTable[NUM_IRC_CMDS] =
     { "439",                &IRCBot::HandleAwayMsgTooLong            },
 };
 
-void IRCBot::HandleCTCP(IRCMessage message)
+void IRCBot::HandleCTCP(const IRCMessage& message)
 {
-    std::string to = message.parts.at(0);
-    std::string text = message.parts.at(message.parts.size() - 1);
+    std::string to(message.parts.at(0));
+    std::string text(message.parts.at(message.parts.size() - 1));
+    std::string nick(message.prefix.nick);
 
     // Remove '\001' from start/end of the string
     text = text.substr(1, text.size() - 2);
 
-    std::cout << "[" + message.prefix.nick << " requested CTCP " << text << "]" << std::endl;
+    std::cout << "[" << nick << " requested CTCP " << text << "]" << std::endl;
 
     if (to == _nick)
     {
+        // DCC CHAT от пользователя и RESUME к предложенному файлу; каждый
+        // открывает сокет, поэтому под тем же лимитом, что и команды
+        if (_dcc && text.compare(0, 4, "DCC ") == 0)
+        {
+            if (CommandLimited(message))
+                return;
+            _dcc->Ctcp(message, std::string_view(text).substr(4));
+            return;
+        }
+
         if (text == "VERSION") // Respond to CTCP VERSION
         {
-            SendIRC("NOTICE " + message.prefix.nick + " :\001VERSION " + IRCBot::botctcpver + " \001");
-            SendIRC("PRIVMSG " + message.prefix.nick + " :\001VERSION " + IRCBot::botctcpver + " \001");
-            std::cout << "Sent CTCP version reply to " << message.prefix.nick << std::endl;
+            std::string botctcpver = Config()->clientconf.xdccvers;
+            SendIRC("NOTICE " + nick + " :\001VERSION " + botctcpver + " \001");
+            SendIRC("PRIVMSG " + nick + " :\001VERSION " + botctcpver + " \001");
+            std::cout << "Sent CTCP version reply to " << nick << std::endl;
             return;
         }
 
         // CTCP not implemented
-        SendIRC("NOTICE " + message.prefix.nick + " :\001ERRMSG " + text + " :Not implemented\001");
+        SendIRC("NOTICE " + nick + " :\001ERRMSG " + text + " :Not implemented\001");
     }
 }
 
-void IRCBot::HandlePrivMsg(IRCMessage message)
+void IRCBot::HandlePrivMsg(const IRCMessage& message)
 {
-    std::string to = message.parts.at(0);
-    std::string text = message.parts.at(message.parts.size() - 1);
+    std::string_view to = message.parts.at(0);
+    std::string_view text = message.parts.at(message.parts.size() - 1);
+    // Параметры бывают пустыми ("PRIVMSG #c :") - первый байт только через проверку
+    bool channel = !to.empty() && to[0] == '#';
+    bool command = !text.empty() && text[0] == Config()->clientconf.command_symbol;
 
     // Handle Client-To-Client Protocol
-    if (text[0] == '\001')
+    if (!text.empty() && text[0] == '\001')
     {
-        HandleCTCP(message);
+        // /me пишется в журнал как обычная реплика с флагом
+        if (text.substr(0, 8) == "\001ACTION ")
+        {
+            size_t end = text.size() - (text.back() == '\001' ? 1 : 0);
+            if (_chanlog)
+                LogMessage(message, text.substr(8, end - 8), LogAction);
+            if (_backlog && channel)
+                Remember(message, text.substr(8, end - 8), LogAction);
+            if (_seen && channel)
+                UpdateSeen(message.prefix.nick, SeenMessage, to);
+        }
+        if (!aclIgnored(message.access))
+            HandleCTCP(message);
         return;
     }
 
-    if (to[0] == '#')
-        std::cout << "From " + message.prefix.nick << " @ " + to + ": " << text << std::endl;
+    if (_chanlog)
+        LogMessage(message, text, 0);
+    if (_backlog && channel && !command)
+        Remember(message, text, 0);
+    if (_seen && channel)
+        UpdateSeen(message.prefix.nick, SeenMessage, to);
+
+    if (channel)
+        std::cout << "From " << message.prefix.nick << " @ " << to << ": " << text << std::endl;
     else
-        std::cout << "From " + message.prefix.nick << ": " << text << std::endl;
+        std::cout << "From " << message.prefix.nick << ": " << text << std::endl;
+
+    // Команды разбирает onPrivMsg, триггеры смотрят остальную речь в каналах
+    if (channel && !command && !aclIgnored(message.access))
+        RunTriggers(message, text);
+}
+
+// Подстановка $nick, $chan, $match и $word в текст ответа триггера
+static std::string expandTrigger(const std::string& format, const std::string_view values[4])
+{
+    static const char* const variables[4] = { "$nick", "$chan", "$match", "$word" };
+
+    std::string result;
+    for (size_t i = 0; i < format.size(); ++i)
+    {
+        size_t var = 0;
+        while (var < 4 && format.compare(i, strlen(variables[var]), variables[var]) != 0)
+            ++var;
+
+        if (var < 4)
+        {
+            result += values[var];
+            i += strlen(variables[var]) - 1;
+        }
+        else
+            result += format[i];
+    }
+    return result;
+}
+
+void IRCBot::RunTriggers(const IRCMessage& message, std::string_view text)
+{
+    std::shared_ptr<const TriggerAutomaton> automaton = _triggers.Current();
+    if (!automaton)
+        return;
+
+    // Свёрнутая копия нужна только на время разбора пачки
+    char* folded = (char*)_arena.allocate(text.size(), 1);
+    memcpy(folded, text.data(), text.size());
+    TriggerAutomaton::Fold(folded, text.size());
+
+    std::vector<TriggerAutomaton::Hit> hits = automaton->Scan(std::string_view(folded, text.size()), MaxTriggerHits);
+    if (hits.empty())
+        return;
+
+    std::string_view channel = message.parts.at(0);
+    bool replied = false;
+    for (const TriggerAutomaton::Hit& hit : hits)
+    {
+        const IRCConfig::Trigger& trigger = automaton->Triggers()[hit.trigger];
+        std::string_view match = text.substr(hit.begin, hit.end - hit.begin);
+
+        if (trigger.action == "log")
+        {
+            std::cout << "[trigger] \"" << match << "\" from " << message.prefix.nick << " @ " << channel
+                      << ": " << text << std::endl;
+            continue;
+        }
+
+        // Отвечаем не больше одного раза на сообщение и в пределах лимитов команд
+        if (replied || trigger.reply.empty() || CommandLimited(message))
+            continue;
+        replied = true;
+
+        // $word - всё слово вокруг совпадения (для ссылок)
+        size_t wordBegin = text.rfind(' ', hit.begin);
+        wordBegin = wordBegin == std::string_view::npos ? 0 : wordBegin + 1;
+        std::string_view word = text.substr(wordBegin, text.find(' ', hit.end) - wordBegin);
+
+        const std::string_view values[] = { message.prefix.nick, channel, match, word };
+        std::string reply = expandTrigger(trigger.reply, values);
+
+        if (trigger.action == "notice")
+            QueueIRC("NOTICE " + std::string(message.prefix.nick) + " :" + reply);
+        else
+            QueueReply(std::string(channel), { reply });
+    }
+}
+
+void IRCBot::LogMessage(const IRCMessage& message, std::string_view text, uint16_t flags)
+{
+    // Для привата "каналом" считается собеседник
+    std::string_view to = message.parts.at(0);
+    if (to.substr(0, 1) != "#")
+    {
+        to = message.prefix.nick;
+        flags |= LogPrivate;
+    }
+
+    _chanlog->Append(Config()->serverconf.bothostname, to, message.prefix.nick, text, flags);
+}
+
+Backlog* IRCBot::GetBacklog()
+{
+    // Бюджет и размеры перечитываются вместе с конфигурацией, в потоке цикла
+    std::shared_ptr<const IRCConfig> conf = Config();
+    if (_backlog && conf != _backlogConfig)
+    {
+        const IRCConfig::Last& last = conf->lastconf;
+        _backlog->Configure(size_t(last.budgetkb) << 10, size_t(last.blockkb) << 10, last.lines);
+        _backlogConfig = conf;
+    }
+    return _backlog;
+}
+
+void IRCBot::Remember(const IRCMessage& message, std::string_view text, uint16_t flags)
+{
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    foldNick(message.parts.at(0), &_backlogKey);
+    GetBacklog()->Append(_backlogKey, message.prefix.nick, text, flags, now);
 }
 
-void IRCBot::HandleNotice(IRCMessage message)
+void IRCBot::UpdateSeen(std::string_view nick, SeenAction action, std::string_view where)
 {
-    std::string from = message.prefix.nick != "" ? message.prefix.nick : message.prefix.prefix;
+    _seen->Update(Config()->serverconf.bothostname, nick, action, where, time(nullptr));
+}
+
+void IRCBot::HandleNotice(const IRCMessage& message)
+{
+    std::string from(message.prefix.nick != "" ? message.prefix.nick : message.prefix.prefix);
     std::string text;
 
     if( !message.parts.empty() )
@@ -97,43 +261,257 @@ void IRCBot::HandleNotice(IRCMessage message)
         std::cout << "-" << from << "- " << text << std::endl;
 }
 
-void IRCBot::HandleChannelJoinPart(IRCMessage message)
+void IRCBot::HandleChannelJoinPart(const IRCMessage& message)
 {
-    std::string channel = message.parts.at(0);
+    std::string channel(message.parts.at(0));
     std::string action = message.command == "JOIN" ? "joins" : "leaves";
     std::cout << message.prefix.nick << " " << action << " " << channel << std::endl;
+
+    if (_seen)
+        UpdateSeen(message.prefix.nick, message.command == "JOIN" ? SeenJoin : SeenPart, channel);
+
+    // Свой user@host нужен для точного расчёта длины исходящих строк
+    if (message.command == "JOIN" && message.prefix.nick == _nick && !message.prefix.host.empty())
+        _selfHost = std::string(message.prefix.user) + "@" + std::string(message.prefix.host);
+
+    // Список своих каналов передаётся новому процессу при обновлении
+    if (message.prefix.nick == _nick)
+    {
+        if (message.command == "JOIN")
+            _channels[foldNick(channel)] = channel;
+        else
+            _channels.erase(foldNick(channel));
+    }
+
+    // Время от начала подключения до входа в канал - главный показатель реконнекта
+    if (message.command == "JOIN" && message.prefix.nick == _nick && _connectStarted != 0)
+    {
+        std::cout << "[+] Joined " << channel << " in " << TimerWheel::Now() - _connectStarted
+                  << " ms after connect" << std::endl;
+        _connectStarted = 0;
+    }
+}
+
+void IRCBot::HandleKick(const IRCMessage& message)
+{
+    std::string channel(message.parts.at(0));
+    std::string nick(message.parts.at(1));
+    std::string_view reason = message.parts.size() > 2 ? message.parts.at(2) : "";
+    std::cout << nick << " was kicked from " << channel << " by " << message.prefix.nick << " (" << reason << ")" << std::endl;
+
+    if (nick == _nick)
+        _channels.erase(foldNick(channel));
 }
 
-void IRCBot::HandleUserNickChange(IRCMessage message)
+void IRCBot::HandleUserNickChange(const IRCMessage& message)
 {
-    std::string newNick = message.parts.at(0);
+    std::string newNick(message.parts.at(0));
+    if (message.prefix.nick == _nick)
+        _nick = newNick;
     std::cout << message.prefix.nick << " changed his nick to " << newNick << std::endl;
+
+    if (_seen)
+    {
+        UpdateSeen(message.prefix.nick, SeenNickTo, newNick);
+        UpdateSeen(newNick, SeenNickFrom, message.prefix.nick);
+    }
 }
 
-void IRCBot::HandleUserQuit(IRCMessage message)
+void IRCBot::HandleUserQuit(const IRCMessage& message)
 {
-    std::string text = message.parts.at(0);
+    std::string_view text = message.parts.at(0);
     std::cout << message.prefix.nick << " quits (" << text << ")" << std::endl;
+
+    if (_seen)
+        UpdateSeen(message.prefix.nick, SeenQuit, "");
 }
 
-void IRCBot::HandleChannelNamesList(IRCMessage message)
+void IRCBot::HandleChannelNamesList(const IRCMessage& message)
 {
-    std::string channel = message.parts.at(2);
-    std::string nicks = message.parts.at(3);
+    std::string_view channel = message.parts.at(2);
+    std::string_view nicks = message.parts.at(3);
     std::cout << "People on " << channel << ":" << std::endl << nicks << std::endl;
 }
 
-void IRCBot::HandleNicknameInUse(IRCMessage message)
+void IRCBot::HandleNicknameInUse(const IRCMessage& message)
 {
     std::cout << message.parts.at(1) << " " << message.parts.at(2) << std::endl;
+
+    // До 001 без свободного ника регистрация не завершится - пробуем следующий
+    if (!_registered)
+    {
+        _nick = NextNick();
+        std::cout << "[*] Trying alternate nick " << _nick << std::endl;
+        SendIRC("NICK " + _nick);
+    }
+}
+
+void IRCBot::HandleWelcome(const IRCMessage& message)
+{
+    // Регистрация прошла - следующий разрыв снова начнёт паузы с минимальной
+    _backoff = 0;
+    _nick = message.parts.at(0);
+    HandleServerMessage(message);
+
+    // Входим в канал сразу, не дожидаясь окончания MOTD
+    OnRegistered();
+}
+
+void IRCBot::OnRegistered()
+{
+    if (_registered)
+        return;
+    _registered = true;
+
+    std::shared_ptr<const IRCConfig> conf = Config();
+
+    if (!conf->clientconf.runatcon.empty()) {
+        this->SendIRC(conf->clientconf.runatcon);
+        std::cout << "Sent: " + conf->clientconf.runatcon << std::endl;
+    }
+
+    // После успешного SASL учётная запись уже опознана, NickServ не нужен
+    if (!conf->clientconf.nspasswd.empty() && !_saslDone) {
+        IRCBot::SendIRC("PRIVMSG NickServ :IDENTIFY " + conf->clientconf.nspasswd);
+        std::cout << "CLIENT sent: PRIVMSG NickServ :IDENTIFY " << conf->clientconf.nspasswd << ":\r\n";
+    }
+
+    if (!conf->clientconf.botschan.empty()) {
+        IRCBot::SendIRC("JOIN " + conf->clientconf.botschan);
+    }
+
+    // Каналы прошлой сессии (или прошлого запуска, из снимка) - через запятую,
+    // сколько войдёт в строку
+    std::string joins;
+    for (const std::string& channel : _rejoin)
+    {
+        if (foldNick(channel) == foldNick(conf->clientconf.botschan))
+            continue;
+        if (!joins.empty() && joins.size() + channel.size() > 400)
+        {
+            SendIRC("JOIN " + joins);
+            joins.clear();
+        }
+        joins += (joins.empty() ? "" : ",") + channel;
+    }
+    if (!joins.empty())
+        SendIRC("JOIN " + joins);
+    _rejoin.clear();
+}
+
+void IRCBot::HandleCap(const IRCMessage& message)
+{
+    if (message.parts.size() < 3)
+        return;
+
+    std::string_view subcommand = message.parts.at(1);
+    std::string_view caps = message.parts.at(message.parts.size() - 1);
+    std::cout << "SERVER [CAP " << subcommand << "]: " << caps << std::endl;
+
+    if (_saslMech.empty())
+        return;
+
+    if (subcommand == "ACK" && caps.find("sasl") != std::string_view::npos)
+    {
+        SendIRC("AUTHENTICATE " + _saslMech);
+    }
+    else if (subcommand == "NAK")
+    {
+        std::cout << "[!] Server does not support SASL, continuing without it" << std::endl;
+        _saslMech.clear();
+        SendIRC("CAP END");
+    }
+}
+
+void IRCBot::HandleAuthenticate(const IRCMessage& message)
+{
+    if (message.parts.empty() || message.parts.at(0) != "+")
+        return;
+
+    // EXTERNAL: учётная запись определяется по клиентскому сертификату TLS
+    if (_saslMech == "EXTERNAL")
+    {
+        SendIRC("AUTHENTICATE +");
+        return;
+    }
+
+    // PLAIN: base64("authzid\0authcid\0password"), кусками по 400 символов
+    if (_saslMech == "PLAIN")
+    {
+        std::shared_ptr<const IRCConfig> conf = Config();
+        std::string account = conf->clientconf.saslacct.empty() ? conf->clientconf.nickname : conf->clientconf.saslacct;
+        std::string encoded = base64Encode(account + '\0' + account + '\0' + conf->clientconf.nspasswd);
+
+        size_t pos = 0;
+        for (; pos < encoded.size(); pos += 400)
+            SendIRC("AUTHENTICATE " + encoded.substr(pos, 400));
+        if (encoded.size() % 400 == 0)
+            SendIRC("AUTHENTICATE +");
+    }
+}
+
+void IRCBot::HandleLoggedIn(const IRCMessage& message)
+{
+    std::cout << "SERVER [900 RPL_LOGGEDIN]: " << message.parts.at(message.parts.size() - 1) << std::endl;
+}
+
+void IRCBot::HandleSaslResult(const IRCMessage& message)
+{
+    if (message.command == "903")
+    {
+        std::cout << "[+] SASL " << _saslMech << " authentication successful" << std::endl;
+        _saslDone = true;
+    }
+    else
+        std::cout << "[!] SASL " << _saslMech << " authentication failed (" << message.command << "): "
+                  << message.parts.at(message.parts.size() - 1) << std::endl;
+
+    // Успех или отказ - регистрацию в любом случае пора завершать
+    if (!_saslMech.empty())
+    {
+        _saslMech.clear();
+        SendIRC("CAP END");
+    }
 }
 
-void IRCBot::HandleServerMessage(IRCMessage message)
+void IRCBot::HandlePong(const IRCMessage& message)
+{
+    std::string_view token = message.parts.at(message.parts.size() - 1);
+    if (_pingSent == 0 || token != "LAG" + std::to_string(_pingSent))
+        return;
+
+    int lag = TimerWheel::Now() - _pingSent;
+    _pingSent = 0;
+    _lagStats.Add(lag);
+    if (_debug)
+        std::cout << "[lag] " << lag << " ms" << std::endl;
+
+    // Темп ответов подстраивается под задержку: при отставании сервера его
+    // счётчик флуда разгружается медленнее, и базовый темп ведёт к Excess Flood
+    const IRCConfig::Timers& timers = Config()->timerconf;
+    _sendInterval = std::min<int>(timers.sendpace + _lagStats.Smoothed(), std::max(timers.sendpace, timers.sendpacemax));
+
+    // Устойчиво большая задержка - соединение живо, но бесполезно, переподключаемся
+    if (timers.laglimit > 0 && _lagStats.Smoothed() > int(timers.laglimit) * 1000)
+    {
+        if (++_lagStrikes >= 3)
+        {
+            std::cout << "[!] Lag " << _lagStats.Smoothed() << " ms is above limit, reconnecting" << std::endl;
+            _lagStrikes = 0;
+            SendIRC("QUIT :Lag too high, reconnecting");
+            Disconnect();
+        }
+    }
+    else
+        _lagStrikes = 0;
+}
+
+void IRCBot::HandleServerMessage(const IRCMessage& message)
 {
     if( message.parts.empty() )
         return;
 
-    std::vector<std::string>::const_iterator itr = message.parts.begin();
+    auto itr = message.parts.begin();
     ++itr; // skip the first parameter (our nick)
     for (; itr != message.parts.end(); ++itr) {
         std::cout << *itr << " ";
@@ -141,13 +519,39 @@ void IRCBot::HandleServerMessage(IRCMessage message)
     std::cout << std::endl;
 }
 
-void IRCBot::HandleEndOfNames(IRCMessage message)
+void IRCBot::HandleISupport(const IRCMessage& message)
+{
+    // Первый параметр - наш ник, последний - "are supported by this server"
+    for (size_t i = 1; i + 1 < message.parts.size(); ++i)
+    {
+        _isupport.emplace_back(message.parts[i]);
+        ApplyISupport(_isupport.back());
+    }
+
+    HandleServerMessage(message);
+}
+
+void IRCBot::ApplyISupport(const std::string& token)
+{
+    size_t eq = token.find('=');
+    if (eq == std::string::npos)
+        return;
+
+    std::string key = token.substr(0, eq);
+    int value = std::atoi(token.c_str() + eq + 1);
+    if (key == "LINELEN" && value > 0)
+        _lineLen = value;
+    else if (key == "USERLEN" && value > 0)
+        _userLen = value;
+}
+
+void IRCBot::HandleEndOfNames(const IRCMessage& message)
 {
     std::cout << "SERVER [366 RPL_ENDOFNAMES]:" << std::endl;
     if( message.parts.empty() )
         return;
 
-    std::vector<std::string>::const_iterator itr = message.parts.begin();
+    auto itr = message.parts.begin();
     ++itr; // skip the first parameter (our nick)
     for (; itr != message.parts.end(); ++itr) {
         std::cout << *itr << " ";
@@ -155,17 +559,17 @@ void IRCBot::HandleEndOfNames(IRCMessage message)
     std::cout << std::endl;
 }
 
-void IRCBot::HandleStartOfMOTD(IRCMessage message)
+void IRCBot::HandleStartOfMOTD(const IRCMessage& message)
 {
     std::cout << "SERVER [375 RPL_MOTDSTART]:\n" << message.parts[1] << std::endl;
 }
 
-void IRCBot::HandleMOTDText(IRCMessage message)
+void IRCBot::HandleMOTDText(const IRCMessage& message)
 {
     if( message.parts.empty() )
         return;
 
-    std::vector<std::string>::const_iterator itr = message.parts.begin();
+    auto itr = message.parts.begin();
     ++itr; // skip the first parameter (our nick)
     for (; itr != message.parts.end(); ++itr) {;
         std::cout << *itr << " ";
@@ -173,31 +577,20 @@ void IRCBot::HandleMOTDText(IRCMessage message)
     std::cout << std::endl;
 }
 
-void IRCBot::HandleEndOfMOTD(IRCMessage message)
+void IRCBot::HandleEndOfMOTD(const IRCMessage& message)
 {
     std::cout << "SERVER [376 RPL_ENDOFMOTD]:\n" << message.parts[1] << std::endl;
-    if (!IRCBot::runonlogin.empty()) {
-        this->SendIRC(IRCBot::runonlogin);
-        std::cout << "Sent: " + IRCBot::runonlogin << std::endl;
-    }
-
-    if (!IRCBot::nspassword.empty()) {
-        IRCBot::SendIRC("PRIVMSG NickServ :IDENTIFY " + IRCBot::nspassword);
-        std::cout << "CLIENT sent: PRIVMSG NickServ :IDENTIFY " << IRCBot::nspassword << ":\r\n";
-    }
-
-    if (!IRCBot::botchannel.empty()) {
-        IRCBot::SendIRC("JOIN " + IRCBot::botchannel);
-    }
+    OnRegistered();     // обычно уже выполнено по 001
 }
 
-void IRCBot::HandleMissingMOTD(IRCMessage message)
+void IRCBot::HandleMissingMOTD(const IRCMessage& message)
 {
     std::cout << "SERVER [422 ERR_NOMOTD]: missing MOTD" << std::endl;
+    OnRegistered();     // запасной путь, если 001 не дошёл до обработчика
     if( message.parts.empty() )
         return;
 
-    std::vector<std::string>::const_iterator itr = message.parts.begin();
+    auto itr = message.parts.begin();
     ++itr; // skip the first parameter (our nick)
     for (; itr != message.parts.end(); ++itr) {
         std::cout << *itr << " ";
@@ -205,13 +598,13 @@ void IRCBot::HandleMissingMOTD(IRCMessage message)
     std::cout << std::endl;
 }
 
-void IRCBot::HandleAwayMsgTooLong(IRCMessage message)
+void IRCBot::HandleAwayMsgTooLong(const IRCMessage& message)
 {
     std::cout << "SERVER [439 ERR_AWAYLENEXCEEDED]: AWAY message is too long!" << std::endl;
     if( message.parts.empty() )
         return;
 
-    std::vector<std::string>::const_iterator itr = message.parts.begin();
+    auto itr = message.parts.begin();
     ++itr; // skip the first parameter (our nick)
     for (; itr != message.parts.end(); ++itr) {
         std::cout << *itr << " ";
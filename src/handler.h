@@ -3,17 +3,17 @@
 
 #include "ircbot.h"
 
-#define NUM_IRC_CMDS 27
+#define NUM_IRC_CMDS 36
 
 struct IRCCommandHandler
 {
     std::string command;
-    void (IRCBot::*handler)(IRCMessage /*message*/);
+    void (IRCBot::*handler)(const IRCMessage& /*message*/);
 };
 
 extern IRCCommandHandler ircCommandTable[NUM_IRC_CMDS];
 
-inline int GetCommandHandler(const std::string& command)
+inline int GetCommandHandler(std::string_view command)
 {
     for (int i = 0; i < NUM_IRC_CMDS; ++i)
     {
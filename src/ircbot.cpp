@@ -1,13 +1,44 @@
 #include <iostream>
 #include <algorithm>
 #include <sstream>
-#include <thread> // Для std::this_thread::sleep_for
-#include <chrono> // Для std::chrono::milliseconds
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <openssl/evp.h>
 
 //#include "irccom.h"
 #include "socket.h"
 #include "ircbot.h"
 #include "handler.h"
+#include "casemap.h"
+#include "memtrack.h"
+
+// Поток резолвера держит ссылку и под её мьютексом передаёт результат в
+// цикл событий; деструктор бота обнуляет указатель
+struct ResolverLink
+{
+    std::mutex mutex;
+    IRCBot* bot;
+};
+
+// Запрос getaddrinfo_a живёт в куче, пока его держит резолвер: освобождает
+// его тот, кто получил результат, или AbandonConnect(), если отмена удалась
+struct HostLookup
+{
+    struct gaicb request;
+    struct addrinfo hints;
+    std::string host;
+    std::string port;
+    std::shared_ptr<ResolverLink> link;
+};
 
 std::vector<std::string> splitStrBySep(std::string const& text, char sep)
 {
@@ -22,6 +53,13 @@ std::vector<std::string> splitStrBySep(std::string const& text, char sep)
     return tokens;
 }
 
+std::string base64Encode(std::string const& data)
+{
+    std::string encoded(4 * ((data.size() + 2) / 3), '\0');
+    EVP_EncodeBlock((unsigned char*)&encoded[0], (const unsigned char*)data.data(), data.size());
+    return encoded;
+}
+
 std::vector<std::string> splitStrBySpc(const std::string& input) {
     std::vector<std::string> result; // Вектор для хранения подстрок
     std::istringstream stream(input); // Поток для чтения строки
@@ -33,25 +71,982 @@ std::vector<std::string> splitStrBySpc(const std::string& input) {
     return result;
 }
 
+IRCBot::IRCBot() : _reconnect(false), _session(false), _quit(false), _registered(false), _saslDone(false),
+    _nickAttempt(0), _connectStarted(0), _backoff(0),
+    _lookup(nullptr), _addresses(nullptr), _nextAddress(nullptr), _resolver(std::make_shared<ResolverLink>()), _offloads(0),
+    _pingTimer(0), _drainTimer(0), _handshakeTimer(0), _connectTimer(0), _stateTimer(0), _driftTimer(0), _wakePending(false),
+    _lastRecv(0), _lastQueued(0), _pingSent(0), _lagStrikes(0), _pongCount(0),
+    _sendInterval(500), _lineLen(DefaultLineLen), _userLen(DefaultUserLen), _savedLag(-1),
+    _chanlog(nullptr), _search(nullptr), _seen(nullptr), _backlog(nullptr), _capture(nullptr), _state(nullptr), _bouncer(nullptr), _dcc(nullptr), _drift(nullptr), _relay(nullptr),
+    _debug(false)
+{
+    _resolver->bot = this;
+
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeFd != -1)
+        WatchFd(_wakeFd, POLLIN, [this](short) { RunPosted(); });
+    else
+        std::cerr << "eventfd failed, posted tasks will wait for the next timer" << std::endl;
+}
+
+IRCBot::~IRCBot()
+{
+    {
+        std::lock_guard<std::mutex> lock(_resolver->mutex);
+        _resolver->bot = nullptr;
+    }
+    AbandonConnect();
+
+    if (_wakeFd != -1)
+        close(_wakeFd);
+}
+
+bool IRCBot::Offload(std::function<std::vector<std::string>()> job, ReplySink done)
+{
+    if (_offloads >= MaxOffloads)
+        return false;
+    ++_offloads;
+
+    // Поток не ждут: бот, разрушенный раньше, чем пришёл ответ, отвязывается
+    // от ResolverLink, и результат просто выбрасывается
+    std::shared_ptr<ResolverLink> link = _resolver;
+    std::thread([link, job, done] {
+        std::vector<std::string> lines = job();
+        std::lock_guard<std::mutex> lock(link->mutex);
+        if (IRCBot* bot = link->bot)
+            bot->Post([bot, lines, done] {
+                --bot->_offloads;
+                done(lines);
+            });
+    }).detach();
+    return true;
+}
+
+void IRCBot::Post(std::function<void()> task)
+{
+    _posted.Push(std::move(task));
+
+    // Одна запись в eventfd на пачку задач, пока цикл не проснулся
+    if (_wakeFd != -1 && !_wakePending.exchange(true))
+    {
+        uint64_t one = 1;
+        if (write(_wakeFd, &one, sizeof(one)) != sizeof(one))
+            _wakePending = false;
+    }
+}
+
+void IRCBot::RunPosted()
+{
+    uint64_t count;
+    if (read(_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return;
+
+    // Сброс до разбора очереди: задача, добавленная во время разбора, снова разбудит цикл
+    _wakePending = false;
+
+    std::function<void()> task;
+    while (_posted.Pop(task))
+        task();
+}
+
+void IRCBot::WatchFd(int fd, short events, FdCallback callback)
+{
+    FdWatch& watch = _watches[fd];
+    watch.events = events;
+    watch.callback = std::move(callback);
+}
+
+void IRCBot::UnwatchFd(int fd)
+{
+    _watches.erase(fd);
+}
+
 bool IRCBot::InitSocket()
 {
     return _socket.Init();
 }
 
-bool IRCBot::Connect(const char* host, int port)
+bool IRCBot::Connect(const char* host, int port, int timeoutMs)
+{
+    AbandonConnect();
+
+    HostLookup* lookup = new HostLookup();
+    lookup->hints.ai_family = AF_UNSPEC;        // Поддержка как IPv4, так и IPv6
+    lookup->hints.ai_socktype = SOCK_STREAM;    // TCP сокет
+    lookup->hints.ai_protocol = IPPROTO_TCP;    // Протокол TCP
+    lookup->host = host;
+    lookup->port = std::to_string(port);
+    lookup->request.ar_name = lookup->host.c_str();
+    lookup->request.ar_service = lookup->port.c_str();
+    lookup->request.ar_request = &lookup->hints;
+    lookup->link = _resolver;
+
+    // Зависший DNS не держит цикл: результат придёт задачей через Post()
+    struct sigevent notify;
+    memset(&notify, 0, sizeof(notify));
+    notify.sigev_notify = SIGEV_THREAD;
+    notify.sigev_notify_function = &IRCBot::LookupDone;
+    notify.sigev_value.sival_ptr = lookup;
+
+    struct gaicb* requests[1] = { &lookup->request };
+    int status = getaddrinfo_a(GAI_NOWAIT, requests, 1, &notify);
+    if (status != 0)
+    {
+        std::cout << "Could not resolve host: " << host << " (" << gai_strerror(status) << ")" << std::endl;
+        delete lookup;
+        return false;
+    }
+
+    _connectHost = host;
+    _lookup = lookup;
+    _connectTimer = _timers.Schedule(timeoutMs, [this] {
+        _connectTimer = 0;
+        if (_lookup)
+            std::cout << "Could not resolve host: " << _connectHost << " (timeout)" << std::endl;
+        else
+            std::cout << "Could not connect to: " << _connectHost << " (timeout)" << std::endl;
+        AbandonConnect();
+        ScheduleReconnect();
+    });
+    return true;
+}
+
+void IRCBot::LookupDone(union sigval value)
+{
+    HostLookup* lookup = static_cast<HostLookup*>(value.sival_ptr);
+    std::shared_ptr<ResolverLink> link = lookup->link;
+    std::lock_guard<std::mutex> lock(link->mutex);
+
+    if (link->bot)
+    {
+        IRCBot* bot = link->bot;
+        bot->Post([bot, lookup] { bot->Resolved(lookup); });
+        return;
+    }
+
+    // Бота уже нет - результат никому не нужен
+    freeaddrinfo(lookup->request.ar_result);
+    delete lookup;
+}
+
+void IRCBot::Resolved(HostLookup* lookup)
 {
-    return _socket.Connect(host, port);
+    int status = gai_error(&lookup->request);
+    struct addrinfo* result = lookup->request.ar_result;
+    bool current = lookup == _lookup;
+    delete lookup;
+
+    // Попытку уже бросили по таймауту, а отменить запрос не удалось
+    if (!current)
+    {
+        freeaddrinfo(result);
+        return;
+    }
+    _lookup = nullptr;
+
+    if (status != 0)
+    {
+        std::cout << "Could not resolve host: " << _connectHost << " (" << gai_strerror(status) << ")" << std::endl;
+        AbandonConnect();
+        ScheduleReconnect();
+        return;
+    }
+
+    _addresses = _nextAddress = result;
+    ConnectNext();
+}
+
+void IRCBot::ConnectNext()
+{
+    // Перебираем адреса по очереди, все в пределах одного таймаута
+    while (_nextAddress)
+    {
+        struct addrinfo* address = _nextAddress;
+        _nextAddress = address->ai_next;
+        if (!_socket.BeginConnect(address))
+            continue;
+
+        int fd = _socket.Fd();
+        WatchFd(fd, POLLOUT, [this, fd](short) {
+            UnwatchFd(fd);
+            if (_socket.FinishConnect())
+                OnConnected();
+            else
+                ConnectNext();  // Если не удалось, продолжаем со следующим адресом
+        });
+        return;
+    }
+
+    std::cout << "Could not connect to: " << _connectHost << std::endl;
+    AbandonConnect();
+    ScheduleReconnect();
+}
+
+void IRCBot::AbandonConnect()
+{
+    _timers.Cancel(_connectTimer);
+    _connectTimer = 0;
+
+    if (_lookup)
+    {
+        // Не отменённый запрос ещё вернётся через Post(), его освободит Resolved()
+        if (gai_cancel(&_lookup->request) == EAI_CANCELED)
+            delete _lookup;
+        _lookup = nullptr;
+    }
+
+    if (_addresses)
+        freeaddrinfo(_addresses);
+    _addresses = _nextAddress = nullptr;
+
+    if (!_socket.Connected() && _socket.Fd() != INVALID_SOCKET)
+    {
+        UnwatchFd(_socket.Fd());
+        _socket.AbortConnect();
+    }
 }
 
 void IRCBot::Disconnect()
 {
+    IRCSocket::SendStats sent = _socket.Stats();
     _socket.Disconnect();
+
+    if (!_session)
+        return;
+
+    _session = false;
+    _timers.Cancel(_pingTimer);
+    _timers.Cancel(_drainTimer);
+    _timers.Cancel(_handshakeTimer);
+    _pingTimer = _drainTimer = _handshakeTimer = 0;
+    _sendq.clear();
+    _inbuf.clear();
+
+    std::cout << "[-] Disconnected." << std::endl;
+    if (_bouncer)
+        _bouncer->Notice("Disconnected from the server");
+    std::cout << "[*] Sent " << sent.lines << " lines (" << sent.bytes << " bytes) in " << sent.writes
+              << " writes, " << sent.partial << " short" << std::endl;
+    const BatchArena::Stats& arena = _arena.GetStats();
+    std::cout << "[*] Parsed " << arena.batches << " batches in " << _arena.Capacity() / 1024 << " KB arena: "
+              << arena.bytes / 1024 << " KB, " << arena.reused * 100 / std::max<uint64_t>(arena.bytes, 1)
+              << "% reused, peak " << arena.peak << " bytes, " << arena.blocks << " blocks" << std::endl;
+
+    if (_quit)
+        return;
+
+    // Плановое переподключение (новый сервер в конфигурации) - сразу
+    if (_reconnect.exchange(false))
+        _timers.Schedule(0, [this] { Start(); });
+    else
+        ScheduleReconnect();
+}
+
+bool IRCBot::Start()
+{
+    std::shared_ptr<const IRCConfig> conf = Config();
+
+    std::cout << "[->] Connecting..." << std::endl;
+
+    _connectStarted = TimerWheel::Now();
+    if (!Connect(conf->serverconf.bothostname.c_str(), conf->serverconf.bothostport, conf->timerconf.connlimit * 1000))
+    {
+        ScheduleReconnect();
+        return false;
+    }
+
+    // Дальше - OnConnected(), когда connect() к одному из адресов завершится
+    return true;
+}
+
+void IRCBot::OnConnected()
+{
+    std::shared_ptr<const IRCConfig> conf = Config();
+
+    AbandonConnect();
+
+    _session = true;
+    _lastRecv = TimerWheel::Now();
+    _pingSent = 0;
+    _lagStats.Reset();
+    _lagStrikes = 0;
+    _sendInterval = conf->timerconf.sendpace;
+
+    // Первое подключение после перезапуска: темп сразу по прошлой задержке,
+    // а не с базового, пока не придут свои замеры
+    if (_savedLag > 0)
+    {
+        _sendInterval = std::min<int>(conf->timerconf.sendpace + _savedLag,
+                                      std::max(conf->timerconf.sendpace, conf->timerconf.sendpacemax));
+        _savedLag = -1;
+    }
+
+    if (conf->serverconf.usetls)
+    {
+        TlsOptions options;
+        options.verify = conf->serverconf.tlsverify;
+        options.cert = conf->serverconf.tlscert;
+        options.key = conf->serverconf.tlskey;
+
+        if (!_socket.StartTls(conf->serverconf.bothostname, conf->serverconf.bothostport, options))
+        {
+            Disconnect();
+            return;
+        }
+
+        // Рукопожатие продолжает Poll(), здесь только ограничиваем его время
+        std::cout << "[>>] Connected. TLS handshake..." << std::endl;
+        _handshakeTimer = _timers.Schedule(conf->timerconf.connlimit * 1000, [this] {
+            _handshakeTimer = 0;
+            std::cout << "[!] TLS handshake timeout" << std::endl;
+            Disconnect();
+        });
+        ContinueHandshake();
+        return;
+    }
+
+    Register();
+}
+
+void IRCBot::ContinueHandshake()
+{
+    Transport::Status status = _socket.Handshake();
+    if (status == Transport::WantRead || status == Transport::WantWrite)
+        return;
+
+    _timers.Cancel(_handshakeTimer);
+    _handshakeTimer = 0;
+
+    if (status == Transport::Failed)
+    {
+        Disconnect();
+        return;
+    }
+
+    Register();
+}
+
+void IRCBot::Register()
+{
+    std::shared_ptr<const IRCConfig> conf = Config();
+
+    std::cout << "[>>] Connected. Loggin in..." << std::endl;
+
+    _registered = false;
+    _saslDone = false;
+    _nickAttempt = 0;
+    _lineLen = DefaultLineLen;
+    _userLen = DefaultUserLen;
+    _selfHost.clear();
+    _isupport.clear();
+
+    // После разрыва возвращаемся во все каналы прошлой сессии
+    for (const std::pair<const std::string, std::string>& channel : _channels)
+        _rejoin.push_back(channel.second);
+    _channels.clear();
+
+    // CAP REQ до NICK/USER: сервер придержит регистрацию до CAP END,
+    // а SASL пройдёт в тех же пакетах, без отдельного NickServ после MOTD
+    _saslMech = conf->clientconf.saslmech;
+    if (!_saslMech.empty())
+        SendIRC("CAP REQ :sasl");
+
+    if (!Login(conf->clientconf.nickname, conf->clientconf.username, conf->serverconf.bothostpass, conf->clientconf.realname))
+    {
+        Disconnect();
+        return;
+    }
+
+    std::cout << "[+] Login completed." << std::endl;
+    SchedulePing();
+}
+
+std::string IRCBot::NextNick()
+{
+    std::shared_ptr<const IRCConfig> conf = Config();
+    const std::vector<std::string>& altnicks = conf->clientconf.altnicks;
+    size_t attempt = _nickAttempt++;
+
+    // Сначала запасные ники из конфигурации, затем Nick_, Nick__, Nick___,
+    // затем Nick со случайным числом - до тех пор, пока сервер не примет
+    if (attempt < altnicks.size())
+        return altnicks[attempt];
+    attempt -= altnicks.size();
+
+    if (attempt < 3)
+        return conf->clientconf.nickname + std::string(attempt + 1, '_');
+
+    return conf->clientconf.nickname + std::to_string(100 + std::rand() % 900);
+}
+
+void IRCBot::ScheduleReconnect()
+{
+    if (_quit)
+        return;
+
+    const IRCConfig::Timers& timers = Config()->timerconf;
+    _backoff = _backoff == 0 ? timers.backoffmin : std::min<int>(_backoff * 2, timers.backoffmax);
+
+    std::cout << "[*] Reconnecting in " << _backoff << " s" << std::endl;
+    _timers.Schedule(_backoff * 1000, [this] { Start(); });
+}
+
+void IRCBot::SchedulePing()
+{
+    unsigned every = Config()->timerconf.pingevery;
+    if (every > 0)
+        _pingTimer = _timers.Schedule(every * 1000, [this] { CheckPing(); });
+}
+
+void IRCBot::CheckPing()
+{
+    _pingTimer = 0;
+
+    // Сервер молчит дольше допустимого - соединение считаем мёртвым
+    int64_t now = TimerWheel::Now();
+    unsigned limit = Config()->timerconf.pinglimit;
+    if (limit > 0 && now - _lastRecv > int64_t(limit) * 1000)
+    {
+        std::cout << "[!] Ping timeout: no data for " << (now - _lastRecv) / 1000 << " s" << std::endl;
+        Disconnect();
+        return;
+    }
+
+    _pingSent = now;
+    SendIRC("PING :LAG" + std::to_string(_pingSent));
+    SchedulePing();
+}
+
+void IRCBot::Poll()
+{
+    // Новый набор триггеров собирается в фоне, пока цикл работает со старым
+    _triggers.Update(Config());
+
+    int timeout = _timers.NextTimeout(TimerWheel::Now(), 1000);
+
+    // Сокет сервера (если есть) первым, за ним eventfd и прочие наблюдаемые
+    _pollfds.clear();
+    bool connected = _socket.Connected();
+    if (connected)
+        _pollfds.push_back({ _socket.Fd(), _socket.PollEvents(), 0 });
+    for (const std::pair<const int, FdWatch>& watch : _watches)
+        _pollfds.push_back({ watch.first, watch.second.events, 0 });
+
+    if (poll(_pollfds.data(), _pollfds.size(), timeout) > 0)
+    {
+        size_t first = 0;
+        if (connected)
+        {
+            first = 1;
+            short revents = _pollfds[0].revents;
+            if (revents && _socket.Handshaking())
+                ContinueHandshake();
+            else if (revents & (POLLIN | POLLERR | POLLHUP))
+            {
+                // TLS мог расшифровать больше, чем вернул за одно чтение
+                do {
+                    ReceiveData();
+                } while (_socket.Connected() && _socket.Pending());
+            }
+        }
+
+        for (size_t i = first; i < _pollfds.size(); ++i)
+        {
+            if (_pollfds[i].revents == 0)
+                continue;
+            // Обработчик может снять наблюдение - и своё, и чужое
+            std::map<int, FdWatch>::iterator watch = _watches.find(_pollfds[i].fd);
+            if (watch == _watches.end())
+                continue;
+            FdCallback callback = watch->second.callback;
+            callback(_pollfds[i].revents);
+        }
+    }
+
+    _timers.Advance(TimerWheel::Now());
+
+    // Всё, что обработчики и таймеры отправили за итерацию, - одной записью
+    _socket.Flush();
+    if (_bouncer)
+        _bouncer->Flush();
+
+    if (_session && !_socket.Connected())
+        Disconnect();
+}
+
+void IRCBot::Quit(std::string reason)
+{
+    _quit = true;
+
+    if (!_session)
+    {
+        AbandonConnect();
+        return;
+    }
+
+    SendIRC("QUIT :" + reason);
+    // Обычно сервер закрывает соединение сам; если нет - закрываем через 2 секунды
+    _timers.Schedule(2000, [this] { Disconnect(); });
+}
+
+bool IRCBot::CanUpgrade()
+{
+    if (!_session || !_registered || _socket.Handshaking())
+    {
+        std::cout << "[!] Upgrade: no registered session to hand over" << std::endl;
+        return false;
+    }
+    if (_socket.Secure())
+    {
+        std::cout << "[!] Upgrade: TLS session state cannot be passed to another process, restart instead" << std::endl;
+        return false;
+    }
+
+    // Новый процесс начнёт писать с начала строки - всё уже поставленное должно уйти
+    _socket.Flush();
+    if (_socket.Sending())
+    {
+        std::cout << "[!] Upgrade: output to the server is still pending, try again" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool IRCBot::Upgrade(std::vector<std::string> argv)
+{
+    if (!CanUpgrade())
+        return false;
+
+    std::shared_ptr<const IRCConfig> conf = Config();
+    UpgradeState state;
+    state.host = conf->serverconf.bothostname;
+    state.port = conf->serverconf.bothostport;
+    state.nick = _nick;
+    state.user = _user;
+    state.selfHost = _selfHost;
+    state.saslDone = _saslDone;
+    state.isupport = _isupport;
+    for (const std::pair<const std::string, std::string>& channel : _channels)
+        state.channels.push_back(channel.second);
+    state.inbuf = _inbuf;
+    for (const QueuedLine& line : _sendq)
+        state.sendq.push_back(line.relay ? line.head + line.relay->text : line.head);
+
+    // Путь к бинарнику - до fork: поиск по PATH в execvp выделяет память, а
+    // это в потомке многопоточного процесса может зависнуть. /proc/self/exe
+    // указывает на прежний файл; если его уже подменили, ссылка кончается на
+    // " (deleted)", а новый бинарник лежит по тому же пути
+    char exe[4096];
+    ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (length <= 0)
+    {
+        std::cout << "[!] Upgrade: cannot find own executable: " << strerror(errno) << std::endl;
+        return false;
+    }
+    exe[length] = '\0';
+    const char deleted[] = " (deleted)";
+    if (size_t(length) > sizeof(deleted) - 1 && strcmp(exe + length - (sizeof(deleted) - 1), deleted) == 0)
+        exe[length - (sizeof(deleted) - 1)] = '\0';
+
+    int channel[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) == -1)
+    {
+        std::cout << "[!] Upgrade: socketpair failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    argv.push_back("--upgrade-fd");
+    argv.push_back(std::to_string(channel[1]));
+    std::vector<char*> args;
+    for (std::string& arg : argv)
+        args.push_back(&arg[0]);
+    args.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Между fork и exec в многопоточном процессе - только async-signal-safe вызовы
+        fcntl(channel[1], F_SETFD, 0);
+        execv(exe, args.data());
+        _exit(127);
+    }
+    close(channel[1]);
+    if (pid == -1)
+    {
+        std::cout << "[!] Upgrade: fork failed: " << strerror(errno) << std::endl;
+        close(channel[0]);
+        return false;
+    }
+
+    std::cout << "[*] Upgrade: started " << exe << " (pid " << pid << "), handing over the connection" << std::endl;
+
+    // Пока новый процесс не ответит, сокет никто не читает: всё, что придёт
+    // от сервера, дождётся его в буфере ядра
+    bool ok = sendUpgrade(channel[0], _socket.Fd(), encodeUpgrade(state))
+        && waitUpgradeAck(channel[0], 'R', UpgradeTimeout)
+        && sendUpgradeAck(channel[0], 'G');
+    close(channel[0]);
+
+    if (!ok)
+    {
+        std::cout << "[!] Upgrade: pid " << pid << " did not take over, keeping the connection" << std::endl;
+        kill(pid, SIGTERM);
+        ReapUpgrade(pid, 0);
+        return false;
+    }
+
+    std::cout << "[+] Upgrade: connection handed over to pid " << pid << ", exiting" << std::endl;
+    _socket.Release();
+    _quit = true;
+    _session = false;
+    _timers.Cancel(_pingTimer);
+    _timers.Cancel(_drainTimer);
+    _pingTimer = _drainTimer = 0;
+    _sendq.clear();
+    _inbuf.clear();
+    return true;
+}
+
+void IRCBot::ReapUpgrade(pid_t pid, int attempt)
+{
+    // После SIGTERM процесс проверяется раз в 100 мс; не ушёл за 2 с - SIGKILL
+    if (waitpid(pid, nullptr, WNOHANG) != 0)
+        return;
+    if (attempt == 20)
+        kill(pid, SIGKILL);
+    _timers.Schedule(100, [this, pid, attempt] { ReapUpgrade(pid, attempt + 1); });
+}
+
+bool IRCBot::Resume(int channel)
+{
+    int fd = -1;
+    std::string data;
+    UpgradeState state;
+    if (!receiveUpgrade(channel, &fd, &data, UpgradeTimeout) || !decodeUpgrade(data, &state))
+    {
+        std::cout << "[!] Upgrade: no usable state from the previous process" << std::endl;
+        if (fd != -1)
+            close(fd);
+        close(channel);
+        return false;
+    }
+
+    // Сокет наш только после ответа прежнего процесса: если он нас не
+    // дождался и работает дальше, читать из сокета вдвоём нельзя
+    bool ok = sendUpgradeAck(channel, 'R') && waitUpgradeAck(channel, 'G', UpgradeTimeout);
+    close(channel);
+    if (!ok || !_socket.Adopt(fd))
+    {
+        std::cout << "[!] Upgrade: the previous process kept the connection" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    std::shared_ptr<const IRCConfig> conf = Config();
+
+    _session = true;
+    _registered = true;
+    _saslDone = state.saslDone;
+    _saslMech.clear();
+    _nickAttempt = 0;
+    _connectStarted = 0;
+    _backoff = 0;
+    _nick = state.nick;
+    _user = state.user;
+    _selfHost = state.selfHost;
+    _lineLen = DefaultLineLen;
+    _userLen = DefaultUserLen;
+    _isupport = state.isupport;
+    for (const std::string& token : _isupport)
+        ApplyISupport(token);
+    _channels.clear();
+    for (const std::string& name : state.channels)
+        _channels[foldNick(name)] = name;
+    _rejoin.clear();
+    _inbuf = state.inbuf;
+
+    _lastRecv = TimerWheel::Now();
+    _pingSent = 0;
+    _lagStats.Reset();
+    _lagStrikes = 0;
+    _sendInterval = conf->timerconf.sendpace;
+    for (const std::string& line : state.sendq)
+        QueueIRC(line);
+    SchedulePing();
+
+    std::cout << "[+] Upgrade: resumed session on " << state.host << ":" << state.port << " as " << _nick
+              << ", " << _channels.size() << " channels, " << _inbuf.size() << " bytes of partial input, "
+              << state.sendq.size() << " queued lines" << std::endl;
+
+    // Конфигурация могла смениться вместе с бинарником
+    if (state.host != conf->serverconf.bothostname || state.port != conf->serverconf.bothostport)
+    {
+        std::cout << "[*] Server changed to " << conf->serverconf.bothostname << ":"
+                  << conf->serverconf.bothostport << ", reconnecting..." << std::endl;
+        _reconnect = true;
+        SendIRC("QUIT :Reconnecting");
+    }
+    return true;
+}
+
+void IRCBot::QueueIRC(std::string data, bool echoed)
+{
+    _sendq.push_back({ std::move(data), nullptr, 0, echoed });
+    if (_drainTimer == 0)
+        DrainQueue();
+}
+
+void IRCBot::QueueRelay(const std::string& head, std::shared_ptr<const RelayMessage> relay, size_t link)
+{
+    MemScope scope(MemRelay);
+    std::shared_ptr<const IRCConfig> conf = Config();
+    if (conf != _relayConfig)
+    {
+        _relayLimiter.Configure(conf->relayconf.rate, conf->relayconf.per, 1024);
+        _relayConfig = conf;
+    }
+
+    // Лимит ссылки не даёт шумному каналу одной сети занять всю очередь
+    // другой: лишнее отбрасывается сразу, а не копится за темпом отправки
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (!Registered() || _relayLimiter.Check(std::to_string(link), now) != RateLimiter::Allowed)
+    {
+        if (_relay)
+            _relay->Dropped(link);
+        return;
+    }
+
+    _sendq.push_back({ head, std::move(relay), link, false });
+    if (_drainTimer == 0)
+        DrainQueue();
+}
+
+void IRCBot::QueueReply(const std::string& target, const std::vector<std::string>& fragments)
+{
+    for (const std::string& line : packReply(fragments, ReplyBudget(target)))
+        QueueIRC("PRIVMSG " + target + " :" + line);
+}
+
+size_t IRCBot::ReplyBudget(const std::string& target) const
+{
+    // Сервер пересылает строку с ":nick!user@host "; пока свой хост не виден
+    // по JOIN, считаем по худшему случаю: ~user длиной до USERLEN и хост в 63 символа
+    size_t userHost = !_selfHost.empty() ? _selfHost.size()
+                                         : 1 + std::min(_user.size(), _userLen) + 1 + 63;
+    size_t used = 1 + _nick.size() + 1 + userHost + 1
+                + 8 + target.size() + 2     // "PRIVMSG target :"
+                + 2;                        // CRLF
+    return _lineLen > used ? _lineLen - used : 0;
+}
+
+void IRCBot::DrainQueue()
+{
+    _drainTimer = 0;
+
+    int64_t wait = _lastQueued + _sendInterval - TimerWheel::Now();
+    if (wait <= 0 && !_sendq.empty())
+    {
+        const QueuedLine& line = _sendq.front();
+        if (line.echoed)
+            _socket.SendData(line.head + "\r\n");
+        else if (!line.relay)
+            SendIRC(line.head);
+        else
+        {
+            SendIRC(line.head + line.relay->text);
+            if (_relay)
+                _relay->Delivered(line.link, TimerWheel::Now() - line.relay->received);
+        }
+        _sendq.pop_front();
+        _lastQueued = TimerWheel::Now();
+        wait = _sendInterval;
+    }
+
+    if (!_sendq.empty())
+        _drainTimer = _timers.Schedule(wait, [this] { DrainQueue(); });
+}
+
+void IRCBot::SetConfig(std::shared_ptr<const IRCConfig> config)
+{
+    std::shared_ptr<const IRCConfig> previous = _config.exchange(config);
+    if (!previous || !Connected())
+        return;
+
+    // Сервер сменился - уходим с текущего, главный цикл подключится заново
+    if (needsReconnect(*previous, *config))
+    {
+        std::cout << "[*] Server changed to " << config->serverconf.bothostname << ":"
+                  << config->serverconf.bothostport << ", reconnecting..." << std::endl;
+        _reconnect = true;
+        SendIRC("QUIT :Reconnecting");
+        return;
+    }
+
+    // Остальное применяется без переподключения
+    if (previous->clientconf.nickname != config->clientconf.nickname)
+        SendIRC("NICK " + config->clientconf.nickname);
+
+    if (previous->clientconf.botschan != config->clientconf.botschan)
+    {
+        if (!previous->clientconf.botschan.empty())
+            SendIRC("PART " + previous->clientconf.botschan);
+        if (!config->clientconf.botschan.empty())
+            SendIRC("JOIN " + config->clientconf.botschan);
+    }
+}
+
+void IRCBot::SetState(StateSnapshot* state)
+{
+    _timers.Cancel(_stateTimer);
+    _stateTimer = 0;
+    _state = state;
+
+    if (!_state)
+    {
+        _userLimiter.SetLookup(nullptr);
+        _chanLimiter.SetLookup(nullptr);
+        return;
+    }
+
+    // Ключи ограничителей не переносятся в память: ещё не встреченный ключ
+    // ищется в отображённом снимке при первой проверке
+    _userLimiter.SetLookup([this](const std::string& key, int64_t* tat, bool* limited) {
+        return _state->FindLimit(0, key, tat, limited);
+    });
+    _chanLimiter.SetLookup([this](const std::string& key, int64_t* tat, bool* limited) {
+        return _state->FindLimit(1, key, tat, limited);
+    });
+
+    std::shared_ptr<const IRCConfig> conf = Config();
+    if (_state->Loaded())
+    {
+        time_t saved = _state->SavedAt() / 1000;
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&saved));
+        std::cout << "[*] State from " << stamp << ": " << _state->Channels().size() << " channels, "
+                  << _state->Limits() << " limiter keys, lag " << _state->Lag() << " ms" << std::endl;
+
+        // Каналы и задержка относятся к своему серверу и нужны только до первого
+        // подключения; после /upgrade снимок открывается уже при живой сессии
+        if (!_session && _state->Network() == conf->serverconf.bothostname)
+        {
+            _rejoin = _state->Channels();
+            _savedLag = _state->Lag();
+        }
+    }
+
+    ScheduleStateSave();
+}
+
+void IRCBot::ScheduleStateSave()
+{
+    unsigned every = Config()->stateconf.every;
+    if (_state && every > 0)
+        _stateTimer = _timers.Schedule(int64_t(every) * 1000, [this] {
+            _stateTimer = 0;
+            SaveState();
+            ScheduleStateSave();
+        });
+}
+
+void IRCBot::SetDrift(DriftMonitor* drift)
+{
+    _timers.Cancel(_driftTimer);
+    _driftTimer = 0;
+    _drift = drift;
+    _driftConfig.reset();
+    ScheduleDriftSample();
+}
+
+void IRCBot::ScheduleDriftSample()
+{
+    // Период и пороги перечитываются вместе с конфигурацией
+    std::shared_ptr<const IRCConfig> conf = Config();
+    if (!_drift)
+        return;
+    if (conf != _driftConfig)
+    {
+        _drift->Configure(conf->driftconf);
+        _driftConfig = conf;
+    }
+    _driftTimer = _timers.Schedule(int64_t(conf->driftconf.every) * 1000, [this] {
+        _driftTimer = 0;
+        SampleDrift();
+        ScheduleDriftSample();
+    });
+}
+
+void IRCBot::SampleDrift()
+{
+    size_t queued = _sendq.size() + (_bouncer ? _bouncer->Queued() : 0);
+    for (const std::string& alarm : _drift->Sample(TimerWheel::Now(), queued))
+    {
+        std::cout << "[!] Drift: " << alarm << std::endl;
+        if (_bouncer)
+            _bouncer->Notice("Drift: " + alarm);
+    }
+
+    if (_drift->Tripped() && Config()->driftconf.exit && !_quit)
+    {
+        std::cout << "[!] Drift: exiting as configured (driftExit)" << std::endl;
+        Quit("Resource drift detected");
+    }
+}
+
+std::vector<std::string> IRCBot::ChannelNames() const
+{
+    std::vector<std::string> names;
+    for (const std::pair<const std::string, std::string>& channel : _channels)
+        names.push_back(channel.second);
+    return names;
+}
+
+void IRCBot::SaveState()
+{
+    if (!_state)
+        return;
+
+    int64_t started = TimerWheel::Now();
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    StateSnapshot::Contents contents;
+    contents.network = Config()->serverconf.bothostname;
+    contents.lag = _lagStats.Count() > 0 ? _lagStats.Smoothed() : _state->Lag();
+
+    // До регистрации своих каналов ещё нет - сохраняем те, куда вернёмся
+    if (_registered)
+    {
+        for (const std::pair<const std::string, std::string>& channel : _channels)
+            contents.channels.push_back(channel.second);
+    }
+    else
+        contents.channels = _rejoin;
+
+    // Истёкшие ключи ничем не отличаются от новых, их не сохраняем
+    auto collect = [&contents, now](uint8_t limiter) {
+        return [&contents, now, limiter](const std::string& key, int64_t tat, bool limited) {
+            if (tat > now)
+                contents.limits.push_back({ limiter, key, tat, limited });
+        };
+    };
+    _userLimiter.ForEach(collect(0));
+    _chanLimiter.ForEach(collect(1));
+
+    if (_state->Save(contents))
+        std::cout << "[*] State saved: " << contents.channels.size() << " channels, " << contents.limits.size()
+                  << " limiter keys, " << _state->Bytes() << " bytes in " << TimerWheel::Now() - started << " ms" << std::endl;
 }
 
 bool IRCBot::SendIRC(std::string data)
 {
+    if (_bouncer && (data.compare(0, 8, "PRIVMSG ") == 0 || data.compare(0, 7, "NOTICE ") == 0))
+        _bouncer->Echo(data);
+
+    // Строки копятся до конца итерации Poll() и уходят в сокет одной записью
     data.append("\r\n");
-    return _socket.SendData(data.c_str());
+    return _socket.SendData(std::move(data));
 }
 
 bool IRCBot::Login(std::string nick, std::string user, std::string pass, std::string rnam)
@@ -79,49 +1074,95 @@ bool IRCBot::Login(std::string nick, std::string user, std::string pass, std::st
 void IRCBot::ReceiveData()
 {
     std::string buffer = _socket.ReceiveData();
-    std::string line;
-    std::istringstream iss(buffer);
-    while(getline(iss, line))
+    if (buffer.empty())
+        return;
+
+    _lastRecv = TimerWheel::Now();
+
+    if (_capture)
+        _capture->Write(buffer.data(), buffer.size());
+
+    Feed(buffer.data(), buffer.size());
+}
+
+void IRCBot::Feed(const char* data, size_t length)
+{
+    MemScope scope(MemParse);
+
+    // Строка может прийти частями - хвост без '\n' ждёт следующего чтения
+    _inbuf.append(data, length);
+    size_t complete = _inbuf.rfind('\n');
+    if (complete == std::string::npos)
+        return;
+
+    // Полные строки пачки копируются в арену одним куском: разобранные
+    // сообщения ссылаются прямо на них, а _inbuf можно сразу сдвинуть
+    ++complete;
+    char* batch = (char*)_arena.allocate(complete, 1);
+    memcpy(batch, _inbuf.data(), complete);
+    _inbuf.erase(0, complete);
+
+    bool session = _session;
+    std::string_view lines(batch, complete);
+    size_t start = 0, end;
+    while ((end = lines.find('\n', start)) != std::string_view::npos)
     {
-        if (line.find("\r") != std::string::npos) {
-            line = line.substr(0, line.size() - 1);
-        }
-        //std::replace(buffer.begin(), buffer.end(), '\r', '\n');
-        Parse(line);
+        std::string_view line = lines.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (!line.empty())
+            Parse(line);
+        // ERROR или потеря связи посреди пачки: остаток относится к старой сессии
+        if (session && !_session)
+            break;
     }
+    _arena.Reset();
 }
 
-void IRCBot::Parse(std::string data)
+void IRCBot::Parse(std::string_view data)
 {
-    std::string original(data);
-    IRCCommandPrefix cmdPrefix;
-    static int pongCount = 0;
+    std::string_view original(data);
+    IRCMessage ircMessage(&_arena);
 
     // if command has prefix
     if (data.substr(0, 1) == ":")
     {
-        cmdPrefix.Parse(data);
-        data = data.substr(data.find(" ") + 1);
+        ircMessage.prefix.Parse(data);
+        size_t space = data.find(' ');
+        data = space != std::string_view::npos ? data.substr(space + 1) : std::string_view();
     }
 
-    std::string command = data.substr(0, data.find(" "));
-    std::transform(command.begin(), command.end(), command.begin(), ::towupper);
-    if (data.find(" ") != std::string::npos)
-        data = data.substr(data.find(" ") + 1);
+    std::string_view command = data.substr(0, data.find(' '));
+    if (std::any_of(command.begin(), command.end(), ::islower))
+    {
+        char* upper = (char*)_arena.allocate(command.size(), 1);
+        std::transform(command.begin(), command.end(), upper, ::toupper);
+        command = std::string_view(upper, command.size());
+    }
+    ircMessage.command = command;
+    if (data.find(' ') != std::string_view::npos)
+        data = data.substr(data.find(' ') + 1);
     else
-        data = "";
+        data = std::string_view();
 
-    std::vector<std::string> parts;
+    std::pmr::vector<std::string_view>& parts = ircMessage.parts;
 
-    if (data != "")
+    if (!data.empty())
     {
-        if (data.substr(0, 1) == ":")
+        if (data[0] == ':')
             parts.push_back(data.substr(1));
         else
         {
             size_t pos1 = 0, pos2;
-            while ((pos2 = data.find(" ", pos1)) != std::string::npos)
+            while (true)
             {
+                pos2 = data.find(' ', pos1);
+                if (pos2 == std::string_view::npos)
+                {
+                    parts.push_back(data.substr(pos1));
+                    break;
+                }
                 parts.push_back(data.substr(pos1, pos2 - pos1));
                 pos1 = pos2 + 1;
                 if (data.substr(pos1, 1) == ":")
@@ -130,8 +1171,6 @@ void IRCBot::Parse(std::string data)
                     break;
                 }
             }
-            if (parts.empty())
-                parts.push_back(data);
         }
     }
 
@@ -142,24 +1181,30 @@ void IRCBot::Parse(std::string data)
         return;
     }
 
-    if (command == "PRIVMSG") {
-        // std::cout << "DATA string on PRIVMSG:" << data << std::endl;
-    }
-
     if (command == "PING")
     {
         //std::cout << "Ping? Pong! - " << getDateVal(0) << std::endl;
-        SendIRC("PONG :" + parts.at(0));
-        //std::cout << getDateVal(4) << " Sent: PONG :" + parts.at(0) + '\n';
-        pongCount++;
-        if (pongCount >= 10) {
-            std::cout << "[pong!] to " << parts.at(0) << " sent " << pongCount << " times for now - " << getDateVal(4) << '\r';
-            pongCount = 0;
+        SendIRC("PONG :" + std::string(parts.at(0)));
+        _pongCount++;
+        if (_pongCount >= 10) {
+            std::cout << "[pong!] to " << parts.at(0) << " sent " << _pongCount << " times for now - " << getDateVal(4) << '\r';
+            _pongCount = 0;
         }
         return;
     }
 
-    IRCMessage ircMessage(command, cmdPrefix, parts);
+    if (_bouncer)
+        _bouncer->Relay(original, ircMessage);
+
+    if (_relay && (command == "PRIVMSG" || command == "JOIN" || command == "PART"))
+        _relay->Publish(this, ircMessage);
+
+    // Доступ отправителя определяется один раз, до всех обработчиков
+    if ((command == "PRIVMSG" || command == "NOTICE") && !ircMessage.prefix.host.empty())
+    {
+        UpdateAcl();
+        ircMessage.access = _acl.Match(ircMessage.prefix.nick, ircMessage.prefix.user, ircMessage.prefix.host);
+    }
 
     // Default handler
     int commandIndex = GetCommandHandler(command);
@@ -172,10 +1217,10 @@ void IRCBot::Parse(std::string data)
         std::cout << original << std::endl;
 
     // Try to call hook (if any matches)
-    CallHook(command, ircMessage);
+    CallHook(ircMessage);
 }
 
-void IRCBot::HookIRCCommand(std::string command, void (*function)(IRCMessage /*message*/, IRCBot* /*client*/))
+void IRCBot::HookIRCCommand(std::string command, void (*function)(const IRCMessage& /*message*/, IRCBot* /*client*/))
 {
     IRCCommandHook hook;
 
@@ -185,14 +1230,14 @@ void IRCBot::HookIRCCommand(std::string command, void (*function)(IRCMessage /*m
     _hooks.push_back(hook);
 }
 
-void IRCBot::CallHook(std::string command, IRCMessage message)
+void IRCBot::CallHook(const IRCMessage& message)
 {
     if (_hooks.empty())
         return;
 
     for (std::list<IRCCommandHook>::const_iterator itr = _hooks.begin(); itr != _hooks.end(); ++itr)
     {
-        if (itr->command == command)
+        if (itr->command == message.command)
         {
             (*(itr->function))(message, this);
             break;
@@ -200,40 +1245,140 @@ void IRCBot::CallHook(std::string command, IRCMessage message)
     }
 }
 
-void onPrivMsg(IRCMessage message, IRCBot* client)
+void IRCBot::UpdateAcl()
+{
+    // Как и лимиты, собирается в потоке приёма из текущего снимка конфигурации
+    std::shared_ptr<const IRCConfig> conf = Config();
+    if (conf == _aclConfig)
+        return;
+    _aclConfig = conf;
+
+    int64_t started = TimerWheel::Now();
+    _acl.Clear();
+    for (const std::string& mask : conf->aclconf.admins)
+        _acl.Add(mask, AclAdmin);
+    for (const std::string& mask : conf->aclconf.ignores)
+        _acl.Add(mask, AclIgnore);
+    if (!conf->aclconf.file.empty())
+        _acl.Load(conf->aclconf.file);
+
+    if (_acl.Count(AclAdmin) == 0 && !conf->clientconf.adminick.empty())
+    {
+        std::cout << "[!] No aclAdmin masks, falling back to " << conf->clientconf.adminick
+                  << "!*@*: anyone using this nick is admin" << std::endl;
+        _acl.Add(conf->clientconf.adminick + "!*@*", AclAdmin);
+    }
+
+    std::cout << "[*] ACL: " << _acl.Count(AclAdmin) << " admin, " << _acl.Count(AclIgnore)
+              << " ignore masks (" << TimerWheel::Now() - started << " ms)" << std::endl;
+}
+
+bool IRCBot::CommandLimited(const IRCMessage& message)
+{
+    // Лимиты перенастраиваются здесь, в потоке приёма, а не в потоке перезагрузки
+    std::shared_ptr<const IRCConfig> conf = Config();
+    if (conf != _limitConfig)
+    {
+        const IRCConfig::Limits& limits = conf->limitconf;
+        _userLimiter.Configure(limits.userrate, limits.userper, limits.maxkeys);
+        _chanLimiter.Configure(limits.chanrate, limits.chanper, limits.maxkeys);
+        _limitConfig = conf;
+    }
+
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // Сначала пользователь: флудер не расходует лимит канала
+    RateLimiter::Result result = _userLimiter.Check(std::string(message.prefix.prefix), now);
+
+    std::string to(message.parts.at(0));
+    if (result == RateLimiter::Allowed && to[0] == '#')
+        result = _chanLimiter.Check(to, now);
+
+    if (result == RateLimiter::Allowed)
+        return false;
+
+    if (result == RateLimiter::LimitedFirst)
+    {
+        std::cout << "[!] Throttled command from " << message.prefix.prefix << " @ " << to << std::endl;
+        if (conf->limitconf.notify)
+            SendIRC("NOTICE " + std::string(message.prefix.nick) + " :Too many commands, slow down");
+    }
+
+    return true;
+}
+
+// Адреса имени и сведения ipinfo.io по каждому. DNS и HTTP - только в потоке
+// Offload(), не в цикле событий
+static std::vector<std::string> lookupIpInfo(const std::string& name, const std::string& token, const std::string& lead)
+{
+    std::string reply = lead;
+    std::vector<std::string> ipSetStr = getIpAddr(name);
+    if (ipSetStr.empty()) {
+        reply += std::string("\x02\x03") + "04Error! Name or address not understood" + "\x03";
+    }
+    for (size_t i = 0; i < ipSetStr.size(); i++) {
+        if (i > 0) {
+            reply += '\n';
+        }
+        reply += getIpInfo(ipSetStr[i], token);
+    }
+    return splitStrBySep(reply, '\n');
+}
+
+void onPrivMsg(const IRCMessage& message, IRCBot* client)
 {
+    MemScope scope(MemReply);
 
     std::string text;
-    if (message.parts.at(message.parts.size() - 1)[0] != IRCBot::commsymbol[0]) {
+    std::string_view said = message.parts.at(message.parts.size() - 1);
+    if (said.empty() || said[0] != client->Config()->clientconf.command_symbol) {
+        return;
+    } else if (aclIgnored(message.access)) {
         return;
     } else {
-        text = message.parts.at(message.parts.size() - 1).substr(1);
+        text = said.substr(1);
     }
+
+    // Один символ команды или символ с пробелами - не команда
+    if (text.find_first_not_of(" \t") == std::string::npos)
+        return;
+
+    if (client->CommandLimited(message))
+        return;
     
-    std::vector<std::string> botReplyMsg = botReply(text, message, client);
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    // Темп отправки задаёт очередь QueueIRC, цикл событий не блокируется
+    std::string target(message.parts.at(message.parts.size() - 2).substr(0, 1) == "#"
+        ? message.parts.at(0) : message.prefix.nick);
+    std::vector<std::string> botReplyMsg = botReply(text, message, client,
+        [client, target](const std::vector<std::string>& lines) { client->QueueReply(target, lines); });
 
-    for (size_t i = 0; i < botReplyMsg.size(); i++) {
-        if (message.parts.at(message.parts.size() - 2)[0] == '#') {
-            replyChan(botReplyMsg[i], message, client);
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        }
-        else {
-            replyNick(botReplyMsg[i], message, client);
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        }
+    if (message.parts.at(message.parts.size() - 2).substr(0, 1) == "#") {
+        replyChan(botReplyMsg, message, client);
     }
+    else {
+        replyNick(botReplyMsg, message, client);
+    }
+    client->CommandDone(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count());
 }
 
-void replyChan(std::string msgChan, IRCMessage message, IRCBot* client) {
-    client->SendIRC("PRIVMSG " + message.parts.at(0) + " :" + msgChan);
+void replyChan(const std::vector<std::string>& msgChan, const IRCMessage& message, IRCBot* client) {
+    client->QueueReply(std::string(message.parts.at(0)), msgChan);
 }
 
-void replyNick(std::string msgNick, IRCMessage message, IRCBot* client) {
-    client->SendIRC("PRIVMSG " + message.prefix.nick + " :" + msgNick);
+void replyNick(const std::vector<std::string>& msgNick, const IRCMessage& message, IRCBot* client) {
+    client->QueueReply(std::string(message.prefix.nick), msgNick);
 }
 
-std::vector<std::string> botReply(const std::string text, IRCMessage message, IRCBot* client) {
+std::vector<std::string> botReply(const std::string& text, const IRCMessage& message, IRCBot* client, IRCBot::ReplySink later) {
+    std::string nick(message.prefix.nick), host(message.prefix.host), to(message.parts.at(0));
     std::vector<std::string> commSet = splitStrBySpc(text);
+    if (commSet.empty()) {
+        return {};
+    }
+    std::shared_ptr<const IRCConfig> conf = client->Config();
     int execCase = 0;
     std::string reply;
     std::cout << "[!] Command received: " << commSet[0] << '\n';
@@ -269,7 +1414,7 @@ std::vector<std::string> botReply(const std::string text, IRCMessage message, IR
                     }
 
                 }
-                reply += " Type " + IRCBot::commsymbol + "help <command> for more info";
+                reply += " Type " + std::string(1, conf->clientconf.command_symbol) + "help <command> for more info";
             }
             else {
                 bool command_found = false;
@@ -295,12 +1440,10 @@ std::vector<std::string> botReply(const std::string text, IRCMessage message, IR
         }
 
         case 3: {
-            if (message.prefix.nick != IRCBot::botadmnick) {
-                reply += message.prefix.nick + ", you are not my admin!";
+            if (!(message.access & AclAdmin)) {
+                reply += nick + ", you are not my admin!";
             } else {
-                client->SendIRC("QUIT :Quit command received from " + client->botadmnick);
-                std::this_thread::sleep_for(std::chrono::milliseconds(500));
-                client->Disconnect();
+                client->Quit("Quit command received from " + nick);
             }
             break;
         }
@@ -321,30 +1464,21 @@ std::vector<std::string> botReply(const std::string text, IRCMessage message, IR
         }
 
         case 7: {
-            reply += "Bot admin is " + client->botadmnick;
+            reply += "Bot admin is " + conf->clientconf.adminick;
             break;
         }
 
         case 8: {
             if (commSet.size() == 1) {
-                reply += message.prefix.nick + ", your host is: " + message.prefix.host;
+                reply += nick + ", your host is: " + host;
             }
             else {
-                if (!client->ipInfoToken.empty()) {
-                    std::vector<std::string>ipSetStr = getIpAddr(commSet[1]);
-                    if (!ipSetStr.empty()) {
-                        for (size_t i = 0; i < ipSetStr.size(); i++) {
-                            if (i > 0) {
-                                reply += '\n' + getIpInfo(ipSetStr[i], client->ipInfoToken);
-                            }
-                            else {
-                                reply += getIpInfo(ipSetStr[i], client->ipInfoToken);
-                            }
-                        }
-                    }
-                    else {
-                        reply += std::string("\x02\x03") + "04Error! Name or address not understood" + "\x03";
+                if (!conf->featureconf.ipinftkn.empty()) {
+                    std::string name = commSet[1], token = conf->featureconf.ipinftkn;
+                    if (client->Offload([name, token] { return lookupIpInfo(name, token, ""); }, later)) {
+                        return {};
                     }
+                    reply += std::string("\x02\x03") + "04Too many lookups in progress, try again later" + "\x03";
                 }
                 else {
                     reply += std::string("\x02\x03") + "04Token for ipinfo.io not specified, function doesn't work" + "\x03";
@@ -356,17 +1490,13 @@ std::vector<std::string> botReply(const std::string text, IRCMessage message, IR
         }
 
         case 9: {
-            reply += message.prefix.nick + ' ';
-            if (!client->ipInfoToken.empty()) {
-                std::vector<std::string> ipSetStr = getIpAddr(message.prefix.host);
-                if (!ipSetStr.empty()) {
-                    for (size_t i = 0; i < ipSetStr.size(); i++) {
-                        reply += getIpInfo(ipSetStr[i], client->ipInfoToken);
-                    }
-                }
-                else {
-                    reply += std::string("\x02\x03") + "04Error! Name or address not understood" + "\x03";
+            reply += nick + ' ';
+            if (!conf->featureconf.ipinftkn.empty()) {
+                std::string token = conf->featureconf.ipinftkn;
+                if (client->Offload([host, token, nick] { return lookupIpInfo(host, token, nick + ' '); }, later)) {
+                    return {};
                 }
+                reply += std::string("\x02\x03") + "04Too many lookups in progress, try again later" + "\x03";
             }
             else {
                 reply += std::string("\x02\x03") + "04Token for ipinfo.io not specified, function doesn't work" + "\x03";
@@ -377,11 +1507,188 @@ std::vector<std::string> botReply(const std::string text, IRCMessage message, IR
 
         case 10: {
             reply += "Memory usage: " + umemStat() + "kB (RSS)";
+            // Подробности учёта выделений; места выделений - только в консоли (/mem)
+            for (const std::string& line : MemTrack::Report(false)) {
+                reply += "\n" + line;
+            }
             break;
         }
 
         case 11: {
-            reply += message.parts.at(0);
+            reply += to;
+            break;
+        }
+
+        case 12: {
+            int minutes = 0;
+            if (commSet.size() > 2) {
+                try {
+                    minutes = std::stoi(commSet[1]);
+                } catch (const std::exception&) {
+                    minutes = 0;
+                }
+            }
+            if (minutes < 1 || minutes > 10080) {
+                reply += "Usage: " + std::string(1, conf->clientconf.command_symbol) + "rmnd <1-10080 min> <text>";
+                break;
+            }
+
+            std::string note;
+            for (size_t i = 2; i < commSet.size(); i++) {
+                note += (i > 2 ? " " : "") + commSet[i];
+            }
+
+            std::string target = to[0] == '#' ? to : nick;
+            std::string line = nick + ", reminder: " + note;
+            client->Timers().Schedule(int64_t(minutes) * 60000, [client, target, line] { client->QueueReply(target, { line }); });
+
+            reply += "Ok, I'll remind you in " + std::to_string(minutes) + " min";
+            break;
+        }
+
+        case 13: {
+            reply += "Lag: " + client->Lag().Report() + ", reply pace " + std::to_string(client->SendInterval()) + " ms";
+            break;
+        }
+
+        case 14: {
+            SearchIndex* search = client->Search();
+            if (!search) {
+                reply += "History search is disabled";
+                break;
+            }
+            if (commSet.size() < 2) {
+                reply += "Usage: " + std::string(1, conf->clientconf.command_symbol) + "grep <words>";
+                break;
+            }
+
+            std::string query;
+            for (size_t i = 1; i < commSet.size(); i++) {
+                query += (i > 1 ? " " : "") + commSet[i];
+            }
+
+            // Из привата ищем по каналу бота, чужие приваты в индекс не попадают
+            std::string channel = to[0] == '#' ? to : conf->clientconf.botschan;
+            int64_t started = TimerWheel::Now();
+            std::vector<SearchIndex::Match> matches = search->Find(conf->serverconf.bothostname, channel, query, 3);
+            std::cout << "[*] grep \"" << query << "\" in " << channel << ": " << matches.size()
+                      << " matches in " << TimerWheel::Now() - started << " ms" << std::endl;
+
+            if (matches.empty()) {
+                reply += "Nothing found in " + channel;
+                break;
+            }
+            for (size_t i = 0; i < matches.size(); i++) {
+                time_t seconds = matches[i].timestamp / 1000;
+                char stamp[32];
+                strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", localtime(&seconds));
+                reply += (i > 0 ? "\n" : "") + std::string("[") + stamp + "] <" + matches[i].nick + "> " + matches[i].text;
+            }
+            break;
+        }
+
+        case 15: {
+            SeenDb* seen = client->Seen();
+            if (!seen) {
+                reply += "Seen database is disabled";
+                break;
+            }
+            if (commSet.size() < 2) {
+                reply += "Usage: " + std::string(1, conf->clientconf.command_symbol) + "seen <nick>";
+                break;
+            }
+
+            SeenEntry entry;
+            if (!seen->Find(conf->serverconf.bothostname, commSet[1], &entry)) {
+                reply += "I haven't seen " + commSet[1];
+                break;
+            }
+
+            reply += entry.nick + " was seen " + getTimeRun(entry.when) + " ago ";
+            switch (entry.action) {
+                case SeenJoin: reply += "joining " + entry.where; break;
+                case SeenPart: reply += "leaving " + entry.where; break;
+                case SeenQuit: reply += "quitting IRC"; break;
+                case SeenNickTo: reply += "changing nick to " + entry.where; break;
+                case SeenNickFrom: reply += "changing nick from " + entry.where; break;
+                case SeenMessage: reply += "talking in " + entry.where; break;
+            }
+            break;
+        }
+
+        case 16: {
+            Backlog* backlog = client->GetBacklog();
+            if (!backlog) {
+                reply += "Channel backlog is disabled";
+                break;
+            }
+
+            // last [N] [#канал]; из привата - канал бота
+            size_t count = 10;
+            std::string channel = to[0] == '#' ? to : conf->clientconf.botschan;
+            for (size_t i = 1; i < commSet.size(); i++) {
+                if (commSet[i][0] == '#')
+                    channel = commSet[i];
+                else if (isdigit(commSet[i][0]))
+                    count = strtoul(commSet[i].c_str(), nullptr, 10);
+            }
+            count = std::min<size_t>(count, conf->lastconf.maxreply);
+
+            int64_t started = TimerWheel::Now();
+            uint64_t inflated = backlog->GetStats().inflated;
+            std::vector<Backlog::Entry> entries = backlog->Last(foldNick(channel), count);
+            std::cout << "[*] last " << count << " in " << channel << ": " << entries.size() << " lines, "
+                      << backlog->GetStats().inflated - inflated << " blocks inflated in "
+                      << TimerWheel::Now() - started << " ms" << std::endl;
+
+            if (entries.empty()) {
+                reply += "Nothing in " + channel + " yet";
+                break;
+            }
+            std::vector<std::string> lines;
+            for (const Backlog::Entry& entry : entries) {
+                time_t seconds = entry.timestamp / 1000;
+                char stamp[32];
+                strftime(stamp, sizeof(stamp), "%H:%M", localtime(&seconds));
+                if (entry.flags & LogAction)
+                    lines.push_back(std::string("[") + stamp + "] * " + entry.nick + " " + entry.text);
+                else
+                    lines.push_back(std::string("[") + stamp + "] <" + entry.nick + "> " + entry.text);
+            }
+
+            // Пропущенное нужно одному спросившему - в канал идёт только короткий ответ
+            if (to[0] == '#') {
+                client->QueueReply(nick, lines);
+                reply += nick + ", sent you " + std::to_string(lines.size()) + " lines of " + channel;
+                break;
+            }
+            for (size_t i = 0; i < lines.size(); i++) {
+                reply += (i > 0 ? "\n" : "") + lines[i];
+            }
+            break;
+        }
+
+        case 17: {
+            DccServer* dcc = client->Dcc();
+            if (!dcc) {
+                reply += "DCC is disabled";
+                break;
+            }
+            // Имя может содержать пробелы - всё после команды
+            if (commSet.size() == 1)
+                reply += dcc->List();
+            else
+                reply += dcc->Offer(message, text.substr(text.find(' ') + 1));
+            break;
+        }
+
+        case 18: {
+            DccServer* dcc = client->Dcc();
+            if (!dcc) {
+                reply += "DCC is disabled";
+                break;
+            }
+            reply += dcc->OfferChat(message);
             break;
         }
         
@@ -456,12 +1763,3 @@ std::string umemStat() {
 }
 
 time_t IRCBot::startTime;           // Bot startup time
-std::string IRCBot::botchannel;     // Bot initial channel
-std::string IRCBot::botadmnick;     // Bot admin nick
-std::string IRCBot::commsymbol;     // command start symbol
-std::string IRCBot::runonlogin;     // run this on login
-std::string IRCBot::nspassword;     // NickServ password
-std::string IRCBot::botctcpver;     // Bot CTCP version
-std::string IRCBot::ipInfoToken;    // Token at ipinfo.io
-
-
@@ -2,57 +2,89 @@
 #define IRCBOT_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <list>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <map>
+#include <functional>
+#include <mutex>
+#include <csignal>
+#include <poll.h>
 #include <sys/resource.h>
 #include "socket.h"
+#include "config.h"
+#include "ratelimit.h"
+#include "timer.h"
+#include "lagstat.h"
+#include "chanlog.h"
+#include "search.h"
+#include "seen.h"
+#include "capture.h"
+#include "replyfmt.h"
+#include "acl.h"
+#include "trigger.h"
+#include "mpsc.h"
+#include "upgrade.h"
+#include "state.h"
+#include "arena.h"
+#include "bouncer.h"
+#include "dcc.h"
+#include "relay.h"
+#include "backlog.h"
+#include "drift.h"
 
 
 class IRCBot;
+struct HostLookup;
+struct ResolverLink;
 
 extern std::vector<std::string> splitStrBySep(std::string const&, char);
+extern std::string base64Encode(std::string const&);
 
+// Части строки - представления в арене пачки (IRCBot::Arena()): живут, пока
+// разбирается пачка, в которой строка пришла. Что нужно дольше, копируется.
 class IRCCommandPrefix
 {
 public:
     
-    std::string prefix;     // prefix nick!user@host
-    std::string nick;       // nick name
-    std::string user;       // user name
-    std::string host;       // host name
+    std::string_view prefix;    // prefix nick!user@host
+    std::string_view nick;      // nick name
+    std::string_view user;      // user name
+    std::string_view host;      // host name
 
-    void Parse(std::string data)
+    void Parse(std::string_view data)
     {
-        if (data == "")
+        if (data.empty())
             return;
 
-        prefix = data.substr(1, data.find(" ") - 1);
-        std::vector<std::string> tokens;
+        prefix = data.substr(1, data.find(' ') - 1);
 
-        if (prefix.find("@") != std::string::npos)
+        size_t at = prefix.find('@');
+        if (at != std::string_view::npos)
         {
-            tokens = splitStrBySep(prefix, '@');
-            nick = tokens.at(0);
-            host = tokens.at(1);
+            nick = prefix.substr(0, at);
+            host = prefix.substr(at + 1, prefix.find('@', at + 1) - at - 1);
         }
-        if (nick != "" && nick.find("!") != std::string::npos)
+        size_t bang = nick.find('!');
+        if (bang != std::string_view::npos)
         {
-            tokens = splitStrBySep(nick, '!');
-            nick = tokens.at(0);
-            user = tokens.at(1);
+            user = nick.substr(bang + 1, nick.find('!', bang + 1) - bang - 1);
+            nick = nick.substr(0, bang);
         }
     };
 };
 
 struct IRCMessage
 {
-    IRCMessage();
-    IRCMessage(std::string cmd, IRCCommandPrefix p, std::vector<std::string> params) :
-        command(cmd), prefix(p), parts(params) {};
+    explicit IRCMessage(std::pmr::memory_resource* arena) : parts(arena) {};
 
-    std::string command;
+    std::string_view command;
     IRCCommandPrefix prefix;
-    std::vector<std::string> parts;
+    std::pmr::vector<std::string_view> parts;
+    unsigned access = 0;    // уровни AclLevel отправителя (для PRIVMSG и NOTICE)
 };
 
 struct IRCCommandHook
@@ -60,52 +92,152 @@ struct IRCCommandHook
     IRCCommandHook() : function(NULL) {};
 
     std::string command;
-    void (*function)(IRCMessage /*message*/, IRCBot* /*client*/);
+    void (*function)(const IRCMessage& /*message*/, IRCBot* /*client*/);
 };
 
 class IRCBot
 {
 public:
-    IRCBot() : _debug(false) {};
+    IRCBot();
+    ~IRCBot();
 
     bool InitSocket();
-    bool Connect(const char* /*host*/, int /*port*/);
+    // Начать подключение: имя разрешается в потоке резолвера, connect() идёт
+    // в цикле событий; timeoutMs на всё вместе отсчитывает таймер цикла.
+    // false - запрос к резолверу не принят.
+    bool Connect(const char* /*host*/, int /*port*/, int /*timeoutMs*/);
     void Disconnect();
     bool Connected() { return _socket.Connected(); };
     bool SendIRC(std::string /*data*/);
+    // Отправка с ограничением темпа (flood control), для ответов бота и строк
+    // клиентов баунсера; echoed - баунсер уже показал строку своим клиентам
+    void QueueIRC(std::string /*data*/, bool /*echoed*/ = false);
+    // Ответ бота: куски упаковываются в строки PRIVMSG длиной до LINELEN сервера
+    void QueueReply(const std::string& /*target*/, const std::vector<std::string>& /*fragments*/);
+    // Строка другой сети: head ("PRIVMSG #канал :") + relay->text; текст
+    // общий для всех получателей. Сверх лимита ссылки - отбрасывается.
+    void QueueRelay(const std::string& /*head*/, std::shared_ptr<const RelayMessage> /*relay*/, size_t /*link*/);
+
+    // Подключение и регистрация по текущей конфигурации; при неудаче
+    // переподключение планируется с экспоненциальной паузой
+    bool Start();
+    // Одна итерация цикла событий: ожидание данных и срабатывание таймеров
+    void Poll();
+    // Уйти с сервера без переподключения
+    void Quit(std::string /*reason*/);
+    bool Finished() { return _quit && !_session; };
+
+    // Горячее обновление: запускает argv (бинарник и его аргументы, к ним
+    // добавится --upgrade-fd N) и передаёт ему сокет и состояние сессии.
+    // true - соединение отдано, этот процесс должен завершиться.
+    bool Upgrade(std::vector<std::string> /*argv*/);
+    // Сессию сейчас можно передать: зарегистрирована, без TLS, вывод ушёл
+    bool CanUpgrade();
+    // Вместо Start() в процессе, запущенном с --upgrade-fd
+    bool Resume(int /*channel*/);
+
+    // Задача для цикла событий из любого потока; выполнится в Poll().
+    // Всё, что трогает соединение (SendIRC, SetConfig), из других потоков
+    // идёт только так.
+    void Post(std::function<void()> /*task*/);
+
+    // Долгая работа с сетью (HTTP, DNS) в отдельном потоке, чтобы не стоял цикл
+    // событий; строки результата уходят в done уже в цикле, если бот ещё жив.
+    // false - занято MaxOffloads потоков
+    typedef std::function<void(const std::vector<std::string>& /*lines*/)> ReplySink;
+    bool Offload(std::function<std::vector<std::string>()> /*job*/, ReplySink /*done*/);
+
+    // Дополнительные дескрипторы в poll() цикла; callback получает revents
+    typedef std::function<void(short /*revents*/)> FdCallback;
+    void WatchFd(int /*fd*/, short /*events*/, FdCallback /*callback*/);
+    void UnwatchFd(int /*fd*/);
+
+    TimerWheel& Timers() { return _timers; };
+    // Задержка до сервера по собственным PING/PONG текущего соединения
+    const LagStats& Lag() { return _lagStats; };
+    int SendInterval() { return _sendInterval; };
+    // Память, которая живёт до конца разбора текущей пачки строк
+    BatchArena& Arena() { return _arena; };
     bool Login(std::string /*nick*/, std::string /*user*/, std::string /*password*/, std::string /*realname*/);
     void ReceiveData();
-    void HookIRCCommand(std::string /*command*/, void (*function)(IRCMessage /*message*/, IRCBot* /*client*/));
-    void Parse(std::string /*data*/);
-    void HandleCTCP(IRCMessage /*message*/);
+    // Разбор принятых байтов как из сокета: запись трафика воспроизводится через него
+    void Feed(const char* /*data*/, size_t /*length*/);
+    void HookIRCCommand(std::string /*command*/, void (*function)(const IRCMessage& /*message*/, IRCBot* /*client*/));
+    // Одна строка без CRLF; её память должна жить до конца пачки (арена)
+    void Parse(std::string_view /*data*/);
+    void HandleCTCP(const IRCMessage& /*message*/);
 
     // Default internal handlers
-    void HandlePrivMsg(IRCMessage /*message*/);
-    void HandleNotice(IRCMessage /*message*/);
-    void HandleChannelJoinPart(IRCMessage /*message*/);
-    void HandleUserNickChange(IRCMessage /*message*/);
-    void HandleUserQuit(IRCMessage /*message*/);
-    void HandleChannelNamesList(IRCMessage /*message*/);
-    void HandleNicknameInUse(IRCMessage /*message*/);
-    void HandleServerMessage(IRCMessage /*message*/);
-    void HandleEndOfNames(IRCMessage /*message*/);
-    void HandleStartOfMOTD(IRCMessage /*message*/);
-    void HandleMOTDText(IRCMessage /*message*/);
-    void HandleEndOfMOTD(IRCMessage /*message*/);
-    void HandleMissingMOTD(IRCMessage /*message*/);
-    void HandleAwayMsgTooLong(IRCMessage /*message*/);
+    void HandlePrivMsg(const IRCMessage& /*message*/);
+    void HandleNotice(const IRCMessage& /*message*/);
+    void HandleChannelJoinPart(const IRCMessage& /*message*/);
+    void HandleKick(const IRCMessage& /*message*/);
+    void HandleUserNickChange(const IRCMessage& /*message*/);
+    void HandleUserQuit(const IRCMessage& /*message*/);
+    void HandleChannelNamesList(const IRCMessage& /*message*/);
+    void HandleNicknameInUse(const IRCMessage& /*message*/);
+    void HandleWelcome(const IRCMessage& /*message*/);
+    void HandleCap(const IRCMessage& /*message*/);
+    void HandleAuthenticate(const IRCMessage& /*message*/);
+    void HandleLoggedIn(const IRCMessage& /*message*/);
+    void HandleSaslResult(const IRCMessage& /*message*/);
+    void HandlePong(const IRCMessage& /*message*/);
+    void HandleServerMessage(const IRCMessage& /*message*/);
+    void HandleISupport(const IRCMessage& /*message*/);
+    void HandleEndOfNames(const IRCMessage& /*message*/);
+    void HandleStartOfMOTD(const IRCMessage& /*message*/);
+    void HandleMOTDText(const IRCMessage& /*message*/);
+    void HandleEndOfMOTD(const IRCMessage& /*message*/);
+    void HandleMissingMOTD(const IRCMessage& /*message*/);
+    void HandleAwayMsgTooLong(const IRCMessage& /*message*/);
 
     void Debug(bool debug) { _debug = debug; };
+    // Журнал входящих PRIVMSG; nullptr - не писать
+    void SetChannelLog(ChannelLog* log) { _chanlog = log; };
+    // Поиск по журналу для команды grep; nullptr - выключен
+    void SetSearchIndex(SearchIndex* search) { _search = search; };
+    SearchIndex* Search() { return _search; };
+    // База команды seen; nullptr - выключена
+    void SetSeenDb(SeenDb* seen) { _seen = seen; };
+    SeenDb* Seen() { return _seen; };
+    // Недавние сообщения каналов для команды last; nullptr - выключены
+    void SetBacklog(Backlog* backlog) { _backlog = backlog; };
+    Backlog* GetBacklog();
+    // Запись принятого трафика; nullptr - не писать
+    void SetCapture(CaptureWriter* capture) { _capture = capture; };
+    // Снимок состояния: читается сразу (каналы, лимиты, задержка) и
+    // перезаписывается по таймеру; nullptr - выключен
+    void SetState(StateSnapshot* /*state*/);
+    void SaveState();
+    // Баунсер для IRC-клиентов; nullptr - выключен
+    void SetBouncer(Bouncer* bouncer) { _bouncer = bouncer; };
+    // Передача файлов и чат по DCC; nullptr - выключены
+    void SetDcc(DccServer* dcc) { _dcc = dcc; };
+    DccServer* Dcc() { return _dcc; };
+    // Контроль медленного роста ресурсов; nullptr - выключен
+    void SetDrift(DriftMonitor* /*drift*/);
+    // Время обработки команды бота, для p99 в контроле роста
+    void CommandDone(int64_t micros) { if (_drift) _drift->Command(micros); };
+    // Мост каналов между сетями; nullptr - выключен
+    void SetRelay(RelayHub* relay) { _relay = relay; };
 
-    static std::string botchannel;    // Bot initial channel
-    static std::string nspassword;    // NickServ password
-    static std::string runonlogin;    // Run on connect commands
-    static std::string botadmnick;    // Bot admin nickname
-    static std::string commsymbol;    // Command first symbol
-    static std::string botctcpver;    // Bot CTCP version reply
-    static time_t startTime;    	  // Bot startup time
+    // Сессия для баунсера: с каким ником и где сидит бот
+    bool Registered() const { return _session && _registered; };
+    const std::string& Nick() const { return _nick; };
+    const std::string& SelfHost() const { return _selfHost; };
+    const std::vector<std::string>& ISupport() const { return _isupport; };
+    // Сокет сервера: по его локальному адресу DCC предлагает подключаться
+    int SocketFd() const { return _socket.Fd(); };
+    std::vector<std::string> ChannelNames() const;
+
+    // Текущий снимок конфигурации; читается без блокировок, заменяется целиком
+    std::shared_ptr<const IRCConfig> Config() const { return _config.load(); };
+    void SetConfig(std::shared_ptr<const IRCConfig> /*config*/);
 
-    static std::string ipInfoToken;
+    // Проверка частоты команд; true - команду нужно отбросить
+    bool CommandLimited(const IRCMessage& /*message*/);
+
+    static time_t startTime;    	  // Bot startup time
 
     std::vector<std::pair<std::string, std::string>> icmd = {
         {"err", "reserved for err message"      },  // 0
@@ -119,28 +251,162 @@ public:
         {"host", "Shows host information"       },  // 8
         {"myip", "Shows your ip information"    },  // 9
         {"rmem", "RAM max resident set size"    },  // 10
-        {"chan", "Shows current channel"        }   // 11
+        {"chan", "Shows current channel"        },  // 11
+        {"rmnd", "Reminds you: rmnd <min> <text>"}, // 12
+        {"lagt", "Shows bot lag to the server"  },  // 13
+        {"grep", "Searches channel history: grep <words>"}, // 14
+        {"seen", "When was nick here: seen <nick>"}, // 15
+        {"last", "Recent channel lines: last [N] [#chan]"}, // 16
+        {"file", "Sends a file over DCC: file [name]"}, // 17
+        {"chat", "Opens a DCC chat with the bot"} // 18
     };
 
 private:
-    void HandleCommand(IRCMessage /*message*/);
-    void CallHook(std::string /*command*/, IRCMessage /*message*/);
+    static const size_t DefaultLineLen = 512;   // RFC 1459, вместе с CRLF
+    static const size_t DefaultUserLen = 10;
+    static const size_t MaxTriggerHits = 16;    // совпадений триггеров на сообщение
+    static const int UpgradeTimeout = 10000;    // ожидание второго процесса при обновлении, мс
+    static const int MaxOffloads = 4;           // одновременных потоков Offload()
+
+    void CallHook(const IRCMessage& /*message*/);
+    // Уведомление getaddrinfo_a (SIGEV_THREAD, поток резолвера)
+    static void LookupDone(union sigval /*value*/);
+    void Resolved(HostLookup* /*lookup*/);
+    void ConnectNext();
+    void OnConnected();
+    // Бросить незавершённые разрешение имени и connect()
+    void AbandonConnect();
+    void ContinueHandshake();
+    void Register();
+    void OnRegistered();
+    std::string NextNick();
+    void ScheduleReconnect();
+    // Забрать процесс, не принявший /upgrade, без ожидания в цикле событий
+    void ReapUpgrade(pid_t /*pid*/, int /*attempt*/);
+    void SchedulePing();
+    void CheckPing();
+    void ScheduleStateSave();
+    void ScheduleDriftSample();
+    void SampleDrift();
+    void DrainQueue();
+    // Место под текст PRIVMSG target в строке, которую сервер перешлёт с нашим префиксом
+    size_t ReplyBudget(const std::string& /*target*/) const;
+    void LogMessage(const IRCMessage& /*message*/, std::string_view /*text*/, uint16_t /*flags*/);
+    void UpdateSeen(std::string_view /*nick*/, SeenAction /*action*/, std::string_view /*where*/);
+    void Remember(const IRCMessage& /*message*/, std::string_view /*text*/, uint16_t /*flags*/);
+    // Пересобирает список доступа, если сменился снимок конфигурации
+    void UpdateAcl();
+    void RunTriggers(const IRCMessage& /*message*/, std::string_view /*text*/);
+    void RunPosted();
+    void ApplyISupport(const std::string& /*token*/);
 
     IRCSocket _socket;
 
     std::list<IRCCommandHook> _hooks;
 
+    std::atomic<std::shared_ptr<const IRCConfig>> _config;
+    std::atomic<bool> _reconnect;
+    bool _session;                  // соединение установлено и ещё не закрыто
+    bool _quit;                     // выход без переподключения
+    bool _registered;               // получен 001, канал и NickServ уже отработаны
+    bool _saslDone;                 // SASL прошёл успешно в этой сессии
+    size_t _nickAttempt;            // номер следующего запасного ника
+    int64_t _connectStarted;        // начало подключения, для замера time-to-join
+    int _backoff;                   // текущая пауза перед переподключением, с
+
+    std::string _connectHost;       // сервер текущей попытки, для сообщений
+    HostLookup* _lookup;            // запрос к резолверу текущей попытки
+    struct addrinfo* _addresses;    // адреса сервера из резолвера
+    struct addrinfo* _nextAddress;  // следующий адрес для connect()
+    std::shared_ptr<ResolverLink> _resolver;    // через него поток резолвера (и Offload) находит бота
+    int _offloads;                  // потоков Offload() ещё не вернули результат
+
+    TimerWheel _timers;
+
+    TimerWheel::TimerId _pingTimer;
+    TimerWheel::TimerId _drainTimer;
+    TimerWheel::TimerId _handshakeTimer;
+    TimerWheel::TimerId _connectTimer;
+    TimerWheel::TimerId _stateTimer;
+    TimerWheel::TimerId _driftTimer;
+
+    struct FdWatch
+    {
+        short events;
+        FdCallback callback;
+    };
+    std::map<int, FdWatch> _watches;
+    std::vector<struct pollfd> _pollfds;
+
+    MpscQueue<std::function<void()>> _posted;
+    int _wakeFd;                    // eventfd: в очереди _posted есть задачи
+    std::atomic<bool> _wakePending; // в _wakeFd уже записано, цикл ещё не проснулся
+
+    std::string _saslMech;          // механизм SASL текущей регистрации
+
+    std::string _inbuf;             // неполная строка, ожидающая продолжения
+    BatchArena _arena;              // строки пачки и всё, что из них разобрано
+    struct QueuedLine
+    {
+        std::string head;                           // строка целиком или её начало
+        std::shared_ptr<const RelayMessage> relay;  // продолжение из другой сети
+        size_t link;                                // ссылка моста, для замера задержки
+        bool echoed;                                // эхо клиентам баунсера уже было
+    };
+    std::deque<QueuedLine> _sendq;  // очередь QueueIRC
+    int64_t _lastRecv;              // время последних данных от сервера, мс
+    int64_t _lastQueued;            // время последней отправки из очереди, мс
+    int64_t _pingSent;              // время нашего последнего PING, мс
+    LagStats _lagStats;
+    int _lagStrikes;                // подряд идущие замеры выше lagLimit
+    int _pongCount;                 // ответов на PING сервера с последнего отчёта
+    int _sendInterval;              // пауза между строками очереди, мс
+    size_t _lineLen;                // LINELEN из 005
+    size_t _userLen;                // USERLEN из 005
+    std::string _selfHost;          // наш user@host, как его видят другие (из своего JOIN)
+    std::vector<std::string> _isupport;             // токены 005 текущего соединения
+    std::map<std::string, std::string> _channels;   // каналы, где мы сидим: свёрнутое имя -> имя
+    std::vector<std::string> _rejoin;   // каналы прошлой сессии или прошлого запуска, для JOIN после 001
+    int _savedLag;                      // задержка из снимка, мс: начальный темп первого подключения
+
+    RateLimiter _userLimiter;                       // по nick!user@host
+    RateLimiter _chanLimiter;                       // по каналу
+    RateLimiter _relayLimiter;                      // по ссылке моста
+    std::shared_ptr<const IRCConfig> _limitConfig;  // снимок, по которому настроены лимиты
+    std::shared_ptr<const IRCConfig> _relayConfig;  // снимок, по которому настроен _relayLimiter
+
+    AccessList _acl;
+    std::shared_ptr<const IRCConfig> _aclConfig;    // снимок, из которого собран _acl
+
+    TriggerEngine _triggers;
+
+    ChannelLog* _chanlog;
+    SearchIndex* _search;
+    SeenDb* _seen;
+    Backlog* _backlog;
+    std::shared_ptr<const IRCConfig> _backlogConfig;    // снимок, по которому настроен _backlog
+    std::string _backlogKey;                            // свёрнутое имя канала, без выделений
+    CaptureWriter* _capture;
+    StateSnapshot* _state;
+    Bouncer* _bouncer;
+    DccServer* _dcc;
+    DriftMonitor* _drift;
+    std::shared_ptr<const IRCConfig> _driftConfig;  // снимок, по которому настроен _drift
+    RelayHub* _relay;
+
     std::string _nick;
     std::string _user;
 
     bool _debug;
 };
 
-void onPrivMsg(IRCMessage message, IRCBot* client);
+void onPrivMsg(const IRCMessage& message, IRCBot* client);
 
-std::vector<std::string> botReply(std::string, IRCMessage, IRCBot*);
-void replyChan(std::string, IRCMessage, IRCBot*);
-void replyNick(std::string, IRCMessage, IRCBot*);
+// later получает ответ, который готовится вне цикла событий (ip по ipinfo.io);
+// сразу тогда возвращается пустой список
+std::vector<std::string> botReply(const std::string&, const IRCMessage&, IRCBot*, IRCBot::ReplySink /*later*/);
+void replyChan(const std::vector<std::string>&, const IRCMessage&, IRCBot*);
+void replyNick(const std::vector<std::string>&, const IRCMessage&, IRCBot*);
 
 std::string getTimeRun(time_t);
 std::string getDateVal(int);
@@ -10,7 +10,7 @@
 #include <arpa/inet.h>
 #include <curl/curl.h>
 
-#include "cppjson.h"
+#include "jsonscan.h"
 #include "ircbot.h"
 
 
@@ -52,6 +52,12 @@ std::string getIpInfo(std::string /* string with ip */ ipAddrStr, std::string ip
 		// Передача указателя на строку, куда будут записываться данные
 		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readbuffer);
 
+		// Запрос идёт в потоке IRCBot::Offload: без сигналов (их получил бы любой
+		// поток), и с пределом, чтобы медленный ipinfo.io не держал поток вечно
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+
 		// Выполнение запроса
 		res = curl_easy_perform(curl);
 
@@ -66,51 +72,60 @@ std::string getIpInfo(std::string /* string with ip */ ipAddrStr, std::string ip
 			// Возврат строки с ipinfo.io
 			ipInfoStr = readbuffer;
 			std::cout << "IP info string:\n" << ipInfoStr << '\n';
-			nlohmann::json jsonData = nlohmann::json::parse(ipInfoStr);
-
-			if (!jsonData["ip"].is_null())
-			{
-				ipReadStr += std::string("\x02") + "IP:      " + std::string("\x03") + "03" + jsonData["ip"].get<std::string>() + "\x03" + '\n';
-			}
-
-			if (!jsonData["hostname"].is_null())
-			{
-				ipReadStr += "Host:    " + jsonData["hostname"].get<std::string>() + '\n';
-			}
-
-			if (!jsonData["city"].is_null())
-			{
-				ipReadStr += "City:    " + jsonData["city"].get<std::string>() + '\n';
-			}
+			IpInfo info;
 
-			if (!jsonData["region"].is_null())
+			// Нужны только девять строковых полей - извлекаем их за один проход,
+			// без дерева JSON; битый ответ не должен ронять поток приёма
+			if (!parseIpInfo(ipInfoStr, info))
 			{
-				ipReadStr += "Region:  " + jsonData["region"].get<std::string>() + '\n';
+				ipReadStr += std::string("\x02\x03") + "04Error! Bad response from ipinfo.io" + "\x03";
 			}
-
-			if (!jsonData["country"].is_null())
-			{
-				ipReadStr += "Country: " + jsonData["country"].get<std::string>() + '\n';
-			}
-
-			if (!jsonData["loc"].is_null())
-			{
-				ipReadStr += "Loc:     " + jsonData["loc"].get<std::string>() + '\n';
-			}
-
-			if (!jsonData["org"].is_null())
-			{
-				ipReadStr += "Org:     " + jsonData["org"].get<std::string>() + '\n';
-			}
-
-			if (!jsonData["postal"].is_null())
-			{
-				ipReadStr += "Index:   " + jsonData["postal"].get<std::string>() + '\n';
-			}
-
-			if (!jsonData["timezone"].is_null())
+			else
 			{
-				ipReadStr += "Tzone:   " + jsonData["timezone"].get<std::string>() /* + '\n' */;
+				if (!info.ip.empty())
+				{
+					ipReadStr += std::string("\x02") + "IP:      " + std::string("\x03") + "03" + info.ip + "\x03" + '\n';
+				}
+
+				if (!info.hostname.empty())
+				{
+					ipReadStr += "Host:    " + info.hostname + '\n';
+				}
+
+				if (!info.city.empty())
+				{
+					ipReadStr += "City:    " + info.city + '\n';
+				}
+
+				if (!info.region.empty())
+				{
+					ipReadStr += "Region:  " + info.region + '\n';
+				}
+
+				if (!info.country.empty())
+				{
+					ipReadStr += "Country: " + info.country + '\n';
+				}
+
+				if (!info.loc.empty())
+				{
+					ipReadStr += "Loc:     " + info.loc + '\n';
+				}
+
+				if (!info.org.empty())
+				{
+					ipReadStr += "Org:     " + info.org + '\n';
+				}
+
+				if (!info.postal.empty())
+				{
+					ipReadStr += "Index:   " + info.postal + '\n';
+				}
+
+				if (!info.timezone.empty())
+				{
+					ipReadStr += "Tzone:   " + info.timezone /* + '\n' */;
+				}
 			}
 		}
 		// Освобождение ресурсов
@@ -13,7 +13,7 @@
 // #include <arpa/inet.h>
 // #include <curl/curl.h>
 
-// #include "cppjson.h"
+// #include "jsonscan.h"
 // #include "ircbot.h"
 
 
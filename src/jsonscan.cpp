@@ -0,0 +1,238 @@
+#include <cctype>
+
+#include "jsonscan.h"
+
+namespace
+{
+
+class JsonScanner
+{
+public:
+    JsonScanner(const std::string& json) : _p(json.data()), _end(json.data() + json.size()) {};
+
+    void SkipSpace()
+    {
+        while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r'))
+            ++_p;
+    }
+
+    bool Consume(char c)
+    {
+        SkipSpace();
+        if (_p < _end && *_p == c)
+        {
+            ++_p;
+            return true;
+        }
+        return false;
+    }
+
+    char Peek()
+    {
+        SkipSpace();
+        return _p < _end ? *_p : '\0';
+    }
+
+    // Строка с разбором escape-последовательностей; out == NULL - только пропуск
+    bool String(std::string* out)
+    {
+        if (!Consume('"'))
+            return false;
+
+        while (_p < _end)
+        {
+            // Участок без кавычек и '\' копируется одним куском
+            const char* start = _p;
+            while (_p < _end && *_p != '"' && *_p != '\\')
+                ++_p;
+            if (out)
+                out->append(start, _p - start);
+
+            if (_p >= _end)
+                return false;
+            if (*_p++ == '"')
+                return true;
+
+            if (_p >= _end)
+                return false;
+            char c = *_p++;
+            switch (c)
+            {
+            case '"': case '\\': case '/':
+                if (out) out->push_back(c);
+                break;
+            case 'b': if (out) out->push_back('\b'); break;
+            case 'f': if (out) out->push_back('\f'); break;
+            case 'n': if (out) out->push_back('\n'); break;
+            case 'r': if (out) out->push_back('\r'); break;
+            case 't': if (out) out->push_back('\t'); break;
+            case 'u':
+                if (!Unicode(out))
+                    return false;
+                break;
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Любое значение без сохранения; глубина вложенности ограничена
+    bool Skip(int depth = 0)
+    {
+        if (depth > 64)
+            return false;
+
+        char c = Peek();
+        if (c == '"')
+            return String(NULL);
+
+        if (c == '{' || c == '[')
+        {
+            char close = c == '{' ? '}' : ']';
+            ++_p;
+            if (Consume(close))
+                return true;
+            do
+            {
+                if (c == '{' && (!String(NULL) || !Consume(':')))
+                    return false;
+                if (!Skip(depth + 1))
+                    return false;
+            } while (Consume(','));
+            return Consume(close);
+        }
+
+        // Число, true, false, null
+        const char* start = _p;
+        while (_p < _end && (isalnum((unsigned char)*_p) || *_p == '-' || *_p == '+' || *_p == '.'))
+            ++_p;
+        return _p > start;
+    }
+
+    bool AtEnd()
+    {
+        SkipSpace();
+        return _p == _end;
+    }
+
+private:
+    bool Hex4(unsigned& code)
+    {
+        if (_end - _p < 4)
+            return false;
+        code = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char c = *_p++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool Unicode(std::string* out)
+    {
+        unsigned code;
+        if (!Hex4(code))
+            return false;
+
+        // Суррогатная пара UTF-16
+        if (code >= 0xD800 && code <= 0xDBFF)
+        {
+            unsigned low;
+            if (_end - _p < 6 || _p[0] != '\\' || _p[1] != 'u')
+                return false;
+            _p += 2;
+            if (!Hex4(low) || low < 0xDC00 || low > 0xDFFF)
+                return false;
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        if (!out)
+            return true;
+
+        if (code < 0x80)
+            out->push_back(char(code));
+        else if (code < 0x800)
+        {
+            out->push_back(char(0xC0 | (code >> 6)));
+            out->push_back(char(0x80 | (code & 0x3F)));
+        }
+        else if (code < 0x10000)
+        {
+            out->push_back(char(0xE0 | (code >> 12)));
+            out->push_back(char(0x80 | ((code >> 6) & 0x3F)));
+            out->push_back(char(0x80 | (code & 0x3F)));
+        }
+        else
+        {
+            out->push_back(char(0xF0 | (code >> 18)));
+            out->push_back(char(0x80 | ((code >> 12) & 0x3F)));
+            out->push_back(char(0x80 | ((code >> 6) & 0x3F)));
+            out->push_back(char(0x80 | (code & 0x3F)));
+        }
+        return true;
+    }
+
+    const char* _p;
+    const char* _end;
+};
+
+}
+
+bool jsonExtract(const std::string& json, const char* const* keys, std::string* const* values, size_t count)
+{
+    JsonScanner scanner(json);
+    std::string key;
+
+    for (size_t i = 0; i < count; ++i)
+        values[i]->clear();
+
+    if (!scanner.Consume('{'))
+        return false;
+    if (scanner.Consume('}'))
+        return scanner.AtEnd();
+
+    do
+    {
+        key.clear();
+        if (!scanner.String(&key) || !scanner.Consume(':'))
+            return false;
+
+        std::string* target = NULL;
+        if (scanner.Peek() == '"')
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (key == keys[i])
+                {
+                    target = values[i];
+                    target->clear();    // повторный ключ - действует последний
+                    break;
+                }
+            }
+        }
+
+        if (target ? !scanner.String(target) : !scanner.Skip())
+            return false;
+    } while (scanner.Consume(','));
+
+    return scanner.Consume('}') && scanner.AtEnd();
+}
+
+bool parseIpInfo(const std::string& json, IpInfo& info)
+{
+    static const char* const keys[] = {
+        "ip", "hostname", "city", "region", "country", "loc", "org", "postal", "timezone"
+    };
+    std::string* const values[] = {
+        &info.ip, &info.hostname, &info.city, &info.region, &info.country,
+        &info.loc, &info.org, &info.postal, &info.timezone
+    };
+
+    return jsonExtract(json, keys, values, sizeof(keys) / sizeof(keys[0]));
+}
@@ -0,0 +1,28 @@
+#ifndef JSONSCAN_H_
+#define JSONSCAN_H_
+
+#include <string>
+
+// Потоковое извлечение строковых полей верхнего уровня JSON-объекта.
+// Документ просматривается один раз без построения дерева: вложенные объекты,
+// массивы и нестроковые значения пропускаются, совпавшие ключи раскодируются
+// прямо в *values[i]. На некорректном входе возвращает false, не бросая исключений.
+bool jsonExtract(const std::string& json, const char* const* keys, std::string* const* values, size_t count);
+
+// Ответ ipinfo.io - только те поля, что показывает бот
+struct IpInfo
+{
+    std::string ip;
+    std::string hostname;
+    std::string city;
+    std::string region;
+    std::string country;
+    std::string loc;
+    std::string org;
+    std::string postal;
+    std::string timezone;
+};
+
+bool parseIpInfo(const std::string& json, IpInfo& info);
+
+#endif
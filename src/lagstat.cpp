@@ -0,0 +1,58 @@
+#include "lagstat.h"
+
+void LagStats::Reset()
+{
+    for (int i = 0; i < Buckets; ++i)
+        _hist[i] = 0;
+    _count = 0;
+    _smoothed = 0;
+    _last = -1;
+    _max = 0;
+}
+
+void LagStats::Add(int ms)
+{
+    if (ms < 0)
+        ms = 0;
+
+    int bucket = 0;
+    while (bucket < Buckets - 1 && ms >= (1 << bucket))
+        ++bucket;
+    ++_hist[bucket];
+
+    // EWMA с весом 1/8, как srtt в TCP
+    _smoothed = _count ? _smoothed + (ms - _smoothed) / 8 : ms;
+    ++_count;
+    _last = ms;
+    if (ms > _max)
+        _max = ms;
+}
+
+int LagStats::Percentile(double p) const
+{
+    if (_count == 0)
+        return -1;
+
+    uint64_t rank = uint64_t(p * _count);
+    if (rank >= _count)
+        rank = _count - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < Buckets; ++i)
+    {
+        seen += _hist[i];
+        if (seen > rank)
+            return i == Buckets - 1 ? _max : (1 << i);
+    }
+    return _max;
+}
+
+std::string LagStats::Report() const
+{
+    if (_count == 0)
+        return "no measurements yet";
+
+    return "last " + std::to_string(_last) + " ms, avg " + std::to_string(Smoothed())
+        + " ms, p50 <" + std::to_string(Percentile(0.5)) + " ms, p99 <" + std::to_string(Percentile(0.99))
+        + " ms, max " + std::to_string(_max) + " ms (" + std::to_string(_count) + " pings)";
+}
@@ -0,0 +1,35 @@
+#ifndef LAGSTAT_H_
+#define LAGSTAT_H_
+
+#include <string>
+#include <cstdint>
+
+// Статистика задержки PING/PONG: гистограмма с логарифмическими корзинами
+// (1, 2, 4 ... мс) и сглаженное среднее для управления темпом отправки.
+class LagStats
+{
+public:
+    LagStats() { Reset(); };
+
+    void Reset();
+    void Add(int ms);
+
+    int Last() const { return _last; };
+    int Smoothed() const { return _count ? int(_smoothed) : -1; };
+    // Верхняя граница корзины, в которую попадает заданный процентиль
+    int Percentile(double p) const;
+    uint64_t Count() const { return _count; };
+
+    std::string Report() const;
+
+private:
+    static const int Buckets = 18;  // до 2^17 мс (~2 мин) и всё, что больше
+
+    uint64_t _hist[Buckets];
+    uint64_t _count;
+    double _smoothed;
+    int _last;
+    int _max;
+};
+
+#endif
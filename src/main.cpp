@@ -8,131 +8,29 @@
 #include <string>
 #include <utility>
 #include <map>
+#include <atomic>
 #include <signal.h>
+#include <unistd.h>
 #include <memory> // Для std::shared_ptr
+#include <curl/curl.h>
 
-#include "cpptoml.h" // Подключение библиотеки cpptoml
 #include "thread.h"
+#include "config.h"
 #include "ircbot.h"
-
-volatile bool running;
-
-struct IRCConfig {
-    struct Server {
-        std::string bothostname;    // Bot host name
-        int bothostport;            // Bot host port
-        std::string bothostpass;    // Bot host pass
-    } serverconf;
-
-    struct Client {
-        std::string username;   // Bot usernane
-        std::string nickname;   // Bot nickname
-        std::string realname;   // Bot realname
-        std::string nspasswd;   // NickServ password
-        std::string botschan;   // Bot channel
-        std::string adminick;   // Bot admin nick
-        std::string runatcon;   // Any command sent upon connection
-        std::string xdccvers;
-        bool connect_runbot;    // Connect at launch
-        char command_symbol;    // Bot command symbol
-    } clientconf;
-
-    struct Feature
-    {
-        std::string ipinftkn;
-    } featureconf;
-    
-};
-
-// Функция для парсинга TOML-файла
-IRCConfig parseTomlFile(const std::string& filename) {
-    IRCConfig config;
-
-    try {
-        // Загрузка TOML-файла
-        auto table = cpptoml::parse_file(filename);
-
-        // Секция [ircServer]
-        const auto& ircServer = table->get_table("ircServer");
-        config.serverconf.bothostname = *ircServer->get_as<std::string>("ircServerHost");
-        config.serverconf.bothostport = *ircServer->get_as<int>("ircServerPort");
-        config.serverconf.bothostpass = *ircServer->get_as<std::string>("ircServerPass");
-
-        // Секция [ircClient]
-        const auto& ircClient = table->get_table("ircClient");
-        config.clientconf.username = *ircClient->get_as<std::string>("ircBotUser");
-        config.clientconf.nickname = *ircClient->get_as<std::string>("ircBotNick");
-        config.clientconf.realname = *ircClient->get_as<std::string>("ircBotRnam");
-        config.clientconf.nspasswd = *ircClient->get_as<std::string>("ircBotNspw");
-        config.clientconf.botschan = *ircClient->get_as<std::string>("ircBotChan");
-        config.clientconf.adminick = *ircClient->get_as<std::string>("ircBotAdmi");
-        config.clientconf.runatcon = *ircClient->get_as<std::string>("ircBotRcon");
-        config.clientconf.xdccvers = *ircClient->get_as<std::string>("ircBotDccv");
-        config.clientconf.connect_runbot = *ircClient->get_as<bool>("ircBotAcon");
-
-        // Командный символ читается как строка длиной в один символ
-        std::string commandSymbolStr = *ircClient->get_as<std::string>("ircBotCsym");
-        if (commandSymbolStr.length() == 1) {
-            config.clientconf.command_symbol = commandSymbolStr[0];
-        } else {
-            throw std::runtime_error("ircBotCsym must be a single character.");
-        }
-
-        // Секция [botComset] - параметры дополнительных команд бота
-        auto botComset = table->get_table("botComset");
-
-        if (botComset)
-        {
-            auto ipinftkn = botComset->get_as<std::string>("ipInfToken");
-            if (ipinftkn)
-            {
-                config.featureconf.ipinftkn = *ipinftkn;
-            }
-            else
-            {
-                std::cerr << "[botComset] exists, but 'ipInfToken' is missing or not a string." << std::endl;
-                // Обработка ошибки или установка значения по умолчанию
-            }
-        }
-        else
-        {
-            std::cerr << "[botComset] section is missing in the TOML file." << std::endl;
-            // Здесь можно использовать значения по умолчанию или завершить программу
-        }
-
-    } catch (const cpptoml::parse_exception& e) {
-        std::cerr << "TOML parsing error: " << e.what() << "\n";
-        throw;
-    } catch (const std::exception& e) {
-        std::cerr << "Error parsing TOML file: " << e.what() << "\n";
-        throw;
-    }
-
-    return config;
-}
-
-// Функция для вывода конфигурации
-void printConfig(const IRCConfig& config) {
-    std::cout << "IRC Server Configuration:\n";
-    std::cout << "Host: " << config.serverconf.bothostname << "\n";
-    std::cout << "Port: " << config.serverconf.bothostport << "\n";
-    std::cout << "Password: " << config.serverconf.bothostpass << "\n\n";
-
-    std::cout << "IRC Client Configuration:\n";
-    std::cout << "Username: " << config.clientconf.username << "\n";
-    std::cout << "Nickname: " << config.clientconf.nickname << "\n";
-    std::cout << "Realname: " << config.clientconf.realname << "\n";
-    std::cout << "NickServ Password: " << config.clientconf.nspasswd << "\n";
-    std::cout << "On IRC connect run: " << config.clientconf.runatcon << "\n";
-    std::cout << "Channel: " << config.clientconf.botschan << "\n";
-    std::cout << "Admin Nick: " << config.clientconf.adminick << "\n";
-    std::cout << "CTCP version: " << config.clientconf.xdccvers << "\n";
-    std::cout << "Auto Connect: " << (config.clientconf.connect_runbot ? "true" : "false") << "\n";
-    std::cout << "Command Symbol: '" << config.clientconf.command_symbol << "'\n";
-
-    std::cout << "Bot features:\n";
-    std::cout << "IP info token: " << config.featureconf.ipinftkn << "\n";
-}
+#include "chanlog.h"
+#include "search.h"
+#include "seen.h"
+#include "capture.h"
+#include "state.h"
+#include "relay.h"
+#include "memtrack.h"
+#include "drift.h"
+#include "dcc.h"
+
+// Пишут главный поток и обработчик сигнала, читают потоки сетей; без блокировок,
+// поэтому из обработчика сигнала её менять можно
+std::atomic<bool> running;
+static_assert(std::atomic<bool>::is_always_lock_free);
 
 void signalHandler(int signal)
 {
@@ -197,6 +95,54 @@ private:
 
 ConsoleCommandHandler commandHandler;
 
+// Командная строка нового процесса для /upgrade: тот же путь к бинарнику
+// (на его месте уже может лежать новая сборка) и тот же конфиг
+std::vector<std::string> upgradeArgv;
+
+// Мост каналов: первая конфигурация и все дополнительные, по сети на поток
+RelayHub relayHub;
+
+// Контроль роста ресурсов первой конфигурации
+DriftMonitor drift;
+
+// Передачи файлов и чаты DCC первой конфигурации
+DccServer dcc;
+
+// Журнал, индекс поиска, seen и снимок состояния первой конфигурации. Открываются
+// по конфигурации запуска: logDir, logSegMb, seenFile и stateFile перечитываются
+// только перезапуском
+IRCConfig storeConfig;
+SeenDb seen;
+ChannelLog chanlog;
+SearchIndex search;
+StateSnapshot state;
+
+void openStores(IRCBot* client)
+{
+    const IRCConfig& config = storeConfig;
+
+    if (config.seenconf.enabled && seen.Open(config.seenconf.file, config.seenconf.maxnicks))
+        client->SetSeenDb(&seen);
+
+    if (config.logconf.enabled && chanlog.Open(config.logconf.dir, size_t(config.logconf.segmentmb) << 20))
+    {
+        client->SetChannelLog(&chanlog);
+        if (config.logconf.search && search.Open(&chanlog))
+            client->SetSearchIndex(&search);
+    }
+}
+
+// Поток записи журнала дописывает хвост и останавливается, seen сбрасывается на диск
+void closeStores(IRCBot* client)
+{
+    client->SetSearchIndex(nullptr);
+    client->SetSeenDb(nullptr);
+    client->SetChannelLog(nullptr);
+    search.Close();
+    chanlog.Close();
+    seen.Close();
+}
+
 void msgCommand(std::string arguments, IRCBot* client)
 {
     std::string to = arguments.substr(0, arguments.find(" "));
@@ -222,6 +168,80 @@ void partCommand(std::string channel, IRCBot* client)
     client->SendIRC("PART " + channel);
 }
 
+void reloadCommand(std::string arguments, IRCBot* client)
+{
+    // Перечитывание выполняет поток ConfigWatcher, как и по внешнему SIGHUP
+    kill(getpid(), SIGHUP);
+}
+
+void upgradeCommand(std::string arguments, IRCBot* client)
+{
+    // Передать умеем только одно соединение
+    if (relayHub.Networks() > 1)
+    {
+        std::cout << "Upgrade is not supported with several networks running." << std::endl;
+        return;
+    }
+    // Передачи и чаты DCC идут по своим сокетам, новому процессу их не отдать
+    if (dcc.Active() > 0)
+    {
+        std::cout << "[!] Upgrade: " << dcc.Active() << " DCC transfers and chats are open, try again later" << std::endl;
+        return;
+    }
+    if (!client->CanUpgrade())
+        return;
+
+    // Новый процесс откроет журнал, seen и снимок сам, после Resume. До передачи
+    // сокета всё должно быть записано и закрыто: иначе оба процесса дописывают
+    // одни файлы и раздают одни и те же ID ников в names.dic
+    client->SaveState();
+    closeStores(client);
+    if (!client->Upgrade(upgradeArgv))
+    {
+        openStores(client);
+        return;
+    }
+    client->SetState(nullptr);
+    state.Close();
+}
+
+void memCommand(std::string arguments, IRCBot* client)
+{
+    for (const std::string& line : MemTrack::Report(true))
+        std::cout << line << std::endl;
+}
+
+void driftCommand(std::string arguments, IRCBot* client)
+{
+    if (!client->Config()->driftconf.enabled)
+    {
+        std::cout << "Drift monitor is off." << std::endl;
+        return;
+    }
+    for (const std::string& line : drift.Report())
+        std::cout << line << std::endl;
+}
+
+void dccCommand(std::string arguments, IRCBot* client)
+{
+    if (!dcc.IsOpen())
+    {
+        std::cout << "DCC is off." << std::endl;
+        return;
+    }
+    for (const std::string& line : dcc.Report())
+        std::cout << line << std::endl;
+}
+
+void relayCommand(std::string arguments, IRCBot* client)
+{
+    std::vector<std::string> lines = relayHub.Report();
+    if (lines.empty())
+        std::cout << "No relay links." << std::endl;
+    for (const std::string& line : lines)
+        std::cout << line << std::endl;
+}
+
 void ctcpCommand(std::string arguments, IRCBot* client)
 {
     std::string to = arguments.substr(0, arguments.find(" "));
@@ -232,6 +252,33 @@ void ctcpCommand(std::string arguments, IRCBot* client)
     client->SendIRC("PRIVMSG " + to + " :\001" + text + "\001");
 }
 
+void historyCommand(std::string arguments, IRCBot* client)
+{
+    std::string channel = arguments.substr(0, arguments.find(" "));
+    size_t count = 20;
+    if (arguments.find(" ") != std::string::npos)
+        count = strtoul(arguments.substr(arguments.find(" ") + 1).c_str(), nullptr, 10);
+
+    // Читатель отображает сегменты сам, поток записи журнала не затрагивается
+    ChannelLogReader reader;
+    if (!reader.Open(client->Config()->logconf.dir))
+    {
+        std::cout << "Channel log is empty or missing." << std::endl;
+        return;
+    }
+
+    for (const ChannelLogReader::Entry& entry : reader.Tail(channel, count))
+    {
+        time_t seconds = entry.timestamp / 1000;
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+        if (entry.flags & LogAction)
+            std::cout << "[" << stamp << "] * " << entry.nick << " " << entry.text << std::endl;
+        else
+            std::cout << "[" << stamp << "] <" << entry.nick << "> " << entry.text << std::endl;
+    }
+}
+
 ThreadReturn inputThread(void* client)
 {
     std::string command;
@@ -240,6 +287,13 @@ ThreadReturn inputThread(void* client)
     commandHandler.AddCommand("join", 1, &joinCommand);
     commandHandler.AddCommand("part", 1, &partCommand);
     commandHandler.AddCommand("ctcp", 2, &ctcpCommand);
+    commandHandler.AddCommand("reload", 0, &reloadCommand);
+    commandHandler.AddCommand("history", 1, &historyCommand);
+    commandHandler.AddCommand("upgrade", 0, &upgradeCommand);
+    commandHandler.AddCommand("relay", 0, &relayCommand);
+    commandHandler.AddCommand("mem", 0, &memCommand);
+    commandHandler.AddCommand("drift", 0, &driftCommand);
+    commandHandler.AddCommand("dcc", 0, &dccCommand);
 
     while(true)
     {
@@ -247,10 +301,12 @@ ThreadReturn inputThread(void* client)
         if (command == "")
             continue;
 
+        // Команда выполняется в потоке цикла событий, как и всё, что пишет в соединение
+        IRCBot* bot = (IRCBot*)client;
         if (command[0] == '/')
-            commandHandler.ParseCommand(command, (IRCBot*)client);
+            bot->Post([command, bot] { commandHandler.ParseCommand(command, bot); });
         else
-            ((IRCBot*)client)->SendIRC(command);
+            bot->Post([command, bot] { bot->SendIRC(command); });
 
         if (command == "quit")
             break;
@@ -259,16 +315,70 @@ ThreadReturn inputThread(void* client)
     pthread_exit(NULL);
 }
 
+// Дополнительная сеть: свой цикл событий в своём потоке, без журнала, seen,
+// снимка состояния и баунсера - они принадлежат первой конфигурации
+ThreadReturn networkThread(void* client)
+{
+    IRCBot* bot = (IRCBot*)client;
+    bot->Start();
+    while (running && !bot->Finished())
+        bot->Poll();
+
+    if (!bot->Finished()) {
+        bot->Quit("Interrupted");
+        bot->Disconnect();
+    }
+    return nullptr;
+}
+
 
 int main(int argc, char* argv[]) {
 
+    // Запись в сокет, закрытый сервером, (в том числе из OpenSSL, у него нет MSG_NOSIGNAL)
+    // должна вернуть EPIPE и уйти в переподключение, а не завершить процесс
+    signal(SIGPIPE, SIG_IGN);
+    // До первого потока: запросы ipinfo.io идут из потоков IRCBot::Offload
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
     IRCConfig config;
 
+    // Режимы записи и воспроизведения трафика:
+    //   ircbot [config.toml] --record capture.bin
+    //   ircbot [config.toml] --replay capture.bin [скорость [повторы]]
+    // Продолжение сессии прежнего процесса (запускает /upgrade):
+    //   ircbot config.toml --upgrade-fd N
+    // Несколько сетей с мостом каналов между ними (SIGHUP перечитывает первую):
+    //   ircbot libera.toml rizon.toml ...
+    std::string recordFile;
+    std::string replayFile;
+    double replaySpeed = 0;
+    int replayLoops = 1;
+    int upgradeFd = -1;
+    std::vector<IRCConfig> networks;    // конфигурации сетей после первой
+
     try {
         // Определение имени конфигурационного файла
         std::string filename = "config.toml";  // значение по умолчанию
-        if (argc > 1) {
-            filename = argv[1];
+        std::vector<std::string> extra;
+        bool named = false;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--record" && i + 1 < argc) {
+                recordFile = argv[++i];
+            } else if (arg == "--replay" && i + 1 < argc) {
+                replayFile = argv[++i];
+                if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                    replaySpeed = std::stod(argv[++i]);
+                if (i + 1 < argc && isdigit(argv[i + 1][0]))
+                    replayLoops = std::stoi(argv[++i]);
+            } else if (arg == "--upgrade-fd" && i + 1 < argc) {
+                upgradeFd = std::stoi(argv[++i]);
+            } else if (!named) {
+                filename = arg;
+                named = true;
+            } else {
+                extra.push_back(arg);
+            }
         }
 
         // Проверка существования файла
@@ -278,19 +388,53 @@ int main(int argc, char* argv[]) {
         }
 
         std::cout << "Using config file \"" + filename + "\":\n" << std::endl;
+        upgradeArgv = { argv[0], filename };
 
         // Парсинг файла
         config = parseTomlFile(filename);
 
         // Вывод конфигурации
         printConfig(config);
+        std::cout << "Allocation tracking: " << (MemTrack::Enabled() ? "on" : "off (IRCBOT_MEMTRACK=1 to enable)") << "\n";
+
+        for (const std::string& name : extra) {
+            if (!std::filesystem::exists(name)) {
+                std::cerr << "Config file " << name << " not found!\n";
+                return 1;
+            }
+            std::cout << "\nUsing config file \"" + name + "\":\n" << std::endl;
+            networks.push_back(parseTomlFile(name));
+            printConfig(networks.back());
+        }
+
+        // Имена сетей в relayLinks должны указывать на одну сеть
+        for (size_t i = 0; i < networks.size(); i++) {
+            if (networks[i].relayconf.name == config.relayconf.name)
+                throw std::runtime_error("relayName \"" + config.relayconf.name + "\" is used by more than one config.");
+            for (size_t j = 0; j < i; j++) {
+                if (networks[i].relayconf.name == networks[j].relayconf.name)
+                    throw std::runtime_error("relayName \"" + networks[i].relayconf.name + "\" is used by more than one config.");
+            }
+        }
 
     } catch (const std::exception& e) {
         std::cerr << "An error occurred: " << e.what() << "\n";
         return 1;
     }
 
-    if (!config.clientconf.connect_runbot)
+    if (!replayFile.empty())
+    {
+        // Воспроизведение идёт через тот же разбор и обработчики, но без сети,
+        // журнала и базы seen - записанный трафик не должен в них попасть
+        IRCBot client;
+        client.startTime = time(nullptr);
+        client.SetConfig(std::make_shared<const IRCConfig>(config));
+        client.HookIRCCommand("PRIVMSG", &onPrivMsg);
+        client.Debug(true);
+        return replayCapture(replayFile, replaySpeed, replayLoops, &client) ? 0 : 1;
+    }
+
+    if (!config.clientconf.connect_runbot && upgradeFd == -1)
     {
         std::cout << "Is this correct? Y/n:";
         std::string input;
@@ -309,75 +453,132 @@ int main(int argc, char* argv[]) {
     IRCBot client;
 
     client.startTime = time(nullptr);
+    client.SetConfig(std::make_shared<const IRCConfig>(config));
 
-    if (!config.clientconf.botschan.empty()) {
-        std::cout << "CH value assigned: " << config.clientconf.botschan << std::endl;
-        client.botchannel = config.clientconf.botschan;
-    }
+     // Hook PRIVMSG
+    client.HookIRCCommand("PRIVMSG", &onPrivMsg);
 
-    if (!config.clientconf.nspasswd.empty()) {
-        std::cout << "NS pass var assigned: " << config.clientconf.nspasswd << std::endl;
-        client.nspassword = config.clientconf.nspasswd;
-    }
+    client.Debug(true);
 
-    if (!config.clientconf.adminick.empty()) {
-        std::cout << "Bot admin nick: " << config.clientconf.adminick << std::endl;
-        client.botadmnick = config.clientconf.adminick;
-    }
+    // История для last живёт только в памяти и не переживает перезапуск
+    Backlog backlog;
+    if (config.lastconf.enabled)
+        client.SetBacklog(&backlog);
 
-    if (!config.clientconf.xdccvers.empty()) {
-        std::cout << "Bot DCC version: " << config.clientconf.xdccvers << std::endl;
-        client.botctcpver = config.clientconf.xdccvers;
-    }
+    // Баунсер слушает в цикле событий бота; клиенты переживают переподключения,
+    // но не перезапуск
+    Bouncer bouncer;
+    if (config.bncconf.enabled && bouncer.Open(&client, config.bncconf))
+        client.SetBouncer(&bouncer);
 
-    if (config.clientconf.command_symbol != 0) {
-        std::cout << "Bot command symbol: " << config.clientconf.command_symbol << std::endl;
-        client.commsymbol.assign(1, config.clientconf.command_symbol);
+    // Передачи идут в цикле событий бота; каталог, слоты и предел скорости
+    // берутся из текущей конфигурации при каждом предложении
+    if (config.dccconf.enabled)
+    {
+        dcc.Open(&client);
+        client.SetDcc(&dcc);
     }
 
-    if (!config.clientconf.runatcon.empty()) {
-        std::cout << "Run on connect: " << config.clientconf.runatcon << std::endl;
-        client.runonlogin = config.clientconf.runatcon;
-    }
+    // Включается только при запуске; пороги и период перечитываются по SIGHUP
+    if (config.driftconf.enabled)
+        client.SetDrift(&drift);
 
-    if (!config.featureconf.ipinftkn.empty()) {
-        std::cout << "IP info token: " << config.featureconf.ipinftkn << std::endl;
-        client.ipInfoToken = config.featureconf.ipinftkn;
+    CaptureWriter capture;
+    if (!recordFile.empty() && capture.Open(recordFile))
+    {
+        std::cout << "Recording received traffic to " << recordFile << std::endl;
+        client.SetCapture(&capture);
     }
 
-     // Hook PRIVMSG
-    client.HookIRCCommand("PRIVMSG", &onPrivMsg);
+    // Боты дополнительных сетей; мост включается, только если сетей больше одной
+    std::vector<std::unique_ptr<IRCBot>> bots;
+    for (const IRCConfig& conf : networks)
+    {
+        bots.push_back(std::make_unique<IRCBot>());
+        bots.back()->SetConfig(std::make_shared<const IRCConfig>(conf));
+        bots.back()->HookIRCCommand("PRIVMSG", &onPrivMsg);
+        bots.back()->Debug(true);
+    }
+    if (!bots.empty())
+    {
+        relayHub.Add(&client);
+        client.SetRelay(&relayHub);
+        for (std::unique_ptr<IRCBot>& bot : bots)
+        {
+            relayHub.Add(bot.get());
+            bot->SetRelay(&relayHub);
+        }
+    }
 
-    client.Debug(true);
+    // Start the config watcher before any other thread, so SIGHUP stays blocked everywhere
+    ConfigWatcher watcher;
+    watcher.Start(&client);
 
     // Start the input thread
     Thread thread;
     thread.Start(&inputThread, &client);
 
-    if (client.InitSocket())
+    running = true;
+    signal(SIGINT, signalHandler);
+
+    std::vector<std::unique_ptr<Thread>> botThreads;
+    for (std::unique_ptr<IRCBot>& bot : bots)
     {
-        std::cout << "[->] Socket initialized. Connecting..." << std::endl;
+        botThreads.push_back(std::make_unique<Thread>());
+        botThreads.back()->Start(&networkThread, bot.get());
+    }
 
-        if (client.Connect(config.serverconf.bothostname.c_str(), config.serverconf.bothostport))
-        {
-            std::cout << "[>>] Connected. Loggin in..." << std::endl;
-
-            if (client.Login(config.clientconf.nickname, config.clientconf.username, config.serverconf.bothostpass, config.clientconf.realname))
-            {
-                std::cout << "[+] Login completed." << std::endl;
-                running = true;
-                signal(SIGINT, signalHandler);
-                while (client.Connected() && running) {
-                    client.ReceiveData();
-                }
-            }
+    // После /upgrade журнал, seen и снимок открываются, только когда соединение
+    // стало нашим: до этого прежний процесс ещё пишет в них
+    if (upgradeFd != -1 && !client.Resume(upgradeFd))
+        return 1;   // соединение осталось у прежнего процесса
 
-            if (client.Connected()) {
-                client.Disconnect();
-            }
-            
-            std::cout << "[-] Disconnected." << std::endl;
-        }
+    storeConfig = config;
+    openStores(&client);
+
+    // Снимок отображается до подключения: каналы и лимиты прошлого запуска
+    // действуют с первой строки от сервера
+    if (config.stateconf.enabled)
+    {
+        state.Open(config.stateconf.file);
+        client.SetState(&state);
     }
-    return 0;
-}
\ No newline at end of file
+
+    // Подключение, переподключения с паузами и PING-контроль идут через таймеры
+    // цикла событий, главный поток только крутит Poll()
+    if (upgradeFd == -1)
+        client.Start();
+    while (running && !client.Finished()) {
+        client.Poll();
+    }
+
+    if (!client.Finished()) {
+        client.Quit("Interrupted");
+        client.Disconnect();
+    }
+
+    // Остальные сети уходят вместе с первой; пустая задача будит их цикл
+    running = false;
+    for (std::unique_ptr<IRCBot>& bot : bots)
+        bot->Post([] {});
+    for (std::unique_ptr<Thread>& botThread : botThreads)
+        botThread->Join();
+    client.SetRelay(nullptr);
+
+    client.SaveState();
+    client.SetBouncer(nullptr);
+    bouncer.Close();
+    client.SetDcc(nullptr);
+    dcc.Close();
+    client.SetState(nullptr);
+    client.SetBacklog(nullptr);
+    client.SetCapture(nullptr);
+    capture.Close();
+    state.Close();
+    closeStores(&client);
+
+    // Прогон на выносливость отличает выход по росту ресурсов от обычного
+    bool drifted = drift.Tripped() && client.Config()->driftconf.exit;
+    client.SetDrift(nullptr);
+    return drifted ? 3 : 0;
+}
@@ -0,0 +1,407 @@
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <unistd.h>
+
+#include "memtrack.h"
+
+namespace
+{
+    const size_t MaxThreads = 64;           // дальше потоки делят последнюю ячейку
+    const int64_t SampleBytes = 256 << 10;  // шаг выборки мест выделения на поток
+    const size_t SiteSlots = 1024;
+    const size_t SiteProbes = 16;
+
+    // Заголовок перед каждым блоком при включённом учёте
+    struct Header
+    {
+        uint64_t size;
+        uint16_t tag;
+        uint16_t reserved;
+        uint32_t offset;    // от начала блока malloc до пользовательского указателя
+    };
+    static_assert(sizeof(Header) == 16, "header keeps default new alignment");
+
+    // Счётчики одного потока. Пишет в ячейку только её поток (освобождение
+    // вычитается из ячейки освобождающего, суммы от этого не меняются),
+    // поэтому хватает обычных load/store без блокировки шины; отчёт только
+    // читает и суммирует. Последнюю ячейку делят лишние потоки - там fetch_add.
+    struct alignas(64) Slot
+    {
+        std::atomic<int64_t> live;
+        std::atomic<int64_t> blocks;
+        std::atomic<int64_t> allocated;
+        std::atomic<int64_t> allocs;
+        std::atomic<int64_t> tags[MemTags];
+    };
+    Slot slots[MaxThreads];
+    std::atomic<size_t> nextSlot;
+
+    struct SiteSlot
+    {
+        std::atomic<uintptr_t> address;
+        std::atomic<uint64_t> samples;
+    };
+    SiteSlot sites[SiteSlots];
+
+    // Тривиальные thread_local: без конструкторов, обращение не выделяет память
+    thread_local int threadSlot = -1;
+    thread_local bool threadShared = false;     // ячейка общая с другими потоками
+    thread_local MemTag threadTag = MemOther;
+    thread_local int64_t sampleCountdown = SampleBytes;
+
+    // -1 - ещё не решено; решается при первом выделении, пока поток один
+    int tracking = -1;
+
+    inline bool enabled()
+    {
+        if (__builtin_expect(tracking < 0, 0))
+        {
+            const char* env = getenv("IRCBOT_MEMTRACK");
+            tracking = env && env[0] && strcmp(env, "0") != 0;
+        }
+        return tracking;
+    }
+
+    inline Slot& slot()
+    {
+        if (__builtin_expect(threadSlot < 0, 0))
+        {
+            threadSlot = std::min(nextSlot.fetch_add(1, std::memory_order_relaxed), MaxThreads - 1);
+            threadShared = threadSlot == int(MaxThreads - 1);
+        }
+        return slots[threadSlot];
+    }
+
+    inline void add(std::atomic<int64_t>& counter, int64_t delta)
+    {
+        if (__builtin_expect(threadShared, 0))
+            counter.fetch_add(delta, std::memory_order_relaxed);
+        else
+            counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    uintptr_t executableBase()
+    {
+        static uintptr_t base = 0;
+        if (base == 0)
+        {
+            Dl_info info;
+            if (dladdr((void*)&MemTrack::Enabled, &info))
+                base = (uintptr_t)info.dli_fbase;
+        }
+        return base;
+    }
+
+    // Код бота, а не libstdc++ и не её шаблоны, инстанцированные в бинарнике
+    bool ownCode(uintptr_t address)
+    {
+        Dl_info info;
+        if (!dladdr((void*)address, &info) || (uintptr_t)info.dli_fbase != executableBase())
+            return false;
+        const char* name = info.dli_sname;
+        return !name || (strncmp(name, "_ZNSt", 5) != 0 && strncmp(name, "_ZNKSt", 6) != 0
+            && strncmp(name, "_ZSt", 4) != 0 && strncmp(name, "_ZN9__gnu_cxx", 13) != 0);
+    }
+
+    // Выделение из стандартной библиотеки (рост std::string, узлы контейнеров)
+    // приписывается первому кадру кода бота выше по стеку
+    __attribute__((noinline)) uintptr_t attribute(uintptr_t caller)
+    {
+        if (ownCode(caller))
+            return caller;
+
+        void* frames[16];
+        int count = backtrace(frames, 16);
+        bool past = false;
+        for (int i = 0; i < count; i++)
+        {
+            uintptr_t frame = (uintptr_t)frames[i];
+            if (frame == caller)
+                past = true;
+            else if (past && ownCode(frame))
+                return frame;
+        }
+        return caller;
+    }
+
+    __attribute__((noinline)) void sample(uintptr_t caller, uint64_t samples)
+    {
+        uintptr_t address = attribute(caller);
+        size_t index = (address * 0x9E3779B97F4A7C15ull) >> 54;  // 10 бит - SiteSlots
+        for (size_t probe = 0; probe < SiteProbes; probe++)
+        {
+            SiteSlot& site = sites[(index + probe) % SiteSlots];
+            uintptr_t current = site.address.load(std::memory_order_relaxed);
+            if (current == 0 && site.address.compare_exchange_strong(current, address, std::memory_order_relaxed))
+                current = address;
+            if (current == address)
+            {
+                site.samples.fetch_add(samples, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // Таблица забита вокруг этого места - выборка теряется
+    }
+
+    void* allocate(size_t size, size_t alignment, uintptr_t caller, bool nothrow)
+    {
+        if (!enabled())
+        {
+            void* p = alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__
+                ? malloc(size ? size : 1)
+                : aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+            if (!p && !nothrow)
+                throw std::bad_alloc();
+            return p;
+        }
+
+        size_t extra = alignment <= sizeof(Header) ? sizeof(Header) : sizeof(Header) + alignment;
+        char* raw = (char*)malloc(size + extra);
+        if (!raw)
+        {
+            if (nothrow)
+                return nullptr;
+            throw std::bad_alloc();
+        }
+        uintptr_t user = (uintptr_t)raw + sizeof(Header);
+        if (alignment > sizeof(Header))
+            user = (user + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+        MemTag tag = threadTag;
+        Header* header = (Header*)user - 1;
+        header->size = size;
+        header->tag = tag;
+        header->offset = uint32_t(user - (uintptr_t)raw);
+
+        Slot& own = slot();
+        add(own.live, size);
+        add(own.blocks, 1);
+        add(own.allocated, size);
+        add(own.allocs, 1);
+        add(own.tags[tag], size);
+
+        sampleCountdown -= int64_t(size);
+        if (__builtin_expect(sampleCountdown <= 0, 0))
+        {
+            uint64_t samples = 1 + uint64_t(-sampleCountdown) / SampleBytes;
+            sampleCountdown += samples * SampleBytes;
+            sample(caller, samples);
+        }
+        return (void*)user;
+    }
+
+    void release(void* p)
+    {
+        if (!p)
+            return;
+        if (!enabled())
+        {
+            free(p);
+            return;
+        }
+
+        Header* header = (Header*)p - 1;
+        Slot& own = slot();
+        add(own.live, -int64_t(header->size));
+        add(own.blocks, -1);
+        add(own.tags[header->tag], -int64_t(header->size));
+        free((char*)p - header->offset);
+    }
+
+    std::string formatBytes(int64_t bytes)
+    {
+        char text[32];
+        if (bytes >= (10ll << 20) || bytes <= -(10ll << 20))
+            snprintf(text, sizeof(text), "%lld MB", (long long)(bytes >> 20));
+        else if (bytes >= (10ll << 10) || bytes <= -(10ll << 10))
+            snprintf(text, sizeof(text), "%lld KB", (long long)(bytes >> 10));
+        else
+            snprintf(text, sizeof(text), "%lld bytes", (long long)bytes);
+        return text;
+    }
+}
+
+MemScope::MemScope(MemTag tag) : _previous(threadTag)
+{
+    threadTag = tag;
+}
+
+MemScope::~MemScope()
+{
+    threadTag = _previous;
+}
+
+void* operator new(size_t size) { return allocate(size, 0, (uintptr_t)__builtin_return_address(0), false); }
+void* operator new[](size_t size) { return allocate(size, 0, (uintptr_t)__builtin_return_address(0), false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0, (uintptr_t)__builtin_return_address(0), true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0, (uintptr_t)__builtin_return_address(0), true); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate(size, size_t(alignment), (uintptr_t)__builtin_return_address(0), false); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocate(size, size_t(alignment), (uintptr_t)__builtin_return_address(0), false); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, size_t(alignment), (uintptr_t)__builtin_return_address(0), true); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, size_t(alignment), (uintptr_t)__builtin_return_address(0), true); }
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+
+bool MemTrack::Enabled()
+{
+    return enabled();
+}
+
+MemTrack::Totals MemTrack::Snapshot()
+{
+    Totals totals;
+    size_t used = std::min(nextSlot.load(std::memory_order_relaxed), MaxThreads);
+    for (size_t i = 0; i < used; i++)
+    {
+        totals.live += slots[i].live.load(std::memory_order_relaxed);
+        totals.blocks += slots[i].blocks.load(std::memory_order_relaxed);
+        totals.allocated += slots[i].allocated.load(std::memory_order_relaxed);
+        totals.allocs += slots[i].allocs.load(std::memory_order_relaxed);
+        for (size_t tag = 0; tag < MemTags; tag++)
+            totals.tags[tag] += slots[i].tags[tag].load(std::memory_order_relaxed);
+    }
+    return totals;
+}
+
+std::vector<MemTrack::Site> MemTrack::TopSites(size_t count)
+{
+    std::vector<Site> result;
+    for (const SiteSlot& slot : sites)
+    {
+        uintptr_t address = slot.address.load(std::memory_order_relaxed);
+        if (address != 0)
+        {
+            uint64_t samples = slot.samples.load(std::memory_order_relaxed);
+            result.push_back({ address, samples, samples * SampleBytes });
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const Site& a, const Site& b) { return a.samples > b.samples; });
+    if (result.size() > count)
+        result.resize(count);
+    return result;
+}
+
+std::string MemTrack::Symbolize(uintptr_t address)
+{
+    Dl_info info;
+    char offset[32];
+    if (!dladdr((void*)address, &info))
+    {
+        snprintf(offset, sizeof(offset), "0x%lx", (unsigned long)address);
+        return offset;
+    }
+
+    // Смещение в модуле - для addr2line -Cfe; имя - ближайший экспортированный
+    // символ, для static-функций оно может оказаться соседним
+    std::string module = info.dli_fname ? info.dli_fname : "?";
+    module = module.substr(module.rfind('/') + 1);
+    snprintf(offset, sizeof(offset), "+0x%lx", (unsigned long)(address - (uintptr_t)info.dli_fbase));
+    module += offset;
+    if (!info.dli_sname)
+        return module;
+
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+    free(demangled);
+    snprintf(offset, sizeof(offset), "+0x%lx", (unsigned long)(address - (uintptr_t)info.dli_saddr));
+    return name + offset + " (" + module + ")";
+}
+
+long MemTrack::ResidentKb(bool anonymous)
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return 0;
+    long pages = 0, resident = 0, shared = 0;
+    if (fscanf(file, "%ld %ld %ld", &pages, &resident, &shared) != 3)
+        resident = shared = 0;
+    fclose(file);
+    return (anonymous ? resident - shared : resident) * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+const char* MemTrack::TagName(MemTag tag)
+{
+    static const char* const names[MemTags] = {
+        "other", "parse", "reply", "bouncer", "relay", "backlog", "log", "search", "seen", "config", "dcc"
+    };
+    return tag < MemTags ? names[tag] : "?";
+}
+
+std::vector<std::string> MemTrack::Report(bool withSites)
+{
+    std::vector<std::string> lines;
+    std::string line = "RSS " + formatBytes(int64_t(ResidentKb()) << 10);
+    if (!Enabled())
+    {
+        lines.push_back(line + ", allocation tracking is off (start with IRCBOT_MEMTRACK=1)");
+        return lines;
+    }
+
+    // Темп - с прошлого отчёта, кто бы его ни запросил (rmem или консоль)
+    static std::mutex mutex;
+    static Totals previous;
+    static int64_t previousTime = 0;
+    Totals totals = Snapshot();
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t allocs, bytes;
+    int64_t elapsed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        elapsed = previousTime ? now - previousTime : 0;
+        allocs = totals.allocs - previous.allocs;
+        bytes = totals.allocated - previous.allocated;
+        previous = totals;
+        previousTime = now;
+    }
+
+    line += ", heap " + formatBytes(totals.live) + " live in " + std::to_string(totals.blocks) + " blocks, "
+        + std::to_string(totals.allocs) + " allocations total";
+    if (elapsed > 0)
+        line += ", " + std::to_string(allocs * 1000 / elapsed) + " allocs/s and "
+            + formatBytes(bytes * 1000 / elapsed) + "/s over " + std::to_string(elapsed / 1000) + " s";
+    lines.push_back(line);
+
+    std::vector<std::pair<int64_t, size_t>> tags;
+    for (size_t tag = 0; tag < MemTags; tag++)
+        tags.push_back({ totals.tags[tag], tag });
+    std::sort(tags.rbegin(), tags.rend());
+    line = "Live by subsystem:";
+    for (const std::pair<int64_t, size_t>& tag : tags)
+    {
+        if (tag.first != 0)
+            line += std::string(" ") + TagName(MemTag(tag.second)) + " " + formatBytes(tag.first) + ",";
+    }
+    if (line.back() == ',')
+        line.pop_back();
+    lines.push_back(line);
+
+    if (withSites)
+    {
+        lines.push_back("Top allocation sites (sampled every " + formatBytes(SampleBytes) + " per thread, since start):");
+        for (const Site& site : TopSites(10))
+            lines.push_back("  ~" + formatBytes(site.bytes) + " " + Symbolize(site.address));
+    }
+    return lines;
+}
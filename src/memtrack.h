@@ -0,0 +1,86 @@
+#ifndef MEMTRACK_H_
+#define MEMTRACK_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Учёт выделений памяти через заменённые глобальные operator new/delete.
+// Включается переменной окружения IRCBOT_MEMTRACK=1 до запуска: решение
+// принимается при первом выделении, ещё до main, и не меняется - блоки с
+// заголовком и без него не смешиваются. Выключенный учёт стоит одну
+// проверку флага на вызов; включённый - 16 байт заголовка на блок и
+// несколько сложений в ячейке счётчиков своего потока.
+//
+// Память C-библиотек (curl, OpenSSL, zlib) идёт мимо operator new и не
+// учитывается; её видно только по RSS.
+
+// Подсистема, которой приписываются выделения текущего потока
+enum MemTag : uint16_t
+{
+    MemOther = 0,
+    MemParse,           // приём и разбор строк сервера, обработчики
+    MemReply,           // команды бота и очередь отправки
+    MemBouncer,
+    MemRelay,
+    MemBacklog,
+    MemLog,             // журнал каналов
+    MemSearch,
+    MemSeen,
+    MemConfig,
+    MemDcc,
+    MemTags
+};
+
+// На время жизни объекта выделения потока идут под тегом tag
+class MemScope
+{
+public:
+    explicit MemScope(MemTag tag);
+    ~MemScope();
+
+    MemScope(const MemScope&) = delete;
+    MemScope& operator=(const MemScope&) = delete;
+
+private:
+    MemTag _previous;
+};
+
+namespace MemTrack
+{
+    bool Enabled();
+
+    struct Totals
+    {
+        int64_t live = 0;           // байт в живых блоках
+        int64_t blocks = 0;         // живых блоков
+        int64_t allocated = 0;      // байт выделено за всё время
+        int64_t allocs = 0;         // вызовов new за всё время
+        int64_t tags[MemTags] = {}; // live по подсистемам
+    };
+    Totals Snapshot();
+
+    struct Site
+    {
+        uintptr_t address;          // адрес возврата из operator new
+        uint64_t samples;
+        uint64_t bytes;             // оценка: выборки * шаг выборки
+    };
+    // Места выделений по выборке (раз в SampleBytes байт на поток), по убыванию bytes
+    std::vector<Site> TopSites(size_t count);
+    // "функция+0x..", или "модуль+0x.." для addr2line
+    std::string Symbolize(uintptr_t address);
+
+    const char* TagName(MemTag tag);
+
+    // Текущий RSS процесса из /proc/self/statm, КБ; работает и без учёта.
+    // anonymous - без страниц файлов (отображённые журнал, индекс, seen)
+    long ResidentKb(bool anonymous = false);
+
+    // Строки отчёта: live и темп с прошлого вызова, подсистемы, при sites -
+    // места выделений. Темп считается между вызовами любого из отчётов.
+    std::vector<std::string> Report(bool sites);
+}
+
+#endif
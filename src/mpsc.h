@@ -0,0 +1,85 @@
+#ifndef MPSC_H_
+#define MPSC_H_
+
+#include <atomic>
+#include <utility>
+
+// Очередь "много писателей - один читатель" без блокировок (схема Вьюкова).
+// Push - один атомарный обмен головы, без циклов CAS; Pop вызывает только
+// поток-владелец. Пока писатель между обменом и привязкой узла, Pop может
+// вернуть false при непустой очереди - писатель разбудит читателя сам,
+// уже после привязки.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : _head(&_stub), _tail(&_stub) {};
+    ~MpscQueue()
+    {
+        T value;
+        while (Pop(value))
+            ;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void Push(T value)
+    {
+        Link(new Node(std::move(value)));
+    }
+
+    bool Pop(T& value)
+    {
+        Node* tail = _tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+
+        // Заглушка не несёт значения - пропускаем её
+        if (tail == &_stub)
+        {
+            if (!next)
+                return false;
+            _tail = tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (!next)
+        {
+            // Последний узел можно забрать, только вернув за ним заглушку
+            if (tail != _head.load(std::memory_order_acquire))
+                return false;
+            _stub.next.store(nullptr, std::memory_order_relaxed);
+            Link(&_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (!next)
+                return false;
+        }
+
+        value = std::move(tail->value);
+        _tail = next;
+        delete tail;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        Node() : next(nullptr) {};
+        explicit Node(T&& v) : next(nullptr), value(std::move(v)) {};
+
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    void Link(Node* node)
+    {
+        Node* prev = _head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    Node _stub;
+    std::atomic<Node*> _head;   // сюда добавляют писатели
+    Node* _tail;                // отсюда забирает читатель
+};
+
+#endif
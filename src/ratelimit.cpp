@@ -0,0 +1,76 @@
+#include <iterator>
+
+#include "ratelimit.h"
+
+void RateLimiter::Configure(unsigned rate, unsigned period, size_t capacity)
+{
+    if (rate == 0 || period == 0)
+    {
+        _interval = 0;
+        _tolerance = 0;
+    }
+    else
+    {
+        _interval = int64_t(period) * 1000000000LL / rate;
+        _tolerance = _interval * (rate - 1);    // rate запросов подряд проходят сразу
+    }
+
+    _capacity = capacity > 0 ? capacity : 1;
+    while (_entries.size() > _capacity)
+    {
+        _entries.erase(_lru.back().key);
+        _lru.pop_back();
+    }
+}
+
+RateLimiter::Result RateLimiter::Check(const std::string& key, int64_t now)
+{
+    if (!Enabled())
+        return Allowed;
+
+    auto itr = _entries.find(key);
+
+    // Сохранённое состояние ещё действующего ключа продолжает работать
+    int64_t savedTat = 0;
+    bool savedLimited = false;
+    bool saved = itr == _entries.end() && _lookup && _lookup(key, &savedTat, &savedLimited) && savedTat > now;
+
+    if (itr == _entries.end())
+    {
+        // Новый ключ: вытесняем самый старый, переиспользуя его узел
+        if (_entries.size() >= _capacity)
+        {
+            _lru.splice(_lru.begin(), _lru, std::prev(_lru.end()));
+            _entries.erase(_lru.front().key);
+            _lru.front().key = key;
+        }
+        else
+            _lru.push_front(Entry());
+
+        Entry& entry = _lru.front();
+        entry.key = key;
+        entry.tat = now + _interval;
+        entry.limited = false;
+        itr = _entries.emplace(key, _lru.begin()).first;
+        if (!saved)
+            return Allowed;
+
+        entry.tat = savedTat;
+        entry.limited = savedLimited;
+    }
+
+    _lru.splice(_lru.begin(), _lru, itr->second);
+    Entry& entry = *itr->second;
+
+    int64_t tat = entry.tat > now ? entry.tat : now;
+    if (tat - _tolerance > now)
+    {
+        Result result = entry.limited ? Limited : LimitedFirst;
+        entry.limited = true;
+        return result;
+    }
+
+    entry.tat = tat + _interval;
+    entry.limited = false;
+    return Allowed;
+}
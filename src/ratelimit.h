@@ -0,0 +1,63 @@
+#ifndef RATELIMIT_H_
+#define RATELIMIT_H_
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+// Ограничитель частоты по алгоритму GCRA: на ключ хранится одно число -
+// теоретическое время прихода следующего запроса (TAT). Число ключей
+// ограничено, давно не использованные вытесняются по LRU.
+class RateLimiter
+{
+public:
+    enum Result
+    {
+        Allowed,        // запрос пропущен
+        Limited,        // превышен лимит, о нём уже сообщали
+        LimitedFirst    // первое превышение после паузы - можно уведомить
+    };
+
+    RateLimiter() : _interval(0), _tolerance(0), _capacity(4096) {};
+
+    // rate запросов за period секунд, не более capacity отслеживаемых ключей.
+    // rate == 0 отключает ограничение. Накопленное состояние ключей сохраняется.
+    void Configure(unsigned rate, unsigned period, size_t capacity);
+    bool Enabled() const { return _interval != 0; };
+
+    Result Check(const std::string& key, int64_t now /*ns*/);
+    size_t Size() const { return _entries.size(); };
+
+    // Ключ, которого нет в памяти, сначала ищется здесь (снимок прошлого
+    // запуска): true - найден, *tat и *limited заполнены
+    typedef std::function<bool(const std::string& /*key*/, int64_t* /*tat*/, bool* /*limited*/)> Lookup;
+    void SetLookup(Lookup lookup) { _lookup = std::move(lookup); };
+
+    // Обход ключей от самых свежих: visit(key, tat, limited)
+    template <typename Visit>
+    void ForEach(Visit visit) const
+    {
+        for (const Entry& entry : _lru)
+            visit(entry.key, entry.tat, entry.limited);
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        int64_t tat;        // theoretical arrival time, ns
+        bool limited;       // последний запрос был отклонён
+    };
+
+    int64_t _interval;      // интервал между запросами, ns
+    int64_t _tolerance;     // допустимый всплеск, ns
+    size_t _capacity;
+
+    std::list<Entry> _lru;  // голова - самые свежие ключи
+    std::unordered_map<std::string, std::list<Entry>::iterator> _entries;
+    Lookup _lookup;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include <iostream>
+
+#include "relay.h"
+#include "ircbot.h"
+#include "casemap.h"
+#include "memtrack.h"
+
+void RelayHub::Add(IRCBot* bot)
+{
+    Network network;
+    network.bot = bot;
+    network.name = bot->Config()->relayconf.name;
+    _networks.push_back(network);
+}
+
+size_t RelayHub::LinkId(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<std::string, size_t>::const_iterator itr = _ids.find(name);
+    if (itr != _ids.end())
+        return itr->second;
+
+    _stats.emplace_back();
+    _stats.back().name = name;
+    _ids[name] = _stats.size() - 1;
+    return _stats.size() - 1;
+}
+
+void RelayHub::Update(Network& network)
+{
+    // Ссылки пересобираются в потоке источника, когда сменился его снимок конфигурации
+    std::shared_ptr<const IRCConfig> conf = network.bot->Config();
+    if (conf == network.config)
+        return;
+    network.config = conf;
+    network.routes.clear();
+
+    for (const IRCConfig::Relay::Link& link : conf->relayconf.links)
+    {
+        IRCBot* target = nullptr;
+        for (const Network& other : _networks)
+        {
+            if (other.name == link.network)
+                target = other.bot;
+        }
+        if (!target || target == network.bot)
+        {
+            std::cout << "[!] Relay: " << network.name << "/" << link.channel << " > " << link.network
+                      << "/" << link.target << ": no such network running" << std::endl;
+            continue;
+        }
+
+        Route route;
+        route.channel = foldNick(link.channel);
+        route.target = target;
+        route.head = "PRIVMSG " + link.target + " :";
+        route.link = LinkId(network.name + "/" + link.channel + " > " + link.network + "/" + link.target);
+        network.routes.push_back(route);
+    }
+}
+
+void RelayHub::Publish(IRCBot* from, const IRCMessage& message)
+{
+    MemScope scope(MemRelay);
+    Network* network = nullptr;
+    for (Network& candidate : _networks)
+    {
+        if (candidate.bot == from)
+            network = &candidate;
+    }
+    if (!network || message.parts.empty() || message.prefix.nick.empty() || message.prefix.nick == from->Nick())
+        return;
+
+    Update(*network);
+    if (network->routes.empty())
+        return;
+
+    bool chat = message.command == "PRIVMSG";
+    if (!chat && !network->config->relayconf.joins)
+        return;
+
+    std::string channel;
+    foldNick(message.parts[0], &channel);
+
+    // Сообщение собирается один раз, при первой подходящей ссылке
+    std::shared_ptr<const RelayMessage> relayed;
+    for (const Route& route : network->routes)
+    {
+        if (route.channel != channel)
+            continue;
+
+        if (!relayed)
+        {
+            std::string nick(message.prefix.nick);
+            std::string text;
+            if (!chat)
+                text = "[" + network->name + "] " + nick + (message.command == "JOIN" ? " joined " : " left ") + std::string(message.parts[0]);
+            else
+            {
+                std::string_view said = message.parts.back();
+                if (said.substr(0, 8) == "\001ACTION ")
+                    text = "[" + network->name + "] * " + nick + " " + std::string(said.substr(8, said.size() - 8 - (said.back() == '\001')));
+                else if (!said.empty() && said[0] == '\001')
+                    return;     // прочий CTCP не пересылается
+                else
+                    text = "[" + network->name + "] <" + nick + "> " + std::string(said);
+            }
+            relayed = std::make_shared<const RelayMessage>(RelayMessage{ std::move(text), TimerWheel::Now() });
+        }
+
+        IRCBot* target = route.target;
+        std::string head = route.head;
+        size_t link = route.link;
+        target->Post([target, head, relayed, link] { target->QueueRelay(head, relayed, link); });
+    }
+}
+
+void RelayHub::Delivered(size_t link, int64_t delayMs)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (link >= _stats.size())
+        return;
+    ++_stats[link].relayed;
+    _stats[link].delay.Add(delayMs);
+}
+
+void RelayHub::Dropped(size_t link)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (link < _stats.size())
+        ++_stats[link].dropped;
+}
+
+std::vector<std::string> RelayHub::Report()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<std::string> lines;
+    for (const LinkStats& stats : _stats)
+    {
+        std::string line = stats.name + ": " + std::to_string(stats.relayed) + " relayed, "
+            + std::to_string(stats.dropped) + " dropped";
+        if (stats.delay.Count() > 0)
+            line += ", delay avg " + std::to_string(stats.delay.Smoothed()) + " ms, p50 <"
+                + std::to_string(stats.delay.Percentile(0.5)) + " ms, p99 <"
+                + std::to_string(stats.delay.Percentile(0.99)) + " ms";
+        lines.push_back(line);
+    }
+    return lines;
+}
@@ -0,0 +1,83 @@
+#ifndef RELAY_H_
+#define RELAY_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "config.h"
+#include "lagstat.h"
+
+class IRCBot;
+struct IRCMessage;
+
+// Строка для пересылки в другие сети: текст без "PRIVMSG канал :" и время
+// приёма у источника. Собирается один раз и по указателю попадает в очереди
+// всех получателей.
+struct RelayMessage
+{
+    std::string text;
+    int64_t received;   // TimerWheel::Now() потока-источника, мс
+};
+
+// Мост каналов между сетями. Каждая сеть - свой IRCBot в своём потоке со
+// своим циклом событий. Источник разбирает ссылки из своей конфигурации
+// (relayLinks) и передаёт сообщение получателю через IRCBot::Post; тот
+// ставит его в свою очередь QueueIRC, где действует темп отправки
+// соединения и лимит ссылки. Задержка от приёма у источника до записи в
+// сокет получателя копится по каждой ссылке.
+class RelayHub
+{
+public:
+    // До запуска потоков ботов
+    void Add(IRCBot* bot);
+    size_t Networks() const { return _networks.size(); };
+
+    // Поток источника: PRIVMSG, JOIN или PART от его сервера
+    void Publish(IRCBot* from, const IRCMessage& message);
+
+    // Поток получателя: строка ссылки ушла на сервер или отброшена
+    void Delivered(size_t link, int64_t delayMs);
+    void Dropped(size_t link);
+
+    // Строка на ссылку: счётчики и задержка
+    std::vector<std::string> Report();
+
+private:
+    struct Route
+    {
+        std::string channel;    // свёрнутое имя канала источника
+        IRCBot* target;
+        std::string head;       // "PRIVMSG #канал :" получателя
+        size_t link;            // номер в _stats
+    };
+
+    struct Network
+    {
+        IRCBot* bot;
+        std::string name;
+        std::shared_ptr<const IRCConfig> config;    // снимок, из которого собраны routes
+        std::vector<Route> routes;                  // только поток этого бота
+    };
+
+    void Update(Network& network);
+    size_t LinkId(const std::string& name);
+
+    std::vector<Network> _networks;     // состав не меняется после запуска потоков
+
+    struct LinkStats
+    {
+        std::string name;       // "сеть/#канал > сеть/#канал"
+        uint64_t relayed = 0;
+        uint64_t dropped = 0;
+        LagStats delay;
+    };
+    std::mutex _mutex;          // _stats и _ids: пишут потоки разных сетей
+    std::vector<LinkStats> _stats;
+    std::map<std::string, size_t> _ids;
+};
+
+#endif
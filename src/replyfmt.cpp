@@ -0,0 +1,234 @@
+#include <algorithm>
+
+#include "replyfmt.h"
+
+const char* const ReplySeparator = " | ";
+
+static const size_t MinBudget = 64;     // на случай сервера с нелепым LINELEN
+
+// Переключатели оформления mIRC: жирный, курсив, подчёркнутый,
+// зачёркнутый, моноширинный, инверсия
+static const char FormatToggles[] = { '\x02', '\x1D', '\x1F', '\x1E', '\x11', '\x16' };
+static const char FormatColor = '\x03';
+static const char FormatReset = '\x0F';
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Длина неделимого фрагмента, начинающегося с pos: код цвета с цифрами,
+// символ UTF-8 или один байт
+static size_t tokenLength(const std::string& text, size_t pos)
+{
+    unsigned char c = text[pos];
+    size_t end = pos + 1;
+
+    if (c == FormatColor)
+    {
+        size_t digits = 0;
+        while (end < text.size() && digits < 2 && isDigit(text[end]))
+            ++end, ++digits;
+        if (digits > 0 && end + 1 < text.size() && text[end] == ',' && isDigit(text[end + 1]))
+        {
+            end += 2;
+            if (end < text.size() && isDigit(text[end]))
+                ++end;
+        }
+        return end - pos;
+    }
+
+    if (c >= 0xC0)
+    {
+        size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+        while (end < text.size() && end - pos < length && (text[end] & 0xC0) == 0x80)
+            ++end;
+    }
+    return end - pos;
+}
+
+namespace {
+
+struct FormatState
+{
+    unsigned toggles = 0;
+    std::string fg, bg;
+
+    void Reset()
+    {
+        toggles = 0;
+        fg.clear();
+        bg.clear();
+    }
+
+    bool Active() const
+    {
+        return toggles != 0 || !fg.empty();
+    }
+
+    bool Colored() const
+    {
+        return !fg.empty();
+    }
+
+    void Scan(const std::string& text, size_t from, size_t to)
+    {
+        for (size_t pos = from; pos < to; )
+        {
+            size_t length = tokenLength(text, pos);
+            char c = text[pos];
+
+            if (c == FormatReset)
+                Reset();
+            else if (c == FormatColor)
+                Color(text.substr(pos + 1, length - 1));
+            else
+            {
+                const char* toggle = std::find(FormatToggles, std::end(FormatToggles), c);
+                if (toggle != std::end(FormatToggles))
+                    toggles ^= 1u << (toggle - FormatToggles);
+            }
+            pos += length;
+        }
+    }
+
+    // Коды, восстанавливающие это оформление в начале новой строки
+    std::string Codes() const
+    {
+        std::string codes;
+        for (size_t i = 0; i < sizeof(FormatToggles); ++i)
+        {
+            if (toggles & (1u << i))
+                codes += FormatToggles[i];
+        }
+        if (!fg.empty())
+        {
+            // Всегда две цифры, чтобы цифра в начале текста не прочиталась как цвет
+            codes += FormatColor + fg;
+            if (!bg.empty())
+                codes += ',' + bg;
+        }
+        return codes;
+    }
+
+private:
+    void Color(const std::string& spec)
+    {
+        // Голый \x03 снимает цвет, "NN" меняет только цвет текста
+        if (spec.empty())
+        {
+            fg.clear();
+            bg.clear();
+            return;
+        }
+
+        size_t comma = spec.find(',');
+        fg = twoDigits(spec.substr(0, comma));
+        if (comma != std::string::npos)
+            bg = twoDigits(spec.substr(comma + 1));
+    }
+
+    static std::string twoDigits(const std::string& digits)
+    {
+        return digits.size() == 1 ? '0' + digits : digits;
+    }
+};
+
+}
+
+// Место разреза куска text начиная с pos так, чтобы взять не больше room
+// байт: по последнему пробелу во второй половине, иначе по границе
+// неделимого фрагмента. resume - откуда продолжать (пробел выбрасывается).
+static size_t findCut(const std::string& text, size_t pos, size_t room, size_t* resume)
+{
+    size_t limit = pos + room;
+    size_t end = pos;
+    size_t space = std::string::npos;
+
+    while (end < text.size())
+    {
+        size_t length = tokenLength(text, end);
+        if (end + length > limit)
+            break;
+        if (text[end] == ' ' && end > pos + room / 2)
+            space = end;
+        end += length;
+    }
+
+    if (space != std::string::npos)
+    {
+        *resume = space + 1;
+        return space;
+    }
+
+    // Даже один символ не помещается - берём его всё равно, чтобы двигаться
+    if (end == pos)
+        end = pos + tokenLength(text, pos);
+    *resume = end;
+    return end;
+}
+
+std::vector<std::string> packReply(const std::vector<std::string>& fragments, size_t budget)
+{
+    std::vector<std::string> lines;
+    std::string line;
+    FormatState state;
+
+    budget = std::max(budget, MinBudget);
+
+    for (const std::string& fragment : fragments)
+    {
+        if (fragment.empty())
+            continue;
+
+        if (!line.empty())
+        {
+            // Оформление куска кончалось вместе с его строкой - сбрасываем
+            std::string glue = (state.Active() ? std::string(1, FormatReset) : "") + ReplySeparator;
+            if (line.size() + glue.size() + fragment.size() <= budget)
+            {
+                line += glue;
+                state.Reset();
+                state.Scan(fragment, 0, fragment.size());
+                line += fragment;
+                continue;
+            }
+            lines.push_back(line);
+            line.clear();
+        }
+
+        state.Reset();
+        for (size_t pos = 0; ; )
+        {
+            size_t room = budget - std::min(line.size(), budget - MinBudget / 2);
+            if (fragment.size() - pos <= room)
+            {
+                state.Scan(fragment, pos, fragment.size());
+                line.append(fragment, pos, std::string::npos);
+                break;
+            }
+
+            size_t resume;
+            size_t cut = findCut(fragment, pos, room, &resume);
+            state.Scan(fragment, pos, cut);
+            line.append(fragment, pos, cut - pos);
+            lines.push_back(line);
+
+            pos = resume;
+            if (pos >= fragment.size())
+            {
+                line.clear();
+                break;
+            }
+
+            line = state.Codes();
+            // ",NN" сразу за цветом стал бы цветом фона - разделяем пустой парой \x02
+            if (state.Colored() && fragment[pos] == ',')
+                line += "\x02\x02";
+        }
+    }
+
+    if (!line.empty())
+        lines.push_back(line);
+    return lines;
+}
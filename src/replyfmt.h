@@ -0,0 +1,19 @@
+#ifndef REPLYFMT_H_
+#define REPLYFMT_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Упаковка ответа бота в строки PRIVMSG. Куски ответа (строки, которые
+// раньше уходили по одной) склеиваются через ReplySeparator в строки длиной
+// до budget байт; слишком длинный кусок режется по пробелу или хотя бы по
+// границе символа UTF-8, не внутри кода цвета. Оформление mIRC (жирный,
+// цвет и т.п.), действующее в месте разреза, повторяется в начале следующей
+// строки, а перед разделителем кусков сбрасывается, как было бы в конце
+// отдельной строки.
+extern const char* const ReplySeparator;
+
+std::vector<std::string> packReply(const std::vector<std::string>& fragments, size_t budget);
+
+#endif
@@ -0,0 +1,750 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "search.h"
+#include "timer.h"
+#include "memtrack.h"
+
+static const char IndexMagic[8] = { 'C', 'H', 'A', 'N', 'I', 'D', 'X', '\0' };
+static const uint32_t IndexVersion = 1;
+static const size_t MinToken = 2;
+static const size_t MaxToken = 48;
+
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t terms;
+    LogAddress first;       // первая запись журнала в сегменте
+    LogAddress next;        // запись журнала сразу за последней проиндексированной
+    uint64_t table;         // смещение таблицы слов
+    uint64_t names;         // смещение блока имён слов
+};
+static_assert(sizeof(IndexHeader) == 48, "IndexHeader layout is part of the file format");
+
+struct IndexTerm
+{
+    uint64_t postings;      // смещение списка в файле
+    LogAddress last;        // последний адрес списка, для склейки при слиянии
+    uint32_t bytes;
+    uint32_t count;
+    uint32_t name;          // смещение слова в блоке имён
+    uint32_t length;
+};
+static_assert(sizeof(IndexTerm) == 32, "IndexTerm layout is part of the file format");
+
+static void putVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static bool getVarint(const uint8_t*& data, const uint8_t* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *data++;
+        result |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void decodePostings(const char* bytes, size_t length, std::vector<LogAddress>& out)
+{
+    const uint8_t* data = (const uint8_t*)bytes;
+    const uint8_t* end = data + length;
+    LogAddress address = 0;
+    uint64_t delta;
+
+    out.clear();
+    while (getVarint(data, end, &delta))
+    {
+        address += delta;
+        out.push_back(address);
+    }
+}
+
+// Отображённый сегмент индекса
+struct SearchIndex::Segment
+{
+    std::string path;
+    uint32_t sequence = 0;
+    const char* data = nullptr;
+    size_t size = 0;
+    const IndexHeader* header = nullptr;
+    const IndexTerm* table = nullptr;
+
+    ~Segment()
+    {
+        if (data)
+            munmap((void*)data, size);
+    }
+
+    bool Map(const std::string& file)
+    {
+        path = file;
+        sequence = strtoul(std::filesystem::path(file).stem().c_str(), nullptr, 10);
+
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(IndexHeader))
+        {
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                data = (const char*)mapped;
+                size = st.st_size;
+            }
+        }
+        close(fd);
+
+        if (!data)
+            return false;
+
+        header = (const IndexHeader*)data;
+        if (memcmp(header->magic, IndexMagic, sizeof(IndexMagic)) != 0 || header->version != IndexVersion
+            || header->table > size || (size - header->table) / sizeof(IndexTerm) < header->terms
+            || header->names > size)
+            return false;
+
+        table = (const IndexTerm*)(data + header->table);
+
+        // Сегмент, оборванный или испорченный при падении, иначе увёл бы Lookup
+        // и decodePostings за конец отображения: каждое слово целиком внутри файла
+        size_t names = size - header->names;
+        for (uint32_t i = 0; i < header->terms; ++i)
+        {
+            const IndexTerm& term = table[i];
+            if (term.postings > size || term.bytes > size - term.postings
+                || term.name > names || term.length > names - term.name)
+                return false;
+        }
+        return true;
+    }
+
+    std::string Term(const IndexTerm& term) const
+    {
+        return std::string(data + header->names + term.name, term.length);
+    }
+
+    const IndexTerm* Lookup(const std::string& word) const
+    {
+        size_t low = 0, high = header->terms;
+        while (low < high)
+        {
+            size_t middle = (low + high) / 2;
+            const IndexTerm& term = table[middle];
+            int diff = memcmp(data + header->names + term.name, word.data(), std::min<size_t>(term.length, word.size()));
+            if (diff == 0)
+                diff = term.length < word.size() ? -1 : term.length > word.size() ? 1 : 0;
+            if (diff == 0)
+                return &term;
+            if (diff < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return nullptr;
+    }
+};
+
+// Запись сегмента: списки пишутся сразу, таблица и имена слов - в конце.
+// Слова должны поступать в порядке возрастания.
+class SegmentWriter
+{
+public:
+    SegmentWriter() : _fd(-1), _offset(sizeof(IndexHeader)) {};
+    ~SegmentWriter()
+    {
+        if (_fd != -1)
+        {
+            close(_fd);
+            unlink(_temp.c_str());
+        }
+    };
+
+    bool Open(const std::string& path)
+    {
+        _path = path;
+        _temp = path + ".tmp";
+        _fd = open(_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return _fd != -1 && lseek(_fd, sizeof(IndexHeader), SEEK_SET) == off_t(sizeof(IndexHeader));
+    };
+
+    bool Add(const std::string& word, LogAddress last, uint32_t count, const char* bytes, size_t length)
+    {
+        IndexTerm term;
+        term.postings = _offset;
+        term.last = last;
+        term.bytes = length;
+        term.count = count;
+        term.name = _names.size();
+        term.length = word.size();
+        _table.push_back(term);
+        _names += word;
+
+        _buffer.append(bytes, length);
+        _offset += length;
+        return _buffer.size() < (1 << 20) || Drain();
+    };
+
+    // Дописывает таблицу и заголовок и атомарно переименовывает файл
+    bool Finish(LogAddress first, LogAddress next)
+    {
+        IndexHeader header;
+        memcpy(header.magic, IndexMagic, sizeof(IndexMagic));
+        header.version = IndexVersion;
+        header.terms = _table.size();
+        header.first = first;
+        header.next = next;
+        header.names = _offset;
+        header.table = (_offset + _names.size() + 7) & ~uint64_t(7);
+
+        _buffer += _names;
+        _buffer.append(header.table - _offset - _names.size(), '\0');
+        _buffer.append((const char*)_table.data(), _table.size() * sizeof(IndexTerm));
+
+        if (!Drain() || pwrite(_fd, &header, sizeof(header), 0) != sizeof(header) || fdatasync(_fd) != 0)
+            return false;
+
+        close(_fd);
+        _fd = -1;
+        return rename(_temp.c_str(), _path.c_str()) == 0;
+    };
+
+private:
+    bool Drain()
+    {
+        const char* data = _buffer.data();
+        size_t length = _buffer.size();
+        while (length > 0)
+        {
+            ssize_t written = write(_fd, data, length);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        _buffer.clear();
+        return true;
+    };
+
+    int _fd;
+    std::string _path;
+    std::string _temp;
+    std::string _buffer;
+    std::string _names;
+    std::vector<IndexTerm> _table;
+    uint64_t _offset;
+};
+
+// Слова индексируются отдельно для каждого канала: "слово\001сеть:канал".
+// Запрос по каналу читает только его списки, а не пересекает их со списком
+// всего канала, который на активном канале длиннее любого слова.
+static std::string channelSuffix(uint32_t network, uint32_t channel)
+{
+    return "\001" + std::to_string(network) + ":" + std::to_string(channel);
+}
+
+std::vector<std::string> SearchIndex::Tokenize(const char* text, size_t length)
+{
+    std::vector<std::string> tokens;
+    std::string token;
+
+    auto finish = [&]() {
+        if (token.size() >= MinToken && token.size() <= MaxToken)
+            tokens.push_back(token);
+        token.clear();
+    };
+
+    const unsigned char* data = (const unsigned char*)text;
+    for (size_t i = 0; i < length; ++i)
+    {
+        unsigned char c = data[i];
+        if (c < 0x80)
+        {
+            if (isalnum(c))
+                token += char(tolower(c));
+            else
+                finish();
+            continue;
+        }
+
+        // Кириллица: А-П (D0 90-9F) -> а-п (D0 B0-BF), Р-Я (D0 A0-AF) -> р-я (D1 80-8F), Ё -> ё
+        if (c == 0xD0 && i + 1 < length)
+        {
+            unsigned char next = data[i + 1];
+            if (next >= 0x90 && next <= 0x9F)
+            {
+                token += char(0xD0);
+                token += char(next + 0x20);
+                ++i;
+                continue;
+            }
+            if (next >= 0xA0 && next <= 0xAF)
+            {
+                token += char(0xD1);
+                token += char(next - 0x20);
+                ++i;
+                continue;
+            }
+            if (next == 0x81)
+            {
+                token += char(0xD1);
+                token += char(0x91);
+                ++i;
+                continue;
+            }
+        }
+
+        // Прочие байты UTF-8 считаем частью слова как есть
+        token += char(c);
+    }
+    finish();
+
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    return tokens;
+}
+
+SearchIndex::SearchIndex() : _log(nullptr), _stop(false), _memBytes(0), _memFirst(0),
+    _segments(std::make_shared<const SegmentList>()), _indexed(0), _next(0), _fileSequence(0), _lastFlush(0)
+{
+}
+
+SearchIndex::~SearchIndex()
+{
+    Close();
+}
+
+std::string SearchIndex::SegmentPath(uint32_t sequence) const
+{
+    char name[16];
+    snprintf(name, sizeof(name), "%08u.idx", sequence);
+    return _dir + "/" + name;
+}
+
+bool SearchIndex::Open(ChannelLog* log)
+{
+    _dir = log->Dir() + "/index";
+
+    std::error_code error;
+    std::filesystem::create_directories(_dir, error);
+    if (error)
+    {
+        std::cerr << "Search index: cannot create " << _dir << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    LoadSegments();
+
+    _log = log;
+    _stop = false;
+    _lastFlush = TimerWheel::Now();
+    if (!_thread.Start(&indexThread, this))
+    {
+        _log = nullptr;
+        return false;
+    }
+
+    std::cout << "Search index: " << _segments->size() << " segments in " << _dir << std::endl;
+    return true;
+}
+
+void SearchIndex::Close()
+{
+    if (!_log)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.Join();
+
+    Flush();
+    _log = nullptr;
+}
+
+void SearchIndex::LoadSegments()
+{
+    SegmentList segments;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(_dir, error))
+    {
+        const std::filesystem::path& path = entry.path();
+        if (path.extension() == ".tmp")
+        {
+            std::filesystem::remove(path, error);   // недописанный сегмент
+            continue;
+        }
+        if (path.extension() != ".idx")
+            continue;
+
+        auto segment = std::make_shared<Segment>();
+        if (segment->Map(path.string()))
+            segments.push_back(segment);
+        else
+            std::cerr << "Search index: skipping damaged " << path.string() << std::endl;
+    }
+
+    std::sort(segments.begin(), segments.end(), [](const auto& a, const auto& b) {
+        if (a->header->first != b->header->first)
+            return a->header->first < b->header->first;
+        return a->header->next > b->header->next;
+    });
+
+    // Сбой между записью слитого сегмента и удалением исходных оставляет
+    // сегменты, целиком покрытые слитым, - они лишние
+    SegmentList live;
+    for (const auto& segment : segments)
+    {
+        if (!live.empty() && segment->header->next <= live.back()->header->next)
+        {
+            std::filesystem::remove(segment->path, error);
+            continue;
+        }
+        live.push_back(segment);
+    }
+
+    for (const auto& segment : live)
+    {
+        _next = std::max(_next, segment->header->next);
+        _fileSequence = std::max(_fileSequence, segment->sequence);
+    }
+
+    _segments = std::make_shared<const SegmentList>(std::move(live));
+}
+
+ThreadReturn SearchIndex::indexThread(void* param)
+{
+    SearchIndex* index = (SearchIndex*)param;
+    MemScope scope(MemSearch);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(index->_mutex);
+            index->_wake.wait_for(lock, std::chrono::seconds(1), [index] { return index->_stop.load(); });
+            if (index->_stop)
+                break;
+        }
+
+        index->IndexNew();
+
+        if (!index->_memtable.empty() && TimerWheel::Now() - index->_lastFlush >= FlushIdleMs)
+            index->Flush();
+        index->Merge();
+    }
+
+    return NULL;
+}
+
+void SearchIndex::IndexNew()
+{
+    ChannelLogReader reader;
+    if (!reader.Open(_log->Dir(), false))
+        return;
+
+    uint32_t sequence = _next >> 32;
+    for (size_t i = 0; i < reader.Segments() && !_stop; ++i)
+    {
+        uint32_t current = reader.SegmentSequence(i);
+        if (current < sequence)
+            continue;
+
+        uint32_t from = current == sequence ? uint32_t(_next) : 0;
+        reader.Scan(i, [this](const LogRecord& record, const char* text, LogAddress address) {
+            if (!(record.flags & LogPrivate))
+                AddDocument(address, record, text);
+            _next = address + logRecordSize(record.length);
+            ++_indexed;
+
+            // Большой хвост журнала (первый запуск) тоже сбрасывается порциями
+            if (_memBytes >= FlushBytes)
+                Flush();
+            return !_stop;
+        }, from);
+    }
+}
+
+void SearchIndex::AddDocument(LogAddress address, const LogRecord& record, const char* text)
+{
+    std::vector<std::string> tokens = Tokenize(text, record.length);
+    std::string suffix = channelSuffix(record.network, record.channel);
+    for (std::string& token : tokens)
+        token += suffix;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_memtable.empty())
+        _memFirst = address;
+
+    for (const std::string& token : tokens)
+    {
+        auto inserted = _memtable.try_emplace(token);
+        Postings& postings = inserted.first->second;
+        if (inserted.second)
+            _memBytes += token.size() + sizeof(Postings) + sizeof(IndexTerm);
+        else if (address <= postings.last)
+            continue;
+
+        size_t before = postings.bytes.size();
+        putVarint(postings.bytes, address - postings.last);
+        postings.last = address;
+        ++postings.count;
+        _memBytes += postings.bytes.size() - before;
+    }
+}
+
+void SearchIndex::Flush()
+{
+    // Память меняет только этот поток, поэтому читать её для записи можно без
+    // блокировки; запросы видят её, пока не опубликован готовый сегмент
+    if (_memtable.empty())
+        return;
+
+    std::vector<const std::pair<const std::string, Postings>*> terms;
+    terms.reserve(_memtable.size());
+    for (const auto& entry : _memtable)
+        terms.push_back(&entry);
+    std::sort(terms.begin(), terms.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+
+    uint32_t sequence = _fileSequence + 1;
+    SegmentWriter writer;
+    bool written = writer.Open(SegmentPath(sequence));
+    for (size_t i = 0; i < terms.size() && written; ++i)
+    {
+        const Postings& postings = terms[i]->second;
+        written = writer.Add(terms[i]->first, postings.last, postings.count, postings.bytes.data(), postings.bytes.size());
+    }
+    written = written && writer.Finish(_memFirst, _next);
+
+    auto segment = std::make_shared<Segment>();
+    if (!written || !segment->Map(SegmentPath(sequence)))
+    {
+        std::cerr << "Search index: cannot write " << SegmentPath(sequence) << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    _fileSequence = sequence;
+    _lastFlush = TimerWheel::Now();
+
+    auto segments = std::make_shared<SegmentList>(*_segments);
+    segments->push_back(segment);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _segments = segments;
+    _memtable.clear();
+    _memBytes = 0;
+}
+
+void SearchIndex::Merge()
+{
+    while (_segments->size() > MaxSegments && !_stop)
+    {
+        // Сливаем соседнюю пару с наименьшим суммарным размером: крупные
+        // сегменты переписываются редко, мелкие быстро собираются вместе
+        std::shared_ptr<const SegmentList> snapshot = _segments;
+        const SegmentList& current = *snapshot;
+        size_t pick = 0;
+        for (size_t i = 1; i + 1 < current.size(); ++i)
+        {
+            if (current[i]->size + current[i + 1]->size < current[pick]->size + current[pick + 1]->size)
+                pick = i;
+        }
+
+        const Segment& older = *current[pick];
+        const Segment& newer = *current[pick + 1];
+        uint32_t sequence = _fileSequence + 1;
+
+        SegmentWriter writer;
+        bool written = writer.Open(SegmentPath(sequence));
+
+        std::string merged;
+        uint32_t a = 0, b = 0;
+        while (written && (a < older.header->terms || b < newer.header->terms))
+        {
+            const IndexTerm* left = a < older.header->terms ? &older.table[a] : nullptr;
+            const IndexTerm* right = b < newer.header->terms ? &newer.table[b] : nullptr;
+            std::string leftWord = left ? older.Term(*left) : std::string();
+            std::string rightWord = right ? newer.Term(*right) : std::string();
+
+            if (left && (!right || leftWord < rightWord))
+            {
+                written = writer.Add(leftWord, left->last, left->count, older.data + left->postings, left->bytes);
+                ++a;
+            }
+            else if (right && (!left || rightWord < leftWord))
+            {
+                written = writer.Add(rightWord, right->last, right->count, newer.data + right->postings, right->bytes);
+                ++b;
+            }
+            else
+            {
+                // Списки идут друг за другом: первый адрес второго списка
+                // перекодируется разностью от последнего адреса первого
+                const uint8_t* data = (const uint8_t*)newer.data + right->postings;
+                const uint8_t* end = data + right->bytes;
+                uint64_t first = 0;
+                getVarint(data, end, &first);
+
+                merged.assign(older.data + left->postings, left->bytes);
+                putVarint(merged, first - left->last);
+                merged.append((const char*)data, end - data);
+                written = writer.Add(leftWord, right->last, left->count + right->count, merged.data(), merged.size());
+                ++a;
+                ++b;
+            }
+        }
+        written = written && writer.Finish(older.header->first, newer.header->next);
+
+        auto segment = std::make_shared<Segment>();
+        if (!written || !segment->Map(SegmentPath(sequence)))
+        {
+            std::cerr << "Search index: merge into " << SegmentPath(sequence) << " failed" << std::endl;
+            return;
+        }
+        _fileSequence = sequence;
+
+        std::string olderPath = older.path;
+        std::string newerPath = newer.path;
+
+        auto segments = std::make_shared<SegmentList>(current);
+        segments->erase(segments->begin() + pick, segments->begin() + pick + 2);
+        segments->insert(segments->begin() + pick, segment);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _segments = segments;
+        }
+
+        // Запросы, которые ещё держат старые сегменты, читают их отображение
+        unlink(olderPath.c_str());
+        unlink(newerPath.c_str());
+    }
+}
+
+// Пересечение отсортированных списков; результат в lists[0]
+static void intersect(std::vector<std::vector<LogAddress>>& lists)
+{
+    std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.size() < b.size(); });
+
+    std::vector<LogAddress>& result = lists[0];
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i)
+    {
+        std::vector<LogAddress> both;
+        std::set_intersection(result.begin(), result.end(), lists[i].begin(), lists[i].end(), std::back_inserter(both));
+        result.swap(both);
+    }
+}
+
+std::vector<SearchIndex::Match> SearchIndex::Find(const std::string& network, const std::string& channel,
+                                                   const std::string& query, size_t limit)
+{
+    MemScope scope(MemSearch);
+    std::vector<Match> matches;
+    if (!_log)
+        return matches;
+
+    std::vector<std::string> words = Tokenize(query.data(), query.size());
+    uint32_t networkId = _log->Find(LogNetwork, network);
+    uint32_t channelId = _log->Find(LogChannel, channel);
+    if (words.empty() || networkId == 0 || channelId == 0)
+        return matches;
+    std::string suffix = channelSuffix(networkId, channelId);
+    for (std::string& word : words)
+        word += suffix;
+
+    std::vector<LogAddress> found;
+    std::vector<std::vector<LogAddress>> lists(words.size());
+    std::shared_ptr<const SegmentList> segments;
+
+    // Сначала самое свежее - индекс в памяти
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        segments = _segments;
+
+        bool complete = true;
+        for (size_t i = 0; i < words.size() && complete; ++i)
+        {
+            auto entry = _memtable.find(words[i]);
+            complete = entry != _memtable.end();
+            if (complete)
+                decodePostings(entry->second.bytes.data(), entry->second.bytes.size(), lists[i]);
+        }
+        if (complete)
+        {
+            intersect(lists);
+            for (auto it = lists[0].rbegin(); it != lists[0].rend() && found.size() < limit; ++it)
+                found.push_back(*it);
+        }
+    }
+
+    for (auto segment = segments->rbegin(); segment != segments->rend() && found.size() < limit; ++segment)
+    {
+        bool complete = true;
+        for (size_t i = 0; i < words.size() && complete; ++i)
+        {
+            const IndexTerm* term = (*segment)->Lookup(words[i]);
+            complete = term != nullptr;
+            if (complete)
+                decodePostings((*segment)->data + term->postings, term->bytes, lists[i]);
+        }
+        if (!complete)
+            continue;
+
+        intersect(lists);
+        for (auto it = lists[0].rbegin(); it != lists[0].rend() && found.size() < limit; ++it)
+            found.push_back(*it);
+    }
+
+    ChannelLogReader reader;
+    reader.Open(_log->Dir(), false);
+    for (LogAddress address : found)
+    {
+        LogRecord record;
+        Match match;
+        if (!reader.Fetch(address, &record, &match.text))
+            continue;
+        match.timestamp = record.timestamp;
+        match.flags = record.flags;
+        match.nick = _log->Name(LogNick, record.nick);
+        matches.push_back(std::move(match));
+    }
+    return matches;
+}
+
+std::string SearchIndex::Report()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    size_t bytes = 0;
+    for (const auto& segment : *_segments)
+        bytes += segment->size;
+
+    return std::to_string(_indexed) + " new records, " + std::to_string(_segments->size()) + " segments (" + std::to_string(bytes >> 10) + " kB), "
+         + std::to_string(_memtable.size()) + " words in memory";
+}
@@ -0,0 +1,98 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+
+#include "thread.h"
+#include "chanlog.h"
+
+// Полнотекстовый поиск по журналу каналов: обратный индекс "слово -> адреса
+// записей журнала". Фоновый поток дочитывает новые записи журнала и копит
+// индекс в памяти; набрав FlushBytes, сбрасывает его в неизменяемый сегмент
+// <logDir>/index/NNNNNNNN.idx. Соседние сегменты периодически сливаются,
+// чтобы их оставалось не больше MaxSegments.
+//
+// Сегмент: заголовок, списки адресов (разности соседних адресов в varint),
+// имена слов и отсортированная таблица слов для двоичного поиска. Файл
+// отображается в память, запрос читает только нужные списки.
+// Приватные сообщения в индекс не попадают.
+class SearchIndex
+{
+public:
+    SearchIndex();
+    ~SearchIndex();
+
+    bool Open(ChannelLog* log);
+    // Сбрасывает накопленное в сегмент и останавливает поток
+    void Close();
+    bool IsOpen() const { return _log != nullptr; };
+
+    struct Match
+    {
+        uint64_t timestamp;
+        uint16_t flags;
+        std::string nick;
+        std::string text;
+    };
+    // Записи канала, содержащие все слова запроса, от новых к старым
+    std::vector<Match> Find(const std::string& network, const std::string& channel,
+                            const std::string& query, size_t limit);
+
+    std::string Report();
+
+    // Слова текста в нижнем регистре (латиница и кириллица), без повторов
+    static std::vector<std::string> Tokenize(const char* text, size_t length);
+
+    struct Segment;
+
+private:
+    static const size_t FlushBytes = 8 << 20;       // объём индекса в памяти до сброса
+    static const size_t MaxSegments = 8;
+    static const int64_t FlushIdleMs = 600000;      // сбрасывать не реже, мс
+
+    struct Postings
+    {
+        LogAddress last = 0;
+        uint32_t count = 0;
+        std::string bytes;      // varint-разности адресов
+    };
+    typedef std::vector<std::shared_ptr<const Segment>> SegmentList;
+
+    static ThreadReturn indexThread(void* param);
+
+    void LoadSegments();
+    void IndexNew();
+    void AddDocument(LogAddress address, const LogRecord& record, const char* text);
+    void Flush();
+    void Merge();
+    std::string SegmentPath(uint32_t sequence) const;
+
+    ChannelLog* _log;
+    std::string _dir;
+    Thread _thread;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _stop;
+
+    // Под _mutex; изменяет только поток индекса
+    std::unordered_map<std::string, Postings> _memtable;
+    size_t _memBytes;
+    LogAddress _memFirst;
+    std::shared_ptr<const SegmentList> _segments;
+    std::atomic<uint64_t> _indexed;     // записей разобрано с момента запуска
+
+    // Только поток индекса
+    LogAddress _next;           // первая ещё не проиндексированная запись
+    uint32_t _fileSequence;
+    int64_t _lastFlush;
+};
+
+#endif
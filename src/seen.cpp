@@ -0,0 +1,374 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "seen.h"
+#include "casemap.h"
+#include "memtrack.h"
+
+static const char SeenMagic[8] = { 'S', 'E', 'E', 'N', 'D', 'B', '\0', '\0' };
+static const uint32_t SeenVersion = 1;
+static const size_t MaxNick = 44;
+static const size_t MaxWhere = 56;
+
+struct SeenDb::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slotSize;
+    uint64_t capacity;      // число ячеек, степень двойки
+    uint64_t count;         // занятые ячейки
+    char reserved[96];
+};
+
+struct SeenDb::Slot
+{
+    uint64_t hash;          // 0 - ячейка пуста
+    uint32_t checksum;      // по всей ячейке, кроме самого поля
+    uint32_t network;       // хеш имени сети
+    int64_t when;
+    uint8_t action;
+    uint8_t nickLength;
+    uint8_t whereLength;
+    uint8_t reserved;
+    char nick[MaxNick];
+    char where[MaxWhere];
+};
+
+static_assert(sizeof(SeenDb::Header) == 128, "SeenDb::Header layout is part of the file format");
+static_assert(sizeof(SeenDb::Slot) == 128, "SeenDb::Slot layout is part of the file format");
+
+static uint32_t fnv32(const void* data, size_t length, uint32_t hash = 2166136261u)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static uint64_t keyHash(const std::string& folded, uint32_t network)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : folded)
+        hash = (hash ^ c) * 1099511628211ull;
+    hash = (hash ^ network) * 1099511628211ull;
+    return hash ? hash : 1;
+}
+
+static uint32_t slotChecksum(const SeenDb::Slot& slot)
+{
+    uint32_t hash = fnv32(&slot.hash, sizeof(slot.hash));
+    return fnv32(&slot.network, sizeof(slot) - offsetof(SeenDb::Slot, network), hash);
+}
+
+static bool slotValid(const SeenDb::Slot& slot)
+{
+    return slot.checksum == slotChecksum(slot) && slot.nickLength <= MaxNick && slot.whereLength <= MaxWhere;
+}
+
+SeenDb::SeenDb() : _fd(-1), _header(nullptr), _slots(nullptr), _mapped(0), _maxCapacity(0)
+{
+}
+
+SeenDb::~SeenDb()
+{
+    Close();
+}
+
+bool SeenDb::Open(const std::string& path, size_t maxEntries)
+{
+    _path = path;
+
+    // Таблица держится заполненной не больше чем на 70%
+    _maxCapacity = InitialCapacity;
+    while (_maxCapacity * 7 / 10 < maxEntries)
+        _maxCapacity <<= 1;
+
+    if (access(path.c_str(), F_OK) == 0)
+    {
+        if (Map(path, 0, false))
+        {
+            std::cout << "Seen database: " << path << ", " << Size() << " of " << Capacity() << " slots" << std::endl;
+            return true;
+        }
+        std::cerr << "Seen database: " << path << " is damaged, starting a new one" << std::endl;
+    }
+
+    return Map(path, InitialCapacity, true);
+}
+
+void SeenDb::Close()
+{
+    if (_header)
+        msync(_header, _mapped, MS_SYNC);
+    Unmap();
+}
+
+bool SeenDb::Map(const std::string& path, size_t capacity, bool create)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (fd == -1)
+    {
+        std::cerr << "Seen database: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    Header header;
+    if (create)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SeenMagic, sizeof(SeenMagic));
+        header.version = SeenVersion;
+        header.slotSize = sizeof(Slot);
+        header.capacity = capacity;
+
+        // Файл разрежённый: место на диске занимают только записанные ячейки
+        if (ftruncate(fd, sizeof(Header) + capacity * sizeof(Slot)) != 0
+            || pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+        {
+            close(fd);
+            return false;
+        }
+    }
+    else
+    {
+        struct stat st;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) != 0
+            || memcmp(header.magic, SeenMagic, sizeof(SeenMagic)) != 0 || header.version != SeenVersion
+            || header.slotSize != sizeof(Slot) || header.capacity == 0 || (header.capacity & (header.capacity - 1))
+            || size_t(st.st_size) != sizeof(Header) + header.capacity * sizeof(Slot))
+        {
+            close(fd);
+            return false;
+        }
+    }
+
+    size_t size = sizeof(Header) + header.capacity * sizeof(Slot);
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    Unmap();
+    _fd = fd;
+    _mapped = size;
+    _header = (Header*)data;
+    _slots = (Slot*)((char*)data + sizeof(Header));
+    return true;
+}
+
+void SeenDb::Unmap()
+{
+    if (_header)
+        munmap(_header, _mapped);
+    if (_fd != -1)
+        close(_fd);
+
+    _fd = -1;
+    _header = nullptr;
+    _slots = nullptr;
+    _mapped = 0;
+}
+
+size_t SeenDb::Size() const
+{
+    return _header ? _header->count : 0;
+}
+
+size_t SeenDb::Capacity() const
+{
+    return _header ? _header->capacity : 0;
+}
+
+SeenDb::Slot* SeenDb::Probe(uint64_t hash, uint32_t network, const std::string& folded, Slot** empty) const
+{
+    size_t mask = _header->capacity - 1;
+    size_t index = hash & mask;
+
+    *empty = nullptr;
+    for (size_t probe = 0; probe <= mask; ++probe, index = (index + 1) & mask)
+    {
+        Slot* slot = &_slots[index];
+        uint64_t slotHash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (slotHash == 0)
+        {
+            *empty = slot;
+            return nullptr;
+        }
+
+        if (slotHash != hash || slot->network != network)
+            continue;
+
+        // Ячейка с оборванной записью этого же ключа перезаписывается целиком
+        if (!slotValid(*slot))
+            return slot;
+
+        if (foldNick(std::string(slot->nick, slot->nickLength)) == folded)
+            return slot;
+    }
+    return nullptr;
+}
+
+int64_t SeenDb::EvictionCutoff() const
+{
+    // Четверть по возрасту оцениваем по равномерной выборке ячеек
+    std::vector<int64_t> sample;
+    size_t step = std::max<size_t>(1, _header->capacity / CutoffSample);
+    for (size_t i = 0; i < _header->capacity; i += step)
+    {
+        if (_slots[i].hash != 0)
+            sample.push_back(_slots[i].when);
+    }
+    if (sample.empty())
+        return 0;
+
+    std::nth_element(sample.begin(), sample.begin() + sample.size() / 4, sample.end());
+    return sample[sample.size() / 4];
+}
+
+bool SeenDb::Rehash(size_t capacity, int64_t cutoff)
+{
+    std::string temp = _path + ".tmp";
+
+    SeenDb fresh;
+    if (!fresh.Map(temp, capacity, true))
+        return false;
+
+    // Записей ровно с временем cutoff (одна секунда при наплыве) выбрасываем
+    // столько, чтобы вместе с более старыми ушла четверть
+    size_t older = 0;
+    if (cutoff)
+    {
+        for (size_t i = 0; i < _header->capacity; ++i)
+            older += _slots[i].hash != 0 && _slots[i].when < cutoff;
+    }
+    size_t sameQuota = cutoff && older < _header->count / 4 ? _header->count / 4 - older : 0;
+
+    // Ключи уникальны, поэтому ячейки просто переносятся в первую свободную
+    // позицию своей цепочки, без сравнения ников
+    size_t mask = capacity - 1;
+    size_t count = 0;
+    for (size_t i = 0; i < _header->capacity; ++i)
+    {
+        const Slot& slot = _slots[i];
+        if (slot.hash == 0 || slot.when < cutoff || !slotValid(slot))
+            continue;
+        if (slot.when == cutoff && sameQuota > 0)
+        {
+            --sameQuota;
+            continue;
+        }
+
+        size_t index = slot.hash & mask;
+        while (fresh._slots[index].hash != 0)
+            index = (index + 1) & mask;
+        fresh._slots[index] = slot;
+        ++count;
+    }
+    fresh._header->count = count;
+
+    if (msync(fresh._header, fresh._mapped, MS_SYNC) != 0 || rename(temp.c_str(), _path.c_str()) != 0)
+    {
+        unlink(temp.c_str());
+        return false;
+    }
+
+    if (capacity > _header->capacity)
+        std::cout << "[*] Seen database grown to " << capacity << " slots (" << count << " nicks)" << std::endl;
+    else
+        std::cout << "[*] Seen database compacted to " << count << " nicks" << std::endl;
+
+    Unmap();
+    std::swap(_fd, fresh._fd);
+    std::swap(_header, fresh._header);
+    std::swap(_slots, fresh._slots);
+    std::swap(_mapped, fresh._mapped);
+    return true;
+}
+
+void SeenDb::Update(std::string_view network, std::string_view nick, SeenAction action,
+                    std::string_view where, time_t when)
+{
+    MemScope scope(MemSeen);
+    if (!_header || nick.empty())
+        return;
+
+    std::string_view shortNick = nick.substr(0, MaxNick);
+    std::string folded;
+    foldNick(shortNick, &folded);
+    uint32_t networkHash = fnv32(network.data(), network.size());
+    uint64_t hash = keyHash(folded, networkHash);
+
+    Slot* empty;
+    Slot* slot = Probe(hash, networkHash, folded, &empty);
+
+    bool fresh = false;
+    if (!slot)
+    {
+        // Растём, пока можно; таблица предельного размера освобождается от
+        // старых записей. Перестройка блокирует на время прохода по файлу,
+        // но случается раз на четверть ёмкости новых ников.
+        if (_header->count >= _header->capacity * 7 / 10)
+        {
+            bool rebuilt = _header->capacity < _maxCapacity
+                ? Rehash(_header->capacity * 2, 0)
+                : Rehash(_header->capacity, EvictionCutoff());
+            if (rebuilt)
+                Probe(hash, networkHash, folded, &empty);
+        }
+        slot = empty;
+        fresh = true;
+    }
+    if (!slot)
+        return;
+
+    Slot record;
+    memset(&record, 0, sizeof(record));
+    record.hash = hash;
+    record.network = networkHash;
+    record.when = when;
+    record.action = action;
+    record.nickLength = shortNick.size();
+    memcpy(record.nick, shortNick.data(), shortNick.size());
+    record.whereLength = std::min(where.size(), MaxWhere);
+    memcpy(record.where, where.data(), record.whereLength);
+    record.checksum = slotChecksum(record);
+
+    if (fresh)
+    {
+        // Содержимое раньше хеша: пока хеш не записан, ячейка для всех пуста
+        memcpy((char*)slot + sizeof(record.hash), (char*)&record + sizeof(record.hash), sizeof(record) - sizeof(record.hash));
+        __atomic_store_n(&slot->hash, hash, __ATOMIC_RELEASE);
+        ++_header->count;
+    }
+    else
+        *slot = record;
+}
+
+bool SeenDb::Find(const std::string& network, const std::string& nick, SeenEntry* entry) const
+{
+    if (!_header)
+        return false;
+
+    std::string folded = foldNick(nick.substr(0, MaxNick));
+    uint32_t networkHash = fnv32(network.data(), network.size());
+
+    Slot* empty;
+    const Slot* slot = Probe(keyHash(folded, networkHash), networkHash, folded, &empty);
+    if (!slot || !slotValid(*slot))
+        return false;
+
+    entry->when = slot->when;
+    entry->action = SeenAction(slot->action);
+    entry->nick.assign(slot->nick, slot->nickLength);
+    entry->where.assign(slot->where, slot->whereLength);
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef SEEN_H_
+#define SEEN_H_
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <ctime>
+
+// Что делал пользователь, когда бот видел его последний раз
+enum SeenAction : uint8_t
+{
+    SeenJoin = 1,
+    SeenPart,
+    SeenQuit,
+    SeenNickTo,         // сменил ник на where
+    SeenNickFrom,       // пришёл с ника where
+    SeenMessage
+};
+
+struct SeenEntry
+{
+    time_t when;
+    SeenAction action;
+    std::string nick;   // как был написан
+    std::string where;  // канал или другой ник
+};
+
+// База "seen": хеш-таблица с открытой адресацией (линейное пробирование)
+// прямо в отображённом файле. Ключ - ник в регистре RFC 1459 плюс сеть.
+// При запуске файл только отображается, ничего не читается целиком.
+//
+// Ячейки не удаляются, поэтому цепочки пробирования не рвутся. Новая ячейка
+// публикуется записью хеша после остального содержимого; обновление на месте
+// защищено контрольной суммой - оборванная запись делает недействительной
+// одну ячейку (её ник просто забывается), но не таблицу.
+//
+// При заполнении на 70% таблица перестраивается в файл вдвое больше, пока не
+// упрётся в maxEntries; дальше она перестраивается того же размера без самой
+// старой четверти записей, и файл больше не растёт.
+class SeenDb
+{
+public:
+    SeenDb();
+    ~SeenDb();
+
+    bool Open(const std::string& path, size_t maxEntries);
+    void Close();
+    bool IsOpen() const { return _header != nullptr; };
+
+    void Update(std::string_view network, std::string_view nick, SeenAction action,
+                std::string_view where, time_t when);
+    bool Find(const std::string& network, const std::string& nick, SeenEntry* entry) const;
+
+    size_t Size() const;
+    size_t Capacity() const;
+
+    struct Header;
+    struct Slot;
+
+private:
+    static const size_t InitialCapacity = 1 << 16;
+    static const size_t CutoffSample = 1 << 16;
+
+    bool Map(const std::string& path, size_t capacity, bool create);
+    void Unmap();
+    // Перестройка в новый файл; cutoff != 0 - без записей старше cutoff
+    // (и части записей ровно с этим временем), всего около четверти
+    bool Rehash(size_t capacity, int64_t cutoff);
+    int64_t EvictionCutoff() const;
+    // Ячейка ключа или nullptr; empty - пустая ячейка в конце цепочки
+    Slot* Probe(uint64_t hash, uint32_t network, const std::string& folded, Slot** empty) const;
+
+    std::string _path;
+    int _fd;
+    Header* _header;
+    Slot* _slots;
+    size_t _mapped;
+    size_t _maxCapacity;
+};
+
+#endif
@@ -1,13 +1,26 @@
 
+
 #include <cstring>
+#include <cerrno>
 #include <fcntl.h>
+#include <poll.h>
+#include <climits>
+#include <netinet/tcp.h>
 #include "socket.h"
 
-#define MAXDATASIZE 2048
+#define MAXDATASIZE 16384
 
 bool IRCSocket::Init()
 {
-    if ((_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
+    return Open(PF_INET);
+}
+
+bool IRCSocket::Open(int family)
+{
+    if (_socket != INVALID_SOCKET)
+        closesocket(_socket);
+
+    if ((_socket = socket(family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) == INVALID_SOCKET)
     {
         std::cout << "Socket error." << std::endl;
         return false;
@@ -20,80 +33,232 @@ bool IRCSocket::Init()
         return false;
     }
 
-    fcntl(_socket, F_SETFL, O_NONBLOCK);
-    fcntl(_socket, F_SETFL, O_ASYNC);
+    // Строки и так копятся до конца итерации цикла и уходят одной записью,
+    // алгоритм Нейгла только задержал бы ответы, идущие по одному через паузу
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (char const*)&on, sizeof(on));
+
+    // Сокет неблокирующий: ожидание идёт в poll() цикла событий
+    fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL) | O_NONBLOCK);
 
     return true;
 }
 
-bool IRCSocket::Connect(const char* host, int port)
+bool IRCSocket::BeginConnect(const struct addrinfo* address)
 {
-    struct addrinfo hints;
-    struct addrinfo* result = nullptr;
-
-    // Заполняем структуру hints для указания параметров разрешения имени хоста
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;      // Поддержка как IPv4, так и IPv6
-    hints.ai_socktype = SOCK_STREAM; // TCP сокет
-    hints.ai_protocol = IPPROTO_TCP; // Протокол TCP
-
-    // Преобразуем порт в строку
-    std::string portStr = std::to_string(port);
-
-    // Вызываем getaddrinfo для разрешения имени хоста
-    int status = getaddrinfo(host, portStr.c_str(), &hints, &result);
-    if (status != 0)
+    if (!Open(address->ai_family))
     {
-        std::cout << "Could not resolve host: " << host << " (" << gai_strerror(status) << ")" << std::endl;
+        AbortConnect();
         return false;
     }
 
-    // Перебираем результаты и пытаемся установить соединение
-    bool connected = false;
-    for (struct addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next)
+    // Неблокирующий connect() сразу возвращает EINPROGRESS; даже если соединение
+    // установилось на месте, итог всё равно забирает FinishConnect() по POLLOUT
+    if (connect(_socket, address->ai_addr, address->ai_addrlen) == SOCKET_ERROR && errno != EINPROGRESS)
     {
-        // Пытаемся установить соединение
-        if (connect(_socket, ptr->ai_addr, ptr->ai_addrlen) == SOCKET_ERROR)
-        {
-            // Если не удалось, продолжаем с следующим адресом
-            continue;
-        }
-        
-        // Соединение успешно установлено
-        connected = true;
-        break;
+        AbortConnect();
+        return false;
     }
 
-    // Освобождаем память, выделенную getaddrinfo
-    freeaddrinfo(result);
+    return true;
+}
 
-    if (!connected)
+bool IRCSocket::FinishConnect()
+{
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &len) == SOCKET_ERROR || error != 0)
     {
-        std::cout << "Could not connect to: " << host << std::endl;
-        closesocket(_socket);
+        AbortConnect();
         return false;
     }
 
+    _transport.reset(new PlainTransport(_socket));
+    _handshake = Transport::Done;
+
+    _stats = SendStats();
     _connected = true;
 
     return true;
 }
 
+void IRCSocket::AbortConnect()
+{
+    if (_connected || _socket == INVALID_SOCKET)
+        return;
+
+    closesocket(_socket);
+    _socket = INVALID_SOCKET;
+}
+
+bool IRCSocket::StartTls(const std::string& host, int port, const TlsOptions& options)
+{
+    TlsTransport* tls = new TlsTransport();
+    _transport.reset(tls);
+    if (!tls->Init(_socket, host, port, options))
+        return false;
+
+    _handshake = Transport::WantWrite;
+    return true;
+}
+
+Transport::Status IRCSocket::Handshake()
+{
+    _handshake = _transport->Handshake();
+    return _handshake;
+}
+
+short IRCSocket::PollEvents()
+{
+    if (_handshake == Transport::WantWrite)
+        return POLLOUT;
+    return Handshaking() || !Sending() ? POLLIN : POLLIN | POLLOUT;
+}
+
 void IRCSocket::Disconnect()
+{
+    if (!_connected)
+        return;
+
+    // То, что уже накоплено (обычно QUIT), отправляем, если сокет примет сразу
+    Flush();
+    Close();
+}
+
+bool IRCSocket::Adopt(int fd)
+{
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 || type != SOCK_STREAM)
+        return false;
+
+    if (_socket != INVALID_SOCKET)
+        closesocket(_socket);
+    _socket = fd;
+
+    // Флаги файла общие с прежним процессом, но опции могли и не быть выставлены
+    int on = 1;
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (char const*)&on, sizeof(on));
+    fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL) | O_NONBLOCK);
+
+    _transport.reset(new PlainTransport(_socket));
+    _handshake = Transport::Done;
+    _stats = SendStats();
+    _connected = true;
+    return true;
+}
+
+void IRCSocket::Release()
+{
+    // close() без shutdown(): пока копия дескриптора есть у нового процесса,
+    // сервер ничего не заметит. Не отправленное остаётся неотправленным.
+    Close();
+}
+
+void IRCSocket::Close()
 {
     if (_connected)
     {
+        _transport.reset();
+        _handshake = Transport::Done;
         closesocket(_socket);
+        _socket = INVALID_SOCKET;
         _connected = false;
     }
+
+    _outq.clear();
+    _outOffset = _outBytes = 0;
 }
 
-bool IRCSocket::SendData(char const* data)
+void IRCSocket::SetCork(bool on)
 {
-    if (_connected)
-        if (send(_socket, data, strlen(data), 0) == -1)
-            return false;
+    int value = on;
+    setsockopt(_socket, IPPROTO_TCP, TCP_CORK, (char const*)&value, sizeof(value));
+}
+
+bool IRCSocket::SendData(std::string data)
+{
+    if (!_connected)
+        return true;
+
+    _outBytes += data.size();
+    _outq.push_back(std::move(data));
+    ++_stats.lines;
+    return true;
+}
+
+bool IRCSocket::Flush()
+{
+    if (!_connected || Handshaking() || _outq.empty())
+        return _connected;
+
+    if (_outBytes > MaxOutput)
+    {
+        std::cout << "[!] Send queue exceeded (" << _outBytes << " bytes), dropping connection" << std::endl;
+        Close();
+        return false;
+    }
+
+    // Пачка, которая не уйдёт одной записью (больше IOV_MAX строк или TLS
+    // больше одной записи), собирается в полные сегменты пробкой TCP_CORK
+    bool cork = _outq.size() > IOV_MAX || _outBytes > CorkBytes;
+    if (cork)
+        SetCork(true);
+
+    bool ok = true;
+    struct iovec iov[IOV_MAX];
+    while (!_outq.empty())
+    {
+        int count = 0;
+        size_t attempted = 0;
+        for (std::deque<std::string>::const_iterator itr = _outq.begin(); itr != _outq.end() && count < IOV_MAX; ++itr, ++count)
+        {
+            size_t skip = count == 0 ? _outOffset : 0;
+            iov[count].iov_base = (void*)(itr->data() + skip);
+            iov[count].iov_len = itr->size() - skip;
+            attempted += iov[count].iov_len;
+        }
+
+        ssize_t sent = _transport->WriteV(iov, count);
+        if (sent > 0)
+        {
+            ++_stats.writes;
+            _stats.bytes += sent;
+            _outBytes -= sent;
+            // Короткая запись: буфер сокета полон (следующая попытка получит
+            // EAGAIN) или TLS отдал одну запись из нескольких - пробуем ещё
+            if (size_t(sent) < attempted)
+                ++_stats.partial;
+
+            // Снимаем отправленные строки; с недописанной продолжим с того же места
+            size_t left = sent;
+            while (left > 0 && left >= _outq.front().size() - _outOffset)
+            {
+                left -= _outq.front().size() - _outOffset;
+                _outOffset = 0;
+                _outq.pop_front();
+            }
+            _outOffset += left;
+            continue;
+        }
+
+        if (sent == -1 && errno == EINTR)
+            continue;
+        // Остаток допишем, когда poll() сообщит POLLOUT
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        ok = false;
+        break;
+    }
 
+    if (!ok)
+    {
+        Close();
+        return false;
+    }
+
+    if (cork)
+        SetCork(false);
     return true;
 }
 
@@ -101,13 +266,11 @@ std::string IRCSocket::ReceiveData()
 {
     char buffer[MAXDATASIZE];
 
-    memset(buffer, 0, MAXDATASIZE);
-
-    int bytes = recv(_socket, buffer, MAXDATASIZE - 1, 0);
+    int bytes = _transport->Read(buffer, MAXDATASIZE);
 
     if (bytes > 0)
-        return std::string(buffer);
-    else
+        return std::string(buffer, bytes);
+    else if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
         Disconnect();
 
     return "";
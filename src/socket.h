@@ -3,33 +3,93 @@
 
 #include <iostream>
 #include <sstream>
+#include <memory>
+#include <deque>
+#include <cstdint>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <unistd.h>
 #define closesocket(s) close(s)
-#define close(s)
 #define SOCKET_ERROR -1
 #define INVALID_SOCKET -1
 
+#include "transport.h"
+#include "tls.h"
+
 class IRCSocket
 {
 public:
+    IRCSocket() : _socket(INVALID_SOCKET), _connected(false), _handshake(Transport::Done), _outOffset(0), _outBytes(0) {};
+
     bool Init();
 
-    bool Connect(char const* host, int port);
+    // Неблокирующее подключение к одному адресу. true - соединение пошло:
+    // готовность придёт как POLLOUT на Fd(), итог заберёт FinishConnect()
+    bool BeginConnect(const struct addrinfo* address);
+    // После POLLOUT: false - адрес не принял соединение, сокет закрыт
+    bool FinishConnect();
+    // Бросить незавершённое подключение
+    void AbortConnect();
     void Disconnect();
 
+    // Горячее обновление: принять уже зарегистрированное соединение от
+    // прежнего процесса / закрыть свою копию, не трогая само соединение
+    bool Adopt(int fd);
+    void Release();
+
+    // Поднять TLS поверх установленного соединения; рукопожатие затем
+    // продвигается вызовами Handshake(), когда сокет готов к PollEvents()
+    bool StartTls(const std::string& host, int port, const TlsOptions& options);
+    Transport::Status Handshake();
+    bool Handshaking() { return _handshake != Transport::Done; };
+    short PollEvents();
+
     bool Connected() { return _connected; };
+    bool Secure() { return _transport && _transport->Secure(); };
+    bool Pending() { return _transport && _transport->Pending(); };
+    int Fd() const { return _socket; };
+
+    // Строка ставится в буфер отправки; в сокет её пишет Flush()
+    bool SendData(std::string data);
+    // Всё накопленное - одним sendmsg (TLS - одним SSL_write). Недописанный
+    // остаток ждёт POLLOUT. false - соединение разорвано.
+    bool Flush();
+    bool Sending() { return !_outq.empty(); };
+
+    struct SendStats
+    {
+        uint64_t lines = 0;     // строк поставлено в буфер
+        uint64_t writes = 0;    // вызовов записи в сокет
+        uint64_t partial = 0;   // из них записавших не всё
+        uint64_t bytes = 0;
+    };
+    // Счётчики текущего соединения
+    SendStats Stats() { return _stats; };
 
-    bool SendData(char const* data);
     std::string ReceiveData();
 
 private:
+    static const size_t MaxOutput = 1 << 20;    // больше не отправленного - сервер не читает
+    static const size_t CorkBytes = 16 << 10;   // пачка, которая уйдёт несколькими записями
+
+    bool Open(int family);
+    void Close();
+    void SetCork(bool on);
+
     int _socket;
+    std::unique_ptr<Transport> _transport;
 
     bool _connected;
+    Transport::Status _handshake;
+
+    // Буфер отправки; только поток цикла событий (другие потоки - через IRCBot::Post)
+    std::deque<std::string> _outq;
+    size_t _outOffset;          // сколько байт первой строки уже отправлено
+    size_t _outBytes;           // всего не отправлено
+    SendStats _stats;
 };
 
 #endif
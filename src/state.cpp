@@ -0,0 +1,352 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "state.h"
+
+static const char StateMagic[8] = { 'I', 'R', 'C', 'S', 'T', 'A', 'T', 'E' };
+static const uint32_t StateVersion = 1;
+
+enum StateSectionKind : uint32_t
+{
+    SectionStrings = 1,     // count - размер пула в байтах
+    SectionChannels,
+    SectionLimits
+};
+
+struct StateSnapshot::StrRef
+{
+    uint32_t offset;    // от начала пула строк
+    uint32_t length;
+};
+
+struct StateSnapshot::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sections;
+    uint64_t size;      // весь файл
+    uint64_t checksum;  // FNV-1a всего, что после заголовка
+    int64_t saved;      // UTC, мс
+    StrRef network;
+    int32_t lag;
+    uint32_t reserved;
+};
+
+struct StateSnapshot::Section
+{
+    uint32_t kind;
+    uint32_t count;
+    uint64_t offset;    // от начала файла, кратно 8
+};
+
+struct StateSnapshot::Channel
+{
+    StrRef name;
+};
+
+struct StateSnapshot::LimitRecord
+{
+    uint64_t hash;      // FNV-1a ключа; записи отсортированы по (limiter, hash)
+    int64_t tat;        // относительно момента сохранения, нс
+    StrRef key;
+    uint8_t limiter;
+    uint8_t limited;
+    uint8_t reserved[6];
+};
+
+static_assert(sizeof(StateSnapshot::Header) == 56, "state header layout");
+static_assert(sizeof(StateSnapshot::LimitRecord) == 32, "state limit record layout");
+
+static uint64_t fnv1a(const char* data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= uint8_t(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int64_t steadyNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t wallMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+StateSnapshot::StateSnapshot() : _data(nullptr), _size(0), _shift(0)
+{
+}
+
+StateSnapshot::~StateSnapshot()
+{
+    Close();
+}
+
+bool StateSnapshot::Open(const std::string& path)
+{
+    _path = path;
+    if (access(path.c_str(), F_OK) != 0)
+        return false;
+
+    if (!Map(path))
+    {
+        std::cerr << "State: " << path << " is damaged or from another version, ignoring it" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void StateSnapshot::Close()
+{
+    Unmap();
+}
+
+void StateSnapshot::Unmap()
+{
+    if (_data)
+        munmap((void*)_data, _size);
+    _data = nullptr;
+    _size = 0;
+}
+
+bool StateSnapshot::Map(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    // Проверяется всё, кроме строк: их границы сверяет String() при чтении
+    const char* bytes = (const char*)data;
+    const Header* header = (const Header*)bytes;
+    bool valid = memcmp(header->magic, StateMagic, sizeof(StateMagic)) == 0
+        && header->version == StateVersion
+        && header->size == uint64_t(st.st_size)
+        && header->sections <= (st.st_size - sizeof(Header)) / sizeof(Section)
+        && header->checksum == fnv1a(bytes + sizeof(Header), st.st_size - sizeof(Header));
+
+    const Section* sections = (const Section*)(bytes + sizeof(Header));
+    for (uint32_t i = 0; valid && i < header->sections; ++i)
+    {
+        uint64_t item = sections[i].kind == SectionStrings ? 1
+                      : sections[i].kind == SectionChannels ? sizeof(Channel)
+                      : sections[i].kind == SectionLimits ? sizeof(LimitRecord) : 0;
+        valid = sections[i].offset % 8 == 0 && sections[i].offset <= uint64_t(st.st_size)
+            && uint64_t(sections[i].count) * item <= st.st_size - sections[i].offset;
+    }
+
+    if (!valid)
+    {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    Unmap();
+    _data = bytes;
+    _size = st.st_size;
+
+    // Время ограничителей хранится от момента сохранения; steady_clock между
+    // запусками не связан, поэтому прошедшее время берётся по системным часам
+    int64_t elapsed = std::max<int64_t>(0, wallMs() - header->saved);
+    _shift = steadyNs() - elapsed * 1000000;
+    return true;
+}
+
+const void* StateSnapshot::SectionData(uint32_t kind, uint32_t* count) const
+{
+    *count = 0;
+    if (!_data)
+        return nullptr;
+
+    const Header* header = (const Header*)_data;
+    const Section* sections = (const Section*)(_data + sizeof(Header));
+    for (uint32_t i = 0; i < header->sections; ++i)
+    {
+        if (sections[i].kind == kind)
+        {
+            *count = sections[i].count;
+            return _data + sections[i].offset;
+        }
+    }
+    return nullptr;
+}
+
+std::string StateSnapshot::String(const StrRef& ref) const
+{
+    uint32_t size;
+    const char* pool = (const char*)SectionData(SectionStrings, &size);
+    if (!pool || ref.offset > size || ref.length > size - ref.offset)
+        return "";
+    return std::string(pool + ref.offset, ref.length);
+}
+
+std::string StateSnapshot::Network() const
+{
+    return _data ? String(((const Header*)_data)->network) : "";
+}
+
+int StateSnapshot::Lag() const
+{
+    return _data ? ((const Header*)_data)->lag : -1;
+}
+
+int64_t StateSnapshot::SavedAt() const
+{
+    return _data ? ((const Header*)_data)->saved : 0;
+}
+
+std::vector<std::string> StateSnapshot::Channels() const
+{
+    uint32_t count;
+    const Channel* channels = (const Channel*)SectionData(SectionChannels, &count);
+
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < count; ++i)
+        names.push_back(String(channels[i].name));
+    return names;
+}
+
+size_t StateSnapshot::Limits() const
+{
+    uint32_t count;
+    SectionData(SectionLimits, &count);
+    return count;
+}
+
+bool StateSnapshot::FindLimit(uint8_t limiter, const std::string& key, int64_t* tat, bool* limited) const
+{
+    uint32_t count;
+    const LimitRecord* records = (const LimitRecord*)SectionData(SectionLimits, &count);
+    if (count == 0)
+        return false;
+
+    uint64_t hash = fnv1a(key.data(), key.size());
+    const LimitRecord* itr = std::lower_bound(records, records + count, std::make_pair(limiter, hash),
+        [](const LimitRecord& record, const std::pair<uint8_t, uint64_t>& wanted) {
+            return record.limiter != wanted.first ? record.limiter < wanted.first : record.hash < wanted.second;
+        });
+
+    for (; itr != records + count && itr->limiter == limiter && itr->hash == hash; ++itr)
+    {
+        if (String(itr->key) == key)
+        {
+            *tat = itr->tat + _shift;
+            *limited = itr->limited != 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Выравнивание секции до 8 байт
+static void pad(std::string& out)
+{
+    out.resize((out.size() + 7) & ~size_t(7), '\0');
+}
+
+bool StateSnapshot::Save(const Contents& contents)
+{
+    if (_path.empty())
+        return false;
+
+    int64_t now = steadyNs();
+
+    std::string pool;
+    auto intern = [&pool](const std::string& value) {
+        StrRef ref = { uint32_t(pool.size()), uint32_t(value.size()) };
+        pool += value;
+        return ref;
+    };
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, StateMagic, sizeof(StateMagic));
+    header.version = StateVersion;
+    header.sections = 3;
+    header.saved = wallMs();
+    header.network = intern(contents.network);
+    header.lag = contents.lag;
+
+    std::vector<Channel> channels;
+    for (const std::string& name : contents.channels)
+        channels.push_back({ intern(name) });
+
+    std::vector<LimitRecord> limits;
+    for (const Limit& limit : contents.limits)
+    {
+        LimitRecord record;
+        memset(&record, 0, sizeof(record));
+        record.hash = fnv1a(limit.key.data(), limit.key.size());
+        record.tat = limit.tat - now;
+        record.key = intern(limit.key);
+        record.limiter = limit.limiter;
+        record.limited = limit.limited;
+        limits.push_back(record);
+    }
+    std::sort(limits.begin(), limits.end(), [](const LimitRecord& a, const LimitRecord& b) {
+        return a.limiter != b.limiter ? a.limiter < b.limiter : a.hash < b.hash;
+    });
+
+    Section sections[3];
+    std::string body(sizeof(sections), '\0');
+    pad(body);
+    sections[0] = { SectionChannels, uint32_t(channels.size()), sizeof(Header) + body.size() };
+    body.append((const char*)channels.data(), channels.size() * sizeof(Channel));
+    pad(body);
+    sections[1] = { SectionLimits, uint32_t(limits.size()), sizeof(Header) + body.size() };
+    body.append((const char*)limits.data(), limits.size() * sizeof(LimitRecord));
+    pad(body);
+    sections[2] = { SectionStrings, uint32_t(pool.size()), sizeof(Header) + body.size() };
+    body += pool;
+    memcpy(&body[0], sections, sizeof(sections));
+
+    header.size = sizeof(Header) + body.size();
+    header.checksum = fnv1a(body.data(), body.size());
+
+    // Новый снимок - рядом, затем rename(): читатель видит либо старый, либо новый
+    std::string temp = _path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        std::cerr << "State: cannot write " << temp << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header)
+        && write(fd, body.data(), body.size()) == ssize_t(body.size())
+        && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(temp.c_str(), _path.c_str()) != 0)
+    {
+        std::cerr << "State: cannot write " << _path << ": " << strerror(errno) << std::endl;
+        unlink(temp.c_str());
+        return false;
+    }
+
+    return Map(_path);
+}
@@ -0,0 +1,77 @@
+#ifndef STATE_H_
+#define STATE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Снимок состояния бота для быстрого перезапуска: каналы, в которых он сидел,
+// состояние ограничителей частоты и сглаженная задержка до сервера.
+//
+// Файл не разбирается при запуске: он отображается в память и читается на
+// месте. Внутри только смещения от начала файла (его можно отобразить по
+// любому адресу), записи фиксированного размера и общий пул строк. Записи
+// ограничителей отсортированы по хешу ключа - ключ, которого ещё нет в
+// памяти, ищется двоичным поиском прямо в отображении. Файл пишется целиком
+// во временный и подменяется rename(), так что оборванная запись оставляет
+// прежний снимок.
+class StateSnapshot
+{
+public:
+    struct Limit
+    {
+        uint8_t limiter;    // номер ограничителя (0 - пользователи, 1 - каналы)
+        std::string key;
+        int64_t tat;        // по steady_clock этого процесса, нс
+        bool limited;
+    };
+
+    struct Contents
+    {
+        std::string network;    // сервер, к которому относятся каналы
+        int lag = -1;           // сглаженная задержка, мс (-1 - не измерялась)
+        std::vector<std::string> channels;
+        std::vector<Limit> limits;
+    };
+
+    StateSnapshot();
+    ~StateSnapshot();
+
+    // Запоминает путь и отображает снимок, если он есть и цел
+    bool Open(const std::string& path);
+    void Close();
+    bool Loaded() const { return _data != nullptr; };
+
+    // Записывает новый снимок и отображает уже его
+    bool Save(const Contents& contents);
+
+    // Чтение отображённого снимка; при !Loaded() - пустые значения
+    std::string Network() const;
+    int Lag() const;
+    int64_t SavedAt() const;            // UTC, мс
+    std::vector<std::string> Channels() const;
+    size_t Limits() const;
+    bool FindLimit(uint8_t limiter, const std::string& key, int64_t* tat, bool* limited) const;
+
+    size_t Bytes() const { return _size; };
+
+    struct Header;
+    struct Section;
+    struct StrRef;
+    struct Channel;
+    struct LimitRecord;
+
+private:
+    bool Map(const std::string& path);
+    void Unmap();
+    const void* SectionData(uint32_t kind, uint32_t* count) const;
+    std::string String(const StrRef& ref) const;
+
+    std::string _path;
+    const char* _data;
+    size_t _size;
+    int64_t _shift;     // сохранённое время ограничителя + _shift = steady_clock этого процесса
+};
+
+#endif
@@ -10,4 +10,14 @@ bool Thread::Start(ThreadFunction callback, void* param)
         return true;
     }
     return false;
-}
\ No newline at end of file
+}
+
+bool Thread::Join()
+{
+    if (_threadId == 0)
+        return false;
+
+    bool joined = pthread_join(_threadId, NULL) == 0;
+    _threadId = 0;
+    return joined;
+}
@@ -16,6 +16,7 @@ public:
     ~Thread();
 
     bool Start(ThreadFunction /*callback*/, void* /*param*/);
+    bool Join();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include <chrono>
+#include <utility>
+
+#include "timer.h"
+
+TimerWheel::TimerWheel() : _current(0), _count(0)
+{
+    for (int i = 0; i < Levels * Slots; ++i)
+        _slots[i] = Nil;
+    for (int i = 0; i < Levels; ++i)
+        _levelCount[i] = 0;
+
+    _origin = Now();
+}
+
+int64_t TimerWheel::Now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(int64_t delayMs, Callback callback)
+{
+    uint32_t index;
+    if (!_free.empty())
+    {
+        index = _free.back();
+        _free.pop_back();
+    }
+    else
+    {
+        index = _nodes.size();
+        _nodes.push_back(Node());
+        _nodes[index].generation = 1;
+    }
+
+    if (delayMs < 0)
+        delayMs = 0;
+
+    uint64_t expires = (Now() - _origin + delayMs + TickMs - 1) / TickMs;
+    if (expires <= _current)
+        expires = _current + 1;
+
+    Node& node = _nodes[index];
+    node.callback = std::move(callback);
+    node.expires = expires;
+    node.active = true;
+
+    Insert(index);
+    ++_count;
+
+    return (uint64_t(node.generation) << 32) | index;
+}
+
+bool TimerWheel::Cancel(TimerId id)
+{
+    uint32_t index = id & 0xFFFFFFFF;
+    uint32_t generation = id >> 32;
+
+    if (index >= _nodes.size())
+        return false;
+
+    Node& node = _nodes[index];
+    if (!node.active || node.generation != generation)
+        return false;
+
+    Unlink(index);
+    Release(index);
+    return true;
+}
+
+void TimerWheel::Advance(int64_t nowMs)
+{
+    uint64_t target = (nowMs - _origin) / TickMs;
+
+    // Пустое колесо перематывается сразу, без прохода по тикам
+    if (_count == 0 && target > _current)
+        _current = target;
+
+    while (_current < target)
+    {
+        ++_current;
+
+        // Дошли до границы ячейки старшего уровня - раскладываем её по младшим
+        for (int level = 1; level < Levels; ++level)
+        {
+            if ((_current >> (SlotBits * (level - 1))) & (Slots - 1))
+                break;
+            Cascade(level);
+        }
+
+        uint32_t slot = _current & (Slots - 1);
+        while (_slots[slot] != Nil)
+        {
+            uint32_t index = _slots[slot];
+            Unlink(index);
+
+            // Узел освобождается до вызова: обработчик может ставить новые таймеры
+            Callback callback = std::move(_nodes[index].callback);
+            Release(index);
+            callback();
+        }
+    }
+}
+
+int TimerWheel::NextTimeout(int64_t nowMs, int maxMs) const
+{
+    if (_count == 0)
+        return maxMs;
+
+    uint64_t ticks = Slots - (_current & (Slots - 1));   // до следующего каскада
+    if (_levelCount[0] > 0)
+    {
+        for (uint64_t i = 1; i < Slots; ++i)
+        {
+            if (_slots[(_current + i) & (Slots - 1)] != Nil)
+            {
+                ticks = i;
+                break;
+            }
+        }
+    }
+
+    int64_t timeout = _origin + int64_t(_current + ticks) * TickMs - nowMs;
+    if (timeout < 0)
+        return 0;
+    return timeout < maxMs ? int(timeout) : maxMs;
+}
+
+void TimerWheel::Insert(uint32_t index)
+{
+    Node& node = _nodes[index];
+
+    uint64_t delta = node.expires - _current;
+    int level = 0;
+    while (level < Levels - 1 && delta >= (uint64_t(1) << (SlotBits * (level + 1))))
+        ++level;
+
+    // Дальше верхнего уровня не заглядываем - такие таймеры встают на его край
+    if (level == Levels - 1 && delta >= (uint64_t(1) << (SlotBits * Levels)))
+        node.expires = _current + (uint64_t(1) << (SlotBits * Levels)) - 1;
+
+    uint16_t slot = level * Slots + ((node.expires >> (SlotBits * level)) & (Slots - 1));
+
+    node.slot = slot;
+    node.prev = Nil;
+    node.next = _slots[slot];
+    if (node.next != Nil)
+        _nodes[node.next].prev = index;
+    _slots[slot] = index;
+
+    ++_levelCount[level];
+}
+
+void TimerWheel::Unlink(uint32_t index)
+{
+    Node& node = _nodes[index];
+
+    if (node.prev != Nil)
+        _nodes[node.prev].next = node.next;
+    else
+        _slots[node.slot] = node.next;
+
+    if (node.next != Nil)
+        _nodes[node.next].prev = node.prev;
+
+    --_levelCount[node.slot / Slots];
+}
+
+void TimerWheel::Release(uint32_t index)
+{
+    Node& node = _nodes[index];
+
+    node.callback = nullptr;
+    node.active = false;
+    if (++node.generation == 0)
+        node.generation = 1;
+
+    _free.push_back(index);
+    --_count;
+}
+
+void TimerWheel::Cascade(int level)
+{
+    uint16_t slot = level * Slots + ((_current >> (SlotBits * level)) & (Slots - 1));
+
+    uint32_t index = _slots[slot];
+    _slots[slot] = Nil;
+
+    while (index != Nil)
+    {
+        uint32_t next = _nodes[index].next;
+        --_levelCount[level];
+        Insert(index);
+        index = next;
+    }
+}
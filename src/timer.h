@@ -0,0 +1,69 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+// Иерархическое колесо таймеров: 4 уровня по 256 ячеек, тик 10 мс.
+// Постановка, отмена и срабатывание таймера - O(1); таймеры дальних уровней
+// переносятся на ближние (каскадом), когда до них доходит очередь.
+// Узлы лежат в одном векторе и связаны индексами, отменённые идут в список
+// свободных, поэтому сотни тысяч таймеров не означают сотни тысяч аллокаций.
+class TimerWheel
+{
+public:
+    typedef uint64_t TimerId;           // 0 - недействительный таймер
+    typedef std::function<void()> Callback;
+
+    static const int64_t TickMs = 10;
+
+    TimerWheel();
+
+    // Текущее монотонное время в миллисекундах
+    static int64_t Now();
+
+    TimerId Schedule(int64_t delayMs, Callback callback);
+    bool Cancel(TimerId id);
+
+    // Выполняет все таймеры, срок которых наступил к моменту nowMs
+    void Advance(int64_t nowMs);
+
+    // Сколько ждать в poll() до ближайшего таймера, не более maxMs
+    int NextTimeout(int64_t nowMs, int maxMs) const;
+
+    size_t Size() const { return _count; };
+
+private:
+    static const int Levels = 4;
+    static const int SlotBits = 8;
+    static const int Slots = 1 << SlotBits;
+    static const uint32_t Nil = 0xFFFFFFFF;
+
+    struct Node
+    {
+        Callback callback;
+        uint64_t expires;   // тик срабатывания
+        uint32_t prev;
+        uint32_t next;
+        uint32_t generation;
+        uint16_t slot;      // level * Slots + index
+        bool active;
+    };
+
+    void Insert(uint32_t index);
+    void Unlink(uint32_t index);
+    void Release(uint32_t index);
+    void Cascade(int level);
+
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _free;
+    uint32_t _slots[Levels * Slots];
+    size_t _levelCount[Levels];
+
+    uint64_t _current;      // последний обработанный тик
+    int64_t _origin;        // время (мс), соответствующее тику 0
+    size_t _count;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <cerrno>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "tls.h"
+#include "timer.h"
+
+static std::mutex sessionLock;
+static std::map<std::string, SSL_SESSION*> sessionCache;
+
+// Контексты по набору настроек: у сетей в разных потоках они свои, а созданный
+// контекст живёт до выхода - SSL_new из другого потока не застанет его освобождённым
+static std::mutex contextLock;
+static std::map<std::string, SSL_CTX*> contexts;
+
+static std::string lastError()
+{
+    char buffer[256];
+    unsigned long error = ERR_get_error();
+    if (error == 0)
+        return "unknown error";
+    ERR_error_string_n(error, buffer, sizeof(buffer));
+    ERR_clear_error();
+    return buffer;
+}
+
+std::string TlsTransport::OptionsKey(const TlsOptions& options)
+{
+    return std::string(options.verify ? "1" : "0") + '\0' + options.cert + '\0' + options.key;
+}
+
+SSL_CTX* TlsTransport::Context(const TlsOptions& options)
+{
+    std::string key = OptionsKey(options);
+    std::lock_guard<std::mutex> lock(contextLock);
+    std::map<std::string, SSL_CTX*>::iterator itr = contexts.find(key);
+    if (itr != contexts.end())
+        return itr->second;
+
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx)
+    {
+        std::cout << "[tls] SSL_CTX_new failed: " << lastError() << std::endl;
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (options.verify)
+    {
+        SSL_CTX_set_default_verify_paths(ctx);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    }
+
+    if (!options.cert.empty())
+    {
+        const std::string& keyFile = options.key.empty() ? options.cert : options.key;
+        if (SSL_CTX_use_certificate_chain_file(ctx, options.cert.c_str()) != 1
+            || SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1)
+        {
+            std::cout << "[tls] Could not load client certificate " << options.cert << ": " << lastError() << std::endl;
+            SSL_CTX_free(ctx);
+            return NULL;
+        }
+    }
+
+    // Сессии храним сами, по host:port и настройкам, чтобы переживать переподключения
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &TlsTransport::NewSession);
+
+    contexts[key] = ctx;
+    return ctx;
+}
+
+int TlsTransport::NewSession(SSL* ssl, SSL_SESSION* session)
+{
+    TlsTransport* transport = (TlsTransport*)SSL_get_app_data(ssl);
+    if (!transport)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(sessionLock);
+    SSL_SESSION*& cached = sessionCache[transport->_cacheKey];
+    if (cached)
+        SSL_SESSION_free(cached);
+    cached = session;
+
+    return 1;   // ссылка на сессию остаётся у кэша
+}
+
+TlsTransport::~TlsTransport()
+{
+    if (_ssl)
+    {
+        SSL_shutdown(_ssl);     // close_notify без ожидания ответа
+        SSL_free(_ssl);
+    }
+}
+
+bool TlsTransport::Init(int fd, const std::string& host, int port, const TlsOptions& options)
+{
+    SSL_CTX* ctx = Context(options);
+    if (!ctx)
+        return false;
+
+    _ssl = SSL_new(ctx);
+    if (!_ssl)
+    {
+        std::cout << "[tls] SSL_new failed: " << lastError() << std::endl;
+        return false;
+    }
+
+    // Сессия несёт клиентский сертификат и проверку сервера, с которыми создана:
+    // после смены ircTlsCert или включения ircTlsVerify её продолжать нельзя
+    _cacheKey = host + ":" + std::to_string(port) + '\0' + OptionsKey(options);
+    SSL_set_app_data(_ssl, this);
+    SSL_set_fd(_ssl, fd);
+    SSL_set_tlsext_host_name(_ssl, host.c_str());
+    if (options.verify)
+        SSL_set1_host(_ssl, host.c_str());
+
+    {
+        std::lock_guard<std::mutex> lock(sessionLock);
+        auto itr = sessionCache.find(_cacheKey);
+        if (itr != sessionCache.end())
+            SSL_set_session(_ssl, itr->second);
+    }
+
+    _started = TimerWheel::Now();
+    return true;
+}
+
+Transport::Status TlsTransport::Handshake()
+{
+    ERR_clear_error();
+    int ret = SSL_connect(_ssl);
+    if (ret == 1)
+    {
+        std::cout << "[tls] " << SSL_get_version(_ssl) << " " << SSL_get_cipher_name(_ssl)
+                  << (SSL_session_reused(_ssl) ? ", session resumed" : ", full handshake")
+                  << " in " << TimerWheel::Now() - _started << " ms" << std::endl;
+        return Done;
+    }
+
+    switch (SSL_get_error(_ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        return WantRead;
+    case SSL_ERROR_WANT_WRITE:
+        return WantWrite;
+    default:
+        break;
+    }
+
+    long verify = SSL_get_verify_result(_ssl);
+    if (verify != X509_V_OK)
+        std::cout << "[tls] Certificate verification failed: " << X509_verify_cert_error_string(verify) << std::endl;
+    else
+        std::cout << "[tls] Handshake failed: " << lastError() << std::endl;
+
+    // Сессия могла стать непригодной - следующая попытка начнётся с полного рукопожатия
+    std::lock_guard<std::mutex> lock(sessionLock);
+    auto itr = sessionCache.find(_cacheKey);
+    if (itr != sessionCache.end())
+    {
+        SSL_SESSION_free(itr->second);
+        sessionCache.erase(itr);
+    }
+
+    return Failed;
+}
+
+ssize_t TlsTransport::Read(char* buffer, size_t length)
+{
+    ERR_clear_error();
+    return Result(SSL_read(_ssl, buffer, length));
+}
+
+ssize_t TlsTransport::Write(const char* data, size_t length)
+{
+    ERR_clear_error();
+    return Result(SSL_write(_ssl, data, length));
+}
+
+bool TlsTransport::Pending()
+{
+    return SSL_pending(_ssl) > 0;
+}
+
+ssize_t TlsTransport::Result(int ret)
+{
+    if (ret > 0)
+        return ret;
+
+    switch (SSL_get_error(_ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        if (errno == 0)
+            return 0;   // соединение оборвано без close_notify
+        return -1;
+    default:
+        std::cout << "[tls] " << lastError() << std::endl;
+        errno = EIO;
+        return -1;
+    }
+}
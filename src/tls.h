@@ -0,0 +1,50 @@
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <string>
+#include <cstdint>
+
+#include "transport.h"
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_session_st SSL_SESSION;
+
+struct TlsOptions
+{
+    bool verify = true;     // Проверять сертификат и имя сервера
+    std::string cert;       // Клиентский сертификат (PEM) для SASL EXTERNAL
+    std::string key;        // Его закрытый ключ (PEM), если не в том же файле
+};
+
+// TLS поверх неблокирующего сокета на OpenSSL. Рукопожатие выполняется по шагам
+// из цикла событий. Сессии (в TLS 1.3 - тикеты) кэшируются по host:port, и
+// повторное подключение к тому же серверу обходится без полного рукопожатия.
+class TlsTransport : public Transport
+{
+public:
+    TlsTransport() : _ssl(NULL), _started(0) {};
+    ~TlsTransport();
+
+    bool Init(int fd, const std::string& host, int port, const TlsOptions& options);
+
+    Status Handshake();
+    ssize_t Read(char* buffer, size_t length);
+    ssize_t Write(const char* data, size_t length);
+
+    bool Pending();
+    bool Secure() { return true; };
+
+private:
+    // Ключ набора настроек: по нему делятся и контексты, и кэш сессий
+    static std::string OptionsKey(const TlsOptions& options);
+    static SSL_CTX* Context(const TlsOptions& options);
+    static int NewSession(SSL* ssl, SSL_SESSION* session);
+    ssize_t Result(int ret);
+
+    SSL* _ssl;
+    std::string _cacheKey;  // host:port и настройки в кэше сессий
+    int64_t _started;       // начало рукопожатия, мс
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include <string>
+#include <sys/socket.h>
+
+#include "transport.h"
+
+ssize_t Transport::WriteV(const struct iovec* iov, int count)
+{
+    std::string batch;
+    for (int i = 0; i < count; ++i)
+        batch.append((const char*)iov[i].iov_base, iov[i].iov_len);
+    return Write(batch.data(), batch.size());
+}
+
+ssize_t PlainTransport::Read(char* buffer, size_t length)
+{
+    return recv(_fd, buffer, length, 0);
+}
+
+ssize_t PlainTransport::Write(const char* data, size_t length)
+{
+    return send(_fd, data, length, MSG_NOSIGNAL);
+}
+
+ssize_t PlainTransport::WriteV(const struct iovec* iov, int count)
+{
+    // sendmsg, а не writev: нужен MSG_NOSIGNAL
+    struct msghdr message = {};
+    message.msg_iov = (struct iovec*)iov;
+    message.msg_iovlen = count;
+    return sendmsg(_fd, &message, MSG_NOSIGNAL);
+}
@@ -0,0 +1,49 @@
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Транспорт поверх уже подключённого неблокирующего сокета.
+// Read/Write возвращают число байт, 0 - соединение закрыто, -1 - ошибка;
+// при -1 и errno == EAGAIN операцию нужно повторить, когда сокет будет готов.
+class Transport
+{
+public:
+    enum Status
+    {
+        Done,       // рукопожатие завершено
+        WantRead,   // ждать POLLIN и повторить Handshake()
+        WantWrite,  // ждать POLLOUT и повторить Handshake()
+        Failed
+    };
+
+    virtual ~Transport() {};
+
+    virtual Status Handshake() = 0;
+    virtual ssize_t Read(char* buffer, size_t length) = 0;
+    virtual ssize_t Write(const char* data, size_t length) = 0;
+    // Запись нескольких буферов одним вызовом. По умолчанию они склеиваются
+    // и уходят одним Write (для TLS - одной записью SSL_write)
+    virtual ssize_t WriteV(const struct iovec* iov, int count);
+
+    // Уже расшифрованные данные, о которых poll() не знает
+    virtual bool Pending() { return false; };
+    virtual bool Secure() { return false; };
+};
+
+class PlainTransport : public Transport
+{
+public:
+    PlainTransport(int fd) : _fd(fd) {};
+
+    Status Handshake() { return Done; };
+    ssize_t Read(char* buffer, size_t length);
+    ssize_t Write(const char* data, size_t length);
+    ssize_t WriteV(const struct iovec* iov, int count);
+
+private:
+    int _fd;
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include <iostream>
+#include <cstring>
+#include <deque>
+
+#include "trigger.h"
+#include "timer.h"
+
+std::string TriggerAutomaton::Fold(const std::string& text)
+{
+    std::string folded(text);
+    Fold(&folded[0], folded.size());
+    return folded;
+}
+
+void TriggerAutomaton::Fold(char* data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        unsigned char c = data[i];
+        if (c >= 'A' && c <= 'Z')
+            data[i] = c + ('a' - 'A');
+        else if (c == 0xD0 && i + 1 < length)
+        {
+            // А-П -> а-п, Р-Я -> р-я, Ё -> ё: два байта остаются двумя
+            unsigned char next = data[i + 1];
+            if (next >= 0x90 && next <= 0x9F)
+                data[i + 1] = next + 0x20;
+            else if (next >= 0xA0 && next <= 0xAF)
+            {
+                data[i] = char(0xD1);
+                data[i + 1] = next - 0x20;
+            }
+            else if (next == 0x81)
+            {
+                data[i] = char(0xD1);
+                data[i + 1] = char(0x91);
+            }
+            ++i;
+        }
+    }
+}
+
+static bool isWordByte(unsigned char c)
+{
+    return c >= 0x80 || c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+TriggerAutomaton::TriggerAutomaton(const std::vector<IRCConfig::Trigger>& triggers) : _triggers(triggers), _classes(1)
+{
+    std::vector<std::string> words;
+    for (const IRCConfig::Trigger& trigger : _triggers)
+    {
+        words.push_back(Fold(trigger.match));
+        _length.push_back(words.back().size());
+    }
+
+    memset(_class, 0, sizeof(_class));
+    for (const std::string& word : words)
+    {
+        for (unsigned char c : word)
+        {
+            if (_class[c] == 0)
+                _class[c] = _classes++;
+        }
+    }
+
+    // Бор: 0 - "перехода нет", корень - состояние 0, в него переходов нет
+    _next.assign(_classes, 0);
+    _out.emplace_back();
+    for (uint32_t i = 0; i < words.size(); ++i)
+    {
+        uint32_t state = 0;
+        for (unsigned char c : words[i])
+        {
+            uint32_t& next = _next[state * _classes + _class[c]];
+            if (next == 0)
+            {
+                next = _out.size();
+                _out.emplace_back();
+                _next.resize(_next.size() + _classes, 0);
+            }
+            state = _next[state * _classes + _class[c]];
+        }
+        if (!words[i].empty())
+            _out[state].push_back(i);
+    }
+
+    // Обход в ширину: ссылки неудач и достройка переходов до ДКА
+    std::vector<uint32_t> fail(_out.size(), 0);
+    _dict.assign(_out.size(), -1);
+    std::deque<uint32_t> queue;
+    for (size_t c = 0; c < _classes; ++c)
+    {
+        if (_next[c] != 0)
+            queue.push_back(_next[c]);
+    }
+
+    while (!queue.empty())
+    {
+        uint32_t state = queue.front();
+        queue.pop_front();
+
+        uint32_t link = fail[state];
+        _dict[state] = !_out[link].empty() ? int32_t(link) : _dict[link];
+
+        for (size_t c = 0; c < _classes; ++c)
+        {
+            uint32_t& next = _next[state * _classes + c];
+            if (next != 0)
+            {
+                fail[next] = _next[link * _classes + c];
+                queue.push_back(next);
+            }
+            else
+                next = _next[link * _classes + c];
+        }
+    }
+}
+
+std::vector<TriggerAutomaton::Hit> TriggerAutomaton::Scan(std::string_view text, size_t limit) const
+{
+    std::vector<Hit> hits;
+    const unsigned char* data = (const unsigned char*)text.data();
+
+    uint32_t state = 0;
+    for (size_t i = 0; i < text.size() && hits.size() < limit; ++i)
+    {
+        state = _next[state * _classes + _class[data[i]]];
+        for (int32_t match = _out[state].empty() ? _dict[state] : int32_t(state); match != -1; match = _dict[match])
+        {
+            for (uint32_t trigger : _out[match])
+            {
+                size_t begin = i + 1 - _length[trigger];
+                size_t end = i + 1;
+                if (_triggers[trigger].word
+                    && ((begin > 0 && isWordByte(data[begin - 1])) || (end < text.size() && isWordByte(data[end]))))
+                    continue;
+                hits.push_back({ trigger, begin, end });
+            }
+        }
+    }
+
+    if (hits.size() > limit)
+        hits.resize(limit);
+    return hits;
+}
+
+TriggerEngine::~TriggerEngine()
+{
+    _builder.Join();
+}
+
+void TriggerEngine::Update(const std::shared_ptr<const IRCConfig>& config)
+{
+    if (config == _seen)
+        return;
+
+    bool changed = !_seen || _seen->triggers != config->triggers;
+    _seen = config;
+    if (!changed)
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wanted = config;
+    if (_running)
+        return;     // текущая сборка заберёт новый снимок, когда закончит
+
+    _builder.Join();
+    _running = true;
+    if (!_builder.Start(&buildThread, this))
+        _running = false;
+}
+
+ThreadReturn TriggerEngine::buildThread(void* param)
+{
+    TriggerEngine* engine = (TriggerEngine*)param;
+
+    while (true)
+    {
+        std::shared_ptr<const IRCConfig> config;
+        {
+            std::lock_guard<std::mutex> lock(engine->_mutex);
+            config.swap(engine->_wanted);
+            if (!config)
+            {
+                engine->_running = false;
+                return NULL;
+            }
+        }
+
+        if (config->triggers.empty())
+        {
+            engine->_current.store(nullptr);
+            continue;
+        }
+
+        int64_t started = TimerWheel::Now();
+        std::shared_ptr<const TriggerAutomaton> automaton = std::make_shared<const TriggerAutomaton>(config->triggers);
+        engine->_current.store(automaton);
+
+        std::cout << "[*] Triggers: " << config->triggers.size() << " patterns, " << automaton->States()
+                  << " states x " << automaton->Classes() << " classes, built in "
+                  << TimerWheel::Now() - started << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef TRIGGER_H_
+#define TRIGGER_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include "thread.h"
+#include "config.h"
+
+// Автомат Ахо-Корасик по всем словам триггеров сразу: переходы достроены
+// до полного ДКА, поэтому сообщение проходится один раз, по одному
+// обращению к таблице на байт, сколько бы триггеров ни было. Байты,
+// которых нет ни в одном слове, сведены в один класс - таблица занимает
+// состояния x классы, а не состояния x 256.
+class TriggerAutomaton
+{
+public:
+    explicit TriggerAutomaton(const std::vector<IRCConfig::Trigger>& triggers);
+
+    struct Hit
+    {
+        uint32_t trigger;   // индекс в Triggers()
+        size_t begin;       // байты совпадения в тексте
+        size_t end;
+    };
+    // Совпадения в порядке окончания, не больше limit
+    std::vector<Hit> Scan(std::string_view text, size_t limit) const;
+
+    const std::vector<IRCConfig::Trigger>& Triggers() const { return _triggers; };
+    size_t States() const { return _out.size(); };
+    size_t Classes() const { return _classes; };
+
+    // Нижний регистр для латиницы и кириллицы с сохранением длины,
+    // чтобы позиции совпадений совпадали с исходным текстом
+    static std::string Fold(const std::string& text);
+    static void Fold(char* data, size_t length);
+
+private:
+    std::vector<IRCConfig::Trigger> _triggers;
+    std::vector<uint32_t> _length;      // длина слова триггера в байтах
+
+    uint8_t _class[256];                // байт -> класс, 0 - нет в словах
+    size_t _classes;
+    std::vector<uint32_t> _next;        // состояние * _classes + класс
+    std::vector<std::vector<uint32_t>> _out;    // триггеры, слово которых кончается в состоянии
+    std::vector<int32_t> _dict;         // ближайший суффикс с непустым _out, -1 - нет
+};
+
+// Текущий автомат и его пересборка. Update() вызывается из потока приёма;
+// если набор триггеров в снимке конфигурации изменился, автомат собирается
+// в фоновом потоке и подменяется атомарно, а до тех пор работает старый.
+class TriggerEngine
+{
+public:
+    TriggerEngine() : _running(false) {};
+    ~TriggerEngine();
+
+    void Update(const std::shared_ptr<const IRCConfig>& config);
+    std::shared_ptr<const TriggerAutomaton> Current() const { return _current.load(); };
+
+private:
+    static ThreadReturn buildThread(void* param);
+
+    std::atomic<std::shared_ptr<const TriggerAutomaton>> _current;
+    std::shared_ptr<const IRCConfig> _seen;     // последний проверенный снимок
+
+    // Под _mutex
+    std::mutex _mutex;
+    std::shared_ptr<const IRCConfig> _wanted;   // снимок, который ждёт сборки
+    bool _running;
+    Thread _builder;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "upgrade.h"
+#include "timer.h"
+
+static const char UpgradeMagic[8] = { 'I', 'R', 'C', 'U', 'P', 'G', '\0', '\0' };
+static const uint32_t UpgradeVersion = 1;
+static const size_t MaxUpgradeSize = 16 << 20;
+
+static void putVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static void putString(std::string& out, const std::string& value)
+{
+    putVarint(out, value.size());
+    out += value;
+}
+
+static void putList(std::string& out, const std::vector<std::string>& values)
+{
+    putVarint(out, values.size());
+    for (const std::string& value : values)
+        putString(out, value);
+}
+
+// Чтение с проверкой границ: любая ошибка делает всё состояние негодным
+class UpgradeReader
+{
+public:
+    UpgradeReader(const std::string& data) : _data(data), _offset(0), _ok(true) {};
+
+    uint64_t Varint()
+    {
+        uint64_t result = 0;
+        for (int shift = 0; _offset < _data.size() && shift < 64; shift += 7)
+        {
+            uint8_t byte = _data[_offset++];
+            result |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return result;
+        }
+        _ok = false;
+        return 0;
+    }
+
+    std::string String()
+    {
+        uint64_t length = Varint();
+        if (!_ok || length > _data.size() - _offset)
+        {
+            _ok = false;
+            return "";
+        }
+        _offset += length;
+        return _data.substr(_offset - length, length);
+    }
+
+    std::vector<std::string> List()
+    {
+        std::vector<std::string> values;
+        uint64_t count = Varint();
+        for (uint64_t i = 0; _ok && i < count; ++i)
+            values.push_back(String());
+        return values;
+    }
+
+    bool Skip(const char* prefix, size_t length)
+    {
+        if (_data.compare(0, length, prefix, length) != 0)
+            return _ok = false;
+        _offset = length;
+        return true;
+    }
+
+    bool Ok() const { return _ok && _offset == _data.size(); };
+
+private:
+    const std::string& _data;
+    size_t _offset;
+    bool _ok;
+};
+
+std::string encodeUpgrade(const UpgradeState& state)
+{
+    std::string out(UpgradeMagic, sizeof(UpgradeMagic));
+    putVarint(out, UpgradeVersion);
+    putString(out, state.host);
+    putVarint(out, state.port);
+    putString(out, state.nick);
+    putString(out, state.user);
+    putString(out, state.selfHost);
+    putVarint(out, state.saslDone);
+    putList(out, state.isupport);
+    putList(out, state.channels);
+    putString(out, state.inbuf);
+    putList(out, state.sendq);
+    return out;
+}
+
+bool decodeUpgrade(const std::string& data, UpgradeState* state)
+{
+    UpgradeReader reader(data);
+    if (!reader.Skip(UpgradeMagic, sizeof(UpgradeMagic)) || reader.Varint() != UpgradeVersion)
+        return false;
+
+    state->host = reader.String();
+    state->port = reader.Varint();
+    state->nick = reader.String();
+    state->user = reader.String();
+    state->selfHost = reader.String();
+    state->saslDone = reader.Varint() != 0;
+    state->isupport = reader.List();
+    state->channels = reader.List();
+    state->inbuf = reader.String();
+    state->sendq = reader.List();
+    return reader.Ok();
+}
+
+bool sendUpgrade(int channel, int fd, const std::string& data)
+{
+    uint32_t length = data.size();
+    struct iovec iov = { &length, sizeof(length) };
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if (sendmsg(channel, &msg, MSG_NOSIGNAL) != sizeof(length))
+        return false;
+
+    // Канал блокирующий, новый процесс читает сразу за заголовком
+    for (size_t sent = 0; sent < data.size();)
+    {
+        ssize_t bytes = send(channel, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return false;
+        sent += bytes;
+    }
+    return true;
+}
+
+// Ждать данных на канале не дольше, чем до deadline
+static bool waitReadable(int channel, int64_t deadline)
+{
+    while (true)
+    {
+        int64_t left = deadline - TimerWheel::Now();
+        struct pollfd pfd = { channel, POLLIN, 0 };
+        if (left <= 0)
+            return false;
+        int ready = poll(&pfd, 1, left);
+        if (ready == -1 && errno == EINTR)
+            continue;
+        return ready == 1;
+    }
+}
+
+bool receiveUpgrade(int channel, int* fd, std::string* data, int timeoutMs)
+{
+    int64_t deadline = TimerWheel::Now() + timeoutMs;
+    *fd = -1;
+
+    uint32_t length = 0;
+    struct iovec iov = { &length, sizeof(length) };
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (!waitReadable(channel, deadline)
+        || recvmsg(channel, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL) != sizeof(length))
+        return false;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    if (*fd == -1 || length > MaxUpgradeSize)
+    {
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+        return false;
+    }
+
+    data->resize(length);
+    for (size_t received = 0; received < length;)
+    {
+        ssize_t bytes = waitReadable(channel, deadline) ? recv(channel, &(*data)[received], length - received, 0) : 0;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+        {
+            close(*fd);
+            *fd = -1;
+            return false;
+        }
+        received += bytes;
+    }
+    return true;
+}
+
+bool sendUpgradeAck(int channel, char ack)
+{
+    return send(channel, &ack, 1, MSG_NOSIGNAL) == 1;
+}
+
+bool waitUpgradeAck(int channel, char ack, int timeoutMs)
+{
+    char received = 0;
+    return waitReadable(channel, TimerWheel::Now() + timeoutMs)
+        && recv(channel, &received, 1, 0) == 1 && received == ack;
+}
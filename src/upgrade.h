@@ -0,0 +1,38 @@
+#ifndef UPGRADE_H_
+#define UPGRADE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Состояние соединения, которое новый процесс получает при горячем обновлении
+// вместе с самим сокетом. Кодируется полями с длиной (varint), с сигнатурой
+// и версией: старый и новый бинарник могут быть разных сборок.
+struct UpgradeState
+{
+    std::string host;                   // сервер, к которому подключён сокет
+    int port = 0;
+    std::string nick;
+    std::string user;
+    std::string selfHost;
+    bool saslDone = false;
+    std::vector<std::string> isupport;  // токены 005 как их прислал сервер
+    std::vector<std::string> channels;  // каналы, где мы сейчас сидим
+    std::string inbuf;                  // принятый хвост без '\n'
+    std::vector<std::string> sendq;     // ещё не отправленное из QueueIRC
+};
+
+std::string encodeUpgrade(const UpgradeState& state);
+bool decodeUpgrade(const std::string& data, UpgradeState* state);
+
+// Передача по UNIX-сокету channel: длина и дескриптор fd (SCM_RIGHTS) одним
+// sendmsg, затем само состояние
+bool sendUpgrade(int channel, int fd, const std::string& data);
+// Приём; *fd открыт с FD_CLOEXEC
+bool receiveUpgrade(int channel, int* fd, std::string* data, int timeoutMs);
+
+// Подтверждения одним байтом: новый процесс - "готов", старый - "отдал"
+bool sendUpgradeAck(int channel, char ack);
+bool waitUpgradeAck(int channel, char ack, int timeoutMs);
+
+#endif
@@ -0,0 +1,140 @@
+# Фейковый ircd для прогона на выносливость: случайный трафик, флуды, смены ников,
+# входы/выходы, команды боту и обрывы соединения.
+#   python3 ircd.py порт строк_в_секунду средняя_длина_сессии_в_секундах
+import random
+import socket
+import sys
+import threading
+import time
+
+CHANNEL = '#soak'
+NICKS = ['n%d' % i for i in range(300)]
+WORDS = ('the bot is running again what did i miss linux kernel patch build ok yes no '
+         'http://x.org/y').split()
+COMMANDS = ['.helo', '.date', '.uptm', '.last 5', '.last 20', '.seen n1', '.seen n%d',
+            '.lagt', '.rmem', '.grep kernel', '.chan', '.help']
+TICK = 0.05     # пауза между пачками строк, с
+
+# Один генератор на весь прогон: одинаковый трафик от запуска к запуску
+rnd = random.Random(7)
+
+
+def send(conn, lines):
+    conn.sendall(''.join(line + '\r\n' for line in lines).encode())
+
+
+def register(conn, reader):
+    """Принять NICK/USER и первый JOIN бота; False - бот ушёл раньше."""
+    nick = 'x'
+    for raw in reader:
+        params = raw.decode(errors='replace').rstrip('\r\n').split(' ')
+        command = params[0].upper()
+        if command == 'NICK' and len(params) > 1:
+            nick = params[1]
+        elif command == 'USER':
+            send(conn, [':srv 001 %s :Welcome' % nick,
+                        ':srv 005 %s CHANTYPES=# NICKLEN=30 :ok' % nick,
+                        ':srv 376 %s :End' % nick])
+        elif command == 'JOIN' and len(params) > 1:
+            send(conn, [':%s!u@h JOIN %s' % (nick, channel) for channel in params[1].split(',')])
+            return True
+    return False
+
+
+def answer(conn, reader, alive):
+    """Отвечать на PING и QUIT бота, пока соединение живо."""
+    try:
+        for raw in reader:
+            line = raw.decode(errors='replace').rstrip('\r\n')
+            command = line.split(' ', 1)[0].upper()
+            if command == 'PING':
+                send(conn, [':srv PONG srv :' + line.split(':', 1)[-1]])
+            elif command == 'QUIT':
+                send(conn, ['ERROR :bye'])
+                break
+    except OSError:
+        pass
+    alive.clear()
+
+
+def chatter(nick):
+    return ':%s!u@h.%d PRIVMSG %s :%s' % (nick, hash(nick) % 50, CHANNEL,
+                                          ' '.join(rnd.choice(WORDS) for _ in range(rnd.randint(2, 14))))
+
+
+def command(nick):
+    text = rnd.choice(COMMANDS).replace('%d', str(rnd.randint(0, 299)))
+    return ':%s!u@h PRIVMSG %s :%s' % (nick, CHANNEL, text)
+
+
+def flood():
+    flooder = 'flood%d' % rnd.randint(0, 3)
+    return [':%s!f@f PRIVMSG %s :flood flood flood %d' % (flooder, CHANNEL, i) for i in range(50)]
+
+
+def batch(size):
+    """Пачка трафика канала: в основном разговор, немного команд, ников, входов и флуда."""
+    lines = []
+    for _ in range(size):
+        nick = rnd.choice(NICKS)
+        roll = rnd.random()
+        if roll < 0.70:
+            lines.append(chatter(nick))
+        elif roll < 0.78:
+            lines.append(command(nick))
+        elif roll < 0.86:
+            lines.append(':%s!u@h NICK :%s' % (nick, rnd.choice(NICKS)))
+        elif roll < 0.93:
+            lines.append(':%s!u@h JOIN %s' % (nick, CHANNEL))
+        elif roll < 0.98:
+            lines.append(':%s!u@h PART %s :bye' % (nick, CHANNEL))
+        else:
+            lines.extend(flood())
+    return lines
+
+
+def session(conn, rate, drop):
+    """Одно соединение бота: регистрация, затем трафик до случайного обрыва."""
+    reader = conn.makefile('rb')
+    if not register(conn, reader):
+        return
+
+    alive = threading.Event()
+    alive.set()
+    threading.Thread(target=answer, args=(conn, reader, alive), daemon=True).start()
+
+    size = int(rate * TICK) + 1
+    end = time.time() + rnd.expovariate(1 / drop)
+    while alive.is_set() and time.time() < end:
+        try:
+            send(conn, batch(size))
+        except OSError:
+            break
+        time.sleep(TICK)
+
+
+def main():
+    port = int(sys.argv[1])
+    rate = float(sys.argv[2])
+    drop = float(sys.argv[3])
+
+    server = socket.socket()
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('127.0.0.1', port))
+    server.listen(5)
+
+    # Бот подключается заново после каждого обрыва - сессии идут по очереди
+    while True:
+        conn, _ = server.accept()
+        try:
+            session(conn, rate, drop)
+        finally:
+            try:
+                conn.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            conn.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Прогон на выносливость: бот против фейкового ircd на заданное число минут.
+#   tools/soak/soak.sh bin/ircbot [минуты]
+# Код 3 от бота - сработал контроль дрейфа (driftExit), прогон провален.
+# Окно и прогрев в soak.toml занимают ~20 минут, короче прогон ничего не проверит.
+BIN=$(realpath "$1")
+MINUTES=${2:-60}
+RATE=${SOAK_RATE:-2000}
+DROP=${SOAK_DROP:-40}
+DIR=$(dirname "$0")
+
+cd "$DIR" || exit 1
+rm -rf run
+mkdir -p run/logs
+mkfifo run/console
+
+python3 ircd.py 6721 "$RATE" "$DROP" > run/ircd.log 2>&1 &
+IRCD=$!
+sleep 1
+
+IRCBOT_MEMTRACK=1 "$BIN" soak.toml < run/console > run/bot.log 2>&1 &
+BOT=$!
+exec 3> run/console
+
+END=$(( $(date +%s) + MINUTES * 60 ))
+while kill -0 "$BOT" 2>/dev/null && [ "$(date +%s)" -lt "$END" ]; do
+    sleep 5
+done
+if kill -0 "$BOT" 2>/dev/null; then
+    echo /drift >&3
+    sleep 1
+    kill -INT "$BOT"
+fi
+wait "$BOT"
+CODE=$?
+exec 3>&-
+kill "$IRCD" 2>/dev/null
+
+grep -a "Drift" run/bot.log | tail -20
+if [ "$CODE" -eq 3 ]; then
+    echo "soak: FAILED, resource drift detected (see $DIR/run/bot.log)"
+    exit 1
+elif [ "$CODE" -ne 0 ]; then
+    echo "soak: FAILED, bot exited with code $CODE (see $DIR/run/bot.log)"
+    exit 1
+fi
+echo "soak: passed ($MINUTES min)"